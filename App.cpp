@@ -20,6 +20,9 @@
 #include "StdAfx.h"
 #include "App.h"
 #include "Dialogs.h"
+#include "Executor.h"
+#include "Metrics.h"
+#include "Pacing.h"
 #include "Shortcut.h"
 
 #ifdef _DEBUG
@@ -39,6 +42,16 @@ constexpr int kMaxIniFile = 20;
 
 TranslatedString s_tokens[int(Token::kNotFound)];
 
+// Thread receiving the hotkeys and executing the shortcuts, so that the GUI thread
+// and its modal loops never delay them. See dispatchThreadProc().
+HANDLE s_dispatch_thread;
+
+// Message-only window of the dispatch thread, receiving the WM_HOTKEY messages.
+HWND s_dispatch_window;
+
+// Maximum number of hotkeys the dispatch thread retrieves from its queue in advance.
+constexpr int kMaxPendingHotKeys = 64;
+
 
 enum class CmdlineOpt {
 	// No arguments.
@@ -48,12 +61,14 @@ enum class CmdlineOpt {
 	kQuit,
 	kAddText,
 	kAddCommand,
+	kCopyStats,
 	
 	// Some arguments.
 	kWithArg,
 	kLoad = kWithArg,
 	kMerge,
 	kSendKeys,
+	kSaveStats,
 	
 	kNone
 };
@@ -66,9 +81,11 @@ constexpr LPCTSTR kCmdlineOptions[] = {
 	_T("quit"),
 	_T("addtext"),
 	_T("addcommand"),
+	_T("copystats"),
 	_T("load"),
 	_T("merge"),
 	_T("sendkeys"),
+	_T("savestats"),
 };
 
 void entryPoint();
@@ -77,8 +94,31 @@ void runGui(CmdlineOpt cmdopt);
 CmdlineOpt execCmdLine(LPCTSTR cmdline, bool initial_launch);
 void processCmdLineAction(CmdlineOpt cmdopt);
 
+// Starts the dispatch thread, returns once it can receive hotkeys.
+void startDispatchThread();
+
+// Stops the dispatch thread, after the execution of the current shortcut if any.
+void stopDispatchThread();
+
+DWORD WINAPI dispatchThreadProc(void* ready_event);
+
+// Executes the shortcut matching a WM_HOTKEY message, in the dispatch thread.
+// queue_depth: number of hotkeys waiting for their dispatch, including this one.
+void dispatchHotKey(const MSG& msg, int queue_depth);
+
+// Appends the latency statistics of the hotkey dispatches as tab-separated values:
+// the global statistics, then the statistics of each shortcut executed at least once.
+void appendDispatchStatsToString(String& output);
+
 LRESULT CALLBACK prcInvisible(HWND hwnd, UINT message, WPARAM wParam, LPARAM lParam, UINT_PTR subclass_id, DWORD_PTR ref_data);
 
+// Window procedure of s_dispatch_window.
+LRESULT CALLBACK prcDispatch(HWND hwnd, UINT message, WPARAM wParam, LPARAM lParam, UINT_PTR subclass_id, DWORD_PTR ref_data);
+
+// Simulates typing the keystroke of a WM_HOTKEY message, given its lParam,
+// to let the window having the focus process it as if no hotkey was registered.
+void typeHotKeyBack(LPARAM lParam);
+
 void updateTrayIcon(DWORD message);
 
 // Displays the tray icon menu, as a child of the invisible window.
@@ -147,10 +187,15 @@ void entryPoint() {
 	e_instance = HINSTANCE(GetModuleHandle(/* lpModuleName= */ nullptr));
 	app::initialize();
 	
+	// Start the dispatch thread before loading the shortcuts: it registers their hotkeys.
+	startDispatchThread();
 	const CmdlineOpt cmdopt = execCmdLine(cmdline, /* initial_launch= */ true);
 	if (cmdopt != CmdlineOpt::kQuit) {
 		runGui(cmdopt);
 	}
+	// Stop the text shortcuts first: they may unregister hotkeys via the dispatch thread.
+	executor::terminate();
+	stopDispatchThread();
 	
 	app::terminate();
 #ifndef _DEBUG
@@ -165,17 +210,21 @@ void initialize() {
 	s_notify_icon_message = RegisterWindowMessage(_T("RyderClavierOptions"));
 	
 	CoInitialize(/* pvReserved= */ nullptr);
+	executor::initialize();
 	shortcut::initialize();
 	
 	e_heap = GetProcessHeap();
-	e_modal_dialog = NULL;
+	setModalDialog(NULL);
 	
 	initializeLanguages();
 	Keystroke::loadVkKeyNames();
 }
 
 void terminate() {
+	executor::terminate();
 	shortcut::terminate();
+	clearProcessNameCache();
+	clearFullPathCache();
 	CoUninitialize();
 }
 
@@ -213,81 +262,148 @@ void runGui(CmdlineOpt cmdopt) {
 	
 	processCmdLineAction(cmdopt);
 	
-	// Message loop
-	DWORD timeMinimum = 0;
-	DWORD timeLast = GetTickCount();
+	// Message loop. The dispatch thread handles the hotkeys.
 	MSG msg;
 	while (GetMessage(&msg, /* hWnd= */ NULL, 0, 0)) {
-		if (msg.message == WM_HOTKEY) {
-			// Shortcut
-			
-			if (msg.time < timeLast) {
-				timeMinimum = 0;
-			}
-			if (msg.time < timeMinimum) {
-				goto Next;
-			}
-			
-			Keystroke ks;
-			ks.m_vk = Keystroke::canonicalizeKey(BYTE(HIWORD(msg.lParam)));
-			ks.m_sided_mod_code = LOWORD(msg.lParam);
-			ks.m_sided = true;
-			const HWND input_window = Keystroke::getInputFocus();
-			
-			// Make ks.m_sided_mod_code sided according to the state of sided special keys.
-			for (const auto& special_key : kSpecialKeys) {
-				if (ks.m_sided_mod_code & special_key.all_mod_codes()) {
-					if (!isKeyDown(special_key.vk_left)) {
-						ks.m_sided_mod_code &= ~special_key.left_mod_code();
-					}
-					if (isKeyDown(special_key.vk_right)) {
-						ks.m_sided_mod_code |= special_key.right_mod_code();
-					}
-				}
+		TranslateMessage(&msg);
+		DispatchMessage(&msg);
+	}
+	
+	// Delete traybar icon
+	updateTrayIcon(NIM_DELETE);
+	
+	// Delete the shortcuts. No saving necessary.
+	shortcut::clearShortcuts();
+}
+
+
+void startDispatchThread() {
+	const HANDLE ready_event = CreateEvent(
+		/* lpEventAttributes= */ nullptr, /* bManualReset= */ false, /* bInitialState= */ false,
+		/* lpName= */ nullptr);
+	DWORD thread_id;
+	s_dispatch_thread = CreateThread(
+		/* lpThreadAttributes= */ nullptr, /* dwStackSize= */ 0, dispatchThreadProc, ready_event,
+		/* dwCreationFlags= */ 0, &thread_id);
+	WaitForSingleObject(ready_event, INFINITE);
+	CloseHandle(ready_event);
+}
+
+void stopDispatchThread() {
+	PostMessage(s_dispatch_window, WM_CLOSE, 0, 0);
+	WaitForSingleObject(s_dispatch_thread, INFINITE);
+	CloseHandle(s_dispatch_thread);
+}
+
+DWORD WINAPI dispatchThreadProc(void* ready_event) {
+	s_dispatch_window = CreateWindow(
+		_T("STATIC"), /* lpWindowName= */ nullptr,
+		/* dwStyle=*/ 0,
+		/* x,y,nWidth,nHeight=*/ 0,0,0,0,
+		HWND_MESSAGE, /* hMenu= */ NULL, e_instance, /* lpParam= */ nullptr);
+	subclassWindow(s_dispatch_window, prcDispatch);
+	Keystroke::setHotKeyWindow(s_dispatch_window);
+	SetEvent(static_cast<HANDLE>(ready_event));
+	
+	// Hotkeys retrieved from the queue and not dispatched yet, in order:
+	// circular buffer starting at first_pending.
+	MSG pending_hotkeys[kMaxPendingHotKeys];
+	int first_pending = 0;
+	int pending_count = 0;
+	
+	MSG msg;
+	while (GetMessage(&msg, /* hWnd= */ NULL, 0, 0)) {
+		if (msg.message != WM_HOTKEY) {
+			DispatchMessage(&msg);
+			continue;
+		}
+		
+		pending_hotkeys[first_pending] = msg;
+		pending_count = 1;
+		do {
+			// Retrieve the hotkeys received meanwhile, to measure the queue depth.
+			while (pending_count < kMaxPendingHotKeys &&
+					PeekMessage(
+						&pending_hotkeys[(first_pending + pending_count) % kMaxPendingHotKeys],
+						/* hWnd= */ NULL, WM_HOTKEY, WM_HOTKEY, PM_REMOVE)) {
+				pending_count++;
 			}
 			
-			// Get the toggle keys state, for conditions checking
-			for (int i = 0; i < Keystroke::kCondTypeCount; i++) {
-				ks.m_conditions[i] = (GetKeyState(Keystroke::kCondTypeVks[i]) & kKeyToggledMask)
-					? Keystroke::Condition::kYes
-					: Keystroke::Condition::kNo;
-			}
+			// The executor coalesces the hotkeys of the text shortcuts still executing, typically auto-repeats.
+			dispatchHotKey(pending_hotkeys[first_pending], pending_count);
 			
-			// Get the current program, for conditions checking
-			TCHAR process[MAX_PATH];
-			if (!getWindowProcessName(input_window, process)) {
-				*process = _T('\0');
+			first_pending = (first_pending + 1) % kMaxPendingHotKeys;
+			pending_count--;
+		} while (pending_count);
+	}
+	
+	Keystroke::setHotKeyWindow(NULL);
+	DestroyWindow(s_dispatch_window);
+	return 0;
+}
+
+void dispatchHotKey(const MSG& msg, int queue_depth) {
+	metrics::recordQueueDepth(queue_depth);
+	
+	if (e_modal_dialog) {
+		// A dialog box of the GUI thread is displayed, typically the main dialog box:
+		// the hotkeys stay registered but the shortcuts are not executed.
+		// For instance, lets the user type the keystroke in the dialog box.
+		typeHotKeyBack(msg.lParam);
+		return;
+	}
+	
+	metrics::Dispatch dispatch(msg.time);
+	
+	Keystroke ks;
+	ks.m_vk = Keystroke::canonicalizeKey(BYTE(HIWORD(msg.lParam)));
+	ks.m_sided_mod_code = LOWORD(msg.lParam);
+	ks.m_sided = true;
+	const HWND input_window = Keystroke::getInputFocus();
+	
+	// Make ks.m_sided_mod_code sided according to the state of sided special keys.
+	for (const auto& special_key : kSpecialKeys) {
+		if (ks.m_sided_mod_code & special_key.all_mod_codes()) {
+			if (!isKeyDown(special_key.vk_left)) {
+				ks.m_sided_mod_code &= ~special_key.left_mod_code();
 			}
-			
-			// Find and execute the shortcut.
-			Shortcut *const sh = shortcut::find(ks, (*process) ? process : nullptr);
-			if (sh) {
-				sh->execute(/* from_hotkey= */ true);
-				if (sh->m_type == Shortcut::Type::kText) {
-					timeMinimum = GetTickCount();
-				}
-			} else {
-				// No matching shortcut found: simulate the keystroke back for default processing.
-				// Do not press the special keys again, do not release them.
-				ks.simulateTyping(/* already_down_mod_code= */ ks.m_sided_mod_code);
+			if (isKeyDown(special_key.vk_right)) {
+				ks.m_sided_mod_code |= special_key.right_mod_code();
 			}
-			
-		} else {
-			// Other message
-			
-			TranslateMessage(&msg);
-			DispatchMessage(&msg);
 		}
-		
-	Next:
-		timeLast = msg.time;
 	}
+	dispatch.endStage(metrics::Stage::kSidedness);
 	
-	// Delete traybar icon
-	updateTrayIcon(NIM_DELETE);
+	// Get the toggle keys state, for conditions checking
+	for (int i = 0; i < Keystroke::kCondTypeCount; i++) {
+		ks.m_conditions[i] = (GetKeyState(Keystroke::kCondTypeVks[i]) & kKeyToggledMask)
+			? Keystroke::Condition::kYes
+			: Keystroke::Condition::kNo;
+	}
 	
-	// Delete the shortcuts. No saving necessary.
-	shortcut::clearShortcuts();
+	// Get the current program, for conditions checking
+	TCHAR process[MAX_PATH];
+	if (!getWindowProcessName(input_window, process)) {
+		*process = _T('\0');
+	}
+	dispatch.endStage(metrics::Stage::kProcessName);
+	
+	// Find and execute the shortcut.
+	// Pin the snapshot: a reload during the execution must not delete the shortcut.
+	const shortcut::SnapshotPin snapshot;
+	Shortcut *const sh = snapshot->index.find(ks, (*process) ? process : nullptr);
+	dispatch.endStage(metrics::Stage::kFind);
+	dispatch.beginExecution();
+	if (sh) {
+		sh->execute(&dispatch);  // Ends and records the dispatch.
+		return;
+	}
+	
+	// No matching shortcut found: simulate the keystroke back for default processing.
+	// Do not press the special keys again, do not release them.
+	ks.simulateTyping(/* already_down_mod_code= */ ks.m_sided_mod_code);
+	dispatch.endExecution();
+	dispatch.record(/* shortcut_stats= */ nullptr);
 }
 
 
@@ -422,7 +538,25 @@ CmdlineOpt execCmdLine(LPCTSTR cmdline, bool initial_launch) {
 					Shortcut shortcut;
 					shortcut.m_type = Shortcut::Type::kText;
 					shortcut.m_text = strbuf_arg;
-					shortcut.execute(/* from_hotkey= */ false);
+					shortcut.compileText();
+					shortcut.execute(/* dispatch= */ nullptr);
+					break;
+				}
+				
+				// Save the latency statistics
+				case CmdlineOpt::kSaveStats: {
+					try_auto_quit = true;
+					const HANDLE file = CreateFile(
+						strbuf_arg,
+						GENERIC_WRITE, /* dwShareMode= */ 0, /* lpSecurityAttributes= */ nullptr, CREATE_ALWAYS,
+						/* dwFlagsAndAttributes= */ 0, /* hTemplateFile= */ NULL);
+					if (file != INVALID_HANDLE_VALUE) {
+						String stats;
+						stats += TCHAR(0xFEFF);  // UTF-16 little endian BOM
+						appendDispatchStatsToString(stats);
+						writeFile(file, stats);
+						CloseHandle(file);
+					}
 					break;
 				}
 				
@@ -505,6 +639,13 @@ void processCmdLineAction(CmdlineOpt cmdopt) {
 			wParam_to_send = ID_ADD_COMMAND;
 			break;
 		
+		case CmdlineOpt::kCopyStats: {
+			String stats;
+			appendDispatchStatsToString(stats);
+			setClipboardText(stats);
+			return;
+		}
+		
 		default:
 			return;
 	}
@@ -512,6 +653,48 @@ void processCmdLineAction(CmdlineOpt cmdopt) {
 }
 
 
+void appendDispatchStatsToString(String& output) {
+	metrics::DispatchStats::appendHeaderToString(output);
+	metrics::getGlobalStats().appendToString(output, _T("*"));
+	
+	for (const Shortcut& sh : shortcut::getShortcuts()) {
+		const metrics::DispatchStats *const shortcut_stats = sh.getDispatchStats();
+		if (shortcut_stats) {
+			TCHAR name[kHotKeyBufSize];
+			sh.getDisplayName(name);
+			String full_name = name;
+			if (sh.m_description.isSome()) {
+				full_name += _T(" - ");
+				full_name += sh.m_description;
+			}
+			shortcut_stats->appendToString(output, full_name);
+		}
+	}
+	
+	// The counts have their own table: their values are not in microseconds.
+	output += _T("\r\n");
+	metrics::DispatchStats::appendHeaderToString(output, metrics::Unit::kCount);
+	metrics::getGlobalStats().appendToString(output, _T("*"), metrics::Unit::kCount);
+	
+	const ProcessNameCacheStats cache_stats = getProcessNameCacheStats();
+	TCHAR buffer[256];
+	wsprintf(buffer, _T("\r\nProcess name cache\tHits\t%lu\tMisses\t%lu\tEvictions\t%lu\r\n"),
+		cache_stats.hits, cache_stats.misses, cache_stats.evictions);
+	output += buffer;
+	
+	const executor::ExecutorStats& executor_stats = executor::getStats();
+	wsprintf(buffer,
+		_T("Text shortcuts\tSubmitted\t%ld\tCompleted\t%ld\tCancelled\t%ld\tCoalesced\t%ld\tDropped\t%ld")
+		_T("\tMax waiting\t%ld\tWaiting limit\t%d\r\n"),
+		executor_stats.submitted, executor_stats.completed, executor_stats.cancelled,
+		executor_stats.coalesced, executor_stats.dropped, executor_stats.max_waiting,
+		executor::Scheduler::kMaxWaitingTasks);
+	output += buffer;
+	
+	pacing::appendTargetStatsToString(output);
+}
+
+
 
 // Invisible window:
 // - quit when destroyed
@@ -590,6 +773,33 @@ Destroy:
 }
 
 
+LRESULT CALLBACK prcDispatch(HWND hwnd, UINT message, WPARAM wParam, LPARAM lParam, UINT_PTR UNUSED(subclass_id), DWORD_PTR UNUSED(ref_data)) {
+	switch (message) {
+		case WM_REGISTERHOTKEY:
+			return Keystroke::onRegisterHotKeyMessage(wParam, lParam);
+		
+		case WM_HOTKEY:
+			// A modal loop runs during the execution of a shortcut, for instance a message box.
+			// The hotkeys stay registered but do not interrupt the execution.
+			typeHotKeyBack(lParam);
+			return 0;
+		
+		case WM_CLOSE:
+			PostQuitMessage(0);
+			return 0;
+	}
+	
+	return DefSubclassProc(hwnd, message, wParam, lParam);
+}
+
+void typeHotKeyBack(LPARAM lParam) {
+	Keystroke ks;
+	ks.m_vk = Keystroke::canonicalizeKey(BYTE(HIWORD(lParam)));
+	ks.m_sided_mod_code = LOWORD(lParam);
+	ks.simulateTyping(/* already_down_mod_code= */ ks.m_sided_mod_code);
+}
+
+
 
 // Handle the tray icon
 void updateTrayIcon(DWORD message) {
@@ -678,8 +888,8 @@ UINT displayTrayIconMenu() {
 		
 		case ID_TRAY_COPYLIST: {
 			String str;
-			for (const Shortcut* sh = shortcut::getFirst(); sh; sh = sh->getNext()) {
-				sh->appendCsvLineToString(str);
+			for (const Shortcut& sh : shortcut::getShortcuts()) {
+				sh.appendCsvLineToString(str);
 			}
 			setClipboardText(str);
 		}
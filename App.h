@@ -27,6 +27,7 @@
 
 #define WM_KEYSTROKE  (WM_USER + 100)
 #define WM_GETFILEICON  (WM_USER + 101)
+#define WM_REGISTERHOTKEY  (WM_USER + 102)
 
 
 namespace app {
@@ -0,0 +1,293 @@
+// Clavier+
+// Keyboard shortcuts manager
+//
+// Copyright (C) 2000-2008 Guillaume Ryder
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+
+#include "StdAfx.h"
+#include "Clipboard.h"
+#include "Global.h"
+
+namespace clipboard {
+namespace {
+
+// How SavedContents saves a clipboard format.
+enum class FormatSaving {
+	kGlobalMemory,  // Copies the global memory.
+	kEnhMetaFile,  // Copies the enhanced metafile.
+	kSynthesized,  // Skips the format: the system synthesizes it from a saved format.
+	kUnsupported,  // Cannot save the format, nor the clipboard.
+};
+
+// Returns how SavedContents saves a clipboard format.
+// IsClipboardFormatAvailable() includes the synthesized formats: the converse format is saved.
+FormatSaving getFormatSaving(UINT format) {
+	switch (format) {
+		case CF_TEXT:
+		case CF_OEMTEXT:
+			return IsClipboardFormatAvailable(CF_UNICODETEXT)
+				? FormatSaving::kSynthesized : FormatSaving::kGlobalMemory;
+		
+		case CF_BITMAP:
+		case CF_PALETTE:  // The device-independent bitmap carries its color table.
+			return (IsClipboardFormatAvailable(CF_DIB) || IsClipboardFormatAvailable(CF_DIBV5))
+				? FormatSaving::kSynthesized : FormatSaving::kUnsupported;
+		
+		case CF_METAFILEPICT:
+			return IsClipboardFormatAvailable(CF_ENHMETAFILE)
+				? FormatSaving::kSynthesized : FormatSaving::kUnsupported;
+		
+		case CF_ENHMETAFILE:
+			return FormatSaving::kEnhMetaFile;
+		
+		case CF_DSPTEXT:
+		case CF_DSPBITMAP:
+		case CF_DSPMETAFILEPICT:
+		case CF_DSPENHMETAFILE:
+		case CF_OWNERDISPLAY:
+			return FormatSaving::kUnsupported;
+		
+		default:
+			// The private and GDI object formats hold handles of unknown types.
+			return ((CF_PRIVATEFIRST <= format && format <= CF_PRIVATELAST) ||
+					(CF_GDIOBJFIRST <= format && format <= CF_GDIOBJLAST))
+				? FormatSaving::kUnsupported : FormatSaving::kGlobalMemory;
+	}
+}
+
+// Returns a copy of global memory, or NULL on failure.
+HGLOBAL copyGlobalMemory(HGLOBAL data) {
+	const SIZE_T size = data ? GlobalSize(data) : 0;
+	if (!size) {
+		return NULL;
+	}
+	const HGLOBAL copy = GlobalAlloc(GMEM_MOVEABLE, size);
+	if (!copy) {
+		return NULL;
+	}
+	const void* const source = GlobalLock(data);
+	if (!source) {
+		GlobalFree(copy);
+		return NULL;
+	}
+	memcpy(GlobalLock(copy), source, size);
+	GlobalUnlock(copy);
+	GlobalUnlock(data);
+	return copy;
+}
+
+// Sets the data of a registered clipboard format to a DWORD.
+void setClipboardDword(LPCTSTR format_name, DWORD value) {
+	const HGLOBAL data = GlobalAlloc(GMEM_MOVEABLE, sizeof(value));
+	if (!data) {
+		return;
+	}
+	*static_cast<DWORD*>(GlobalLock(data)) = value;
+	GlobalUnlock(data);
+	if (!SetClipboardData(RegisterClipboardFormat(format_name), data)) {
+		GlobalFree(data);
+	}
+}
+
+}  // namespace
+
+
+bool SavedContents::save() {
+	clear();
+	
+	// Check all the formats before getting any data: GetClipboardData() renders the delayed ones.
+	UINT format = 0;
+	while ((format = EnumClipboardFormats(format)) != 0) {
+		VERIF(getFormatSaving(format) != FormatSaving::kUnsupported);
+	}
+	
+	const int capacity = CountClipboardFormats();
+	if (capacity <= 0) {
+		return true;
+	}
+	m_formats = new SavedFormat[capacity];
+	
+	SIZE_T total_size = 0;
+	while (m_count < capacity && (format = EnumClipboardFormats(format)) != 0) {
+		const FormatSaving saving = getFormatSaving(format);
+		if (saving == FormatSaving::kSynthesized) {
+			continue;
+		}
+		const HANDLE data = GetClipboardData(format);
+		if (!data) {
+			continue;
+		}
+		
+		const bool metafile = (saving == FormatSaving::kEnhMetaFile);
+		total_size += metafile
+			? GetEnhMetaFileBits(HENHMETAFILE(data), /* nSize= */ 0, /* lpData= */ nullptr)
+			: GlobalSize(data);
+		if (total_size > kMaxSize) {
+			clear();
+			return false;
+		}
+		
+		const HANDLE copy = metafile
+			? HANDLE(CopyEnhMetaFile(HENHMETAFILE(data), /* lpszFile= */ nullptr))
+			: HANDLE(copyGlobalMemory(HGLOBAL(data)));
+		if (copy) {
+			m_formats[m_count++] = { format, copy };
+		}
+	}
+	return true;
+}
+
+void SavedContents::restore() {
+	for (int i = 0; i < m_count; i++) {
+		if (SetClipboardData(m_formats[i].format, m_formats[i].data)) {
+			m_formats[i].data = NULL;  // The clipboard owns the data now.
+		}
+	}
+	clear();
+}
+
+void SavedContents::clear() {
+	for (int i = 0; i < m_count; i++) {
+		const HANDLE data = m_formats[i].data;
+		if (!data) {
+			continue;
+		}
+		if (m_formats[i].format == CF_ENHMETAFILE) {
+			DeleteEnhMetaFile(HENHMETAFILE(data));
+		} else {
+			GlobalFree(data);
+		}
+	}
+	delete[] m_formats;
+	m_formats = nullptr;
+	m_count = 0;
+}
+
+
+Paster::~Paster() {
+	if (m_window) {
+		DestroyWindow(m_window);
+	}
+}
+
+bool Paster::offer(LPCTSTR text, int length) {
+	if (!m_window) {
+		m_window = CreateWindow(
+			_T("STATIC"), /* lpWindowName= */ nullptr,
+			/* dwStyle=*/ 0,
+			/* x,y,nWidth,nHeight=*/ 0,0,0,0,
+			HWND_MESSAGE, /* hMenu= */ NULL, e_instance, /* lpParam= */ nullptr);
+		VERIF(m_window);
+		subclassWindow(m_window, prcOwner, /* ref_data= */ reinterpret_cast<DWORD_PTR>(this));
+	}
+	
+	VERIF(OpenClipboard(m_window));
+	if (!m_saved_contents.save()) {
+		// Keep the contents rather than losing some of them.
+		CloseClipboard();
+		return false;
+	}
+	EmptyClipboard();
+	m_text = text;
+	m_length = length;
+	m_requested = false;
+	
+	// Offer the text with delayed rendering. Keep it out of the clipboard history and monitors:
+	// their requests would look like the target accepting the paste.
+	SetClipboardData(CF_UNICODETEXT, /* hMem= */ NULL);
+	setClipboardDword(_T("ExcludeClipboardContentFromMonitorProcessing"), 0);
+	setClipboardDword(_T("CanIncludeInClipboardHistory"), 0);
+	CloseClipboard();
+	return true;
+}
+
+executor::Coroutine Paster::finish(executor::Task* task) {
+	// Process the messages sent to the thread, including WM_RENDERFORMAT, until the target
+	// requests the text. Leave the posted messages in the queue.
+	bool can_continue = true;
+	DWORD start = GetTickCount();
+	for (;;) {
+		MSG msg;
+		PeekMessage(&msg, /* hWnd= */ NULL, 0, 0, PM_NOREMOVE | PM_QS_SENDMESSAGE);
+		if (m_requested || !can_continue || GetTickCount() - start >= kRequestTimeoutMs) {
+			break;
+		}
+		can_continue = co_await executor::sleep(task, kPollIntervalMs);
+	}
+	
+	// Withdraw the text if not requested in time: prcOwner() declines the late requests,
+	// the caller types the text instead.
+	if (!m_requested) {
+		m_text = nullptr;
+	}
+	
+	// The target closes the clipboard once it has read the text.
+	start = GetTickCount();
+	bool opened;
+	while (!(opened = toBool(OpenClipboard(m_window))) &&
+			can_continue && GetTickCount() - start < kCloseTimeoutMs) {
+		can_continue = co_await executor::sleep(task, kPollIntervalMs);
+	}
+	if (opened) {
+		if (GetClipboardOwner() == m_window) {
+			EmptyClipboard();
+			m_saved_contents.restore();
+		}
+		CloseClipboard();
+	}
+	m_saved_contents.clear();
+	m_text = nullptr;
+	co_return can_continue;
+}
+
+LRESULT CALLBACK Paster::prcOwner(HWND hwnd, UINT message, WPARAM wParam, LPARAM lParam,
+		UINT_PTR UNUSED(subclass_id), DWORD_PTR ref_data) {
+	Paster *const paster = reinterpret_cast<Paster*>(ref_data);
+	switch (message) {
+		case WM_RENDERFORMAT:
+			// Decline the requests arriving after finish() has withdrawn the text.
+			if (wParam == CF_UNICODETEXT && paster->m_text) {
+				paster->m_requested = true;
+				paster->render();
+			}
+			return 0;
+		
+		case WM_RENDERALLFORMATS:
+			// finish() empties the clipboard before the window is destroyed.
+			return 0;
+		
+		default:
+			return DefSubclassProc(hwnd, message, wParam, lParam);
+	}
+}
+
+void Paster::render() {
+	if (!m_text) {
+		return;
+	}
+	const SIZE_T size = (m_length + 1) * sizeof(*m_text);
+	const HGLOBAL data = GlobalAlloc(GMEM_MOVEABLE, size);
+	if (!data) {
+		return;
+	}
+	memcpy(GlobalLock(data), m_text, size);
+	GlobalUnlock(data);
+	if (!SetClipboardData(CF_UNICODETEXT, data)) {
+		GlobalFree(data);
+	}
+}
+
+}  // namespace clipboard
@@ -0,0 +1,143 @@
+// Clavier+
+// Keyboard shortcuts manager
+//
+// Copyright (C) 2000-2008 Guillaume Ryder
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+
+// Pasting of texts via the clipboard, for the long texts: one Ctrl+V instead of one input
+// event per character. Restores the previous contents of the clipboard afterwards.
+
+#pragma once
+
+#include "Executor.h"
+
+namespace clipboard {
+
+// Copy of the contents of the clipboard: the data of its formats stored as global memory,
+// and its enhanced metafile. Does not save the formats the system synthesizes from the saved
+// ones: ANSI texts, bitmaps, palettes and old-style metafiles.
+class SavedContents {
+public:
+	
+	// Maximum size of the saved data, in bytes: saving copies all the data, and renders the
+	// delayed formats of the clipboard owner.
+	static constexpr SIZE_T kMaxSize = 1 << 20;
+	
+	SavedContents() : m_formats(nullptr), m_count(0) {}
+	
+	SavedContents(const SavedContents& other) = delete;
+	SavedContents& operator =(const SavedContents& other) = delete;
+	
+	~SavedContents() {
+		clear();
+	}
+	
+	// Replaces the saved contents with a copy of the contents of the clipboard.
+	// Returns false if the clipboard has a format that cannot be copied, for example a bitmap
+	// the system cannot convert or an owner-display format: nothing is saved then, and no
+	// delayed format is rendered. Also returns false, saving nothing, once the data exceeds
+	// kMaxSize: the formats rendered until then stay rendered.
+	// Requires the clipboard to be open.
+	bool save();
+	
+	// Places the saved contents on the clipboard, then forgets them.
+	// Requires the clipboard to be open and emptied.
+	void restore();
+	
+	// Forgets the saved contents.
+	void clear();
+	
+	int getFormatCount() const {
+		return m_count;
+	}
+
+private:
+	
+	struct SavedFormat {
+		UINT format;
+		HANDLE data;  // HENHMETAFILE for CF_ENHMETAFILE, HGLOBAL otherwise.
+	};
+	
+	SavedFormat* m_formats;
+	int m_count;
+};
+
+
+// Pastes texts in the window having the keyboard focus:
+// 1) offer() saves the contents of the clipboard then offers the text with delayed rendering;
+// 2) the caller simulates Ctrl+V;
+// 3) finish() copies the text to the clipboard once the target requests it, waits until the
+//    target reads it, then restores the saved contents of the clipboard.
+// Thanks to delayed rendering, the text is copied only if the target accepts the paste, and
+// finish() knows whether it did. If the target does not accept it in time, the text is
+// withdrawn: the late requests get no text, and the caller types the text instead.
+// Must be used by a single thread, which must not have the clipboard open.
+// The thread must process its sent messages only: finish() polls them between sleeps.
+class Paster {
+public:
+	
+	// Maximum duration to wait for the target to request the text, in milliseconds.
+	static constexpr DWORD kRequestTimeoutMs = 1000;
+	
+	// Maximum duration to wait for the target to close the clipboard, in milliseconds.
+	static constexpr DWORD kCloseTimeoutMs = 1000;
+	
+	// Interval between two checks of the clipboard by finish(), in milliseconds.
+	static constexpr DWORD kPollIntervalMs = 5;
+	
+	Paster() : m_window(NULL), m_text(nullptr), m_length(0), m_requested(false) {}
+	
+	Paster(const Paster& other) = delete;
+	Paster& operator =(const Paster& other) = delete;
+	
+	~Paster();
+	
+	// Saves the contents of the clipboard then offers a text.
+	// Returns false if the clipboard cannot be opened or its contents cannot be saved: nothing is
+	// offered and the clipboard is unchanged, the caller should type the text instead.
+	// text: the text to paste, null-terminated, of length characters. Must remain valid until finish().
+	bool offer(LPCTSTR text, int length);
+	
+	// Waits until the target requests the offered text, for at most kRequestTimeoutMs, then
+	// restores the saved contents of the clipboard unless another program changed it meanwhile.
+	// If the target does not request the text in time, withdraws it: see isRequested().
+	// Suspends the task while waiting, see executor::sleep().
+	// Returns false if the task is cancelled meanwhile.
+	executor::Coroutine finish(executor::Task* task);
+	
+	// Returns whether the target has requested the text offered last, that is accepted the paste.
+	// If false once finish() is done, the text has not been pasted: the caller should type it.
+	bool isRequested() const {
+		return m_requested;
+	}
+
+private:
+	
+	// Window procedure of m_window, the owner of the clipboard while the text is offered.
+	static LRESULT CALLBACK prcOwner(HWND hwnd, UINT message, WPARAM wParam, LPARAM lParam,
+		UINT_PTR subclass_id, DWORD_PTR ref_data);
+	
+	// Copies the offered text to the clipboard, in response to WM_RENDERFORMAT.
+	void render();
+	
+	HWND m_window;  // Created by the first offer(). Owns the clipboard until finish() restores it.
+	LPCTSTR m_text;  // Null once finish() has withdrawn the text.
+	int m_length;
+	bool m_requested;
+	SavedContents m_saved_contents;
+};
+
+}  // namespace clipboard
@@ -46,6 +46,9 @@ Shortcut *s_shortcut = nullptr;  // Shortcut being edited
 
 HWND s_hwnd_list = NULL;  // Shortcuts list
 
+// Indexes the shortcuts of s_hwnd_list, for detecting conflicts as soon as they are introduced.
+shortcut::ShortcutIndex s_list_index;
+
 // Process GUI events to update shortcuts data from the dialog box controls
 bool s_process_gui_events;
 
@@ -94,6 +97,15 @@ void onItemUpdated(int columns_mask);
 // Updates the shortcut counts label.
 void onShortcutsCountChanged();
 
+enum class ConflictReport {
+	kMessageBox,
+	kBalloonTip,  // Over the programs text box, non-modal.
+};
+
+// Reports whether a shortcut of the list conflicts with another one, according to s_list_index.
+// Hides the programs text box balloon tip if there is no conflict.
+void reportConflict(const Shortcut& shortcut, ConflictReport report);
+
 void fillSpecialCharsMenu(HMENU menu, int pos, UINT first_id);
 
 // Appends the escaped version of the input string to the output.
@@ -226,11 +238,13 @@ void addShortcut(Shortcut* shortcut) {
 	
 	// Add the shortcut to the list, in selected state.
 	s_process_gui_events = false;
+	s_list_index.add(shortcut);
 	addItem(shortcut, /* selected= */ true);
 	onItemUpdated(~0);
 	updateList();
 	onShortcutsCountChanged();
 	s_process_gui_events = true;
+	reportConflict(*shortcut, ConflictReport::kMessageBox);
 	
 	// Give the focus to the main control of the shortcut.
 	const HWND edit_control = GetDlgItem(
@@ -606,6 +620,11 @@ constexpr LPCTSTR kWriteCommands[] = {
 	_T("[{MouseWheel,<(-) ticks>}]"),
 	_T("[{KeysDown,<keys>}]"),
 	_T("[{FocusOrLaunch,<window name>,<command>,<delay>}]"),
+	_T("[{Cancel}]"),
+	_T("[{Batch,<size>,<delay>}]"),
+	_T("[{Pacing,<delay>}]"),
+	_T("[{Paste,<min length>}]"),
+	_T("[{Overlap,Queue/Coalesce/Drop}]"),
 };
 
 
@@ -614,16 +633,13 @@ void onMainCommand(UINT id, WORD notify, HWND hwnd) {
 		
 		case IDCANCEL: {
 			// Get delete new shortcuts
+			s_list_index.clear();
 			LVITEM lvi = { .mask = LVIF_PARAM };
 			for (lvi.iItem = 0; ListView_GetItem(s_hwnd_list, &lvi); lvi.iItem++) {
 				delete reinterpret_cast<Shortcut*>(lvi.lParam);
 			}
 			ListView_DeleteAllItems(s_hwnd_list);
 			
-			for (Shortcut* sh = shortcut::getFirst(); sh; sh = sh->getNext()) {
-				sh->registerHotKey();
-			}
-			
 			EndDialog(e_hdlgMain, IDCANCEL);
 			break;
 		}
@@ -646,34 +662,36 @@ void onMainCommand(UINT id, WORD notify, HWND hwnd) {
 			// Get all shortcuts from the list, check unicity
 			const int item_count = ListView_GetItemCount(s_hwnd_list);
 			Shortcut **const shortcuts = new Shortcut*[item_count];
+			shortcut::ShortcutIndex checked_index;
 			LVITEM lvi = { .mask = LVIF_PARAM };
 			for (lvi.iItem = 0; lvi.iItem < item_count; lvi.iItem++) {
 				ListView_GetItem(s_hwnd_list, &lvi);
 				Shortcut *const shortcut = shortcuts[lvi.iItem] = reinterpret_cast<Shortcut*>(lvi.lParam);
-				String *const programs = shortcut->getPrograms();
-				for (int i = 0; i < lvi.iItem; i++) {
-					if (shortcuts[i]->testConflict(*shortcut, programs, shortcut->m_programs_only)) {
-						TCHAR shortcut_display_name[kHotKeyBufSize];
-						shortcut->getDisplayName(shortcut_display_name);
-						messageBox(e_hdlgMain, ERR_SHORTCUT_DUPLICATE, MB_ICONERROR, shortcut_display_name);
-						delete [] programs;
-						delete [] shortcuts;
-						return;
-					}
+				if (checked_index.findConflict(*shortcut)) {
+					TCHAR shortcut_display_name[kHotKeyBufSize];
+					shortcut->getDisplayName(shortcut_display_name);
+					messageBox(e_hdlgMain, ERR_SHORTCUT_DUPLICATE, MB_ICONERROR, shortcut_display_name);
+					checked_index.clear();
+					delete [] shortcuts;
+					return;
 				}
-				delete [] programs;
+				checked_index.add(shortcut);
 			}
+			checked_index.clear();
+			s_list_index.clear();
 			
-			// Create a valid linked list from the list box
-			// and register the hot keys
-			shortcut::clearShortcuts();
+			// Replace the list of shortcuts with the list box contents
+			// and update the hot keys of the changed keystrokes only
+			shortcut::detachShortcuts();
 			for (int i = 0; i < item_count; i++) {
 				Shortcut *const shortcut = shortcuts[i];
 				shortcut->clearIcons();
-				shortcut->registerHotKey();
-				shortcut->addToList();
+				shortcut::addShortcut(*shortcut);
+				delete shortcut;
 			}
+			shortcut::commitShortcuts();
 			delete [] shortcuts;
+			ListView_DeleteAllItems(s_hwnd_list);
 			
 			if (id != IDCCMD_QUIT) {
 				shortcut::saveShortcuts();
@@ -767,10 +785,10 @@ void onMainCommand(UINT id, WORD notify, HWND hwnd) {
 			lvi.mask = LVIF_PARAM;
 			ListView_GetItem(s_hwnd_list, &lvi);
 			
-			// Delete item, hotkey, and shortcut object
+			// Delete item and shortcut object
 			ListView_DeleteItem(s_hwnd_list, lvi.iItem);
 			auto *sh = reinterpret_cast<Shortcut*>(lvi.lParam);
-			sh->unregisterHotKey();
+			s_list_index.remove(sh);
 			delete sh;
 			
 			// Select an other item and update
@@ -790,10 +808,13 @@ void onMainCommand(UINT id, WORD notify, HWND hwnd) {
 			SetFocus(s_hwnd_list);
 			Keystroke ks = *s_shortcut;
 			if (ks.showEditDialog(e_hdlgMain)) {
+				s_list_index.remove(s_shortcut);
 				static_cast<Keystroke&>(*s_shortcut) = ks;
+				s_list_index.add(s_shortcut);
 				updateItem();
 				onItemUpdated((1 << kColKeystroke) | (1 << kColCond));
 				updateList();
+				reportConflict(*s_shortcut, ConflictReport::kMessageBox);
 			}
 			break;
 		}
@@ -897,8 +918,14 @@ void onMainCommand(UINT id, WORD notify, HWND hwnd) {
 				getDlgItemText(e_hdlgMain, id, col_contents);
 				
 				if (id == IDCTXT_COMMAND) {
+					s_shortcut->compileCommand();
 					s_shortcut->clearIcons();
 					s_shortcut->getIcon();
+				} else if (id == IDCTXT_TEXT) {
+					s_shortcut->compileText();
+				} else if (id == IDCTXT_PROGRAMS) {
+					s_shortcut->compilePrograms();
+					reportConflict(*s_shortcut, ConflictReport::kBalloonTip);
 				}
 				
 				updateItem();
@@ -914,6 +941,7 @@ void onMainCommand(UINT id, WORD notify, HWND hwnd) {
 				s_shortcut->m_programs_only = toBool(SendDlgItemMessage(e_hdlgMain,
 					IDCCBO_PROGRAMS, CB_GETCURSEL, 0, 0));
 				updateItem();
+				reportConflict(*s_shortcut, ConflictReport::kBalloonTip);
 			}
 			break;
 		
@@ -935,7 +963,7 @@ void onMainCommand(UINT id, WORD notify, HWND hwnd) {
 			break;
 		
 		case IDCCMD_TEST:
-			s_shortcut->execute(/* from_hotkey= */ false);
+			s_shortcut->execute(/* dispatch= */ nullptr);
 			break;
 		
 		case IDCCMD_TEXT_MENU: {
@@ -1002,7 +1030,8 @@ INT_PTR CALLBACK prcMain(HWND hdlg, UINT message, WPARAM wParam, LPARAM lParam)
 		
 		// Initialization
 		case WM_INITDIALOG: {
-			e_hdlgMain = e_modal_dialog = hdlg;
+			e_hdlgMain = hdlg;
+			setModalDialog(hdlg);
 			
 			s_process_gui_events = false;
 			
@@ -1063,12 +1092,14 @@ INT_PTR CALLBACK prcMain(HWND hdlg, UINT message, WPARAM wParam, LPARAM lParam)
 				ListView_InsertColumn(s_hwnd_list, lvc.iSubItem, &lvc);
 			}
 			
-			// Fill shortcuts list and unregister hot keys
+			// Fill shortcuts list.
+			// Keep the hot keys registered: the modal loop hook types them back meanwhile.
 			int shortcut_count = 0, shortcut_icon_count = 0;
-			for (Shortcut *sh = shortcut::getFirst(); sh; sh = sh->getNext()) {
-				Shortcut *const sh_copy = new Shortcut(*sh);
-				sh_copy->unregisterHotKey();
-				addItem(sh_copy, (s_shortcut == sh));
+			s_list_index.clear();
+			for (const Shortcut& sh : shortcut::getShortcuts()) {
+				Shortcut *const sh_copy = new Shortcut(sh);
+				s_list_index.add(sh_copy);
+				addItem(sh_copy, (s_shortcut == &sh));
 				shortcut_count++;
 				if (sh_copy->m_type == Shortcut::Type::kCommand) {
 					shortcut_icon_count++;
@@ -1475,7 +1506,7 @@ LRESULT CALLBACK prcProgramsTarget(HWND hwnd, UINT message, WPARAM wParam, LPARA
 INT_PTR CALLBACK prcCmdSettings(HWND hdlg, UINT message, WPARAM wParam, LPARAM UNUSED(lParam)) {
 	switch (message) {
 		case WM_INITDIALOG: {
-			e_modal_dialog = hdlg;
+			setModalDialog(hdlg);
 			centerParent(hdlg);
 			
 			// Fill "command line show" list
@@ -1532,13 +1563,14 @@ INT_PTR CALLBACK prcCmdSettings(HWND hdlg, UINT message, WPARAM wParam, LPARAM U
 				case IDOK:
 					getDlgItemText(hdlg, IDCTXT_COMMAND, &s_shortcut->m_command);
 					getDlgItemText(hdlg, IDCTXT_DIRECTORY, &s_shortcut->m_directory);
+					s_shortcut->compileCommand();
 					s_shortcut->m_show_option = Shortcut::kShowOptions[
 						SendDlgItemMessage(hdlg, IDCCBO_SHOW, CB_GETCURSEL, 0,0)];
 					s_shortcut->clearIcons();
 					// Fall-through
 					
 				case IDCANCEL:
-					e_modal_dialog = e_hdlgMain;
+					setModalDialog(e_hdlgMain);
 					EndDialog(hdlg, LOWORD(wParam));
 					break;
 			}
@@ -1554,7 +1586,7 @@ INT_PTR CALLBACK prcLanguage(HWND hdlg, UINT message, WPARAM wParam, LPARAM UNUS
 	
 	switch (message) {
 		case WM_INITDIALOG: {
-			e_modal_dialog = hdlg;
+			setModalDialog(hdlg);
 			
 			for (int lang = 0; lang < i18n::kLangCount; lang++) {
 				ListBox_AddString(list_hwnd, getLanguageName(i18n::Language(lang)));
@@ -1595,7 +1627,7 @@ INT_PTR CALLBACK prcLanguage(HWND hdlg, UINT message, WPARAM wParam, LPARAM UNUS
 INT_PTR CALLBACK prcAbout(HWND hdlg, UINT message, WPARAM wParam, LPARAM lParam) {
 	switch (message) {
 		case WM_INITDIALOG: {
-			e_modal_dialog = hdlg;
+			setModalDialog(hdlg);
 			centerParent(hdlg);
 			
 			// Extract the version and copyright notice from resources,
@@ -1755,6 +1787,40 @@ void onShortcutsCountChanged() {
 }
 
 
+void reportConflict(const Shortcut& shortcut, ConflictReport report) {
+	const HWND programs_edit = GetDlgItem(e_hdlgMain, IDCTXT_PROGRAMS);
+	if (!s_list_index.findConflict(shortcut)) {
+		if (report == ConflictReport::kBalloonTip) {
+			Edit_HideBalloonTip(programs_edit);
+		}
+		return;
+	}
+	
+	TCHAR shortcut_display_name[kHotKeyBufSize];
+	shortcut.getDisplayName(shortcut_display_name);
+	
+	switch (report) {
+		case ConflictReport::kMessageBox:
+			messageBox(e_hdlgMain, ERR_SHORTCUT_DUPLICATE, MB_ICONWARNING, shortcut_display_name);
+			break;
+		
+		case ConflictReport::kBalloonTip: {
+			TCHAR format[256], text[1024];
+			i18n::loadStringAuto(ERR_SHORTCUT_DUPLICATE, format);
+			wsprintf(text, format, shortcut_display_name);
+			EDITBALLOONTIP balloon_tip = {
+				.cbStruct = sizeof(balloon_tip),
+				.pszTitle = kAppName,
+				.pszText = text,
+				.ttiIcon = TTI_WARNING,
+			};
+			Edit_ShowBalloonTip(programs_edit, &balloon_tip);
+			break;
+		}
+	}
+}
+
+
 Shortcut* getSelectedShortcut() {
 	LVITEM lvi = { .iItem = ListView_GetNextItem(s_hwnd_list, -1, LVNI_SELECTED) };
 	if (lvi.iItem < 0) {
@@ -1947,7 +2013,7 @@ void Shortcut::getColumnText(int column_text, String& output) const {
 		}
 		
 		case kColUsageCount:
-			i18n::formatInteger(m_usage_count, &output);
+			i18n::formatInteger(getUsageCount(), &output);
 			break;
 		
 		case kColDescription:
@@ -1974,7 +2040,7 @@ int CALLBACK Shortcut::compare(const Shortcut* shortcut1, const Shortcut* shortc
 			return Keystroke::compare(*shortcut1, *shortcut2);
 		
 		case kColUsageCount:
-			return shortcut1->m_usage_count - shortcut2->m_usage_count;
+			return shortcut1->getUsageCount() - shortcut2->getUsageCount();
 	}
 	
 	// Other columns: sort alphabetically.
@@ -0,0 +1,350 @@
+// Clavier+
+// Keyboard shortcuts manager
+//
+// Copyright (C) 2000-2008 Guillaume Ryder
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+
+#include "StdAfx.h"
+#include "Executor.h"
+#include "Global.h"
+#include "Metrics.h"
+#include "Pacing.h"
+
+#include <algorithm>
+
+namespace executor {
+namespace {
+
+Scheduler s_scheduler(Scheduler::Clock::kReal);
+
+// Runs s_scheduler. NULL if not started or terminated.
+HANDLE s_thread;
+
+// Auto-reset event signaled to make the thread run s_scheduler.
+HANDLE s_wake_event;
+
+// Set by terminate(): the thread exits once no task is left.
+volatile bool s_stopping;
+
+
+DWORD WINAPI executorThreadProc(void* param);
+
+}  // namespace
+
+
+Coroutine& Coroutine::operator =(Coroutine&& other) {
+	if (this != &other) {
+		if (m_handle) {
+			m_handle.destroy();
+		}
+		m_handle = other.m_handle;
+		other.m_handle = nullptr;
+	}
+	return *this;
+}
+
+Coroutine::~Coroutine() {
+	if (m_handle) {
+		m_handle.destroy();
+	}
+}
+
+bool Coroutine::runSynchronously() {
+	m_handle.resume();
+	assert(m_handle.done());
+	return m_handle.promise().result;
+}
+
+
+bool Sleep::await_ready() {
+	if (m_task) {
+		return m_task->isCancelled();
+	}
+	pacing::Pacer().wait(LONGLONG(m_duration_ms) * 1000);
+	return true;
+}
+
+void Sleep::await_suspend(std::coroutine_handle<> handle) {
+	m_task->m_resume_handle = handle;
+	m_task->m_wake_time = m_task->m_scheduler->now() + m_duration_ms;
+}
+
+bool Sleep::await_resume() const {
+	return !m_task || !m_task->isCancelled();
+}
+
+
+void Scheduler::submit(const void* key, Task* task, Admission admission) {
+	InterlockedIncrement(&m_stats.submitted);
+	task->m_scheduler = this;
+	task->m_submit_time = metrics::getTimestamp();
+	
+	AcquireSRWLockExclusive(&m_lock);
+	
+	Lane* lane = m_lanes;
+	while (lane && lane->key != key) {
+		lane = lane->next;
+	}
+	if (!lane) {
+		lane = new Lane;
+		lane->key = key;
+		lane->running_task = nullptr;
+		lane->first_waiting = lane->last_waiting = nullptr;
+		lane->waiting_count = 0;
+		lane->next = m_lanes;
+		m_lanes = lane;
+	}
+	
+	// Counter of the task if not admitted.
+	LONG* rejected_counter = nullptr;
+	if (lane->running_task || lane->waiting_count) {
+		switch (admission) {
+			case Admission::kCoalesce:
+				if (lane->waiting_count) {
+					rejected_counter = &m_stats.coalesced;
+				}
+				break;
+			
+			case Admission::kQueue:
+				if (lane->waiting_count >= kMaxWaitingTasks) {
+					rejected_counter = &m_stats.dropped;
+				}
+				break;
+			
+			case Admission::kDrop:
+				rejected_counter = &m_stats.dropped;
+				break;
+		}
+	}
+	
+	if (!rejected_counter) {
+		if (lane->last_waiting) {
+			lane->last_waiting->m_next_waiting = task;
+		} else {
+			lane->first_waiting = task;
+		}
+		lane->last_waiting = task;
+		lane->waiting_count++;
+		if (lane->waiting_count > m_stats.max_waiting) {
+			m_stats.max_waiting = lane->waiting_count;
+		}
+	}
+	
+	ReleaseSRWLockExclusive(&m_lock);
+	
+	if (rejected_counter) {
+		InterlockedIncrement(rejected_counter);
+		delete task;
+	}
+}
+
+void Scheduler::cancelAll(const Task* except_task) {
+	AcquireSRWLockExclusive(&m_lock);
+	for (Lane* lane = m_lanes; lane; lane = lane->next) {
+		if (lane->running_task && lane->running_task != except_task) {
+			lane->running_task->m_cancelled = true;
+		}
+		// Including the tasks waiting behind except_task: a cancelling task must not run again.
+		if (lane->waiting_count) {
+			while (Task *const task = lane->first_waiting) {
+				lane->first_waiting = task->m_next_waiting;
+				InterlockedIncrement(&m_stats.cancelled);
+				delete task;
+			}
+			lane->last_waiting = nullptr;
+			lane->waiting_count = 0;
+		}
+	}
+	ReleaseSRWLockExclusive(&m_lock);
+}
+
+DWORD Scheduler::runReady() {
+	DWORD delay;
+	bool resumed;
+	do {
+		delay = INFINITE;
+		resumed = false;
+		
+		AcquireSRWLockExclusive(&m_lock);
+		
+		// Delete the lanes without tasks. Only this thread deletes lanes and removes running tasks:
+		// the lanes stay valid while the lock is released below.
+		for (Lane** lane_ptr = &m_lanes; *lane_ptr;) {
+			Lane *const lane = *lane_ptr;
+			if (lane->running_task || lane->waiting_count) {
+				lane_ptr = &lane->next;
+			} else {
+				*lane_ptr = lane->next;
+				delete lane;
+			}
+		}
+		
+		// Resume each ready task once. submit() inserts the new lanes at the head of the list:
+		// they wait for the next pass.
+		for (Lane* lane = m_lanes; lane; lane = lane->next) {
+			Task* task = lane->running_task;
+			const bool starting = !task;
+			if (starting) {
+				task = lane->first_waiting;
+				if (!task) {
+					continue;
+				}
+				lane->first_waiting = task->m_next_waiting;
+				if (!lane->first_waiting) {
+					lane->last_waiting = nullptr;
+				}
+				lane->waiting_count--;
+				lane->running_task = task;
+			} else if (!task->m_cancelled) {
+				const LONG remaining = LONG(task->m_wake_time - now());
+				if (remaining > 0) {
+					delay = std::min(delay, DWORD(remaining));
+					continue;
+				}
+			}
+			
+			ReleaseSRWLockExclusive(&m_lock);
+			resume(lane, task, starting);
+			resumed = true;
+			AcquireSRWLockExclusive(&m_lock);
+		}
+		
+		ReleaseSRWLockExclusive(&m_lock);
+	} while (resumed);
+	
+	return delay;
+}
+
+void Scheduler::resume(Lane* lane, Task* task, bool starting) {
+	if (starting) {
+		metrics::recordStage(metrics::Stage::kMacroQueue, task->m_submit_time);
+		task->m_run_start = metrics::getTimestamp();
+		task->m_coroutine = task->run();
+		task->m_resume_handle = task->m_coroutine.getHandle();
+	}
+	
+	if (task->m_dispatch) {
+		task->m_dispatch->resumeExecution();
+	}
+	task->m_resume_handle.resume();
+	if (task->m_dispatch) {
+		task->m_dispatch->suspendExecution();
+	}
+	if (!task->m_coroutine.isDone()) {
+		return;  // Suspended by sleep().
+	}
+	
+	metrics::recordStage(metrics::Stage::kMacroRun, task->m_run_start);
+	InterlockedIncrement(task->m_cancelled ? &m_stats.cancelled : &m_stats.completed);
+	
+	AcquireSRWLockExclusive(&m_lock);
+	lane->running_task = nullptr;
+	ReleaseSRWLockExclusive(&m_lock);
+	delete task;
+}
+
+DWORD Scheduler::now() const {
+	return (m_clock == Clock::kVirtual) ? m_virtual_now : DWORD(pacing::getMicroseconds() / 1000);
+}
+
+void Scheduler::runFor(DWORD duration_ms) {
+	assert(m_clock == Clock::kVirtual);
+	const DWORD end = m_virtual_now + duration_ms;
+	for (;;) {
+		const DWORD delay = runReady();
+		const DWORD remaining = end - m_virtual_now;
+		if (delay > remaining) {
+			m_virtual_now = end;
+			return;
+		}
+		m_virtual_now += delay;
+	}
+}
+
+void Scheduler::runUntilIdle() {
+	assert(m_clock == Clock::kVirtual);
+	for (;;) {
+		const DWORD delay = runReady();
+		if (delay == INFINITE) {
+			return;
+		}
+		m_virtual_now += delay;
+	}
+}
+
+
+void initialize() {
+	s_stopping = false;
+	s_wake_event = CreateEvent(
+		/* lpEventAttributes= */ nullptr, /* bManualReset= */ false, /* bInitialState= */ false,
+		/* lpName= */ nullptr);
+	DWORD thread_id;
+	s_thread = CreateThread(
+		/* lpThreadAttributes= */ nullptr, /* dwStackSize= */ 0, executorThreadProc,
+		/* lpParameter= */ nullptr, /* dwCreationFlags= */ 0, &thread_id);
+}
+
+void terminate() {
+	if (!s_thread) {
+		return;
+	}
+	s_stopping = true;
+	cancelAll(/* except_task= */ nullptr);
+	WaitForSingleObject(s_thread, INFINITE);
+	CloseHandle(s_thread);
+	CloseHandle(s_wake_event);
+	s_thread = s_wake_event = NULL;
+}
+
+void submit(const void* key, Task* task, Admission admission) {
+	if (s_stopping) {
+		delete task;
+		return;
+	}
+	s_scheduler.submit(key, task, admission);
+	SetEvent(s_wake_event);
+}
+
+void cancelAll(const Task* except_task) {
+	s_scheduler.cancelAll(except_task);
+	SetEvent(s_wake_event);
+}
+
+const ExecutorStats& getStats() {
+	return s_scheduler.getStats();
+}
+
+
+namespace {
+
+DWORD WINAPI executorThreadProc(void* UNUSED(param)) {
+	// Wakes up the tasks with a high-resolution timer when possible.
+	pacing::Pacer pacer;
+	for (;;) {
+		const DWORD delay = s_scheduler.runReady();
+		if (s_stopping && delay == INFINITE) {
+			return 0;
+		}
+		if (delay == INFINITE) {
+			WaitForSingleObject(s_wake_event, INFINITE);
+		} else {
+			pacer.waitForEvent(s_wake_event, LONGLONG(delay) * 1000);
+		}
+	}
+}
+
+}  // namespace
+}  // namespace executor
@@ -0,0 +1,317 @@
+// Clavier+
+// Keyboard shortcuts manager
+//
+// Copyright (C) 2000-2008 Guillaume Ryder
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+
+// Runs the text shortcuts off the dispatch thread, so that their delays do not block the hotkeys.
+//
+// Tasks are C++20 coroutines: their delays suspend them instead of blocking a thread, so one
+// thread runs all the tasks. Tasks are grouped by key, typically the executed shortcut:
+// the tasks of a key run one at a time, the tasks of different keys concurrently.
+// A task gives up the thread only when it sleeps: long tasks should sleep(task, 0) regularly,
+// like the texts after each run of characters or batch of input.
+
+#pragma once
+
+#include <coroutine>
+
+namespace metrics {
+
+class Dispatch;
+
+}  // namespace metrics
+
+
+namespace executor {
+
+class Scheduler;
+class Task;
+
+// Coroutine executing a task or a part of it. Returns whether to continue executing the task.
+// Starts suspended: runs when awaited by another coroutine, or when resumed by the Scheduler.
+class [[nodiscard]] Coroutine {
+public:
+	
+	struct promise_type;
+	using Handle = std::coroutine_handle<promise_type>;
+	
+	// Resumes the awaiting coroutine, if any, once the coroutine ends.
+	struct FinalAwaiter {
+		bool await_ready() noexcept {
+			return false;
+		}
+		
+		std::coroutine_handle<> await_suspend(Handle handle) noexcept {
+			const std::coroutine_handle<> continuation = handle.promise().continuation;
+			return continuation ? continuation : std::noop_coroutine();
+		}
+		
+		void await_resume() noexcept {}
+	};
+	
+	struct promise_type {
+		Coroutine get_return_object() {
+			return Coroutine(Handle::from_promise(*this));
+		}
+		
+		std::suspend_always initial_suspend() noexcept {
+			return {};
+		}
+		
+		FinalAwaiter final_suspend() noexcept {
+			return {};
+		}
+		
+		void return_value(bool value) {
+			result = value;
+		}
+		
+		void unhandled_exception() {}
+		
+		bool result = false;
+		std::coroutine_handle<> continuation;  // The awaiting coroutine. Optional.
+	};
+	
+	Coroutine() : m_handle(nullptr) {}
+	
+	explicit Coroutine(Handle handle) : m_handle(handle) {}
+	
+	Coroutine(Coroutine&& other) : m_handle(other.m_handle) {
+		other.m_handle = nullptr;
+	}
+	
+	Coroutine& operator =(Coroutine&& other);
+	
+	~Coroutine();
+	
+	// Awaiting a coroutine runs it until its end, then returns its result.
+	bool await_ready() const {
+		return false;
+	}
+	
+	std::coroutine_handle<> await_suspend(std::coroutine_handle<> awaiting) {
+		m_handle.promise().continuation = awaiting;
+		return m_handle;
+	}
+	
+	bool await_resume() const {
+		return m_handle.promise().result;
+	}
+	
+	Handle getHandle() const {
+		return m_handle;
+	}
+	
+	bool isDone() const {
+		return m_handle.done();
+	}
+	
+	// Runs the coroutine in the calling thread until its end, then returns its result.
+	// The coroutine must not suspend: its sleep() calls must have no task.
+	bool runSynchronously();
+	
+private:
+	
+	Handle m_handle;
+};
+
+
+// Awaitable returned by sleep().
+class Sleep {
+public:
+	
+	Sleep(Task* task, DWORD duration_ms) : m_task(task), m_duration_ms(duration_ms) {}
+	
+	bool await_ready();
+	void await_suspend(std::coroutine_handle<> handle);
+	bool await_resume() const;
+	
+private:
+	
+	Task* m_task;
+	DWORD m_duration_ms;
+};
+
+// Suspends a task for a duration, in milliseconds.
+// The co_await returns whether to continue executing the task: false if cancelled.
+// task: the task to suspend, null to sleep the calling thread via pacing::Pacer::wait() instead.
+inline Sleep sleep(Task* task, DWORD duration_ms) {
+	return Sleep(task, duration_ms);
+}
+
+
+// A unit of work of a Scheduler, typically one execution of a text shortcut.
+// Owned by the scheduler once submitted: deleted after running or cancellation.
+class Task {
+public:
+	
+	Task() = default;
+	virtual ~Task() = default;
+	
+	Task(const Task& other) = delete;
+	Task& operator =(const Task& other) = delete;
+	
+	// Returns the coroutine running the task, in the thread of the scheduler.
+	// The coroutine should suspend via sleep() instead of sleeping.
+	virtual Coroutine run() = 0;
+	
+	// Returns whether the task has been cancelled: it should then end as soon as possible.
+	bool isCancelled() const {
+		return m_cancelled;
+	}
+	
+protected:
+	
+	// The hotkey dispatch executed by the task, resumed while the task runs, see
+	// metrics::markOutput(). Optional, set by the subclass.
+	metrics::Dispatch* m_dispatch = nullptr;
+	
+private:
+	
+	friend class Scheduler;
+	friend class Sleep;
+	
+	Scheduler* m_scheduler = nullptr;
+	volatile bool m_cancelled = false;
+	Task* m_next_waiting = nullptr;  // The next task of the lane waiting after this one.
+	
+	LONGLONG m_submit_time = 0;  // Performance counter at the submission.
+	LONGLONG m_run_start = 0;  // Performance counter at the run start.
+	
+	Coroutine m_coroutine;  // The coroutine returned by run(), once started.
+	std::coroutine_handle<> m_resume_handle;  // The innermost coroutine suspended by sleep().
+	DWORD m_wake_time = 0;  // Scheduler::now() at which to resume m_resume_handle.
+};
+
+
+// Admission policy of a task submitted while other tasks of its key are running or waiting,
+// typically a hotkey pressed again or auto-repeated while its shortcut is still executing.
+enum class Admission : BYTE {
+	// Waits after the other tasks, unless one is already waiting: merges the repeats into one run.
+	kCoalesce,
+	
+	// Waits after the other tasks, in order, up to Scheduler::kMaxWaitingTasks per key.
+	kQueue,
+	
+	// Is dropped.
+	kDrop,
+};
+
+// Counters of the tasks of a scheduler. Thread-safe.
+struct ExecutorStats {
+	LONG submitted;
+	LONG completed;  // Ran until their end.
+	LONG cancelled;  // Cancelled while running or waiting.
+	LONG coalesced;  // Merged into a task of their key already waiting: Admission::kCoalesce.
+	LONG dropped;  // Admission::kDrop, or Admission::kQueue with a full queue.
+	LONG max_waiting;  // Maximum number of tasks waiting at the same time for one key.
+};
+
+// Runs tasks as coroutines, in a single thread.
+// submit() and cancelAll() are thread-safe; the other methods must be called by the thread
+// running the tasks.
+class Scheduler {
+public:
+	
+	enum class Clock {
+		kReal,  // pacing::getMicroseconds(), in milliseconds.
+		kVirtual,  // Starts at 0, advanced by runFor() and runUntilIdle() only. For tests.
+	};
+	
+	// Maximum number of tasks waiting per key, with Admission::kQueue.
+	static constexpr int kMaxWaitingTasks = 32;
+	
+	constexpr explicit Scheduler(Clock clock)
+		: m_clock(clock), m_virtual_now(0), m_lock{}, m_lanes(nullptr), m_stats{} {}
+	
+	Scheduler(const Scheduler& other) = delete;
+	Scheduler& operator =(const Scheduler& other) = delete;
+	
+	// Queues a task to run after the tasks of the same key, or deletes it according to admission.
+	// key: identifies the tasks to serialize, not dereferenced.
+	void submit(const void* key, Task* task, Admission admission = Admission::kCoalesce);
+	
+	// Cancels the running and waiting tasks of all keys.
+	// except_task: a running task not to cancel, typically the calling one. Optional.
+	// The tasks waiting behind it are cancelled.
+	void cancelAll(const Task* except_task);
+	
+	// Runs the tasks until all are suspended or done.
+	// Returns the delay until the next suspended task wakes up, INFINITE if there is none left.
+	DWORD runReady();
+	
+	// Virtual clock only: runs the tasks while advancing the clock by the given duration,
+	// instantly jumping from a wake up time to the next.
+	void runFor(DWORD duration_ms);
+	
+	// Virtual clock only: runs the tasks until none is left, advancing the clock instantly.
+	void runUntilIdle();
+	
+	// Returns the current time of the clock, in milliseconds.
+	DWORD now() const;
+	
+	const ExecutorStats& getStats() const {
+		return m_stats;
+	}
+	
+private:
+	
+	// The tasks of a key. Deleted by runReady() once it has no task left.
+	struct Lane {
+		const void* key;
+		Task* running_task;  // Optional.
+		
+		// Tasks starting after running_task, in order: linked list via Task::m_next_waiting.
+		Task* first_waiting;  // Null if none.
+		Task* last_waiting;  // Null if none.
+		int waiting_count;
+		
+		Lane* next;
+	};
+	
+	// Resumes a running task, or starts it if needed. Finishes it if done.
+	void resume(Lane* lane, Task* task, bool starting);
+	
+	const Clock m_clock;
+	DWORD m_virtual_now;
+	
+	// Guards m_lanes and the lanes.
+	SRWLOCK m_lock;
+	
+	// Linked list of the lanes, in no particular order.
+	Lane* m_lanes;
+	
+	ExecutorStats m_stats;
+};
+
+
+// The executor: a scheduler with a real clock, running in its own thread.
+
+// Starts the thread of the executor.
+void initialize();
+
+// Cancels all tasks then stops the thread of the executor. Idempotent.
+// Deletes the tasks submitted afterwards.
+void terminate();
+
+void submit(const void* key, Task* task, Admission admission = Admission::kCoalesce);
+
+void cancelAll(const Task* except_task);
+
+const ExecutorStats& getStats();
+
+}  // namespace executor
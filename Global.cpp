@@ -23,6 +23,8 @@
 #include "Shortcut.h"
 
 #include <algorithm>
+#include <emmintrin.h>
+#include <intrin.h>
 #include <intshcut.h>
 #include <msi.h>
 #include <tlhelp32.h>
@@ -47,7 +49,7 @@ const int kWindowClassBufferLength = 200;
 HANDLE e_heap;
 HINSTANCE e_instance;
 HWND e_invisible_window;
-HWND e_modal_dialog;
+HWND volatile e_modal_dialog;
 bool e_icon_visible = true;
 
 int e_column_widths[kColCount];
@@ -58,6 +60,11 @@ bool e_maximize_main_dialog = false;
 TCHAR e_ini_filepath[MAX_PATH];
 
 
+void setModalDialog(HWND hdlg) {
+	InterlockedExchangePointer(reinterpret_cast<PVOID volatile*>(&e_modal_dialog), hdlg);
+}
+
+
 int messageBox(HWND hwnd, UINT string_id, UINT type, LPCTSTR arg) {
 	TCHAR format[256], text[1024];
 	i18n::loadStringAuto(string_id, format);
@@ -149,30 +156,121 @@ void writeFile(HANDLE file, LPCTSTR strbuf) {
 }
 
 
-bool getWindowProcessName(HWND hwnd, LPTSTR process_name) {
+namespace {
+
+// Cache of getWindowProcessName() results, keyed by process ID.
+//
+// Each entry keeps a handle to its process open. Windows does not reuse the ID of a process while
+// handles to it remain open, so an entry always describes the process currently having its ID:
+// a process cannot change its image either. Hits thus need no system call. Entries of exited
+// processes are evicted on misses, then the least recently used entry if the cache is full.
+struct ProcessNameCacheEntry {
 	DWORD process_id;
-	GetWindowThreadProcessId(hwnd, &process_id);
+	HANDLE process_handle;  // NULL for unused entries.
+	DWORD last_use;  // Value of s_process_name_cache_clock at the last hit.
+	TCHAR process_name[MAX_PATH];
+};
+
+constexpr int kProcessNameCacheSize = 16;
+
+// Guards the variables below: the dispatch thread and the GUI thread both query the cache.
+SRWLOCK s_process_name_cache_lock;
+
+ProcessNameCacheEntry s_process_name_cache[kProcessNameCacheSize];
+DWORD s_process_name_cache_clock;
+ProcessNameCacheStats s_process_name_cache_stats;
+
+void evictProcessNameCacheEntry(ProcessNameCacheEntry& entry) {
+	CloseHandle(entry.process_handle);
+	entry.process_handle = NULL;
+	s_process_name_cache_stats.evictions++;
+}
+
+// Returns an unused entry of the process name cache, evicting entries if needed.
+ProcessNameCacheEntry& allocateProcessNameCacheEntry() {
+	ProcessNameCacheEntry* free_entry = nullptr;
+	ProcessNameCacheEntry* lru_entry = nullptr;
+	for (auto& entry : s_process_name_cache) {
+		DWORD exit_code;
+		if (entry.process_handle &&
+				(!GetExitCodeProcess(entry.process_handle, &exit_code) || exit_code != STILL_ACTIVE)) {
+			evictProcessNameCacheEntry(entry);
+		}
+		
+		if (!entry.process_handle) {
+			if (!free_entry) {
+				free_entry = &entry;
+			}
+		} else if (!lru_entry || LONG(entry.last_use - lru_entry->last_use) < 0) {
+			// The subtraction tolerates s_process_name_cache_clock overflows.
+			lru_entry = &entry;
+		}
+	}
+	
+	if (!free_entry) {
+		evictProcessNameCacheEntry(*lru_entry);
+		free_entry = lru_entry;
+	}
+	return *free_entry;
+}
+
+// getWindowProcessName() once the process ID is known. Requires s_process_name_cache_lock.
+bool getProcessName(DWORD process_id, LPTSTR process_name) {
+	s_process_name_cache_clock++;
+	for (auto& entry : s_process_name_cache) {
+		if (entry.process_handle && entry.process_id == process_id) {
+			entry.last_use = s_process_name_cache_clock;
+			s_process_name_cache_stats.hits++;
+			StringCchCopy(process_name, MAX_PATH, entry.process_name);
+			return true;
+		}
+	}
+	s_process_name_cache_stats.misses++;
 	
 	const HANDLE process_handle = OpenProcess(PROCESS_QUERY_INFORMATION, /* bInheritHandle= */ false, process_id);
 	VERIF(process_handle);
-	const bool ok = (GetProcessImageFileName(process_handle, process_name, MAX_PATH) > 0);
-	CloseHandle(process_handle);
-	
-	if (ok) {
-		PathStripPath(process_name);
-		CharLower(process_name);
+	if (GetProcessImageFileName(process_handle, process_name, MAX_PATH) <= 0) {
+		CloseHandle(process_handle);
+		return false;
 	}
 	
+	PathStripPath(process_name);
+	CharLower(process_name);
+	
+	ProcessNameCacheEntry& entry = allocateProcessNameCacheEntry();
+	entry.process_id = process_id;
+	entry.process_handle = process_handle;
+	entry.last_use = s_process_name_cache_clock;
+	StringCchCopy(entry.process_name, arrayLength(entry.process_name), process_name);
+	return true;
+}
+
+}  // namespace
+
+bool getWindowProcessName(HWND hwnd, LPTSTR process_name) {
+	DWORD process_id;
+	VERIF(GetWindowThreadProcessId(hwnd, &process_id));
+	
+	AcquireSRWLockExclusive(&s_process_name_cache_lock);
+	const bool ok = getProcessName(process_id, process_name);
+	ReleaseSRWLockExclusive(&s_process_name_cache_lock);
 	return ok;
 }
 
+const ProcessNameCacheStats& getProcessNameCacheStats() {
+	return s_process_name_cache_stats;
+}
 
-void sleepBackground(DWORD duration_millis) {
-	const HANDLE process = GetCurrentProcess();
-	const DWORD old_priority = GetPriorityClass(process);
-	SetPriorityClass(process, IDLE_PRIORITY_CLASS);
-	Sleep(duration_millis);
-	SetPriorityClass(process, old_priority);
+void clearProcessNameCache() {
+	AcquireSRWLockExclusive(&s_process_name_cache_lock);
+	for (auto& entry : s_process_name_cache) {
+		if (entry.process_handle) {
+			CloseHandle(entry.process_handle);
+			entry.process_handle = NULL;
+		}
+	}
+	s_process_name_cache_stats = {};
+	ReleaseSRWLockExclusive(&s_process_name_cache_lock);
 }
 
 
@@ -238,9 +336,12 @@ void clipboardToEnvironment() {
 		if (clipboard_mem) {
 			const LPTSTR clipboard_text = LPTSTR(GlobalLock(clipboard_mem));
 			if (clipboard_text) {
-				if (lstrlen(clipboard_text) < kClipboardStringBugSize) {
-					ok = true;
-					SetEnvironmentVariable(kClipboardEnvVariableName, clipboard_text);
+				// Copy the text straight from the clipboard memory, unless it must be truncated.
+				if (lstrlen(clipboard_text) <= kMaxEnvVariableLength) {
+					ok = toBool(SetEnvironmentVariable(kClipboardEnvVariableName, clipboard_text));
+				} else {
+					const String truncated_text(clipboard_text, kMaxEnvVariableLength);
+					ok = toBool(SetEnvironmentVariable(kClipboardEnvVariableName, truncated_text));
 				}
 				GlobalUnlock(clipboard_mem);
 			}
@@ -254,6 +355,12 @@ void clipboardToEnvironment() {
 }
 
 
+bool referencesClipboardVariable(LPCTSTR command) {
+	// "%kClipboardEnvVariableName%". ExpandEnvironmentStrings() ignores the case of the names.
+	return command && StrStrI(command, _T("%CLIPBOARD%"));
+}
+
+
 HWND findVisibleChildWindow(HWND hwnd_parent, LPCTSTR wnd_class, bool allow_same_prefix) {
 	HWND hwnd_child = NULL;
 	while (toBool(hwnd_child = FindWindowEx(
@@ -280,15 +387,16 @@ bool checkWindowClass(HWND hwnd, LPCTSTR wnd_class, bool allow_same_prefix) {
 namespace {
 
 struct FIND_WINDOW_BY_NAME {
-	LPCTSTR title_regexp;
+	const WildcardPattern* title_pattern;
 	HWND hwnd_found;
 };
 
 BOOL CALLBACK prcEnumFindWindowByName(HWND hwnd, LPARAM lParam) {
 	auto *fwbn = reinterpret_cast<FIND_WINDOW_BY_NAME*>(lParam);
 	TCHAR title[1024];
-	if (GetWindowText(hwnd, title, arrayLength(title))) {
-		if (matchWildcards(fwbn->title_regexp, title)) {
+	const int title_length = GetWindowText(hwnd, title, arrayLength(title));
+	if (title_length) {
+		if (fwbn->title_pattern->match(title, title_length)) {
 			fwbn->hwnd_found = hwnd;
 			return false;
 		}
@@ -296,11 +404,39 @@ BOOL CALLBACK prcEnumFindWindowByName(HWND hwnd, LPARAM lParam) {
 	return true;
 }
 
+// Returns the position of the first occurrence of c in subject[from..to[, -1 if none.
+// Compares 8 characters at a time.
+int findChar(LPCTSTR subject, int from, int to, TCHAR c) {
+	const __m128i needle = _mm_set1_epi16(short(c));
+	int i = from;
+	for (; i + 8 <= to; i += 8) {
+		const __m128i chunk = _mm_loadu_si128(reinterpret_cast<const __m128i*>(subject + i));
+		const int mask = _mm_movemask_epi8(_mm_cmpeq_epi16(chunk, needle));
+		if (mask) {
+			unsigned long first_byte;
+			_BitScanForward(&first_byte, DWORD(mask));
+			return i + int(first_byte / sizeof(TCHAR));
+		}
+	}
+	for (; i < to; i++) {
+		if (subject[i] == c) {
+			return i;
+		}
+	}
+	return -1;
+}
+
 }  // namespace
 
 HWND findWindowByName(LPCTSTR title_regexp) {
+	WildcardPattern title_pattern;
+	title_pattern.compile(title_regexp);
+	return findWindowByName(title_pattern);
+}
+
+HWND findWindowByName(const WildcardPattern& title_pattern) {
 	FIND_WINDOW_BY_NAME fwbn = {
-		.title_regexp = title_regexp,
+		.title_pattern = &title_pattern,
 		.hwnd_found = NULL,
 	};
 	EnumWindows(prcEnumFindWindowByName, reinterpret_cast<LPARAM>(&fwbn));
@@ -309,33 +445,128 @@ HWND findWindowByName(LPCTSTR title_regexp) {
 
 
 bool matchWildcards(LPCTSTR pattern, LPCTSTR subject, LPCTSTR pattern_end) {
+	if (!pattern_end) {
+		pattern_end = pattern + lstrlen(pattern);
+	}
+	
+	// On mismatch, backtrack to the last '*' only, making it match one more character.
+	// Earlier '*' never need to be revisited: the last one can absorb any extra character.
+	LPCTSTR star_pattern = nullptr;
+	LPCTSTR star_subject = nullptr;
 	for (;;) {
-		const TCHAR pattern_chr = (pattern == pattern_end) ? _T('\0') : *pattern++;
-		switch (pattern_chr) {
-			
-			case _T('\0'):
-				return !*subject;
-			
-			case _T('*'):
-				if (!*pattern || pattern == pattern_end) {
-					return true;  // Optimization
-				}
-				do {
-					if (matchWildcards(pattern, subject, pattern_end)) {
-						return true;
-					}
-				} while (*subject++);
-				return false;
-			
-			case _T('?'):
-				VERIF(*subject++);
-				break;
-			
-			default:
-				VERIF(*subject++ == pattern_chr);
-				break;
+		if (pattern != pattern_end && *pattern == _T('*')) {
+			star_pattern = ++pattern;
+			star_subject = subject;
+			continue;
+		}
+		
+		if (*subject) {
+			if (pattern != pattern_end && (*pattern == _T('?') || *pattern == *subject)) {
+				pattern++;
+				subject++;
+				continue;
+			}
+		} else if (pattern == pattern_end) {
+			return true;
+		}
+		
+		// Mismatch.
+		VERIF(star_pattern && *star_subject);
+		pattern = star_pattern;
+		subject = ++star_subject;
+	}
+}
+
+
+void WildcardPattern::compile(LPCTSTR pattern, LPCTSTR pattern_end) {
+	clear();
+	
+	const int pattern_length = pattern_end ? int(pattern_end - pattern) : lstrlen(pattern);
+	int star_count = 0;
+	for (int i = 0; i < pattern_length; i++) {
+		if (pattern[i] == _T('*')) {
+			star_count++;
+		}
+	}
+	
+	m_pattern = new TCHAR[pattern_length - star_count + 1];
+	m_segments = new Segment[star_count + 1];
+	
+	int length = 0;
+	Segment* segment = m_segments;
+	*segment = { .start = 0, .length = 0 };
+	for (int i = 0; i < pattern_length; i++) {
+		if (pattern[i] == _T('*')) {
+			segment++;
+			*segment = { .start = length, .length = 0 };
+		} else {
+			m_pattern[length++] = pattern[i];
+			segment->length++;
+		}
+	}
+	m_pattern[length] = _T('\0');
+	m_segment_count = star_count + 1;
+}
+
+void WildcardPattern::clear() {
+	delete [] m_pattern;
+	delete [] m_segments;
+	m_pattern = nullptr;
+	m_segments = nullptr;
+	m_segment_count = 0;
+}
+
+bool WildcardPattern::match(LPCTSTR subject, int subject_length) const {
+	VERIF(m_segment_count);
+	const Segment& first_segment = m_segments[0];
+	
+	if (m_segment_count == 1) {
+		// No '*'.
+		return subject_length == first_segment.length && matchSegment(first_segment, subject);
+	}
+	
+	// Match the segments anchored to the ends of the subject.
+	const Segment& last_segment = m_segments[m_segment_count - 1];
+	const int end = subject_length - last_segment.length;
+	VERIF(first_segment.length <= end);
+	VERIF(matchSegment(first_segment, subject));
+	VERIF(matchSegment(last_segment, subject + end));
+	
+	// Find the middle segments, each one as early as possible.
+	int position = first_segment.length;
+	for (int i = 1; i < m_segment_count - 1; i++) {
+		const Segment& segment = m_segments[i];
+		position = findSegment(segment, subject, position, end);
+		VERIF(position >= 0);
+		position += segment.length;
+	}
+	return true;
+}
+
+bool WildcardPattern::matchSegment(const Segment& segment, LPCTSTR subject) const {
+	const LPCTSTR segment_chars = m_pattern + segment.start;
+	for (int i = 0; i < segment.length; i++) {
+		VERIF(segment_chars[i] == _T('?') || segment_chars[i] == subject[i]);
+	}
+	return true;
+}
+
+int WildcardPattern::findSegment(const Segment& segment, LPCTSTR subject, int from, int to) const {
+	const int last_start = to - segment.length;
+	VERIFP(from <= last_start, -1);
+	VERIFP(segment.length, from);
+	
+	const TCHAR first_chr = m_pattern[segment.start];
+	for (int position = from; position <= last_start; position++) {
+		if (first_chr != _T('?')) {
+			position = findChar(subject, position, last_start + 1, first_chr);
+			VERIFP(position >= 0, -1);
+		}
+		if (matchSegment(segment, subject + position)) {
+			return position;
 		}
 	}
+	return -1;
 }
 
 
@@ -628,68 +859,366 @@ LPCTSTR getSemiColonToken(LPTSTR* token_start) {
 // Command line parsing and executing
 //------------------------------------------------------------------------
 
+namespace {
+
+// Cache of the successful findFullPath() searches, keyed by the unquoted path: the searches
+// query the file system and the registry at each launch otherwise.
+// Entries are replaced in round-robin order. A hit is used only if its file still exists:
+// the program may have been uninstalled or moved since the search.
+struct FullPathCacheEntry {
+	TCHAR path[MAX_PATH];  // Empty for unused entries.
+	TCHAR full_path[MAX_PATH];
+};
+
+constexpr int kFullPathCacheSize = 16;
+
+// Guards the variables below: the commands are launched by their own threads.
+SRWLOCK s_full_path_cache_lock;
+
+FullPathCacheEntry s_full_path_cache[kFullPathCacheSize];
+int s_full_path_cache_next;  // Index of the next entry to replace.
+
+// Removes the entry of a path from the cache of findFullPath(), if any.
+void removeFullPathCacheEntry(LPCTSTR path) {
+	AcquireSRWLockExclusive(&s_full_path_cache_lock);
+	for (auto& entry : s_full_path_cache) {
+		if (!lstrcmpi(entry.path, path)) {
+			*entry.path = _T('\0');
+		}
+	}
+	ReleaseSRWLockExclusive(&s_full_path_cache_lock);
+}
+
+// findFullPath() without the cache. Returns false if the file is not found.
+bool searchFullPath(LPCTSTR path, LPTSTR full_path) {
+	if (SearchPath(/* lpPath= */ nullptr, path, /* lpExtension= */ nullptr,
+			MAX_PATH, full_path, /* lpFilePath= */ nullptr)) {
+		return true;
+	}
+	
+	DWORD buf = MAX_PATH;
+	if (SUCCEEDED(AssocQueryString(ASSOCF_OPEN_BYEXENAME, ASSOCSTR_EXECUTABLE,
+			path, _T("open"), full_path, &buf))) {
+		return true;
+	}
+	
+	// Successful if greater than 32.
+	return 32 < reinterpret_cast<UINT_PTR>(FindExecutable(path, /* lpDirectory= */ nullptr, full_path));
+}
+
+// Returns the first environment variable reference of text at or after text[from]:
+// "%name%" with a non-empty name. Returns false if none.
+bool findEnvReference(LPCTSTR text, int from, int* start, int* end) {
+	for (LPCTSTR opening = StrChr(text + from, _T('%')); opening; opening = StrChr(opening + 1, _T('%'))) {
+		const LPCTSTR closing = StrChr(opening + 1, _T('%'));
+		if (!closing) {
+			return false;
+		}
+		if (closing > opening + 1) {
+			*start = int(opening - text);
+			*end = int(closing - text) + 1;
+			return true;
+		}
+	}
+	return false;
+}
+
+// Appends characters to a string of known length, then updates the length.
+void appendChars(String* output, int* output_length, LPCTSTR chars, int length) {
+	const LPTSTR buffer = output->getBuffer(*output_length + length + 1);
+	memcpy(buffer + *output_length, chars, length * sizeof(TCHAR));
+	*output_length += length;
+	buffer[*output_length] = _T('\0');
+}
+
+// Serializes the launches around %CLIPBOARD%: the launched programs inherit the environment
+// of the process. A launch referencing the variable holds the lock exclusively from setting
+// the variable until removing it, the other launches hold it shared: they never inherit it.
+SRWLOCK s_clipboard_variable_lock;
+
+// Returns whether an unquoted path is a .exe program that CreateProcess() can run.
+// Rejects the URLs and the shell monikers, such as the UWP apps "shell:AppsFolder\<app ID>":
+// any ':' other than the one of a drive.
+bool isPlainExecutable(LPCTSTR path) {
+	const int drive_length = PathGetDriveNumber(path) < 0 ? 0 : 2;
+	return !StrChr(path + drive_length, _T(':')) && !lstrcmpi(PathFindExtension(path), _T(".exe"));
+}
+
+// Launches the program of a launch with CreateProcess().
+// Returns false if the program cannot be launched.
+bool createProcess(const CommandLine::Launch& launch, int show_mode) {
+	// CreateProcess() requires a writable command line, beginning with the program.
+	String command_line = _T("\"");
+	command_line += launch.program;
+	command_line += _T("\" ");
+	command_line += launch.parameters;
+	STARTUPINFO si = {
+		.cb = sizeof(si),
+		.dwFlags = STARTF_USESHOWWINDOW,
+		.wShowWindow = WORD(show_mode),
+	};
+	PROCESS_INFORMATION pi;
+	const LONGLONG launch_start = metrics::getTimestamp();
+	VERIF(CreateProcess(launch.program, command_line.getBuffer(command_line.getLength() + 1),
+		/* lpProcessAttributes= */ nullptr, /* lpThreadAttributes= */ nullptr,
+		/* bInheritHandles= */ FALSE, /* dwCreationFlags= */ 0, /* lpEnvironment= */ nullptr,
+		*launch.directory ? launch.directory : nullptr, &si, &pi));
+	metrics::recordStage(metrics::Stage::kProcessLaunch, launch_start);
+	CloseHandle(pi.hThread);
+	CloseHandle(pi.hProcess);
+	return true;
+}
+
+// Launches the file of a launch with ShellExecuteEx().
+void shellExecute(const CommandLine::Launch& launch, int show_mode) {
+	SHELLEXECUTEINFO sei = {
+		.cbSize = sizeof(sei),
+		.fMask = SEE_MASK_FLAG_DDEWAIT,
+		.hwnd = e_invisible_window,
+		.lpVerb = nullptr,
+		.lpFile = launch.file,
+		.lpParameters = launch.parameters,
+		.lpDirectory = launch.directory,
+		.nShow = show_mode,
+	};
+	const LONGLONG launch_start = metrics::getTimestamp();
+	ShellExecuteEx(&sei);
+	metrics::recordStage(metrics::Stage::kShellLaunch, launch_start);
+}
+
+}  // namespace
+
 void findFullPath(LPTSTR path, LPTSTR full_path) {
 	if (!isPathSlow(path)) {
 		PathUnquoteSpaces(path);
-		if (SearchPath(/* lpPath= */ nullptr, path, /* lpExtension= */ nullptr,
-				MAX_PATH, full_path, /* lpFilePath= */ nullptr)) {
-			return;
-		}
 		
-		DWORD buf = MAX_PATH;
-		if (SUCCEEDED(AssocQueryString(ASSOCF_OPEN_BYEXENAME, ASSOCSTR_EXECUTABLE,
-				path, _T("open"), full_path, &buf))) {
-			return;
+		bool cached = false;
+		AcquireSRWLockShared(&s_full_path_cache_lock);
+		for (const auto& entry : s_full_path_cache) {
+			if (*path && !lstrcmpi(entry.path, path)) {
+				StringCchCopy(full_path, MAX_PATH, entry.full_path);
+				cached = true;
+				break;
+			}
+		}
+		ReleaseSRWLockShared(&s_full_path_cache_lock);
+		if (cached) {
+			// One attribute query instead of the whole search.
+			if (GetFileAttributes(full_path) != INVALID_FILE_ATTRIBUTES) {
+				return;
+			}
+			removeFullPathCacheEntry(path);
 		}
 		
-		if (32 < reinterpret_cast<UINT_PTR>(FindExecutable(path, /* lpDirectory= */ nullptr, full_path))) {
-			return;  // Successful.
+		if (searchFullPath(path, full_path)) {
+			AcquireSRWLockExclusive(&s_full_path_cache_lock);
+			FullPathCacheEntry& entry = s_full_path_cache[s_full_path_cache_next];
+			s_full_path_cache_next = (s_full_path_cache_next + 1) % kFullPathCacheSize;
+			StringCchCopy(entry.path, arrayLength(entry.path), path);
+			StringCchCopy(entry.full_path, arrayLength(entry.full_path), full_path);
+			ReleaseSRWLockExclusive(&s_full_path_cache_lock);
+			return;
 		}
 	}
 	
 	StringCchCopy(full_path, MAX_PATH, path);
 }
 
+void clearFullPathCache() {
+	AcquireSRWLockExclusive(&s_full_path_cache_lock);
+	for (auto& entry : s_full_path_cache) {
+		*entry.path = _T('\0');
+	}
+	s_full_path_cache_next = 0;
+	ReleaseSRWLockExclusive(&s_full_path_cache_lock);
+}
 
-void shellExecuteCmdLine(LPCTSTR command, LPCTSTR directory, int show_mode) {
-	// Expand the environment variables before splitting
-	TCHAR command_exp[MAX_PATH + kClipboardStringBugSize];
-	ExpandEnvironmentStrings(command, command_exp, arrayLength(command_exp));
+
+EnvTemplate::EnvTemplate(const EnvTemplate& other)
+		: m_text(other.m_text), m_references(nullptr), m_reference_count(other.m_reference_count) {
+	if (m_reference_count) {
+		m_references = new Reference[m_reference_count];
+		memcpy(m_references, other.m_references, m_reference_count * sizeof(Reference));
+	}
+}
+
+void EnvTemplate::compile(LPCTSTR text) {
+	m_text = text;
+	delete[] m_references;
+	m_references = nullptr;
+	m_reference_count = 0;
+	
+	// Count the references, then record them.
+	int start, end;
+	for (int from = 0; findEnvReference(m_text, from, &start, &end); from = end) {
+		m_reference_count++;
+	}
+	if (m_reference_count) {
+		m_references = new Reference[m_reference_count];
+		Reference* reference = m_references;
+		for (int from = 0; findEnvReference(m_text, from, &start, &end); from = end) {
+			reference->start = start;
+			reference->end = end;
+			reference++;
+		}
+	}
+}
+
+bool EnvTemplate::references(LPCTSTR name) const {
+	const int name_length = lstrlen(name);
+	for (int i = 0; i < m_reference_count; i++) {
+		const Reference& reference = m_references[i];
+		if (reference.end - reference.start - 2 == name_length &&
+				!StrCmpNI(LPCTSTR(m_text) + reference.start + 1, name, name_length)) {
+			return true;
+		}
+	}
+	return false;
+}
+
+void EnvTemplate::expand(String* output) const {
+	if (!m_reference_count) {
+		*output = m_text;
+		return;
+	}
+	
+	// Reuse the buffer of output: the appends terminate the text.
+	const LPCTSTR text = m_text;
+	int output_length = 0;
+	int literal_start = 0;
+	for (int i = 0; i < m_reference_count; i++) {
+		const Reference& reference = m_references[i];
+		appendChars(output, &output_length, text + literal_start, reference.start - literal_start);
+		literal_start = reference.end;
+		
+		// Substitute the value in place. Keep the reference if the variable is not defined,
+		// or if it grows between the two calls.
+		const String name(text + reference.start + 1, reference.end - reference.start - 2);
+		const DWORD value_size = GetEnvironmentVariable(name, nullptr, 0);
+		if (value_size) {
+			const LPTSTR buffer = output->getBuffer(output_length + int(value_size));
+			const DWORD value_length = GetEnvironmentVariable(name, buffer + output_length, value_size);
+			if (value_length < value_size) {
+				output_length += int(value_length);
+				continue;
+			}
+		}
+		appendChars(output, &output_length, text + reference.start, reference.end - reference.start);
+	}
+	appendChars(output, &output_length, text + literal_start, lstrlen(text + literal_start));
+}
+
+
+void CommandLine::compile(LPCTSTR command, LPCTSTR directory) {
+	m_command.compile(command);
+	m_directory.compile(directory);
+	m_references_clipboard =
+		referencesClipboardVariable(command) || referencesClipboardVariable(directory);
+	
+	// Split the command line now if the file has no variable reference: the variables of
+	// the arguments cannot move the end of the file. The variables of the file can: their
+	// values can contain spaces.
+	TCHAR file[MAX_PATH];
+	StringCchCopy(file, arrayLength(file), m_command.getText());
+	PathRemoveArgs(file);
+	m_split_at_launch = toBool(StrChr(file, _T('%')));
+	if (m_split_at_launch) {
+		m_file.empty();
+		m_arguments.compile(_T(""));
+	} else {
+		m_file = file;
+		m_arguments.compile(PathGetArgs(m_command.getText()));
+	}
+	
+	// Use CreateProcess() only if it runs the same program as ShellExecuteEx():
+	// the latter searches the relative files in the directory first, findFullPath() does not.
+	PathUnquoteSpaces(file);
+	m_backend = !m_split_at_launch && isPlainExecutable(file) &&
+			(strIsEmpty(directory) || !PathIsRelative(file))
+		? LaunchBackend::kCreateProcess
+		: LaunchBackend::kShellExecute;
+}
+
+void CommandLine::prepare(Launch* launch) const {
+	// Get the file and the arguments.
+	if (m_split_at_launch) {
+		String command;
+		m_command.expand(&command);
+		StringCchCopy(launch->file, arrayLength(launch->file), command);
+		PathRemoveArgs(launch->file);
+		launch->parameters = PathGetArgs(command);
+	} else {
+		StringCchCopy(launch->file, arrayLength(launch->file), m_file);
+		m_arguments.expand(&launch->parameters);
+	}
 	
-	// Split the command line: get the file and the arguments
-	TCHAR path[MAX_PATH];
-	StringCchCopy(path, arrayLength(path), command_exp);
-	PathRemoveArgs(path);
+	// Search the full path of the file if needed
+	const bool directory_from_file = strIsEmpty(m_directory.getText());
+	TCHAR full_path[MAX_PATH];
+	if (directory_from_file || m_backend == LaunchBackend::kCreateProcess) {
+		findFullPath(launch->file, full_path);
+		PathQuoteSpaces(launch->file);
+	}
+	
+	// Fall back to ShellExecuteEx() if the program is not found
+	if (m_backend == LaunchBackend::kCreateProcess && !PathIsRelative(full_path)) {
+		StringCchCopy(launch->program, arrayLength(launch->program), full_path);
+	} else {
+		*launch->program = _T('\0');
+	}
 	
 	// If the directory is empty, get it from the file
-	TCHAR real_directory[MAX_PATH];
-	if (!directory || !*directory) {
-		findFullPath(path, real_directory);
-		PathRemoveFileSpec(real_directory);
-		PathQuoteSpaces(path);
+	if (directory_from_file) {
+		StringCchCopy(launch->directory, arrayLength(launch->directory), full_path);
+		PathRemoveFileSpec(launch->directory);
+	} else {
+		String directory;
+		m_directory.expand(&directory);
+		StringCchCopy(launch->directory, arrayLength(launch->directory), directory);
+	}
+}
+
+void CommandLine::execute(int show_mode) const {
+	if (m_references_clipboard) {
+		AcquireSRWLockExclusive(&s_clipboard_variable_lock);
+		clipboardToEnvironment();
 	} else {
-		ExpandEnvironmentStrings(directory, real_directory, arrayLength(real_directory));
+		AcquireSRWLockShared(&s_clipboard_variable_lock);
 	}
 	
+	Launch launch;
+	prepare(&launch);
+	
 	// Run the command line
-	SHELLEXECUTEINFO sei = {
-		.cbSize = sizeof(sei),
-		.fMask = SEE_MASK_FLAG_DDEWAIT,
-		.hwnd = e_invisible_window,
-		.lpVerb = nullptr,
-		.lpFile = path,
-		.lpParameters = PathGetArgs(command_exp),
-		.lpDirectory = real_directory,
-		.nShow = show_mode,
-	};
-	ShellExecuteEx(&sei);
+	if (!*launch.program || !createProcess(launch, show_mode)) {
+		shellExecute(launch, show_mode);
+	}
+	
+	if (m_references_clipboard) {
+		SetEnvironmentVariable(kClipboardEnvVariableName, /* lpValue= */ nullptr);
+		ReleaseSRWLockExclusive(&s_clipboard_variable_lock);
+	} else {
+		ReleaseSRWLockShared(&s_clipboard_variable_lock);
+	}
+}
+
+
+void shellExecuteCmdLine(LPCTSTR command, LPCTSTR directory, int show_mode) {
+	CommandLine command_line;
+	command_line.compile(command, directory);
+	ShellExecuteThread *const shell_execute_thread = new ShellExecuteThread(command_line, show_mode);
+	startThread(shell_execute_thread->thread, shell_execute_thread);
 }
 
 
 DWORD WINAPI ShellExecuteThread::thread(void* params) {
 	auto *params_ptr = reinterpret_cast<ShellExecuteThread*>(params);
-	shellExecuteCmdLine(params_ptr->m_command, params_ptr->m_directory, params_ptr->m_show_mode);
+	const HRESULT com_result = CoInitializeEx(/* pvReserved= */ nullptr, COINIT_APARTMENTTHREADED);
+	params_ptr->m_command_line.execute(params_ptr->m_show_mode);
 	delete params_ptr;
+	if (SUCCEEDED(com_result)) {
+		CoUninitialize();
+	}
 	return 0;
 }
 
@@ -38,11 +38,12 @@ inline constexpr size_t kHotKeyBufSize = 128;
 inline constexpr size_t kCodeBufSize = 32;
 inline constexpr size_t kWindowTitleBufSize = 256;
 
-inline constexpr int kClipboardStringBugSize = MAX_PATH * 10;
-
 // Name of the environment variable set by clipboardToEnvironment().
 inline constexpr LPCTSTR kClipboardEnvVariableName = _T("CLIPBOARD");
 
+// Maximum length of the value of an environment variable, in characters, excluding the null one.
+inline constexpr int kMaxEnvVariableLength = 32767 - 1;
+
 
 inline constexpr LPCTSTR kAppName = _T("Clavier+");
 
@@ -50,7 +51,9 @@ inline constexpr LPCTSTR kAppName = _T("Clavier+");
 extern HANDLE e_heap;
 extern HINSTANCE e_instance;
 extern HWND e_invisible_window;  // Invisible background window
-extern HWND e_modal_dialog;
+// Modal dialog box of the GUI thread, NULL if none. Read by the dispatch thread too.
+// Only the GUI thread writes it, via setModalDialog().
+extern HWND volatile e_modal_dialog;
 extern bool e_icon_visible;
 
 
@@ -59,6 +62,9 @@ inline void subclassWindow(HWND hwnd, SUBCLASSPROC subclass_proc, DWORD_PTR ref_
 }
 
 
+// Sets e_modal_dialog atomically.
+void setModalDialog(HWND hdlg);
+
 // Display a message box. The message is read from string resources.
 int messageBox(HWND hwnd, UINT string_id, UINT type = MB_ICONERROR, LPCTSTR arg = nullptr);
 
@@ -85,16 +91,27 @@ void writeFile(HANDLE file, LPCTSTR strbuf);
 
 // Retrieves the basename of the process that created a window.
 // Returns true on success (process_name contains a valid name), false on failure.
+// Caches the names of the most recently queried processes, see clearProcessNameCache().
+// Thread-safe.
 //
 // hwnd: The window to get the process name of.
 // process_name: The buffer where to put the basename of the process that created the window,
 //   in lowercase. Should have a size of MAX_PATH.
 bool getWindowProcessName(HWND hwnd, LPTSTR process_name);
 
-// Sleeps in idle priority.
-//
-// duration_millis: the time to sleep, in milliseconds.
-void sleepBackground(DWORD duration_millis);
+// Counters of the getWindowProcessName() cache.
+struct ProcessNameCacheStats {
+	DWORD hits;
+	DWORD misses;  // Including failed lookups.
+	DWORD evictions;  // Entries dropped because their process exited or to make room.
+};
+
+// Returns the counters of the getWindowProcessName() cache since the last clearProcessNameCache().
+const ProcessNameCacheStats& getProcessNameCacheStats();
+
+// Empties the getWindowProcessName() cache and resets its counters.
+// Releases the process handles the cache keeps open.
+void clearProcessNameCache();
 
 // Wrapper for SHGetFileInfo() that does not call the function if the file belongs
 // to a slow device. If the call to SHGetFileInfo() fails and SHGFI_USEFILEATTRIBUTES was not
@@ -109,9 +126,15 @@ void sleepBackground(DWORD duration_millis);
 //   to SHGetFileInfo().
 bool getFileInfo(LPCTSTR path, DWORD file_attributes, SHFILEINFO& shfi, UINT flags);
 
-// Puts the text contents of the clipboard to the environment variable named clipboard_env_variable.
+// Puts the text contents of the clipboard to the environment variable named clipboard_env_variable,
+// truncated to kMaxEnvVariableLength characters.
+// Sets the variable for the whole process: CommandLine::execute() removes it after the launch.
 void clipboardToEnvironment();
 
+// Returns whether a command line expands the environment variable set by clipboardToEnvironment().
+// The commands not referencing it do not need clipboardToEnvironment(): it opens the clipboard.
+bool referencesClipboardVariable(LPCTSTR command);
+
 // Returns a visible child of a window matching the given window class name, NULL if none is found.
 // Picks an arbitrary window if multiple match.
 //
@@ -129,6 +152,62 @@ HWND findVisibleChildWindow(HWND hwnd_parent, LPCTSTR wnd_class, bool allow_same
 //   If true, it should only have wnd_class only as prefix; full equality is not enforced.
 bool checkWindowClass(HWND hwnd, LPCTSTR wnd_class, bool allow_same_prefix);
 
+// Wildcards pattern compiled for repeated matching. Same semantics as matchWildcards().
+//
+// The pattern is split into its '*'-separated segments. The first and last segments are anchored
+// to the ends of the subject; the other segments are searched for leftmost, in order, skipping
+// over the subject with SIMD compares for their first character. Matching a subject takes
+// O(pattern length * subject length) time in the worst case and does not allocate.
+class WildcardPattern {
+public:
+	
+	WildcardPattern() : m_pattern(nullptr), m_segments(nullptr), m_segment_count(0) {}
+	
+	WildcardPattern(const WildcardPattern& other) = delete;
+	WildcardPattern& operator =(const WildcardPattern& other) = delete;
+	
+	~WildcardPattern() {
+		clear();
+	}
+	
+	// Compiles a pattern. Replaces the previous pattern, if any.
+	//
+	// pattern, pattern_end: see matchWildcards().
+	void compile(LPCTSTR pattern, LPCTSTR pattern_end = nullptr);
+	
+	// Determines if a string matches the pattern.
+	//
+	// subject: the string to test against the pattern.
+	// subject_length: the number of characters of subject, as returned by lstrlen().
+	bool match(LPCTSTR subject, int subject_length) const;
+	
+	bool match(LPCTSTR subject) const {
+		return match(subject, lstrlen(subject));
+	}
+	
+private:
+	
+	struct Segment {
+		int start;  // In m_pattern.
+		int length;
+	};
+	
+	void clear();
+	
+	// Determines if a segment matches the start of a string of at least segment.length characters.
+	bool matchSegment(const Segment& segment, LPCTSTR subject) const;
+	
+	// Returns the leftmost position where a segment matches subject[from..to[, -1 if none.
+	int findSegment(const Segment& segment, LPCTSTR subject, int from, int to) const;
+	
+	// The pattern, without the '*' characters.
+	LPTSTR m_pattern;
+	
+	// The '*'-separated segments of the pattern. Contains one more segment than there are '*'.
+	Segment* m_segments;
+	int m_segment_count;
+};
+
 // Returns a top-level window whose title matches a regexp, NULL if none is found.
 // Picks an arbitrary window if multiple match.
 //
@@ -136,11 +215,15 @@ bool checkWindowClass(HWND hwnd, LPCTSTR wnd_class, bool allow_same_prefix);
 //   The regular expression is evaluated by matchWildcards().
 HWND findWindowByName(LPCTSTR title_regexp);
 
-// Determines if a string matches a wildcards pattern. Case insensitive.
+// Same as findWindowByName(LPCTSTR), with an already compiled regexp.
+HWND findWindowByName(const WildcardPattern& title_pattern);
+
+// Determines if a string matches a wildcards pattern. Case sensitive.
+// Runs in O(pattern length * subject length) time in the worst case.
+// Prefer WildcardPattern to match the same pattern many times.
 //
 // pattern: the pattern to use for testing matching. Supports '*' and '?'.
-//   This string must be given in lower case.
-// subject: the string to test against the pattern. The case does not matter.
+// subject: the string to test against the pattern.
 // pattern_end: if not null, points to the successor of the last character of the pattern; if
 //   equals pattern, the pattern will be considered empty.
 bool matchWildcards(LPCTSTR pattern, LPCTSTR subject, LPCTSTR pattern_end = nullptr);
@@ -222,6 +305,7 @@ enum class Token {
 	kConditionNo,
 	
 	kUsageCount,
+	kPacing,
 	
 	kNotFound
 };
@@ -331,16 +415,145 @@ private:
 // Command line parsing and executing
 //------------------------------------------------------------------------
 
+// Searches the full path of an executable or a document, path itself if not found.
+// Unquotes path. The successful searches are cached, see clearFullPathCache(); the cached
+// full paths no longer existing are searched again.
 void findFullPath(LPTSTR path, LPTSTR full_path);
 
+// Forgets the findFullPath() searches, for instance after the installed programs change.
+void clearFullPathCache();
+
+
+// Text referencing environment variables, parsed once: expand() only substitutes the values,
+// instead of parsing the text at each ExpandEnvironmentStrings() call.
+// The references are "%name%" with a non-empty name, "%%" is not a reference.
+class EnvTemplate {
+public:
+	
+	EnvTemplate() : m_references(nullptr), m_reference_count(0) {}
+	EnvTemplate(const EnvTemplate& other);
+	EnvTemplate& operator =(const EnvTemplate& other) = delete;
+	
+	~EnvTemplate() {
+		delete[] m_references;
+	}
+	
+	// Replaces the template with the parsing of text.
+	void compile(LPCTSTR text);
+	
+	const String& getText() const {
+		return m_text;
+	}
+	
+	bool hasReferences() const {
+		return toBool(m_reference_count);
+	}
+	
+	// Returns whether the template references a variable, case insensitive.
+	bool references(LPCTSTR name) const;
+	
+	// Replaces output with the text, the references substituted with the current values
+	// of the variables. Keeps the references to undefined variables.
+	void expand(String* output) const;
+	
+private:
+	
+	// Reference to a variable: m_text[start] is the opening '%', m_text[end - 1] the closing '%'.
+	struct Reference {
+		int start;
+		int end;
+	};
+	
+	String m_text;
+	Reference* m_references;  // Null if none.
+	int m_reference_count;
+};
+
+
+// Function launching a CommandLine.
+enum class LaunchBackend : BYTE {
+	// ShellExecuteEx(): any command, including documents, URLs and UWP apps.
+	kShellExecute,
+	
+	// CreateProcess(): .exe programs, without the file associations lookup and the DDE wait
+	// of ShellExecuteEx(). Falls back to ShellExecuteEx() if the program is not found
+	// or cannot be created, for instance because it requires elevation.
+	kCreateProcess,
+};
+
+// Command line of a shortcut, parsed once: split into the file to execute and its arguments,
+// with their environment variable references. Launching only substitutes the variables.
+class CommandLine {
+public:
+	
+	// Arguments of ShellExecuteEx(), and of CreateProcess() if program is not empty.
+	struct Launch {
+		TCHAR file[MAX_PATH];
+		String parameters;
+		TCHAR directory[MAX_PATH];
+		TCHAR program[MAX_PATH];  // Full path of the program, unquoted. Empty to use ShellExecuteEx().
+	};
+	
+	CommandLine()
+		: m_split_at_launch(false), m_references_clipboard(false),
+			m_backend(LaunchBackend::kShellExecute) {}
+	CommandLine(const CommandLine& other) = default;
+	CommandLine& operator =(const CommandLine& other) = delete;
+	
+	// Replaces the command line with the parsing of command and directory.
+	// directory: the working directory, empty to use the directory of the file.
+	void compile(LPCTSTR command, LPCTSTR directory);
+	
+	// Returns whether the command or the directory references %CLIPBOARD%,
+	// see referencesClipboardVariable().
+	bool referencesClipboard() const {
+		return m_references_clipboard;
+	}
+	
+	// Returns the backend chosen by compile(): kCreateProcess if the file is a .exe program
+	// without variable, and either absolute or executed in the directory of its full path.
+	LaunchBackend getBackend() const {
+		return m_backend;
+	}
+	
+	// Computes the arguments of a launch: substitutes the variables, splits the command
+	// if it could not be split by compile(), searches the full path of the file if needed
+	// by the directory or by the backend.
+	void prepare(Launch* launch) const;
+	
+	// Launches the command with its backend. Records the latency of the launch call
+	// as metrics::Stage::kProcessLaunch or kShellLaunch.
+	// If the command references %CLIPBOARD%, sets the variable during the launch only,
+	// see clipboardToEnvironment(): the programs launched meanwhile do not inherit it.
+	void execute(int show_mode) const;
+	
+private:
+	
+	// Whether the file references variables: the command is split after substituting them.
+	bool m_split_at_launch;
+	
+	bool m_references_clipboard;
+	
+	LaunchBackend m_backend;
+	
+	EnvTemplate m_command;
+	String m_file;  // Empty if m_split_at_launch.
+	EnvTemplate m_arguments;  // Empty if m_split_at_launch.
+	EnvTemplate m_directory;
+};
+
+// Compiles a command line and executes it in a new thread, see ShellExecuteThread.
+// For the command lines executed once.
 void shellExecuteCmdLine(LPCTSTR command, LPCTSTR directory, int show_mode);
 
 
+// Executes a command line in a new thread, with COM initialized: ShellExecuteEx() may wait
+// for DDE conversations or COM-activated handlers, which must not block the caller.
 class ShellExecuteThread {
 public:
 	
-	ShellExecuteThread(const String& command, const String& directory, int show_mode)
-		: m_command(command), m_directory(directory), m_show_mode(show_mode) {}
+	ShellExecuteThread(const CommandLine& command_line, int show_mode)
+		: m_command_line(command_line), m_show_mode(show_mode) {}
 	
 	ShellExecuteThread(const ShellExecuteThread& other) = delete;
 	ShellExecuteThread& operator =(const ShellExecuteThread& other) = delete;
@@ -349,8 +562,7 @@ public:
 	
 private:
 	
-	String m_command;
-	String m_directory;
+	CommandLine m_command_line;
 	int m_show_mode;
 };
 
@@ -22,7 +22,8 @@
 #include "MyString.h"
 
 extern HINSTANCE e_instance;
-extern HWND e_modal_dialog;
+extern HWND volatile e_modal_dialog;
+void setModalDialog(HWND hdlg);
 
 namespace i18n {
 namespace {
@@ -136,7 +137,7 @@ INT_PTR dialogBox(UINT id, HWND hwnd_parent, DLGPROC window_proc, LPARAM init_pa
 		reinterpret_cast<const DLGTEMPLATE*>(loadResource(id, RT_DIALOG)),
 		hwnd_parent, window_proc, init_param);
 	
-	e_modal_dialog = hdlgModalOld;
+	setModalDialog(hdlgModalOld);
 	return result;
 }
 
@@ -0,0 +1,207 @@
+// Clavier+
+// Keyboard shortcuts manager
+//
+// Copyright (C) 2000-2008 Guillaume Ryder
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+
+#include "StdAfx.h"
+#include "Input.h"
+#include "Metrics.h"
+
+#include <algorithm>
+
+namespace input {
+
+namespace {
+
+// Number of characters per page of LayoutCache::char_pages.
+constexpr int kCharPageSize = 256;
+
+constexpr int kCharPageCount = (1 << (sizeof(TCHAR) * 8)) / kCharPageSize;
+
+// Flag of the LayoutCache entries: distinguishes the cached results from the missing entries.
+constexpr LONG kCachedFlag = 0x10000;
+
+}  // namespace
+
+// Cache of a KeyboardLayout. Never deleted: the number of layouts is small.
+// The entries are kCachedFlag | result, 0 if not cached yet. Concurrent fills are harmless:
+// they store the same value.
+struct LayoutCache {
+	HKL volatile hkl;  // Null if the cache is not used yet.
+	
+	// VkKeyScanEx() results by character, in pages of kCharPageSize characters allocated lazily.
+	LONG* volatile char_pages[kCharPageCount];
+	
+	// MapVirtualKeyEx(MAPVK_VK_TO_VSC) results by virtual key.
+	LONG volatile scan_codes[256];
+};
+
+namespace {
+
+LayoutCache layout_caches[KeyboardLayout::kMaxCachedLayouts];
+
+}  // namespace
+
+
+KeyboardLayout KeyboardLayout::getCurrent() {
+	const HKL hkl = GetKeyboardLayout(/* idThread= */ 0);
+	for (LayoutCache& cache : layout_caches) {
+		HKL cache_hkl = cache.hkl;
+		if (!cache_hkl) {
+			// Claim the unused cache, unless another thread just did.
+			cache_hkl = HKL(InterlockedCompareExchangePointer(
+				reinterpret_cast<PVOID volatile*>(&cache.hkl), hkl, nullptr));
+			if (!cache_hkl) {
+				return KeyboardLayout(hkl, &cache);
+			}
+		}
+		if (cache_hkl == hkl) {
+			return KeyboardLayout(hkl, &cache);
+		}
+	}
+	return KeyboardLayout(hkl, /* cache= */ nullptr);
+}
+
+SHORT KeyboardLayout::vkKeyScan(TCHAR c) const {
+	if (!m_cache) {
+		return VkKeyScanEx(c, m_hkl);
+	}
+	
+	const UINT index = UINT(TBYTE(c));
+	LONG* page = m_cache->char_pages[index / kCharPageSize];
+	if (!page) {
+		// Allocate the page, unless another thread just did.
+		LONG* const new_page = new LONG[kCharPageSize]();
+		page = static_cast<LONG*>(InterlockedCompareExchangePointer(
+			reinterpret_cast<PVOID volatile*>(&m_cache->char_pages[index / kCharPageSize]),
+			new_page, nullptr));
+		if (page) {
+			delete[] new_page;
+		} else {
+			page = new_page;
+		}
+	}
+	
+	LONG volatile& entry = page[index % kCharPageSize];
+	if (!entry) {
+		entry = kCachedFlag | WORD(VkKeyScanEx(c, m_hkl));
+	}
+	return SHORT(WORD(entry));
+}
+
+UINT KeyboardLayout::vkToScanCode(UINT vk) const {
+	if (!m_cache || vk >= UINT(arrayLength(m_cache->scan_codes))) {
+		return MapVirtualKeyEx(vk, MAPVK_VK_TO_VSC, m_hkl);
+	}
+	
+	LONG volatile& entry = m_cache->scan_codes[vk];
+	if (!entry) {
+		entry = kCachedFlag | WORD(MapVirtualKeyEx(vk, MAPVK_VK_TO_VSC, m_hkl));
+	}
+	return WORD(entry);
+}
+
+
+void InputBatch::setMaxSize(int max_size) {
+	assert(isEmpty());
+	m_max_size = max_size ? std::clamp(max_size, kMinSize, kMaxSize) : 0;
+}
+
+bool InputBatch::addKey(UINT vk, bool down) {
+	VERIF(m_size < m_max_size);
+	
+	INPUT& event = m_events[m_size++];
+	ZeroMemory(&event, sizeof(event));
+	event.type = INPUT_KEYBOARD;
+	event.ki.wVk = WORD(vk);
+	event.ki.wScan = WORD(m_layout.vkToScanCode(vk));
+	event.ki.dwFlags = down ? 0 : KEYEVENTF_KEYUP;
+	if (Keystroke::isKeyExtended(vk)) {
+		event.ki.dwFlags |= KEYEVENTF_EXTENDEDKEY;
+	}
+	return true;
+}
+
+bool InputBatch::addKeystroke(const Keystroke& keystroke, DWORD already_down_mod_code) {
+	const DWORD to_press_mod_code = keystroke.getUnsidedModCode() & ~already_down_mod_code;
+	int event_count = 2;
+	for (const auto& special_key : kSpecialKeys) {
+		if (to_press_mod_code & special_key.mod_code) {
+			event_count += 2;
+		}
+	}
+	VERIF(m_size + event_count <= m_max_size);
+	
+	m_hotkey_suspension->suspend(keystroke);
+	
+	// Press the special keys that are not already kept down.
+	for (const auto& special_key : kSpecialKeys) {
+		if (to_press_mod_code & special_key.mod_code) {
+			addKey(special_key.vk, /* down= */ true);
+		}
+	}
+	
+	// Press and release the main key.
+	addKey(keystroke.m_vk, /* down= */ true);
+	addKey(keystroke.m_vk, /* down= */ false);
+	
+	// Release the special keys that should not be kept down.
+	for (const auto& special_key : kSpecialKeys) {
+		if (to_press_mod_code & special_key.mod_code) {
+			addKey(special_key.vk, /* down= */ false);
+		}
+	}
+	return true;
+}
+
+bool InputBatch::addUnicode(TCHAR c) {
+	VERIF(m_size + 2 <= m_max_size);
+	fillUnicodeEvents(c, &m_events[m_size]);
+	m_size += 2;
+	return true;
+}
+
+void InputBatch::send() {
+	if (m_size) {
+		metrics::markOutput();
+		m_send_function(UINT(m_size), m_events, sizeof(INPUT));
+		m_sent_event_count += m_size;
+		m_sent_batch_count++;
+		m_size = 0;
+		m_layout = KeyboardLayout::getCurrent();
+	}
+}
+
+
+void fillUnicodeEvents(TCHAR c, INPUT events[2]) {
+	for (int i = 0; i < 2; i++) {
+		INPUT& event = events[i];
+		ZeroMemory(&event, sizeof(event));
+		event.type = INPUT_KEYBOARD;
+		event.ki.wScan = WORD(c);
+		event.ki.dwFlags = KEYEVENTF_UNICODE | (i ? KEYEVENTF_KEYUP : 0);
+	}
+}
+
+bool sendUnicode(TCHAR c, InputBatch::SendFunction send_function) {
+	INPUT events[2];
+	fillUnicodeEvents(c, events);
+	metrics::markOutput();
+	return send_function(arrayLength(events), events, sizeof(INPUT)) == arrayLength(events);
+}
+
+}  // namespace input
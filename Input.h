@@ -0,0 +1,157 @@
+// Clavier+
+// Keyboard shortcuts manager
+//
+// Copyright (C) 2000-2008 Guillaume Ryder
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+
+#pragma once
+
+#include "Keystroke.h"
+
+namespace input {
+
+struct LayoutCache;
+
+// Translations of characters and virtual keys in a keyboard layout: the results of
+// VkKeyScanEx() and MapVirtualKeyEx(), cached per layout and filled lazily. Thread-safe.
+// Switching the keyboard layout switches to the cache of the new layout: no invalidation needed.
+class KeyboardLayout {
+public:
+	
+	// Maximum number of layouts having a cache. The translations of the other layouts are not cached.
+	static constexpr int kMaxCachedLayouts = 8;
+	
+	// Returns the keyboard layout of the calling thread.
+	static KeyboardLayout getCurrent();
+	
+	HKL getHkl() const {
+		return m_hkl;
+	}
+	
+	// Returns the virtual key code and shift state typing a character, -1 if none: VkKeyScanEx().
+	SHORT vkKeyScan(TCHAR c) const;
+	
+	// Returns the scan code of a virtual key, 0 if none: MapVirtualKeyEx(MAPVK_VK_TO_VSC).
+	UINT vkToScanCode(UINT vk) const;
+
+private:
+	
+	KeyboardLayout(HKL hkl, LayoutCache* cache) : m_hkl(hkl), m_cache(cache) {}
+	
+	HKL m_hkl;
+	LayoutCache* m_cache;  // Null if the translations are not cached.
+};
+
+
+// Simulated keyboard input sent in batches: one SendInput() call per batch of key events,
+// instead of one keybd_event() call per key event.
+// Disabled by default: see setMaxSize().
+class InputBatch {
+public:
+	
+	// Signature of SendInput().
+	using SendFunction = UINT (WINAPI*)(UINT count, INPUT* inputs, int input_size);
+	
+	// Maximum number of events of a batch.
+	static constexpr int kMaxSize = 128;
+	
+	// Minimum number of events of an enabled batch: the events of the longest keystroke,
+	// see addKeystroke().
+	static constexpr int kMinSize = 2 * arrayLength(kSpecialKeys) + 2;
+	
+	// hotkey_suspension: suspends the hotkeys of the keystrokes. Must outlive the batch.
+	// send_function: SendInput(), or a replacement for tests.
+	explicit InputBatch(HotKeySuspension* hotkey_suspension, SendFunction send_function = SendInput)
+		: m_hotkey_suspension(hotkey_suspension), m_send_function(send_function),
+			m_layout(KeyboardLayout::getCurrent()), m_max_size(0), m_size(0),
+			m_sent_event_count(0), m_sent_batch_count(0) {}
+	
+	InputBatch(const InputBatch& other) = delete;
+	InputBatch& operator =(const InputBatch& other) = delete;
+	
+	// Enables or disables batching. Assumes the batch is empty.
+	// max_size: the maximum number of events per batch, clamped to [kMinSize, kMaxSize];
+	//   0 to disable batching.
+	void setMaxSize(int max_size);
+	
+	bool isEnabled() const {
+		return toBool(m_max_size);
+	}
+	
+	bool isEmpty() const {
+		return !m_size;
+	}
+	
+	// Appends the events of Keystroke::keybdEvent(vk, down).
+	// Returns false, without appending the event, if the batch is full.
+	bool addKey(UINT vk, bool down);
+	
+	// Appends the events of keystroke.simulateTyping(already_down_mod_code, hotkey_suspension):
+	// suspends the hotkey of the keystroke.
+	// Returns false, without appending any event, if the batch does not have room for the events.
+	bool addKeystroke(const Keystroke& keystroke, DWORD already_down_mod_code);
+	
+	// Appends the events of sendUnicode(c).
+	// Returns false, without appending any event, if the batch does not have room for the events.
+	bool addUnicode(TCHAR c);
+	
+	// Sends the events in one call. Noop if empty.
+	// The next events use the keyboard layout current after the call.
+	void send();
+	
+	// Returns the number of events sent by send(), and the number of calls sending them.
+	int getSentEventCount() const {
+		return m_sent_event_count;
+	}
+	int getSentBatchCount() const {
+		return m_sent_batch_count;
+	}
+	
+	// Returns the events not sent yet.
+	const INPUT* getEvents(int* count) const {
+		*count = m_size;
+		return m_events;
+	}
+
+private:
+	
+	HotKeySuspension* m_hotkey_suspension;
+	SendFunction m_send_function;
+	
+	// Translates the virtual keys of the events. Updated after each batch.
+	KeyboardLayout m_layout;
+	
+	int m_max_size;  // 0 if disabled.
+	
+	INPUT m_events[kMaxSize];
+	int m_size;
+	
+	int m_sent_event_count;
+	int m_sent_batch_count;
+};
+
+
+// Fills the 2 events typing a UTF-16 code unit regardless of the keyboard layout:
+// the press and the release of a KEYEVENTF_UNICODE key. The target receives them as VK_PACKET,
+// translated to WM_CHAR. A character outside the BMP takes 2 code units: a surrogate pair.
+void fillUnicodeEvents(TCHAR c, INPUT events[2]);
+
+// Types a UTF-16 code unit regardless of the keyboard layout: sends the events of
+// fillUnicodeEvents() in one call. No hotkey can match them.
+// Returns false if the events are rejected, for instance blocked by UIPI.
+bool sendUnicode(TCHAR c, InputBatch::SendFunction send_function = SendInput);
+
+}  // namespace input
@@ -19,10 +19,39 @@
 
 #include "StdAfx.h"
 #include "Keystroke.h"
+#include "Input.h"
+#include "Metrics.h"
+#include "Pacing.h"
+
+#if defined(_M_X64) || defined(__SSE2__)
+#define USE_SSE2
+#include <emmintrin.h>
+#endif
 
 
 String Keystroke::s_vk_key_names[256];
 BYTE Keystroke::s_next_named_vk[256];
+HWND Keystroke::s_hotkey_window;
+DWORD Keystroke::s_hotkey_thread_id;
+
+namespace {
+
+// States of the hotkeys, indexed like HotKeySuspension. Only accessed by the thread of
+// the hotkey window, see Keystroke::changeHotKey().
+WORD s_hotkey_suspension_counts[HotKeySuspension::kHotKeyCount];
+DWORD s_requested_hotkeys[HotKeySuspension::kHotKeyCount / 32];  // See Keystroke::registerHotKey().
+DWORD s_registered_hotkeys[HotKeySuspension::kHotKeyCount / 32];  // Registered with RegisterHotKey().
+
+bool testBit(const DWORD bitset[], int index) {
+	return toBool(bitset[index / 32] & (DWORD(1) << (index % 32)));
+}
+
+void setBit(DWORD bitset[], int index, bool value) {
+	const DWORD bit = DWORD(1) << (index % 32);
+	bitset[index / 32] = value ? (bitset[index / 32] | bit) : (bitset[index / 32] & ~bit);
+}
+
+}  // namespace
 
 
 void Keystroke::loadVkKeyNames() {
@@ -188,8 +217,13 @@ void Keystroke::parseDisplayName(LPTSTR input) {
 }
 
 
-void Keystroke::simulateTyping(DWORD already_down_mod_code) const {
-	const bool was_registered = unregisterHotKey();
+void Keystroke::simulateTyping(
+		DWORD already_down_mod_code, HotKeySuspension* suspension, pacing::Pacer* pacer) const {
+	HotKeySuspension keystroke_suspension;
+	if (!suspension) {
+		suspension = &keystroke_suspension;
+	}
+	suspension->suspend(*this);
 	const DWORD to_press_mod_code = getUnsidedModCode() & ~already_down_mod_code;
 	
 	// Press the special keys that are not already kept down.
@@ -201,7 +235,11 @@ void Keystroke::simulateTyping(DWORD already_down_mod_code) const {
 	
 	// Press and release the main key.
 	keybdEvent(m_vk, /* down= */ true);
-	sleepBackground(0);
+	if (pacer) {
+		pacer->pause();
+	} else {
+		pacing::yield();
+	}
 	keybdEvent(m_vk, /* down= */ false);
 	
 	// Release the special keys that should not be kept down.
@@ -210,10 +248,6 @@ void Keystroke::simulateTyping(DWORD already_down_mod_code) const {
 			keybdEvent(special_key.vk, /* down= */ false);
 		}
 	}
-	
-	if (was_registered) {
-		registerHotKey();
-	}
 }
 
 void Keystroke::keybdEvent(UINT vk, bool down) {
@@ -221,24 +255,134 @@ void Keystroke::keybdEvent(UINT vk, bool down) {
 	if (isKeyExtended(vk)) {
 		dwFlags |= KEYEVENTF_EXTENDEDKEY;
 	}
-	keybd_event(BYTE(vk), BYTE(MapVirtualKey(vk, 0)), dwFlags, 0);
+	metrics::markOutput();
+	keybd_event(BYTE(vk), BYTE(input::KeyboardLayout::getCurrent().vkToScanCode(vk)), dwFlags, 0);
 }
 
 
 void Keystroke::registerHotKey() const {
-	const WORD mod_code = getUnsidedModCode();
-	if (m_vk == VK_NUMPAD5) {
-		RegisterHotKey(/* hWnd= */ NULL, MAKEWORD(VK_CLEAR, mod_code), mod_code, VK_CLEAR);
-	}
-	RegisterHotKey(/* hWnd= */ NULL, MAKEWORD(m_vk, mod_code), mod_code, m_vk);
+	changeHotKey(HotKeyChange::kRegister, m_vk, getUnsidedModCode());
 }
 
 bool Keystroke::unregisterHotKey() const {
-	const WORD mod_code = getUnsidedModCode();
-	if (m_vk == VK_NUMPAD5) {
-		UnregisterHotKey(/* hWnd= */ NULL, MAKEWORD(VK_CLEAR, mod_code));
+	return changeHotKey(HotKeyChange::kUnregister, m_vk, getUnsidedModCode());
+}
+
+void Keystroke::registerFailedHotKeys() {
+	changeHotKey(HotKeyChange::kRegisterFailed, 0, 0);
+}
+
+void Keystroke::setHotKeyWindow(HWND hwnd) {
+	s_hotkey_thread_id = hwnd ? GetWindowThreadProcessId(hwnd, /* lpdwProcessId= */ nullptr) : 0;
+	s_hotkey_window = hwnd;
+}
+
+LRESULT Keystroke::onRegisterHotKeyMessage(WPARAM wParam, LPARAM lParam) {
+	return changeHotKey(HotKeyChange(wParam), BYTE(LOWORD(lParam)), HIWORD(lParam));
+}
+
+bool Keystroke::changeHotKey(HotKeyChange change, BYTE vk, WORD mod_code) {
+	// RegisterHotKey() fails for the windows of other threads.
+	// Delegating also serializes the changes: the states need no lock.
+	const HWND hwnd = s_hotkey_window;
+	if (hwnd && s_hotkey_thread_id != GetCurrentThreadId()) {
+		return toBool(SendMessage(hwnd, WM_REGISTERHOTKEY, WPARAM(change), MAKELPARAM(vk, mod_code)));
+	}
+	
+	if (change == HotKeyChange::kRegisterFailed) {
+		for (int hotkey = 0; hotkey < HotKeySuspension::kHotKeyCount; hotkey++) {
+			if (testBit(s_requested_hotkeys, hotkey) && !testBit(s_registered_hotkeys, hotkey) &&
+					!s_hotkey_suspension_counts[hotkey]) {
+				setBit(s_registered_hotkeys, hotkey,
+					setHotKeyRegistered(BYTE(hotkey), WORD(hotkey >> 8), /* registered= */ true));
+			}
+		}
+		return true;
+	}
+	
+	const int hotkey = vk | (mod_code << 8);
+	WORD& suspension_count = s_hotkey_suspension_counts[hotkey];
+	const bool was_registered = testBit(s_registered_hotkeys, hotkey);
+	bool registered = was_registered;
+	switch (change) {
+		case HotKeyChange::kRegister:
+			setBit(s_requested_hotkeys, hotkey, true);
+			if (!registered && !suspension_count) {
+				registered = setHotKeyRegistered(vk, mod_code, /* registered= */ true);
+			}
+			setBit(s_registered_hotkeys, hotkey, registered);
+			return registered;
+		
+		case HotKeyChange::kUnregister:
+		case HotKeyChange::kSuspend:
+			if (change == HotKeyChange::kUnregister) {
+				setBit(s_requested_hotkeys, hotkey, false);
+			} else {
+				suspension_count++;
+			}
+			if (registered) {
+				setHotKeyRegistered(vk, mod_code, /* registered= */ false);
+				setBit(s_registered_hotkeys, hotkey, false);
+			}
+			return was_registered;
+		
+		case HotKeyChange::kResume:
+			VERIF(suspension_count);
+			suspension_count--;
+			if (!suspension_count && !registered && testBit(s_requested_hotkeys, hotkey)) {
+				registered = setHotKeyRegistered(vk, mod_code, /* registered= */ true);
+				setBit(s_registered_hotkeys, hotkey, registered);
+				return registered;
+			}
+			return false;
+	}
+	return false;
+}
+
+bool Keystroke::setHotKeyRegistered(BYTE vk, WORD mod_code, bool registered) {
+	const HWND hwnd = s_hotkey_window;
+	if (vk == VK_NUMPAD5) {
+		const int clear_id = MAKEWORD(VK_CLEAR, mod_code);
+		if (registered) {
+			RegisterHotKey(hwnd, clear_id, mod_code, VK_CLEAR);
+		} else {
+			UnregisterHotKey(hwnd, clear_id);
+		}
+	}
+	
+	const int id = MAKEWORD(vk, mod_code);
+	return toBool(registered ? RegisterHotKey(hwnd, id, mod_code, vk) : UnregisterHotKey(hwnd, id));
+}
+
+
+void HotKeySuspension::suspend(const Keystroke& keystroke) {
+	const WORD mod_code = keystroke.getUnsidedModCode();
+	const int hotkey = keystroke.m_vk | (mod_code << 8);
+	const DWORD bit = DWORD(1) << (hotkey % 32);
+	DWORD& checked = m_checked[hotkey / 32];
+	VERIFV(!(checked & bit));
+	
+	checked |= bit;
+	m_checked_count++;
+	if (Keystroke::changeHotKey(Keystroke::HotKeyChange::kSuspend, keystroke.m_vk, mod_code)) {
+		m_suspended[hotkey / 32] |= bit;
+		m_suspended_count++;
+	}
+}
+
+void HotKeySuspension::restore() {
+	for (int word = 0; m_checked_count && word < arrayLength(m_checked); word++) {
+		for (DWORD bits = m_checked[word]; bits; bits &= bits - 1) {
+			DWORD bit_index;
+			_BitScanForward(&bit_index, bits);
+			const int hotkey = word * 32 + int(bit_index);
+			Keystroke::changeHotKey(Keystroke::HotKeyChange::kResume, BYTE(hotkey), WORD(hotkey >> 8));
+			m_checked_count--;
+		}
+		m_checked[word] = 0;
 	}
-	return toBool(UnregisterHotKey(/* hWnd= */ NULL, MAKEWORD(m_vk, mod_code)));
+	ZeroMemory(m_suspended, sizeof(m_suspended));
+	m_suspended_count = 0;
 }
 
 
@@ -267,6 +411,88 @@ bool Keystroke::isSubset(const Keystroke& other) const {
 }
 
 
+namespace {
+
+// Layout of the packed keystrokes, from the least significant bit.
+constexpr DWORD kPackedVkMask = 0xFF;
+constexpr DWORD kPackedModCodeMask = 0xF;  // MOD_ALT | MOD_CONTROL | MOD_SHIFT | MOD_WIN
+constexpr int kPackedLeftModCodeShift = 8;
+constexpr int kPackedRightModCodeShift = 12;
+constexpr int kPackedUnsidedModCodeShift = 16;
+constexpr DWORD kPackedSidedBit = 1 << 20;
+constexpr int kPackedConditionsShift = 24;
+constexpr int kPackedConditionBits = 2;
+constexpr DWORD kPackedConditionMask = (1 << kPackedConditionBits) - 1;
+
+constexpr int getPackedConditionShift(int cond_type) {
+	return kPackedConditionsShift + cond_type * kPackedConditionBits;
+}
+
+}  // namespace
+
+DWORD Keystroke::pack() const {
+	DWORD packed = m_vk |
+		((m_sided_mod_code & kPackedModCodeMask) << kPackedLeftModCodeShift) |
+		(((m_sided_mod_code >> kRightModCodeOffset) & kPackedModCodeMask) << kPackedRightModCodeShift) |
+		((getUnsidedModCode() & kPackedModCodeMask) << kPackedUnsidedModCodeShift);
+	if (m_sided) {
+		packed |= kPackedSidedBit;
+	}
+	for (int i = 0; i < kCondTypeCount; i++) {
+		packed |= DWORD(m_conditions[i]) << getPackedConditionShift(i);
+	}
+	return packed;
+}
+
+void Keystroke::packPattern(DWORD* key, DWORD* mask) const {
+	// Sided keystrokes match only sided keystrokes with the same sided mod code.
+	// Unsided keystrokes match any keystroke with the same unsided mod code.
+	*mask = m_sided
+		? kPackedVkMask |
+			(kPackedModCodeMask << kPackedLeftModCodeShift) |
+			(kPackedModCodeMask << kPackedRightModCodeShift) |
+			kPackedSidedBit
+		: kPackedVkMask | (kPackedModCodeMask << kPackedUnsidedModCodeShift);
+	
+	// kIgnore conditions match any condition.
+	for (int i = 0; i < kCondTypeCount; i++) {
+		if (m_conditions[i] != Condition::kIgnore) {
+			*mask |= kPackedConditionMask << getPackedConditionShift(i);
+		}
+	}
+	
+	*key = pack() & *mask;
+}
+
+int Keystroke::findPackedMatch(DWORD packed, const DWORD* keys, const DWORD* masks, int start, int count) {
+	int i = start;
+#ifdef USE_SSE2
+	const __m128i packed4 = _mm_set1_epi32(int(packed));
+	for (; i + 4 <= count; i += 4) {
+		const __m128i keys4 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(keys + i));
+		const __m128i masks4 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(masks + i));
+		const int matches = _mm_movemask_ps(_mm_castsi128_ps(
+			_mm_cmpeq_epi32(_mm_and_si128(packed4, masks4), keys4)));
+		if (matches) {
+			DWORD first_match;
+			_BitScanForward(&first_match, DWORD(matches));
+			return i + int(first_match);
+		}
+	}
+#endif  // USE_SSE2
+	return findPackedMatchScalar(packed, keys, masks, i, count);
+}
+
+int Keystroke::findPackedMatchScalar(DWORD packed, const DWORD* keys, const DWORD* masks, int start, int count) {
+	for (int i = start; i < count; i++) {
+		if ((packed & masks[i]) == keys[i]) {
+			return i;
+		}
+	}
+	return count;
+}
+
+
 HWND Keystroke::getInputFocus() {
 	HWND new_input_window;
 	DWORD new_input_thread;
@@ -486,7 +712,7 @@ INT_PTR CALLBACK prcEditDialog(HWND hdlg, UINT message, WPARAM wParam, LPARAM UN
 		
 		// Initialization
 		case WM_INITDIALOG: {
-			e_modal_dialog = hdlg;
+			setModalDialog(hdlg);
 			centerParent(hdlg);
 				
 			// Subclass the keystroke control. Display the initial keystroke name.
@@ -570,7 +796,7 @@ INT_PTR CALLBACK prcSendKeysDialog(HWND hdlg, UINT message, WPARAM wParam, LPARA
 		
 		// Initialization
 		case WM_INITDIALOG: {
-			e_modal_dialog = hdlg;
+			setModalDialog(hdlg);
 			centerParent(hdlg);
 				
 			const HWND hctl = GetDlgItem(hdlg, IDCTXT);
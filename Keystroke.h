@@ -82,6 +82,12 @@ inline constexpr SpecialKey kSpecialKeys[] = {
 };
 
 
+class HotKeySuspension;
+
+namespace pacing {
+class Pacer;
+}
+
 class Keystroke {
 public:
 	
@@ -201,24 +207,59 @@ public:
 	// Simulate typing the keystroke: presses the keys down and up.
 	// Simulates special keys as unsided.
 	// already_down_mod_code: special keys to assume are already down and to keep down, unsided.
-	void simulateTyping(DWORD already_down_mod_code) const;
+	// suspension: suspends the hotkey of the keystroke if not null. Otherwise, the hotkey is
+	//   suspended during the simulation only.
+	// pacer: paces the key press and release if not null. Otherwise, yields between them.
+	void simulateTyping(
+		DWORD already_down_mod_code, HotKeySuspension* suspension = nullptr,
+		pacing::Pacer* pacer = nullptr) const;
 	
 	// Simulates pressing or releasing a virtual key. Wrapper for keybd_event().
 	static void keybdEvent(UINT vk, bool down);
 	
 	
-	// Registers a global shortcut for this keystroke.
+	// Registers a global shortcut for this keystroke. The hotkey stays unregistered while
+	// a HotKeySuspension suspends it, and until registerFailedHotKeys() if the registration fails.
 	void registerHotKey() const;
 	
-	// Cancels an invocation of registerHotKey().
+	// Cancels an invocation of registerHotKey(), including its pending registration.
 	// Returns true if a hotkey was actually unregistered, false on noop.
 	bool unregisterHotKey() const;
 	
+	// Retries the registration of the hotkeys whose registerHotKey() failed, for instance
+	// because another program had registered them. Skips the suspended hotkeys.
+	static void registerFailedHotKeys();
+	
+	// Sets the window receiving the WM_HOTKEY messages, NULL for the message queue of the thread
+	// registering the hotkeys. Should be called before registering hotkeys.
+	// The other threads delegate the hotkeys registration to the thread of the window
+	// by sending it WM_REGISTERHOTKEY messages: its procedure must call onRegisterHotKeyMessage().
+	static void setHotKeyWindow(HWND hwnd);
+	
+	// Handles a WM_REGISTERHOTKEY message, see setHotKeyWindow().
+	static LRESULT onRegisterHotKeyMessage(WPARAM wParam, LPARAM lParam);
+	
 	
 	// Returns true if this keystroke is a special case (a subset) of the given keystroke.
 	// Allows telling if two keystrokes conflict.
 	bool isSubset(const Keystroke& other) const;
 	
+	// Packs this keystroke into 32 bits: virtual key code, sided and unsided mod codes,
+	// sided-ness, and 2 bits per condition.
+	DWORD pack() const;
+	
+	// Packs this keystroke into a pattern matching the packed keystrokes it is a subset of:
+	// isSubset(other) if and only if (other.pack() & *mask) == *key.
+	void packPattern(DWORD* key, DWORD* mask) const;
+	
+	// Returns the index of the first pattern of [start, count) matching a packed keystroke,
+	// count if none. The patterns are stored as two parallel arrays, see packPattern().
+	// Compares 4 patterns at once with SSE2.
+	static int findPackedMatch(DWORD packed, const DWORD* keys, const DWORD* masks, int start, int count);
+	
+	// Same as findPackedMatch(), one pattern at a time.
+	static int findPackedMatchScalar(DWORD packed, const DWORD* keys, const DWORD* masks, int start, int count);
+	
 	// Returns whether the system can release the special keys of this keystroke.
 	// Media keys do not support special keys releasing.
 	bool canReleaseSpecialKeys() const {
@@ -293,6 +334,31 @@ private:
 	// Retrieves the name of a virtual key.
 	static void loadVkKeyName(BYTE vk, String* output);
 	
+	friend class HotKeySuspension;
+	
+	// Changes of the state of a hotkey, see changeHotKey().
+	enum class HotKeyChange {
+		kRegister,  // registerHotKey(). Returns whether the hotkey is registered.
+		kUnregister,  // unregisterHotKey(). Returns whether the hotkey was registered.
+		kSuspend,  // HotKeySuspension::suspend(). Returns whether the hotkey was registered.
+		kResume,  // HotKeySuspension::restore(). Returns whether the hotkey is registered again.
+		kRegisterFailed,  // registerFailedHotKeys(), for all hotkeys. Returns true.
+	};
+	
+	// Applies a change to the state of a hotkey: the registration requested by registerHotKey()
+	// and the number of suspensions. The hotkey is registered iff requested and not suspended.
+	// Delegates to the thread of s_hotkey_window, which owns the states: see setHotKeyWindow().
+	// mod_code: unsided.
+	static bool changeHotKey(HotKeyChange change, BYTE vk, WORD mod_code);
+	
+	// Registers or unregisters a hotkey for s_hotkey_window, from the thread of the window.
+	// Returns true on success.
+	static bool setHotKeyRegistered(BYTE vk, WORD mod_code, bool registered);
+	
+	// See setHotKeyWindow().
+	static HWND s_hotkey_window;
+	static DWORD s_hotkey_thread_id;
+	
 	// Name of each virtual key, empty if unknown.
 	static String s_vk_key_names[256];
 	
@@ -301,3 +367,46 @@ private:
 	// s_next_named_vk[vk] = 0xFF if no such vk_next exists.
 	static BYTE s_next_named_vk[256];
 };
+
+
+// Unregisters the hotkeys of the keystrokes simulated by a macro, for the whole macro:
+// unregisters each hotkey once, at its first keystroke, instead of around each keystroke.
+// Registers them again once, when destroyed, including on early exits.
+// The suspensions are counted per hotkey: a hotkey suspended by concurrent macros is registered
+// again when the last one restores it, and only if its shortcuts still register it.
+class HotKeySuspension {
+public:
+	
+	// Number of hotkeys: virtual key code in the low byte, unsided MOD_* bitmask in the high bits.
+	static constexpr int kHotKeyCount = 256 << 4;
+	
+	HotKeySuspension() : m_checked{}, m_checked_count(0), m_suspended{}, m_suspended_count(0) {}
+	
+	HotKeySuspension(const HotKeySuspension& other) = delete;
+	HotKeySuspension& operator =(const HotKeySuspension& other) = delete;
+	
+	~HotKeySuspension() {
+		restore();
+	}
+	
+	// Unregisters the hotkey of a keystroke until restore(), or defers its registration if not
+	// registered yet. Noop if already done.
+	void suspend(const Keystroke& keystroke);
+	
+	// Ends the suspensions: registers again the hotkeys no other suspension suspends.
+	void restore();
+	
+	// Returns the number of hotkeys unregistered by suspend() and not restored yet.
+	int getSuspendedCount() const {
+		return m_suspended_count;
+	}
+	
+private:
+	
+	// Bitsets by hotkey. m_checked: hotkeys suspend() processed.
+	// m_suspended: hotkeys suspend() actually unregistered.
+	DWORD m_checked[kHotKeyCount / 32];
+	int m_checked_count;
+	DWORD m_suspended[kHotKeyCount / 32];
+	int m_suspended_count;
+};
@@ -0,0 +1,451 @@
+// Clavier+
+// Keyboard shortcuts manager
+//
+// Copyright (C) 2000-2008 Guillaume Ryder
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+
+#include "StdAfx.h"
+#include "Macro.h"
+#include "Executor.h"
+#include "Global.h"
+#include "Keystroke.h"
+
+#include <algorithm>
+
+namespace macro {
+namespace {
+
+struct OpcodeInfo {
+	LPCTSTR name;
+	int arg_count;
+};
+
+// Indexed by Opcode.
+constexpr OpcodeInfo kOpcodeInfos[] = {
+	{ _T("Chars"), 1 },
+	{ _T("Empty"), 0 },
+	{ _T("CommandLine"), 0 },
+	{ _T("Wait"), 1 },
+	{ _T("Focus"), 2 },
+	{ _T("FocusOrLaunch"), 1 },
+	{ _T("Cancel"), 0 },
+	{ _T("Copy"), 0 },
+	{ _T("MouseButton"), 2 },
+	{ _T("MouseMoveTo"), 2 },
+	{ _T("MouseMoveToFocus"), 2 },
+	{ _T("MouseMoveBy"), 2 },
+	{ _T("MouseWheel"), 1 },
+	{ _T("KeysDown"), 1 },
+	{ _T("Batch"), 2 },
+	{ _T("Pacing"), 1 },
+	{ _T("Paste"), 1 },
+	{ _T("Overlap"), 1 },
+	{ _T("Keystroke"), 3 },
+	{ _T("KeystrokeChars"), 0 },
+};
+static_assert(arrayLength(kOpcodeInfos) == int(Opcode::kCount));
+
+// Argument of [{Overlap}] for each executor::Admission.
+constexpr LPCTSTR kAdmissionNames[] = {
+	_T("Coalesce"),
+	_T("Queue"),
+	_T("Drop"),
+};
+static_assert(arrayLength(kAdmissionNames) == int(executor::Admission::kDrop) + 1);
+
+constexpr int kInstructionDwords = sizeof(Instruction) / sizeof(DWORD);
+static_assert(sizeof(Instruction) % sizeof(DWORD) == 0);
+
+// Returns the number of DWORDs of a string of an Instruction, including its padding.
+int getStringDwords(LPCTSTR string) {
+	return int(((lstrlen(string) + 1) * sizeof(TCHAR) + sizeof(DWORD) - 1) / sizeof(DWORD));
+}
+
+// Appends a string to output, quoted, with C-like escaping of the special characters.
+void appendQuoted(LPCTSTR string, String* output) {
+	*output += _T('"');
+	for (LPCTSTR chr = string; *chr; chr++) {
+		switch (*chr) {
+			case _T('\r'):  *output += _T("\\r");  break;
+			case _T('\n'):  *output += _T("\\n");  break;
+			case _T('\t'):  *output += _T("\\t");  break;
+			case _T('"'):  *output += _T("\\\"");  break;
+			case _T('\\'):  *output += _T("\\\\");  break;
+			default:  *output += *chr;  break;
+		}
+	}
+	*output += _T('"');
+}
+
+}  // namespace
+
+
+LPCTSTR Instruction::getString(int index) const {
+	assert(0 <= index && index < string_count);
+	const DWORD* string = reinterpret_cast<const DWORD*>(this) + kInstructionDwords;
+	for (; index > 0; index--) {
+		string += getStringDwords(reinterpret_cast<LPCTSTR>(string));
+	}
+	return reinterpret_cast<LPCTSTR>(string);
+}
+
+
+Program::Program(const Program& other)
+	: m_code(nullptr),
+	m_size(other.m_size),
+	m_capacity(other.m_size),
+	m_admission(other.m_admission),
+	m_window_patterns(nullptr),
+	m_window_pattern_count(other.m_window_pattern_count) {
+	if (other.m_size) {
+		m_code = new DWORD[m_size];
+		memcpy(m_code, other.m_code, m_size * sizeof(DWORD));
+	}
+	compileWindowPatterns();
+}
+
+void Program::clear() {
+	delete [] m_code;
+	m_code = nullptr;
+	m_size = 0;
+	m_capacity = 0;
+	m_admission = executor::Admission::kCoalesce;
+	delete [] m_window_patterns;
+	m_window_patterns = nullptr;
+	m_window_pattern_count = 0;
+}
+
+const WildcardPattern& Program::getWindowPattern(const Instruction& instruction) const {
+	assert(instruction.opcode == Opcode::kFocus || instruction.opcode == Opcode::kFocusOrLaunch);
+	return m_window_patterns[instruction.args[2]];
+}
+
+void Program::compileWindowPatterns() {
+	if (!m_window_pattern_count) {
+		return;
+	}
+	m_window_patterns = new WildcardPattern[m_window_pattern_count];
+	for (const Instruction* instruction = begin(); instruction != end(); instruction = instruction->getNext()) {
+		if (instruction->opcode == Opcode::kFocus || instruction->opcode == Opcode::kFocusOrLaunch) {
+			m_window_patterns[instruction->args[2]].compile(instruction->getString(0));
+		}
+	}
+}
+
+void Program::compile(LPCTSTR text) {
+	clear();
+	
+	// Receives the pending regular characters, then the inside of each special command.
+	// Both are at most as long as the text.
+	const int text_length = lstrlen(text);
+	const LPTSTR buffer = new TCHAR[text_length + 1];
+	int chars_length = 0;
+	
+	bool escaping = false;  // whether the next character is '\'-escaped
+	for (int i = 0; text[i]; i++) {
+		const TCHAR c = text[i];
+		if (c == _T('\n')) {
+			// Skip '\n': redundant with the expected '\r'.
+			continue;
+		}
+		
+		if (!escaping && c == _T('\\')) {
+			escaping = true;
+			continue;
+		}
+		
+		if (escaping || c != _T('[')) {
+			// Regular character.
+			escaping = false;
+			buffer[chars_length++] = c;
+			continue;
+		}
+		
+		// '[': inline shortcut, or inline command line execution
+		
+		// Extract the inside of the shortcut.
+		// Take into account '\' escaping to detect the end of the shortcut, but do not unescape.
+		const LPCTSTR shortcut_start = text + i + 1;
+		const TCHAR *shortcut_end = shortcut_start;
+		bool escaping2 = false;
+		while (*shortcut_end && !(*shortcut_end == _T(']') && !escaping2)) {
+			escaping2 = !escaping2 && (*shortcut_end == _T('\\'));
+			shortcut_end++;
+		}
+		if (!*shortcut_end) {
+			// Non-terminated command.
+			break;
+		}
+		
+		if (chars_length) {
+			buffer[chars_length] = _T('\0');
+			append(Opcode::kChars, chars_length, 0, 0, buffer);
+			chars_length = 0;
+		}
+		
+		const int inside_length = int(shortcut_end - shortcut_start);
+		memcpy(buffer, shortcut_start, inside_length * sizeof(TCHAR));
+		buffer[inside_length] = _T('\0');
+		compileSpecialCommand(buffer, inside_length);
+		
+		if (*shortcut_start == _T('[')) {
+			// Double brackets: skip the second closing bracket.
+			shortcut_end++;
+			if (!*shortcut_end) {
+				break;
+			}
+		}
+		i = int(shortcut_end - text);
+	}
+	
+	if (chars_length) {
+		buffer[chars_length] = _T('\0');
+		append(Opcode::kChars, chars_length, 0, 0, buffer);
+	}
+	
+	delete [] buffer;
+	compileWindowPatterns();
+}
+
+void Program::compileSpecialCommand(LPTSTR inside, int inside_length) {
+	if (!inside_length) {
+		// []
+		append(Opcode::kEmpty);
+		return;
+	}
+	
+	if (inside[0] == _T('[')) {
+		// Double brackets: [[command line]]
+		
+		const LPTSTR command_line = &inside[1];
+		unescape(command_line);
+		append(Opcode::kCommandLine, 0, 0, 0, command_line);
+		
+	} else if (inside[0] == _T('{') && inside[inside_length - 1] == _T('}')) {
+		// Braces: [{command}]
+		
+		inside[inside_length - 1] = _T('\0');
+		LPTSTR arg = &inside[1];
+		
+		// To support comma escaping, unescape the arguments one-by-one.
+		const LPCTSTR command = parseCommaSepArgUnescape(arg);
+		
+		const auto append_mouse_move = [&](Opcode opcode) {
+			const int x = StrToInt(parseCommaSepArgUnescape(arg));
+			const int y = StrToInt(parseCommaSepArgUnescape(arg));
+			append(opcode, x, y);
+		};
+		
+		if (!lstrcmpi(command, _T("Wait"))) {
+			append(Opcode::kWait, StrToInt(parseCommaSepArgUnescape(arg)));
+			
+		} else if (!lstrcmpi(command, _T("Focus"))) {
+			const int delay_ms = StrToInt(parseCommaSepArgUnescape(arg));
+			
+			// Detect the '!' prefix before unescaping the window name.
+			const bool ignore_not_found = (arg[0] == _T('!'));
+			if (ignore_not_found) {
+				arg++;
+			}
+			const LPCTSTR window_name = parseCommaSepArgUnescape(arg);
+			append(Opcode::kFocus, delay_ms, ignore_not_found, m_window_pattern_count++, window_name);
+			
+		} else if (!lstrcmpi(command, _T("FocusOrLaunch"))) {
+			const LPCTSTR window_name = parseCommaSepArgUnescape(arg);
+			const LPCTSTR command_line = parseCommaSepArgUnescape(arg);
+			const int delay_ms = StrToInt(parseCommaSepArgUnescape(arg));
+			append(Opcode::kFocusOrLaunch, delay_ms, 0, m_window_pattern_count++,
+				window_name, command_line);
+			
+		} else if (!lstrcmpi(command, _T("Cancel"))) {
+			append(Opcode::kCancel);
+			
+		} else if (!lstrcmpi(command, _T("Copy"))) {
+			unescape(arg);
+			append(Opcode::kCopy, 0, 0, 0, arg);
+			
+		} else if (!lstrcmpi(command, _T("MouseButton"))) {
+			unescape(arg);
+			CharUpper(arg);
+			
+			DWORD dwFlags = 0;
+			bool click = false;
+			switch (lstrlen(arg)) {
+				case 2:
+					switch (MAKELONG(arg[1], arg[0])) {
+						case 'L\0D':  dwFlags = MOUSEEVENTF_LEFTDOWN;  break;
+						case 'L\0U':  dwFlags = MOUSEEVENTF_LEFTUP;  break;
+						case 'M\0D':  dwFlags = MOUSEEVENTF_MIDDLEDOWN;  break;
+						case 'M\0U':  dwFlags = MOUSEEVENTF_MIDDLEUP;  break;
+						case 'R\0D':  dwFlags = MOUSEEVENTF_RIGHTDOWN;  break;
+						case 'R\0U':  dwFlags = MOUSEEVENTF_RIGHTUP;  break;
+					}
+					break;
+				
+				case 1:
+					switch (*arg) {
+						case 'L':  dwFlags = MOUSEEVENTF_LEFTDOWN;  break;
+						case 'M':  dwFlags = MOUSEEVENTF_MIDDLEDOWN;  break;
+						case 'R':  dwFlags = MOUSEEVENTF_RIGHTDOWN;  break;
+					}
+					click = true;
+					break;
+			}
+			if (dwFlags) {
+				append(Opcode::kMouseButton, int(dwFlags), click);
+			}
+			
+		} else if (!lstrcmpi(command, _T("MouseMoveTo"))) {
+			append_mouse_move(Opcode::kMouseMoveTo);
+			
+		} else if (!lstrcmpi(command, _T("MouseMoveToFocus"))) {
+			append_mouse_move(Opcode::kMouseMoveToFocus);
+			
+		} else if (!lstrcmpi(command, _T("MouseMoveBy"))) {
+			append_mouse_move(Opcode::kMouseMoveBy);
+			
+		} else if (!lstrcmpi(command, _T("MouseWheel"))) {
+			const int offset = -StrToInt(parseCommaSepArgUnescape(arg)) * WHEEL_DELTA;
+			if (offset) {
+				append(Opcode::kMouseWheel, offset);
+			}
+			
+		} else if (!lstrcmpi(command, _T("KeysDown"))) {
+			unescape(arg);
+			Keystroke keep_down_keystroke;
+			keep_down_keystroke.parseDisplayName(arg);
+			append(Opcode::kKeysDown, keep_down_keystroke.getUnsidedModCode());
+			
+		} else if (!lstrcmpi(command, _T("Batch"))) {
+			const int max_size = StrToInt(parseCommaSepArgUnescape(arg));
+			const int delay_ms = StrToInt(parseCommaSepArgUnescape(arg));
+			append(Opcode::kBatch, max_size, delay_ms);
+			
+		} else if (!lstrcmpi(command, _T("Pacing"))) {
+			append(Opcode::kPacing, std::max(StrToInt(parseCommaSepArgUnescape(arg)), 0));
+			
+		} else if (!lstrcmpi(command, _T("Paste"))) {
+			append(Opcode::kPaste, std::max(StrToInt(parseCommaSepArgUnescape(arg)), 0));
+			
+		} else if (!lstrcmpi(command, _T("Overlap"))) {
+			unescape(arg);
+			for (int admission = 0; admission < arrayLength(kAdmissionNames); admission++) {
+				if (!lstrcmpi(arg, kAdmissionNames[admission])) {
+					append(Opcode::kOverlap, admission);
+					m_admission = executor::Admission(admission);
+					break;
+				}
+			}
+		}
+		
+	} else if (inside[0] == _T('|') && inside[inside_length - 1] == _T('|')) {
+		// Brackets and pipe: [|characters as keystroke|]
+		
+		inside[inside_length - 1] = _T('\0');
+		unescape(inside);
+		
+		// Skip the leading '|' and the '\n', redundant with '\r'.
+		TCHAR* output = inside;
+		for (LPCTSTR chr_ptr = inside; *++chr_ptr;) {
+			if (*chr_ptr != _T('\n')) {
+				*output++ = *chr_ptr;
+			}
+		}
+		*output = _T('\0');
+		append(Opcode::kKeystrokeChars, 0, 0, 0, inside);
+		
+	} else {
+		// Simple brackets: [keystroke]
+		
+		unescape(inside);
+		Keystroke keystroke;
+		keystroke.parseDisplayName(inside);
+		append(Opcode::kKeystroke, keystroke.m_vk, int(keystroke.m_sided_mod_code), keystroke.m_sided);
+	}
+}
+
+void Program::append(Opcode opcode, int arg0, int arg1, int arg2, LPCTSTR string0, LPCTSTR string1) {
+	const int string_count = string0 ? (string1 ? 2 : 1) : 0;
+	const LPCTSTR strings[] = { string0, string1 };
+	
+	int size = kInstructionDwords;
+	for (int i = 0; i < string_count; i++) {
+		size += getStringDwords(strings[i]);
+	}
+	reserve(m_size + size);
+	
+	DWORD *const code = m_code + m_size;
+	Instruction *const instruction = reinterpret_cast<Instruction*>(code);
+	*instruction = {
+		.opcode = opcode,
+		.string_count = BYTE(string_count),
+		.size = size,
+		.args = { arg0, arg1, arg2 },
+	};
+	
+	// Copy the strings, zero the padding.
+	DWORD* string = code + kInstructionDwords;
+	for (int i = 0; i < string_count; i++) {
+		const int string_dwords = getStringDwords(strings[i]);
+		string[string_dwords - 1] = 0;
+		memcpy(string, strings[i], (lstrlen(strings[i]) + 1) * sizeof(TCHAR));
+		string += string_dwords;
+	}
+	
+	m_size += size;
+}
+
+void Program::reserve(int capacity) {
+	if (capacity <= m_capacity) {
+		return;
+	}
+	
+	int new_capacity = std::max(m_capacity * 2, 64);
+	while (new_capacity < capacity) {
+		new_capacity *= 2;
+	}
+	
+	DWORD *const new_code = new DWORD[new_capacity];
+	if (m_code) {
+		memcpy(new_code, m_code, m_size * sizeof(DWORD));
+		delete [] m_code;
+	}
+	m_code = new_code;
+	m_capacity = new_capacity;
+}
+
+
+void Program::disassemble(String* output) const {
+	for (const Instruction* instruction = begin(); instruction != end(); instruction = instruction->getNext()) {
+		const OpcodeInfo& info = kOpcodeInfos[int(instruction->opcode)];
+		*output += info.name;
+		
+		for (int i = 0; i < info.arg_count; i++) {
+			TCHAR arg_buffer[16];
+			wsprintf(arg_buffer, _T(" %d"), instruction->args[i]);
+			*output += arg_buffer;
+		}
+		
+		for (int i = 0; i < instruction->string_count; i++) {
+			*output += _T(' ');
+			appendQuoted(instruction->getString(i), output);
+		}
+		
+		*output += _T("\r\n");
+	}
+}
+
+}  // namespace macro
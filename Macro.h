@@ -0,0 +1,215 @@
+// Clavier+
+// Keyboard shortcuts manager
+//
+// Copyright (C) 2000-2008 Guillaume Ryder
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+
+// Compiled form of the text of the shortcuts: the text is parsed once, when loaded or edited,
+// into a stream of instructions that the execution interprets without parsing.
+
+#pragma once
+
+#include "Executor.h"
+
+class WildcardPattern;
+
+namespace macro {
+
+// Operation of an Instruction. Lists the integer arguments and strings of each operation.
+enum class Opcode : BYTE {
+	// Regular characters to send as WM_CHAR, unescaped, without '\n'.
+	// args: length. strings: characters.
+	kChars,
+	
+	// []
+	kEmpty,
+	
+	// [[command line]]
+	// strings: command line, unescaped.
+	kCommandLine,
+	
+	// [{Wait,duration}]
+	// args: duration in milliseconds.
+	kWait,
+	
+	// [{Focus,delay,[!]window_name}]
+	// args: delay in milliseconds, whether window_name begins with '!',
+	//   index of the compiled window_name, see Program::getWindowPattern().
+	// strings: window_name without the '!' prefix, unescaped.
+	kFocus,
+	
+	// [{FocusOrLaunch,window_name,command,delay}]
+	// args: delay in milliseconds, unused,
+	//   index of the compiled window_name, see Program::getWindowPattern().
+	// strings: window_name, command; unescaped.
+	kFocusOrLaunch,
+	
+	// [{Cancel}]
+	kCancel,
+	
+	// [{Copy,text}]
+	// strings: text, unescaped.
+	kCopy,
+	
+	// [{MouseButton,state}]
+	// args: mouse_event() flags of the press, whether to release the button after pressing it.
+	kMouseButton,
+	
+	// [{MouseMoveTo,x,y}], [{MouseMoveToFocus,x,y}], [{MouseMoveBy,dx,dy}]
+	// args: x, y.
+	kMouseMoveTo,
+	kMouseMoveToFocus,
+	kMouseMoveBy,
+	
+	// [{MouseWheel,offset}]
+	// args: mouse_event() wheel movement, never 0.
+	kMouseWheel,
+	
+	// [{KeysDown,keystroke}]
+	// args: unsided MOD_* constants bitmask of the keystroke.
+	kKeysDown,
+	
+	// [{Batch,size,delay}]
+	// args: maximum number of input events per batch, 0 to disable batching;
+	//   delay between batches in milliseconds.
+	kBatch,
+	
+	// [{Pacing,delay}]
+	// args: delay between simulated input events in microseconds.
+	kPacing,
+	
+	// [{Paste,min_length}]
+	// args: minimum length of the regular characters to paste, 0 to never paste.
+	kPaste,
+	
+	// [{Overlap,admission}]
+	// args: executor::Admission of the executions started while the shortcut is still executing.
+	// Applies to the whole text: see Program::getAdmission(). Noop when executed.
+	kOverlap,
+	
+	// [keystroke]
+	// args: Keystroke::m_vk, m_sided_mod_code, m_sided.
+	kKeystroke,
+	
+	// [|characters as keystrokes|]
+	// strings: characters, unescaped, without '\n'.
+	kKeystrokeChars,
+	
+	kCount
+};
+
+// Instruction of a Program: a fixed size header followed by string_count strings.
+// Each string is null-terminated and padded to a multiple of sizeof(DWORD) bytes.
+struct Instruction {
+	Opcode opcode;
+	BYTE string_count;
+	
+	// Size of the instruction including its strings, in DWORDs.
+	int size;
+	
+	// Integer arguments, see Opcode. The unused ones are 0.
+	int args[3];
+	
+	// Returns a string of the instruction. index must be less than string_count.
+	LPCTSTR getString(int index) const;
+	
+	const Instruction* getNext() const {
+		return reinterpret_cast<const Instruction*>(reinterpret_cast<const DWORD*>(this) + size);
+	}
+};
+
+// Stream of instructions compiled from the text of a shortcut.
+// Iterate from begin() to end() with Instruction::getNext().
+class Program {
+public:
+	
+	Program()
+		: m_code(nullptr), m_size(0), m_capacity(0), m_admission(executor::Admission::kCoalesce),
+			m_window_patterns(nullptr), m_window_pattern_count(0) {}
+	Program(const Program& other);
+	Program& operator =(const Program& other) = delete;
+	
+	~Program() {
+		clear();
+	}
+	
+	// Replaces the instructions with the compilation of the text of a shortcut.
+	// Accepts any text: ignores the unknown commands, stops at the first non-terminated '['.
+	// Parses the keystrokes, assumes Keystroke::loadVkKeyNames() has been called.
+	void compile(LPCTSTR text);
+	
+	// Removes all instructions.
+	void clear();
+	
+	bool isEmpty() const {
+		return !m_size;
+	}
+	
+	const Instruction* begin() const {
+		return reinterpret_cast<const Instruction*>(m_code);
+	}
+	
+	const Instruction* end() const {
+		return reinterpret_cast<const Instruction*>(m_code + m_size);
+	}
+	
+	// Returns the size of the instructions, in bytes.
+	int getSize() const {
+		return m_size * int(sizeof(DWORD));
+	}
+	
+	// Returns the admission of the last [{Overlap}] command, Admission::kCoalesce if none.
+	executor::Admission getAdmission() const {
+		return m_admission;
+	}
+	
+	// Returns the compiled window name of a kFocus or kFocusOrLaunch instruction of the program.
+	const WildcardPattern& getWindowPattern(const Instruction& instruction) const;
+	
+	// Appends a human readable listing of the instructions to output, one line per instruction:
+	// the name of the opcode, then the integer arguments, then the quoted strings.
+	void disassemble(String* output) const;
+
+private:
+	
+	// Appends an instruction. The strings are copied, string1 is ignored if string0 is null.
+	void append(Opcode opcode, int arg0 = 0, int arg1 = 0, int arg2 = 0,
+		LPCTSTR string0 = nullptr, LPCTSTR string1 = nullptr);
+	
+	// Compiles a special command: the inside of a "[...]" block.
+	// inside: the inside, not unescaped yet, null-terminated. Modified by the compilation.
+	// inside_length: the number of characters of inside.
+	void compileSpecialCommand(LPTSTR inside, int inside_length);
+	
+	// Ensures the capacity is at least the given number of DWORDs.
+	void reserve(int capacity);
+	
+	// Allocates and compiles the m_window_pattern_count window names of the instructions.
+	void compileWindowPatterns();
+	
+	DWORD* m_code;
+	int m_size;  // In DWORDs.
+	int m_capacity;  // In DWORDs.
+	
+	executor::Admission m_admission;  // See getAdmission().
+	
+	// Compiled window names of the kFocus and kFocusOrLaunch instructions, in order.
+	// Null if none.
+	WildcardPattern* m_window_patterns;
+	int m_window_pattern_count;
+};
+
+}  // namespace macro
@@ -0,0 +1,273 @@
+// Clavier+
+// Keyboard shortcuts manager
+//
+// Copyright (C) 2000-2008 Guillaume Ryder
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+
+#include "StdAfx.h"
+#include "Metrics.h"
+#include "MyString.h"
+
+#include <algorithm>
+#include <intrin.h>
+
+namespace metrics {
+namespace {
+
+// Indexed by Stage.
+constexpr LPCTSTR kStageNames[] = {
+	_T("Queue"),
+	_T("Sidedness"),
+	_T("ProcessName"),
+	_T("Find"),
+	_T("FirstOutput"),
+	_T("Execute"),
+	_T("Total"),
+	_T("ShellLaunch"),
+	_T("ProcessLaunch"),
+	_T("QueueDepth"),
+	_T("MacroQueue"),
+	_T("MacroRun"),
+};
+static_assert(arrayLength(kStageNames) == int(Stage::kCount));
+
+// Suffixes of the percentile headers, indexed by Unit.
+constexpr LPCTSTR kUnitSuffixes[] = {
+	_T(" (us)"),
+	_T(""),
+};
+
+constexpr int kPercentiles[] = { 50, 90, 99, 100 };
+
+DispatchStats s_global_stats;
+
+// Frequency of the performance counter, 0 until the first conversion.
+LONGLONG s_frequency;
+
+// Dispatch resumed in a thread, see Dispatch::resumeExecution().
+// Few threads resume dispatches: the dispatch thread and the executor thread.
+struct RunningDispatch {
+	volatile LONG thread_id;  // 0 if the slot is free.
+	Dispatch* dispatch;  // Written and read by the thread owning the slot only.
+};
+
+RunningDispatch s_running_dispatches[4];
+
+// Returns the slot of the calling thread, nullptr if none.
+RunningDispatch* findRunningDispatch(DWORD thread_id) {
+	for (RunningDispatch& running : s_running_dispatches) {
+		if (DWORD(running.thread_id) == thread_id) {
+			return &running;
+		}
+	}
+	return nullptr;
+}
+
+
+DWORD toMicroseconds(LONGLONG duration) {
+	if (!s_frequency) {
+		LARGE_INTEGER frequency;
+		QueryPerformanceFrequency(&frequency);
+		s_frequency = frequency.QuadPart;
+	}
+	const LONGLONG duration_us = duration * 1000000 / s_frequency;
+	return (duration_us < LONGLONG(MAXDWORD)) ? DWORD(duration_us) : MAXDWORD;
+}
+
+}  // namespace
+
+
+Unit getStageUnit(Stage stage) {
+	return (stage == Stage::kQueueDepth) ? Unit::kCount : Unit::kMicroseconds;
+}
+
+
+void Histogram::add(DWORD duration_us) {
+	int bucket = 0;
+	DWORD bit_index;
+	if (_BitScanReverse(&bit_index, duration_us)) {
+		bucket = int(bit_index) + 1;
+		if (bucket >= kBucketCount) {
+			bucket = kBucketCount - 1;
+		}
+	}
+	InterlockedIncrement(&m_buckets[bucket]);
+}
+
+DWORD Histogram::getCount() const {
+	DWORD count = 0;
+	for (const LONG bucket_count : m_buckets) {
+		count += DWORD(bucket_count);
+	}
+	return count;
+}
+
+DWORD Histogram::getPercentile(int percentile) const {
+	const DWORD count = getCount();
+	VERIFP(count, 0);
+	
+	// Rank of the percentile among the sorted durations, rounded up, at least 1.
+	const DWORD rank = std::max(DWORD(1), DWORD((ULONGLONG(count) * percentile + 99) / 100));
+	DWORD cumulated_count = 0;
+	for (int bucket = 0; bucket < kBucketCount; bucket++) {
+		cumulated_count += getBucketCount(bucket);
+		if (cumulated_count >= rank) {
+			return getBucketUpperBound(bucket);
+		}
+	}
+	return getBucketUpperBound(kBucketCount - 1);
+}
+
+
+void DispatchStats::appendHeaderToString(String& output, Unit unit) {
+	output += _T("Name\tStage\tCount");
+	TCHAR buffer[32];
+	for (const int percentile : kPercentiles) {
+		wsprintf(buffer, _T("\tP%d%s"), percentile, kUnitSuffixes[int(unit)]);
+		output += buffer;
+	}
+	for (int bucket = 0; bucket < Histogram::kBucketCount - 1; bucket++) {
+		wsprintf(buffer, _T("\t<%lu"), Histogram::getBucketUpperBound(bucket));
+		output += buffer;
+	}
+	wsprintf(buffer, _T("\t>=%lu\r\n"), Histogram::getBucketUpperBound(Histogram::kBucketCount - 2));
+	output += buffer;
+}
+
+void DispatchStats::appendToString(String& output, LPCTSTR name, Unit unit) const {
+	TCHAR buffer[32];
+	for (int stage = 0; stage < int(Stage::kCount); stage++) {
+		const Histogram& histogram = stages[stage];
+		const DWORD count = histogram.getCount();
+		if (!count || getStageUnit(Stage(stage)) != unit) {
+			continue;
+		}
+		
+		output += name;
+		output += _T('\t');
+		output += kStageNames[stage];
+		wsprintf(buffer, _T("\t%lu"), count);
+		output += buffer;
+		for (const int percentile : kPercentiles) {
+			wsprintf(buffer, _T("\t%lu"), histogram.getPercentile(percentile));
+			output += buffer;
+		}
+		for (int bucket = 0; bucket < Histogram::kBucketCount; bucket++) {
+			wsprintf(buffer, _T("\t%lu"), histogram.getBucketCount(bucket));
+			output += buffer;
+		}
+		output += _T("\r\n");
+	}
+}
+
+
+Dispatch::Dispatch(DWORD message_time)
+		: m_measured_stages(1 << int(Stage::kQueue)),
+		m_first_output(0) {
+	m_start = m_stage_start = getTimestamp();
+	
+	// Same clock as GetTickCount(), compared with wrap-around arithmetic.
+	const LONG queue_ms = LONG(GetTickCount() - message_time);
+	m_durations_us[int(Stage::kQueue)] = DWORD(std::max(LONG(0), queue_ms)) * 1000;
+}
+
+void Dispatch::endStage(Stage stage) {
+	const LONGLONG now = getTimestamp();
+	m_durations_us[int(stage)] = toMicroseconds(now - m_stage_start);
+	m_measured_stages |= 1 << int(stage);
+	m_stage_start = now;
+}
+
+void Dispatch::beginExecution() {
+	m_execution_start = m_stage_start = getTimestamp();
+	resumeExecution();
+}
+
+void Dispatch::endExecution() {
+	suspendExecution();
+	endStage(Stage::kExecute);
+	
+	if (m_first_output) {
+		m_durations_us[int(Stage::kFirstOutput)] = toMicroseconds(m_first_output - m_execution_start);
+		m_durations_us[int(Stage::kTotal)] =
+			m_durations_us[int(Stage::kQueue)] + toMicroseconds(m_first_output - m_start);
+		m_measured_stages |= (1 << int(Stage::kFirstOutput)) | (1 << int(Stage::kTotal));
+	}
+}
+
+void Dispatch::record(DispatchStats* shortcut_stats) const {
+	for (int stage = 0; stage < int(Stage::kCount); stage++) {
+		if (m_measured_stages & (1 << stage)) {
+			s_global_stats.stages[stage].add(m_durations_us[stage]);
+			if (shortcut_stats) {
+				shortcut_stats->stages[stage].add(m_durations_us[stage]);
+			}
+		}
+	}
+}
+
+
+void Dispatch::resumeExecution() {
+	const DWORD thread_id = GetCurrentThreadId();
+	RunningDispatch* running = findRunningDispatch(thread_id);
+	if (!running) {
+		for (RunningDispatch& slot : s_running_dispatches) {
+			if (!InterlockedCompareExchange(&slot.thread_id, LONG(thread_id), 0)) {
+				running = &slot;
+				break;
+			}
+		}
+		VERIFV(running);
+	}
+	running->dispatch = this;
+}
+
+void Dispatch::suspendExecution() {
+	RunningDispatch *const running = findRunningDispatch(GetCurrentThreadId());
+	if (running && running->dispatch == this) {
+		running->dispatch = nullptr;
+		InterlockedExchange(&running->thread_id, 0);
+	}
+}
+
+
+void markOutput() {
+	const RunningDispatch *const running = findRunningDispatch(GetCurrentThreadId());
+	Dispatch *const dispatch = running ? running->dispatch : nullptr;
+	if (dispatch && !dispatch->m_first_output) {
+		dispatch->m_first_output = getTimestamp();
+	}
+}
+
+LONGLONG getTimestamp() {
+	LARGE_INTEGER counter;
+	QueryPerformanceCounter(&counter);
+	return counter.QuadPart;
+}
+
+void recordStage(Stage stage, LONGLONG start) {
+	s_global_stats.stages[int(stage)].add(toMicroseconds(getTimestamp() - start));
+}
+
+void recordQueueDepth(int depth) {
+	s_global_stats.stages[int(Stage::kQueueDepth)].add(DWORD(depth));
+}
+
+const DispatchStats& getGlobalStats() {
+	return s_global_stats;
+}
+
+}  // namespace metrics
@@ -0,0 +1,162 @@
+// Clavier+
+// Keyboard shortcuts manager
+//
+// Copyright (C) 2000-2008 Guillaume Ryder
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+
+// Latency instrumentation of the hotkeys dispatch. Always on: measuring a dispatch costs a few
+// QueryPerformanceCounter() calls and histogram counter increments.
+
+#pragma once
+
+class String;
+
+namespace metrics {
+
+// Stages of a hotkey dispatch, from the WM_HOTKEY message to the shortcut execution.
+enum class Stage {
+	kQueue,  // From the WM_HOTKEY message posting to its processing. Millisecond precision.
+	kSidedness,  // Probing the state of the sided special keys.
+	kProcessName,  // getWindowProcessName().
+	kFind,  // ShortcutIndex::find().
+	kFirstOutput,  // From the execution start to the first input or command of the dispatch.
+	kExecute,  // Shortcut::execute() and its text task, or typing the keystroke back if no match.
+	kTotal,  // From the WM_HOTKEY message posting to the first output.
+	kShellLaunch,  // ShellExecuteEx() call launching a command. Global only.
+	kProcessLaunch,  // CreateProcess() call launching a command, see LaunchBackend. Global only.
+	kQueueDepth,  // Hotkeys waiting when the dispatch starts, including it. Unit::kCount. Global only.
+	kMacroQueue,  // From the submission of a text shortcut to the executor to its run. Global only.
+	kMacroRun,  // Run of a text shortcut by the executor, including its delays. Global only.
+	kCount
+};
+
+// Unit of the values of the histogram of a stage.
+enum class Unit {
+	kMicroseconds,  // Durations: all stages but Stage::kQueueDepth.
+	kCount,  // Stage::kQueueDepth.
+};
+
+Unit getStageUnit(Stage stage);
+
+// Histogram of durations, with fixed logarithmic buckets: bucket 0 counts the durations
+// below 1 microsecond, bucket i > 0 counts the durations in [2^(i-1), 2^i) microseconds.
+// The last bucket also counts all longer durations.
+// Also used for counts, with the same buckets: see Unit.
+// Thread-safe. Initially empty if zero-initialized.
+class Histogram {
+public:
+	
+	static constexpr int kBucketCount = 32;
+	
+	void add(DWORD duration_us);
+	
+	DWORD getCount() const;
+	
+	// Returns the upper bound of the bucket containing the given percentile (0-100), in microseconds.
+	// Returns 0 if the histogram is empty.
+	DWORD getPercentile(int percentile) const;
+	
+	DWORD getBucketCount(int bucket) const {
+		return DWORD(m_buckets[bucket]);
+	}
+	
+	// Returns the exclusive upper bound of the durations counted by a bucket, in microseconds.
+	static DWORD getBucketUpperBound(int bucket) {
+		return DWORD(1) << bucket;
+	}
+	
+private:
+	
+	LONG m_buckets[kBucketCount];
+};
+
+// Histograms of each stage of the hotkey dispatches.
+// Initially empty if zero-initialized.
+struct DispatchStats {
+	Histogram stages[int(Stage::kCount)];
+	
+	// Appends one tab-separated line per non-empty stage histogram of the given unit,
+	// see appendHeaderToString().
+	// name: the first column of each line.
+	void appendToString(String& output, LPCTSTR name, Unit unit = Unit::kMicroseconds) const;
+	
+	// Appends the tab-separated header line of appendToString() for the given unit.
+	static void appendHeaderToString(String& output, Unit unit = Unit::kMicroseconds);
+};
+
+// Measures the stages of one hotkey dispatch, in the dispatch thread.
+// A text shortcut continues its execution in the executor with a copy of the dispatch.
+class Dispatch {
+public:
+	
+	// Starts measuring the dispatch of a WM_HOTKEY message.
+	// message_time: the time of the message, see MSG::time.
+	explicit Dispatch(DWORD message_time);
+	
+	~Dispatch() {
+		suspendExecution();
+	}
+	
+	// Ends the current stage then starts the next one.
+	void endStage(Stage stage);
+	
+	// Starts the kExecute stage, until endExecution(). Resumes the execution.
+	void beginExecution();
+	void endExecution();
+	
+	// While resumed, markOutput() called from the calling thread records the first output
+	// of the dispatch. A thread runs at most one dispatch at a time.
+	// endExecution() and the destruction of the dispatch suspend it.
+	void resumeExecution();
+	void suspendExecution();
+	
+	// Adds the measured durations to the global statistics,
+	// and to the statistics of the executed shortcut if not null.
+	void record(DispatchStats* shortcut_stats) const;
+	
+private:
+	
+	friend void markOutput();
+	
+	DWORD m_durations_us[int(Stage::kCount)];
+	DWORD m_measured_stages;  // Bit mask of the stages to record.
+	
+	LONGLONG m_start;
+	LONGLONG m_stage_start;
+	LONGLONG m_execution_start;
+	LONGLONG m_first_output;  // 0 until markOutput() is called.
+};
+
+// Records the first injected input or launched command of the Dispatch resumed
+// in the calling thread, if any.
+// Should be called just before injecting input or launching a command. Cheap if no dispatch runs.
+void markOutput();
+
+// Returns the current value of the performance counter.
+LONGLONG getTimestamp();
+
+// Adds to the global statistics the duration of a stage that started at the given timestamp
+// and ends now. Thread-safe.
+void recordStage(Stage stage, LONGLONG start);
+
+// Adds to the global statistics the number of hotkeys waiting for their dispatch,
+// as Stage::kQueueDepth. Thread-safe.
+void recordQueueDepth(int depth);
+
+// Returns the statistics aggregated over all dispatches.
+const DispatchStats& getGlobalStats();
+
+}  // namespace metrics
@@ -0,0 +1,479 @@
+// Clavier+
+// Keyboard shortcuts manager
+//
+// Copyright (C) 2000-2008 Guillaume Ryder
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+
+#include "StdAfx.h"
+#include "Pacing.h"
+#include "Global.h"
+#include "MyString.h"
+
+#include <algorithm>
+
+// Defined by the Windows 10 1803 SDK and later.
+#ifndef CREATE_WAITABLE_TIMER_HIGH_RESOLUTION
+#define CREATE_WAITABLE_TIMER_HIGH_RESOLUTION  0x00000002
+#endif
+
+namespace pacing {
+namespace {
+
+// Longest wait done by yielding in a loop when the timer is regular, in microseconds:
+// the regular timers wait for at least one tick of the system clock.
+constexpr LONGLONG kMaxYieldingWaitUs = 1000;
+
+volatile DWORD s_default_event_delay_us = kDefaultEventDelayUs;
+
+// Frequency of the performance counter, 0 until the first call of getMicroseconds().
+LONGLONG s_frequency;
+
+// Statistics of the target processes of FlowControl.
+struct TargetStats {
+	TCHAR process_name[MAX_PATH];  // Empty if the entry is unused.
+	DWORD char_count;
+	LONGLONG duration_us;  // From the first character posted to the target processing the last one.
+	DWORD probe_count;
+	DWORD timeout_count;
+	int window;  // The last window, to start the next texts with.
+};
+
+constexpr int kMaxTargetStats = 16;
+
+// Guards the variables below: the executor thread and the dispatch thread both post characters.
+SRWLOCK s_target_stats_lock;
+
+TargetStats s_target_stats[kMaxTargetStats];
+
+// Returns the entry of a process. Allocates it if needed, replacing the entry with the fewest
+// characters if all are used. Requires s_target_stats_lock.
+TargetStats& getTargetStats(LPCTSTR process_name) {
+	TargetStats* smallest_stats = nullptr;
+	for (TargetStats& stats : s_target_stats) {
+		if (!lstrcmp(stats.process_name, process_name)) {
+			return stats;
+		}
+		if (!smallest_stats || !stats.process_name[0] ||
+				(smallest_stats->process_name[0] && stats.char_count < smallest_stats->char_count)) {
+			smallest_stats = &stats;
+		}
+	}
+	
+	*smallest_stats = {};
+	StringCchCopy(smallest_stats->process_name, arrayLength(smallest_stats->process_name), process_name);
+	smallest_stats->window = FlowControl::kInitialWindow;
+	return *smallest_stats;
+}
+
+// Message posted by FlowControl after the characters, see FlowControl::ProbeMethod::kMarker.
+// wParam: the sequence number of the marker, unique across the FlowControls. lParam: unused.
+// Registered by the first FlowControl::setTarget() call.
+UINT s_marker_message;
+
+// The sequence number of the last marker posted by any FlowControl.
+LONG s_marker_sequence;
+
+// Acknowledgement of the markers of a FlowControl, written by markerHookProc() in the thread
+// of the target. The markers do not reference their FlowControl: after a timeout, they stay in
+// the queue of the target, possibly after the FlowControl is destroyed.
+struct MarkerSlot {
+	HANDLE event;  // Signaled by each acknowledgement. NULL if the slot is free.
+	volatile LONG posted_sequence;  // The sequence number of the last marker posted.
+	volatile LONG acked_sequence;  // The sequence number of the last marker acknowledged.
+};
+
+// One per FlowControl probing a target of this process.
+MarkerSlot s_marker_slots[8];
+
+// Guards the allocation of s_marker_slots and their events.
+SRWLOCK s_marker_slots_lock;
+
+// Yields the processor until getMicroseconds() reaches a deadline.
+void yieldUntil(LONGLONG deadline_us) {
+	while (getMicroseconds() < deadline_us) {
+		yield();
+	}
+}
+
+}  // namespace
+
+
+DWORD getDefaultEventDelay() {
+	return s_default_event_delay_us;
+}
+
+void setDefaultEventDelay(DWORD delay_us) {
+	s_default_event_delay_us = delay_us;
+}
+
+LONGLONG getMicroseconds() {
+	if (!s_frequency) {
+		LARGE_INTEGER frequency;
+		QueryPerformanceFrequency(&frequency);
+		s_frequency = frequency.QuadPart;
+	}
+	LARGE_INTEGER counter;
+	QueryPerformanceCounter(&counter);
+	
+	// Convert the seconds and the remainder separately to avoid overflows.
+	const LONGLONG seconds = counter.QuadPart / s_frequency;
+	const LONGLONG remainder = counter.QuadPart % s_frequency;
+	return seconds * 1000000 + remainder * 1000000 / s_frequency;
+}
+
+void yield() {
+	SwitchToThread();
+}
+
+
+Pacer::~Pacer() {
+	if (m_timer) {
+		CloseHandle(m_timer);
+	}
+}
+
+void Pacer::wait(LONGLONG duration_us) {
+	if (duration_us <= 0) {
+		yield();
+		return;
+	}
+	
+	// Lower the priority of the calling thread only, not of the whole process.
+	const HANDLE thread = GetCurrentThread();
+	const int old_priority = GetThreadPriority(thread);
+	SetThreadPriority(thread, THREAD_PRIORITY_IDLE);
+	waitForTimer(/* event= */ NULL, duration_us);
+	SetThreadPriority(thread, old_priority);
+}
+
+bool Pacer::waitForEvent(HANDLE event, LONGLONG duration_us) {
+	if (duration_us <= 0) {
+		return WaitForSingleObject(event, 0) == WAIT_OBJECT_0;
+	}
+	return waitForTimer(event, duration_us);
+}
+
+bool Pacer::isHighResolution() {
+	createTimer();
+	return m_timer_state == TimerState::kHighResolution;
+}
+
+void Pacer::createTimer() {
+	if (m_timer_state != TimerState::kNotCreated) {
+		return;
+	}
+	
+	m_timer = CreateWaitableTimerEx(
+		/* lpTimerAttributes= */ nullptr, /* lpTimerName= */ nullptr,
+		CREATE_WAITABLE_TIMER_HIGH_RESOLUTION, TIMER_ALL_ACCESS);
+	if (m_timer) {
+		m_timer_state = TimerState::kHighResolution;
+		return;
+	}
+	
+	// High-resolution timers are not supported before Windows 10 1803.
+	m_timer = CreateWaitableTimer(
+		/* lpTimerAttributes= */ nullptr, /* bManualReset= */ false, /* lpTimerName= */ nullptr);
+	m_timer_state = m_timer ? TimerState::kRegular : TimerState::kFailed;
+}
+
+bool Pacer::waitForTimer(HANDLE event, LONGLONG duration_us) {
+	createTimer();
+	if (m_timer_state == TimerState::kRegular && !event && duration_us < kMaxYieldingWaitUs) {
+		yieldUntil(getMicroseconds() + duration_us);
+		return false;
+	}
+	
+	if (m_timer_state != TimerState::kFailed) {
+		LARGE_INTEGER due_time;
+		due_time.QuadPart = -duration_us * 10;  // Relative, in 100 nanoseconds units.
+		if (SetWaitableTimer(
+				m_timer, &due_time, /* lPeriod= */ 0, /* pfnCompletionRoutine= */ nullptr,
+				/* lpArgToCompletionRoutine= */ nullptr, /* fResume= */ false)) {
+			if (!event) {
+				WaitForSingleObject(m_timer, INFINITE);
+				return false;
+			}
+			const HANDLE handles[] = { event, m_timer };
+			return WaitForMultipleObjects(
+				arrayLength(handles), handles, /* bWaitAll= */ false, INFINITE) == WAIT_OBJECT_0;
+		}
+	}
+	
+	// No timer: fall back to the millisecond waits.
+	const DWORD duration_ms = DWORD(std::min((duration_us + 999) / 1000, LONGLONG(INFINITE - 1)));
+	if (event) {
+		return WaitForSingleObject(event, duration_ms) == WAIT_OBJECT_0;
+	}
+	Sleep(duration_ms);
+	return false;
+}
+
+
+FlowControl::~FlowControl() {
+	drain();
+	unhook();
+}
+
+void FlowControl::setTarget(HWND target) {
+	if (target == m_target) {
+		return;
+	}
+	drain();
+	unhook();
+	m_target = target;
+	
+	// Hook the threads of this process to acknowledge markers. The hooks of the other processes
+	// would require a DLL: make them repaint instead.
+	DWORD process_id = 0;
+	m_target_thread_id = GetWindowThreadProcessId(target, &process_id);
+	m_probe_method = ProbeMethod::kNone;
+	if (process_id == GetCurrentProcessId()) {
+		if (!s_marker_message) {
+			s_marker_message = RegisterWindowMessage(_T("Clavier+FlowControlMarker"));
+		}
+		const HANDLE event = CreateEvent(
+			/* lpEventAttributes= */ nullptr, /* bManualReset= */ false, /* bInitialState= */ false,
+			/* lpName= */ nullptr);
+		if (event) {
+			AcquireSRWLockExclusive(&s_marker_slots_lock);
+			for (int slot = 0; slot < int(arrayLength(s_marker_slots)); slot++) {
+				if (!s_marker_slots[slot].event) {
+					s_marker_slots[slot] = { event, 0, 0 };
+					m_marker_slot = slot;
+					break;
+				}
+			}
+			ReleaseSRWLockExclusive(&s_marker_slots_lock);
+			if (m_marker_slot < 0) {
+				CloseHandle(event);
+			}
+		}
+		m_hook = SetWindowsHookEx(
+			WH_GETMESSAGE, markerHookProc, /* hmod= */ NULL, m_target_thread_id);
+		if (s_marker_message && m_marker_slot >= 0 && m_hook) {
+			m_probe_method = ProbeMethod::kMarker;
+		} else {
+			unhook();
+			m_probe_method = ProbeMethod::kSendMessage;
+		}
+	} else if (process_id) {
+		m_probe_method = ProbeMethod::kPaint;
+	}
+	
+	if (!getWindowProcessName(target, m_process_name)) {
+		m_process_name[0] = _T('\0');
+	}
+	
+	m_window = kInitialWindow;
+	if (m_process_name[0]) {
+		AcquireSRWLockExclusive(&s_target_stats_lock);
+		m_window = getTargetStats(m_process_name).window;
+		ReleaseSRWLockExclusive(&s_target_stats_lock);
+	}
+}
+
+bool FlowControl::onPosted() {
+	if (!m_char_count) {
+		m_start_us = getMicroseconds();
+	}
+	m_char_count++;
+	m_pending_count++;
+	if (m_pending_count < m_window) {
+		return false;
+	}
+	probe();
+	return true;
+}
+
+void FlowControl::drain() {
+	if (!m_char_count) {
+		return;
+	}
+	if (m_pending_count) {
+		probe();
+	}
+	
+	if (m_process_name[0]) {
+		AcquireSRWLockExclusive(&s_target_stats_lock);
+		TargetStats& stats = getTargetStats(m_process_name);
+		stats.char_count += DWORD(m_char_count);
+		stats.duration_us += getMicroseconds() - m_start_us;
+		stats.probe_count += m_probe_count;
+		stats.timeout_count += m_timeout_count;
+		stats.window = m_window;
+		ReleaseSRWLockExclusive(&s_target_stats_lock);
+	}
+	m_char_count = 0;
+	m_probe_count = 0;
+	m_timeout_count = 0;
+}
+
+void FlowControl::probe() {
+	m_pending_count = 0;
+	
+	const LONGLONG start_us = getMicroseconds();
+	const LONGLONG deadline_us = start_us + LONGLONG(kProbeTimeoutMs) * 1000;
+	bool answered = true;
+	switch (m_probe_method) {
+		case ProbeMethod::kNone:
+			return;
+		
+		case ProbeMethod::kMarker:
+			answered = probeMarker(deadline_us);
+			break;
+		
+		case ProbeMethod::kPaint:
+			if (invalidateProbePixel()) {
+				answered = waitForRepaint(deadline_us);
+				break;
+			}
+			// The target does not repaint, for instance because it is hidden: send instead.
+			[[fallthrough]];
+		
+		case ProbeMethod::kSendMessage: {
+			DWORD_PTR result;
+			if (!SendMessageTimeout(m_target, WM_NULL, 0, 0, SMTO_ABORTIFHUNG, kProbeTimeoutMs, &result)) {
+				if (GetLastError() != ERROR_TIMEOUT) {
+					// The target cannot be probed, for instance because it runs elevated.
+					m_probe_method = ProbeMethod::kNone;
+					m_window = kMaxWindow;
+					return;
+				}
+				answered = false;
+			}
+			break;
+		}
+	}
+	
+	m_probe_count++;
+	if (!answered) {
+		m_timeout_count++;
+		m_window = std::max(m_window / 2, kMinWindow);
+	} else if (getMicroseconds() - start_us < kFastProbeUs) {
+		m_window = std::min(m_window * 2, kMaxWindow);
+	}
+}
+
+bool FlowControl::probeMarker(LONGLONG deadline_us) {
+	MarkerSlot& slot = s_marker_slots[m_marker_slot];
+	const LONG sequence = InterlockedIncrement(&s_marker_sequence);
+	InterlockedExchange(&slot.posted_sequence, sequence);
+	VERIF(PostMessage(m_target, s_marker_message, WPARAM(sequence), /* lParam= */ 0));
+	
+	const bool same_thread = (m_target_thread_id == GetCurrentThreadId());
+	while (slot.acked_sequence != sequence) {
+		const LONGLONG remaining_us = deadline_us - getMicroseconds();
+		if (remaining_us <= 0) {
+			return false;
+		}
+		
+		if (same_thread) {
+			// The target waits for this thread: process its messages until the marker.
+			MSG msg;
+			if (PeekMessage(&msg, NULL, 0, 0, PM_REMOVE)) {
+				TranslateMessage(&msg);
+				DispatchMessage(&msg);
+			}
+		} else {
+			WaitForSingleObject(slot.event, DWORD((remaining_us + 999) / 1000));
+		}
+	}
+	return true;
+}
+
+bool FlowControl::invalidateProbePixel() {
+	RECT client_rect;
+	VERIF(IsWindowVisible(m_target) && !IsIconic(m_target) &&
+		GetClientRect(m_target, &client_rect) && !IsRectEmpty(&client_rect));
+	
+	// Repaint the top-left pixel only, without erasing: the target paints it identically.
+	const RECT pixel = { 0, 0, 1, 1 };
+	return toBool(InvalidateRect(m_target, &pixel, /* bErase= */ false));
+}
+
+bool FlowControl::waitForRepaint(LONGLONG deadline_us) {
+	while (GetUpdateRect(m_target, /* lpRect= */ nullptr, /* bErase= */ false)) {
+		if (getMicroseconds() >= deadline_us) {
+			return false;
+		}
+		m_pacer.wait(kPaintPollUs);
+	}
+	return true;
+}
+
+void FlowControl::unhook() {
+	if (m_hook) {
+		UnhookWindowsHookEx(m_hook);
+		m_hook = NULL;
+	}
+	if (m_marker_slot >= 0) {
+		AcquireSRWLockExclusive(&s_marker_slots_lock);
+		MarkerSlot& slot = s_marker_slots[m_marker_slot];
+		CloseHandle(slot.event);
+		slot = {};
+		ReleaseSRWLockExclusive(&s_marker_slots_lock);
+		m_marker_slot = -1;
+	}
+}
+
+LRESULT CALLBACK FlowControl::markerHookProc(int code, WPARAM wParam, LPARAM lParam) {
+	MSG *const msg = reinterpret_cast<MSG*>(lParam);
+	if (code == HC_ACTION && wParam == PM_REMOVE && msg->message == s_marker_message) {
+		// Acknowledge the marker to the FlowControl waiting for it, if any: ignore the stale markers,
+		// left by the timed out probes, possibly of a destroyed FlowControl.
+		const LONG sequence = LONG(msg->wParam);
+		AcquireSRWLockShared(&s_marker_slots_lock);
+		for (MarkerSlot& slot : s_marker_slots) {
+			if (slot.event && slot.posted_sequence == sequence) {
+				InterlockedExchange(&slot.acked_sequence, sequence);
+				SetEvent(slot.event);
+				break;
+			}
+		}
+		ReleaseSRWLockShared(&s_marker_slots_lock);
+		msg->message = WM_NULL;  // Hide the marker from the target.
+	}
+	return CallNextHookEx(/* hhk= */ NULL, code, wParam, lParam);
+}
+
+
+void appendTargetStatsToString(String& output) {
+	AcquireSRWLockExclusive(&s_target_stats_lock);
+	for (const TargetStats& stats : s_target_stats) {
+		if (!stats.process_name[0]) {
+			continue;
+		}
+		TCHAR buffer[MAX_PATH + 128];
+		wsprintf(buffer,
+			_T("Text target\t%s\tCharacters\t%lu\tChars/s\t%lu\tProbes\t%lu\tTimeouts\t%lu\tWindow\t%d\r\n"),
+			stats.process_name, stats.char_count,
+			DWORD(stats.char_count * LONGLONG(1000000) / std::max(stats.duration_us, LONGLONG(1))),
+			stats.probe_count, stats.timeout_count, stats.window);
+		output += buffer;
+	}
+	ReleaseSRWLockExclusive(&s_target_stats_lock);
+}
+
+void clearTargetStats() {
+	AcquireSRWLockExclusive(&s_target_stats_lock);
+	for (TargetStats& stats : s_target_stats) {
+		stats = {};
+	}
+	ReleaseSRWLockExclusive(&s_target_stats_lock);
+}
+
+}  // namespace pacing
@@ -0,0 +1,228 @@
+// Clavier+
+// Keyboard shortcuts manager
+//
+// Copyright (C) 2000-2008 Guillaume Ryder
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+
+// Pacing of the simulated input: waits between input events and for the delays of the texts,
+// with high-resolution waitable timers instead of Sleep() and its ~15 ms granularity.
+
+#pragma once
+
+class String;
+
+namespace pacing {
+
+// Default delay between two simulated input events, in microseconds.
+// 0 only yields the processor between the events.
+constexpr DWORD kDefaultEventDelayUs = 0;
+
+// Gets or sets the delay between two simulated input events of the shortcuts that do not set
+// theirs with [{Pacing}], in microseconds. Thread-safe.
+DWORD getDefaultEventDelay();
+void setDefaultEventDelay(DWORD delay_us);
+
+// Returns the time elapsed since an arbitrary origin, in microseconds. Thread-safe.
+LONGLONG getMicroseconds();
+
+// Gives the rest of the time slice of the calling thread to the other ready threads,
+// typically the program receiving the simulated input.
+void yield();
+
+// Waits for durations with a waitable timer: high-resolution if the system supports it
+// (Windows 10 1803 and later), else regular with sub-millisecond waits done by yielding.
+// Not thread-safe: each thread should use its own instance.
+class Pacer {
+public:
+	
+	explicit Pacer(DWORD event_delay_us = getDefaultEventDelay())
+		: m_timer(NULL), m_timer_state(TimerState::kNotCreated), m_event_delay_us(event_delay_us) {}
+	
+	Pacer(const Pacer& other) = delete;
+	Pacer& operator =(const Pacer& other) = delete;
+	
+	~Pacer();
+	
+	DWORD getEventDelay() const {
+		return m_event_delay_us;
+	}
+	
+	void setEventDelay(DWORD delay_us) {
+		m_event_delay_us = delay_us;
+	}
+	
+	// Waits between two simulated input events: for the event delay, or yields if it is 0.
+	void pause() {
+		if (m_event_delay_us) {
+			wait(m_event_delay_us);
+		} else {
+			yield();
+		}
+	}
+	
+	// Waits for a duration in microseconds, in idle thread priority: the other threads and
+	// programs run first once the duration elapses. Yields if the duration is 0.
+	void wait(LONGLONG duration_us);
+	
+	// Waits for a duration in microseconds or until an event is signaled, in the thread priority.
+	// Returns true if the event is signaled.
+	bool waitForEvent(HANDLE event, LONGLONG duration_us);
+	
+	// Returns whether the timer is high-resolution. Creates the timer if needed.
+	bool isHighResolution();
+
+private:
+	
+	enum class TimerState {
+		kNotCreated,
+		kHighResolution,
+		kRegular,
+		kFailed,  // Fall back to Sleep().
+	};
+	
+	// Creates the timer if not done yet.
+	void createTimer();
+	
+	// Waits via the timer for a duration, or until the event is signaled if not null.
+	// Returns true if the event is signaled.
+	bool waitForTimer(HANDLE event, LONGLONG duration_us);
+	
+	HANDLE m_timer;
+	TimerState m_timer_state;
+	DWORD m_event_delay_us;
+};
+
+
+// Back-pressure of the regular characters posted to a target window as WM_CHAR messages.
+// After each window of posted characters, probes the target: waits until it processes the
+// messages posted so far, for at most kProbeTimeoutMs. Then adapts the window to the backlog of
+// the target: doubles it while the target catches up fast, halves it when the target lags.
+// The next texts start with the last window of the target process.
+// Not thread-safe.
+class FlowControl {
+public:
+	
+	static constexpr int kMinWindow = 1;
+	static constexpr int kMaxWindow = 256;
+	static constexpr int kInitialWindow = 16;
+	
+	// Maximum duration of a probe growing the window, in microseconds.
+	static constexpr LONGLONG kFastProbeUs = 1000;
+	
+	// Maximum duration of a probe, in milliseconds: longer probes give up and halve the window.
+	static constexpr DWORD kProbeTimeoutMs = 200;
+	
+	FlowControl()
+		: m_target(NULL), m_probe_method(ProbeMethod::kNone), m_target_thread_id(0), m_hook(NULL),
+			m_marker_slot(-1), m_window(kInitialWindow),
+			m_pending_count(0), m_char_count(0), m_start_us(0), m_probe_count(0), m_timeout_count(0) {
+		m_process_name[0] = _T('\0');
+	}
+	
+	FlowControl(const FlowControl& other) = delete;
+	FlowControl& operator =(const FlowControl& other) = delete;
+	
+	// Drains the target.
+	~FlowControl();
+	
+	// Sets the window receiving the next characters. Drains the previous target if different.
+	void setTarget(HWND target);
+	
+	// Counts a character posted to the target. Probes the target once the window is full.
+	// Returns whether it has probed the target: the caller may let other work run then.
+	bool onPosted();
+	
+	// Waits until the target processes the posted characters, for at most kProbeTimeoutMs,
+	// then records the rate of the target. Noop if no character has been posted since the last call.
+	// Should be called before sending any other input, to keep the input in order.
+	void drain();
+	
+	// Returns the number of characters posted between two probes.
+	int getWindow() const {
+		return m_window;
+	}
+
+private:
+	
+	enum class ProbeMethod {
+		kNone,  // Cannot probe the target: post without waiting.
+		
+		// Posts a marker message after the characters. A WH_GETMESSAGE hook acknowledges it once
+		// the target retrieves it, hence has retrieved the characters. Targets of this process only.
+		kMarker,
+		
+		// Invalidates a pixel of the target: the target receives WM_PAINT, then validates the
+		// pixel, only once it has retrieved all its posted messages. Other processes.
+		kPaint,
+		
+		// SendMessageTimeout(WM_NULL): processed before the posted messages, hence measures the
+		// latency of the target but not its backlog. Fallback for the targets without paint.
+		kSendMessage,
+	};
+	
+	// Polling period of the update region of the target, with ProbeMethod::kPaint.
+	static constexpr LONGLONG kPaintPollUs = 250;
+	
+	// WH_GETMESSAGE hook procedure acknowledging the markers retrieved by the target.
+	static LRESULT CALLBACK markerHookProc(int code, WPARAM wParam, LPARAM lParam);
+	
+	// Probes the target then adapts the window.
+	void probe();
+	
+	// Posts a marker, then waits until the target acknowledges it.
+	// Returns whether the target did before the deadline, in microseconds.
+	bool probeMarker(LONGLONG deadline_us);
+	
+	// Invalidates a pixel of the target. Returns false if the target would not repaint it.
+	bool invalidateProbePixel();
+	
+	// Waits until the target repaints the invalidated pixel.
+	// Returns whether the target did before the deadline, in microseconds.
+	bool waitForRepaint(LONGLONG deadline_us);
+	
+	// Removes m_hook and frees m_marker_slot, if any.
+	void unhook();
+	
+	HWND m_target;
+	ProbeMethod m_probe_method;
+	DWORD m_target_thread_id;
+	TCHAR m_process_name[MAX_PATH];  // Empty if unknown: not recorded in the statistics.
+	
+	// With ProbeMethod::kMarker.
+	HHOOK m_hook;  // Installed on the thread of the target.
+	int m_marker_slot;  // Acknowledges the markers, see markerHookProc(). -1 if none.
+	
+	Pacer m_pacer;  // Polls the update region of the target, with ProbeMethod::kPaint.
+	
+	int m_window;
+	int m_pending_count;  // Characters posted since the last probe.
+	
+	// Counters since the last drain.
+	int m_char_count;
+	LONGLONG m_start_us;  // When the first character has been posted.
+	DWORD m_probe_count;
+	DWORD m_timeout_count;
+};
+
+// Appends one line per target process of FlowControl: the number of characters posted,
+// the achieved rate in characters per second, the number of probes and timeouts, the window.
+// Thread-safe.
+void appendTargetStatsToString(String& output);
+
+// Forgets the statistics and the windows of the target processes. Thread-safe.
+void clearTargetStats();
+
+}  // namespace pacing
@@ -106,6 +106,11 @@
 #define ID_TEXT_CMD_MOUSE_WHEEL         40046
 #define ID_TEXT_CMD_KEYS_DOWN           40047
 #define ID_TEXT_CMD_FOCUS_OR_LAUNCH     40048
+#define ID_TEXT_CMD_CANCEL              40049
+#define ID_TEXT_CMD_BATCH               40050
+#define ID_TEXT_CMD_PACING              40051
+#define ID_TEXT_CMD_PASTE               40052
+#define ID_TEXT_CMD_OVERLAP             40053
 #define ID_TRAY_SETTINGS                40056
 #define ID_TRAY_COPY_LIST               40057
 #define ID_TRAY_COPYLIST                40058
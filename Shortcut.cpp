@@ -18,25 +18,45 @@
 
 
 #include "StdAfx.h"
+#include "Clipboard.h"
+#include "Executor.h"
 #include "I18n.h"
+#include "Input.h"
+#include "Pacing.h"
 #include "Shortcut.h"
 
 #include <algorithm>
+#include <new>
 
 namespace shortcut {
 namespace {
 
-Shortcut* s_first_shortcut;
-Shortcut* s_last_shortcut;
+// Snapshot of no shortcuts, current until the first commitShortcuts(). Never deleted.
+Snapshot s_empty_snapshot;
+
+// Current snapshot, replaced only by publishSnapshot(). Never null.
+Snapshot* volatile s_snapshot = &s_empty_snapshot;
+
+// Snapshot being built by addShortcut(), published by commitShortcuts(). Null if none.
+Snapshot* s_draft_snapshot;
+
+// Snapshots replaced by publishSnapshot() but possibly still pinned, linked by next_retired.
+Snapshot* s_retired_snapshots;
+
+// Hazard slots of SnapshotPin: the snapshot pinned in each slot, null if none.
+// A slot is owned by a pin while its s_hazard_slots_used entry is non-zero.
+constexpr int kHazardSlotCount = 8;
+Snapshot* volatile s_hazard_snapshots[kHazardSlotCount];
+volatile LONG s_hazard_slots_used[kHazardSlotCount];
+
+// Last identifier given to a shortcut, see ShortcutStats::id.
+volatile LONG s_last_shortcut_id;
 
 constexpr WCHAR kUtf16LittleEndianBom = 0xFEFF;
 
+// Default minimum length of the regular characters pasted via the clipboard, see [{Paste}].
+constexpr int kDefaultPasteMinLength = 2048;
 
-enum class LastTextExecution {
-	None,
-	Text,
-	Keystroke,
-};
 
 struct ExecutionContext {
 	BYTE keyboard_state[256];
@@ -47,68 +67,215 @@ struct ExecutionContext {
 	HWND input_window;
 	DWORD input_thread;
 	
-	LastTextExecution lastTextExecution;
+	// The task executing the shortcut, null if executed synchronously.
+	executor::Task* task;
+	
+	// Suspends the hotkeys of the simulated keystrokes until the end of the text.
+	// Owned by typeText().
+	HotKeySuspension* hotkey_suspension;
+	
+	// Batches the simulated keystrokes once [{Batch}] enables it. Owned by typeText().
+	input::InputBatch* batch;
+	
+	// Delay between two batches, in milliseconds.
+	int batch_delay_ms;
+	
+	// Paces the simulated input events. Owned by typeText().
+	pacing::Pacer* pacer;
+	
+	// Minimum length of the regular characters pasted via the clipboard, 0 to never paste.
+	int paste_min_length;
 };
 
+// Execution of a text shortcut by the executor, see Shortcut::execute().
+// Copies the shortcut: its snapshot can be deleted meanwhile.
+// Ends and records the hotkey dispatch once deleted: after running, or if cancelled or rejected.
+class TextTask : public executor::Task {
+public:
+	
+	// Runs in the dispatch thread.
+	TextTask(const Shortcut& shortcut, bool can_release_special_keys,
+		ShortcutStats* stats, const metrics::Dispatch& dispatch);
+	
+	~TextTask() override;
+	
+	executor::Coroutine run() override;
+	
+private:
+	
+	BYTE m_keyboard_state[256];  // Captured when the hotkey is dispatched.
+	BYTE m_vk;
+	bool m_can_release_special_keys;
+	macro::Program m_macro;
+	
+	ShortcutStats* m_stats;  // Referenced by the task.
+	metrics::Dispatch m_hotkey_dispatch;
+};
+
+// Releases a reference to statistics, deletes them once unreferenced.
+void releaseStats(ShortcutStats* stats);
+
+// Records the latency of a hotkey dispatch in the statistics of the executed shortcut.
+void recordDispatch(ShortcutStats* stats, const metrics::Dispatch& dispatch);
+
+// Catches the keyboard focus and, if can_release_special_keys, releases the special keys
+// and the vk key of the hotkey via SetKeyboardState().
+// Reads keyboard_state and initializes the other members of the context, except task.
+void prepareExecution(ExecutionContext* context, BYTE vk, bool can_release_special_keys);
+
+// Types the text of a shortcut, including its special commands: interprets its compiled form.
+// Stops at the first special command once the execution is cancelled.
+executor::Coroutine typeText(const macro::Program& program, ExecutionContext* context);
+
+// Returns whether the execution has been cancelled.
+bool isCancelled(const ExecutionContext* context);
+
+// Returns whether typeBatched() types an instruction: the batch of the context is enabled
+// and the instruction types keystrokes, or regular characters without special keys kept down.
+bool isBatched(const macro::Instruction& instruction, const ExecutionContext* context);
+
+// Types an instruction accepted by isBatched() via the batch of the context.
+// Sends the batch each time it is full, waiting for the delay between batches.
+// Returns whether to continue executing the shortcut.
+executor::Coroutine typeBatched(const macro::Instruction& instruction, ExecutionContext* context);
+
+// Sends the full batch of the context, then waits for the delay between batches: at least
+// yields to the other tasks.
+// Returns false if the execution is cancelled meanwhile.
+executor::Coroutine sendFullBatch(ExecutionContext* context);
+
+// Returns whether typeText() tries to paste an instruction via the clipboard: the instruction
+// types regular characters, at least paste_min_length, without special keys kept down.
+bool isPasted(const macro::Instruction& instruction, const ExecutionContext* context);
+
+// Pastes the regular characters of an instruction via the clipboard: simulates Ctrl+V.
+// Sets *pasted to false if the clipboard cannot hold the characters or the target does not
+// accept the paste: they are not typed then.
+// Returns false if the execution is cancelled meanwhile.
+executor::Coroutine pasteCharacters(
+	const macro::Instruction& instruction, ExecutionContext* context, clipboard::Paster* paster,
+	bool* pasted);
+
 
-// Each command*() must unescape LPTSTR arg when present.
+// macro::Program::compile() parses and unescapes the arguments of the command*().
+
+// Commands returning executor::Coroutine suspend the task during their delays.
+// They return false if the execution is cancelled meanwhile.
 
 // []
 // Sleep for 100 milliseconds and catch the focus.
 // Convenience alias for [{Focus,100}].
 // Reads & updates input_thread and input_window in the context.
-void commandEmpty(ExecutionContext* context);
+executor::Coroutine commandEmpty(ExecutionContext* context);
 
 // [{Wait,duration}]
 // Sleep for a given number of milliseconds.
-void commandWait(LPTSTR arg);
+executor::Coroutine commandWait(ExecutionContext* context, int duration_ms);
 
 // [{Focus,delay,[!]window_name}]
 // Sleep for delay milliseconds and catch the focus.
 // If window_name does not begin with '!', return false if the window is not found.
+// window_pattern: window_name, compiled.
 // Reads & updates input_thread and input_window in the context.
-bool commandFocus(ExecutionContext* context, LPTSTR arg);
+executor::Coroutine commandFocus(ExecutionContext* context, int delay_ms, LPCTSTR window_name, const WildcardPattern& window_pattern, bool ignore_not_found);
 
 // [{FocusOrLaunch,window_name,command,delay}]
-// Activate window_name.
+// Activate window_name, compiled in window_pattern.
 // If the window is not found, relases any pressed special keys, execute command, then sleep for delay milliseconds.
 // Either way, catch the focus (reads & updates input_thread and input_window in the context).
-void commandFocusOrLaunch(ExecutionContext* context, LPTSTR arg);
+executor::Coroutine commandFocusOrLaunch(ExecutionContext* context, const WildcardPattern& window_pattern, LPCTSTR command, int delay_ms);
+
+// [{Cancel}]
+// Cancel the other text shortcuts running or waiting in the executor.
+void commandCancel(ExecutionContext* context);
 
 // [{Copy,text}]
 // Copy the text argument to the clipboard.
-void commandCopy(LPTSTR arg);
+void commandCopy(LPCTSTR text);
 
 // [{Mouse,state}] where state is 2 letters:
 // 1 letter for button: L (left), M (middle), R (right)
 // 1 letter for state: U (up), D (down)
 // Simulate mouse clicks.
-void commandMouseButton(LPTSTR arg);
+// flags: the mouse_event() flags of the press. click: whether to release the button afterwards.
+void commandMouseButton(ExecutionContext* context, DWORD flags, bool click);
 
 // [{MouseMoveTo,x,y}], [{MouseMoveToFocus,x,y}], [{MouseMoveBy,dx,dy}]
 // Move the mouse cursor.
-// arg: move coordinates relative to origin_point.
-void commandMouseMove(POINT origin_point, LPTSTR arg);
+// x, y: move coordinates relative to origin_point.
+void commandMouseMove(ExecutionContext* context, POINT origin_point, int x, int y);
 
 // [{MouseWheel,offset}]
 // Simulate a mouse wheel scroll.
-void commandMouseWheel(LPTSTR arg);
+// offset: the mouse_event() wheel movement.
+void commandMouseWheel(ExecutionContext* context, int offset);
 
 // [{KeysDown,keystroke}]
 // Keep special keys down.
 // Reads & updates keep_down_unsided_mod_code.
-void commandKeysDown(ExecutionContext* context, LPTSTR arg);
+void commandKeysDown(ExecutionContext* context, DWORD keep_down_mod_code);
+
+// [{Batch,size,delay}]
+// Type the next keystrokes and characters in batches of up to size input events,
+// waiting for delay milliseconds between batches. Disable batching if size is 0.
+// Assumes the batch of the context is empty.
+void commandBatch(ExecutionContext* context, int max_size, int delay_ms);
+
+// [{Pacing,delay}]
+// Wait for delay microseconds between the next simulated input events.
+void commandPacing(ExecutionContext* context, DWORD delay_us);
 
+// [{Paste,min_length}]
+// Paste the next regular characters of at least min_length characters via the clipboard.
+// Never paste if min_length is 0.
+void commandPaste(ExecutionContext* context, int min_length);
 
-// Return whether to continue executing the shortcut.
-bool executeSpecialCommand(LPCTSTR shortcut_start, LPCTSTR& shortcut_end, ExecutionContext* context);
+// [keystroke], [|characters as keystroke|]
+// Simulate a keystroke or keystrokes typing characters, after releasing the special keys.
+void commandKeystroke(ExecutionContext* context, const macro::Instruction& instruction);
+
+// Executes a special command instruction of a program.
+// Returns whether to continue executing the shortcut.
+executor::Coroutine executeSpecialCommand(const macro::Program& program, const macro::Instruction& instruction, ExecutionContext* context);
 
 void executeCommandLine(LPCTSTR command, ExecutionContext* context);
 
-void simulateCharacter(TCHAR c, DWORD keep_down_mod_code);
+// Simulates a keystroke typing a character. If it has no keystroke, types it as Unicode input
+// if canTypeUnicode() and the input is accepted, else simulates Alt + its code.
+// Reads keep_down_mod_code, hotkey_suspension and pacer from the context.
+void simulateCharacter(const ExecutionContext* context, const input::KeyboardLayout& layout, TCHAR c);
+
+// Returns whether the characters without keystroke can be typed as Unicode input events,
+// see input::sendUnicode(): not while Ctrl, Alt or Win are kept down, they would combine.
+bool canTypeUnicode(DWORD keep_down_mod_code);
+
+// Gets the keystroke typing a character in a keyboard layout.
+// Returns false if the character has no keystroke.
+bool getCharacterKeystroke(
+	const input::KeyboardLayout& layout, TCHAR c, DWORD keep_down_mod_code, Keystroke* keystroke);
+
+// Returns the keystroke of a macro::Opcode::kKeystroke instruction,
+// including the special keys kept down.
+Keystroke getInstructionKeystroke(const macro::Instruction& instruction, DWORD keep_down_mod_code);
+
+// Returns whether Keystroke::releaseSpecialKeys() would simulate key releases.
+bool hasSpecialKeysToRelease(const BYTE keyboard_state[], DWORD keep_down_mod_code);
 
 void focusWindow(HWND hwnd);
 
+// Appends the shortcuts of an INI file to the snapshot being built.
+void readShortcuts(LPCTSTR ini_filepath);
+
+// Atomically replaces the current snapshot. Retires the previous one, then deletes
+// the retired snapshots no longer pinned.
+void publishSnapshot(Snapshot* snapshot);
+
+// Returns whether a SnapshotPin currently pins the given snapshot.
+bool isSnapshotPinned(const Snapshot* snapshot);
+
+// Deletes a snapshot and its shortcuts.
+void deleteSnapshot(Snapshot* snapshot);
+
 
 constexpr LPCTSTR kLineSeparator = _T("-\r\n");
 constexpr int kConfigCodeModCodeOffset = 8;
@@ -116,23 +283,206 @@ constexpr int kConfigCodeModCodeOffset = 8;
 }  // namespace
 
 
-void initialize() {
-	s_first_shortcut = s_last_shortcut = nullptr;
-}
+void initialize() {}
 
 void terminate() {
+	if (s_draft_snapshot) {
+		deleteSnapshot(s_draft_snapshot);
+		s_draft_snapshot = nullptr;
+	}
+	
+	while (s_retired_snapshots) {
+		Snapshot *const snapshot = s_retired_snapshots;
+		assert(!isSnapshotPinned(snapshot));
+		s_retired_snapshots = snapshot->next_retired;
+		deleteSnapshot(snapshot);
+	}
+	
+	if (s_snapshot != &s_empty_snapshot) {
+		deleteSnapshot(s_snapshot);
+		s_snapshot = &s_empty_snapshot;
+	}
+}
+
+const Snapshot& getSnapshot() {
+	return *s_snapshot;
 }
 
-Shortcut* getFirst() {
-	return s_first_shortcut;
+const ShortcutTable& getShortcuts() {
+	return s_snapshot->shortcuts;
+}
+
+Shortcut* addShortcut(const Shortcut& shortcut) {
+	if (!s_draft_snapshot) {
+		forkShortcuts();
+	}
+	
+	Shortcut *const copy = s_draft_snapshot->shortcuts.get(s_draft_snapshot->shortcuts.append(shortcut));
+	copy->compilePrograms();
+	copy->compileText();
+	copy->compileCommand();
+	s_draft_snapshot->index.add(copy);
+	return copy;
 }
 
 Shortcut* find(const Keystroke& ks, LPCTSTR program) {
+	return s_snapshot->index.find(ks, program);
+}
+
+
+SnapshotPin::SnapshotPin() {
+	// Claim a free hazard slot, wait for one if they are all used.
+	for (m_slot = 0; InterlockedCompareExchange(&s_hazard_slots_used[m_slot], 1, 0); ) {
+		if (++m_slot == kHazardSlotCount) {
+			m_slot = 0;
+			SwitchToThread();
+		}
+	}
+	
+	// Publish the hazard, then verify that the snapshot is still current: publishSnapshot()
+	// reads the hazards after replacing the snapshot, so it cannot miss this pin.
+	Snapshot *snapshot;
+	do {
+		snapshot = s_snapshot;
+		InterlockedExchangePointer(
+			reinterpret_cast<PVOID volatile*>(&s_hazard_snapshots[m_slot]), snapshot);
+	} while (snapshot != s_snapshot);
+	m_snapshot = snapshot;
+}
+
+SnapshotPin::~SnapshotPin() {
+	InterlockedExchangePointer(reinterpret_cast<PVOID volatile*>(&s_hazard_snapshots[m_slot]), nullptr);
+	InterlockedExchange(&s_hazard_slots_used[m_slot], 0);
+}
+
+namespace {
+
+void publishSnapshot(Snapshot* snapshot) {
+	snapshot->version = s_snapshot->version + 1;
+	Snapshot *const previous = static_cast<Snapshot*>(InterlockedExchangePointer(
+		reinterpret_cast<PVOID volatile*>(&s_snapshot), snapshot));
+	if (previous != &s_empty_snapshot) {
+		previous->next_retired = s_retired_snapshots;
+		s_retired_snapshots = previous;
+	}
+	
+	// Delete the retired snapshots no longer pinned.
+	// New pins cannot pick them since they are no longer current.
+	Snapshot** next_link = &s_retired_snapshots;
+	while (Snapshot *const retired = *next_link) {
+		if (isSnapshotPinned(retired)) {
+			next_link = &retired->next_retired;
+		} else {
+			*next_link = retired->next_retired;
+			deleteSnapshot(retired);
+		}
+	}
+}
+
+bool isSnapshotPinned(const Snapshot* snapshot) {
+	for (const Snapshot* hazard_snapshot : s_hazard_snapshots) {
+		if (hazard_snapshot == snapshot) {
+			return true;
+		}
+	}
+	return false;
+}
+
+void deleteSnapshot(Snapshot* snapshot) {
+	snapshot->shortcuts.clear();
+	snapshot->index.clear();
+	delete snapshot;
+}
+
+}  // namespace
+
+
+void ShortcutIndex::add(Shortcut* shortcut) {
+	if (!m_buckets) {
+		m_buckets = new Bucket[kBucketCount]();
+	}
+	
+	Bucket& bucket = m_buckets[getBucketIndex(*shortcut)];
+	if (bucket.count == bucket.capacity) {
+		const int new_capacity = bucket.capacity ? bucket.capacity * 2 : 4;
+		Shortcut** const new_shortcuts = new Shortcut*[new_capacity];
+		DWORD* const new_packed_keys = new DWORD[new_capacity];
+		DWORD* const new_packed_masks = new DWORD[new_capacity];
+		if (bucket.count) {
+			memcpy(new_shortcuts, bucket.shortcuts, bucket.count * sizeof(Shortcut*));
+			memcpy(new_packed_keys, bucket.packed_keys, bucket.count * sizeof(DWORD));
+			memcpy(new_packed_masks, bucket.packed_masks, bucket.count * sizeof(DWORD));
+		}
+		delete [] bucket.shortcuts;
+		delete [] bucket.packed_keys;
+		delete [] bucket.packed_masks;
+		bucket.shortcuts = new_shortcuts;
+		bucket.packed_keys = new_packed_keys;
+		bucket.packed_masks = new_packed_masks;
+		bucket.capacity = new_capacity;
+	}
+	shortcut->packPattern(&bucket.packed_keys[bucket.count], &bucket.packed_masks[bucket.count]);
+	bucket.shortcuts[bucket.count++] = shortcut;
+}
+
+void ShortcutIndex::remove(const Shortcut* shortcut) {
+	VERIFV(m_buckets);
+	
+	Bucket& bucket = m_buckets[getBucketIndex(*shortcut)];
+	for (int i = 0; i < bucket.count; i++) {
+		if (bucket.shortcuts[i] == shortcut) {
+			// Preserve the order of the other shortcuts.
+			bucket.count--;
+			for (; i < bucket.count; i++) {
+				bucket.shortcuts[i] = bucket.shortcuts[i + 1];
+				bucket.packed_keys[i] = bucket.packed_keys[i + 1];
+				bucket.packed_masks[i] = bucket.packed_masks[i + 1];
+			}
+			return;
+		}
+	}
+}
+
+void ShortcutIndex::clear() {
+	VERIFV(m_buckets);
+	for (int i = 0; i < kBucketCount; i++) {
+		delete [] m_buckets[i].shortcuts;
+		delete [] m_buckets[i].packed_keys;
+		delete [] m_buckets[i].packed_masks;
+	}
+	delete [] m_buckets;
+	m_buckets = nullptr;
+}
+
+Shortcut* const* ShortcutIndex::getBucket(const Keystroke& ks, int* count) const {
+	if (!m_buckets) {
+		*count = 0;
+		return nullptr;
+	}
+	
+	const Bucket& bucket = m_buckets[getBucketIndex(ks)];
+	*count = bucket.count;
+	return bucket.shortcuts;
+}
+
+Shortcut* ShortcutIndex::find(const Keystroke& ks, LPCTSTR program) const {
+	VERIFP(m_buckets, nullptr);
+	const Bucket& bucket = m_buckets[getBucketIndex(ks)];
+	
+	// Filter the shortcuts on their keystroke in batches, then check their programs one by one.
+	const DWORD packed = ks.pack();
 	Shortcut *best_shortcut = nullptr;
-	for (Shortcut* sh = getFirst(); sh; sh = sh->getNext()) {
-		if (sh->isSubset(ks, program)) {
+	for (int i = 0;
+			(i = Keystroke::findPackedMatch(packed, bucket.packed_keys, bucket.packed_masks, i, bucket.count)) < bucket.count;
+			i++) {
+		Shortcut *const sh = bucket.shortcuts[i];
+		assert(sh->Keystroke::isSubset(ks));
+		if (sh->matchesProgram(program)) {
 			// Pick the first matching shortcut, but give precedence to m_programs_only = true.
-			if (!best_shortcut || (!best_shortcut->m_programs_only && sh->m_programs_only)) {
+			if (sh->m_programs_only) {
+				return sh;
+			}
+			if (!best_shortcut) {
 				best_shortcut = sh;
 			}
 		}
@@ -140,6 +490,119 @@ Shortcut* find(const Keystroke& ks, LPCTSTR program) {
 	return best_shortcut;
 }
 
+Shortcut* ShortcutIndex::findConflict(const Shortcut& shortcut) const {
+	int count;
+	Shortcut* const* const shortcuts = getBucket(shortcut, &count);
+	
+	for (int i = 0; i < count; i++) {
+		Shortcut *const sh = shortcuts[i];
+		if (sh != &shortcut && sh->testConflict(shortcut)) {
+			return sh;
+		}
+	}
+	return nullptr;
+}
+
+void ShortcutIndex::swap(ShortcutIndex& other) {
+	Bucket *const buckets = m_buckets;
+	m_buckets = other.m_buckets;
+	other.m_buckets = buckets;
+}
+
+void ShortcutIndex::registerHotKeysMissingFrom(const ShortcutIndex& other) const {
+	forEachKeystrokeMissingFrom(other, [](const Shortcut& shortcut) {
+		shortcut.registerHotKey();
+	});
+}
+
+void ShortcutIndex::unregisterHotKeysMissingFrom(const ShortcutIndex& other) const {
+	forEachKeystrokeMissingFrom(other, [](const Shortcut& shortcut) {
+		shortcut.unregisterHotKey();
+	});
+}
+
+template<typename Callback>
+void ShortcutIndex::forEachKeystrokeMissingFrom(const ShortcutIndex& other, Callback callback) const {
+	VERIFV(m_buckets);
+	for (int i = 0; i < kBucketCount; i++) {
+		if (m_buckets[i].count && !(other.m_buckets && other.m_buckets[i].count)) {
+			callback(*m_buckets[i].shortcuts[0]);
+		}
+	}
+}
+
+
+// The DEBUG_NEW macro does not support placement new.
+#pragma push_macro("new")
+#undef new
+
+ShortcutTable::Handle ShortcutTable::append() {
+	::new(allocateSlot()) Shortcut;
+	return m_size - 1;
+}
+
+ShortcutTable::Handle ShortcutTable::append(const Shortcut& shortcut) {
+	::new(allocateSlot()) Shortcut(shortcut);
+	return m_size - 1;
+}
+
+#pragma pop_macro("new")
+
+void* ShortcutTable::allocateSlot() {
+	const int chunk_index = m_size >> kChunkShift;
+	if (chunk_index == m_chunk_capacity) {
+		const int new_chunk_capacity = m_chunk_capacity ? m_chunk_capacity * 2 : 4;
+		Chunk** const new_chunks = new Chunk*[new_chunk_capacity];
+		if (m_chunk_capacity) {
+			memcpy(new_chunks, m_chunks, m_chunk_capacity * sizeof(Chunk*));
+		}
+		delete [] m_chunks;
+		m_chunks = new_chunks;
+		m_chunk_capacity = new_chunk_capacity;
+	}
+	
+	const int slot_index = m_size & (kChunkSize - 1);
+	if (!slot_index) {
+		m_chunks[chunk_index] = new Chunk;
+		m_chunks[chunk_index]->live_mask = 0;
+	}
+	
+	Chunk& chunk = *m_chunks[chunk_index];
+	chunk.live_mask |= ULONGLONG(1) << slot_index;
+	m_size++;
+	m_count++;
+	return chunk.slots[slot_index];
+}
+
+void ShortcutTable::remove(Handle handle) {
+	Shortcut *const shortcut = get(handle);
+	VERIFV(shortcut);
+	
+	shortcut->~Shortcut();
+	m_chunks[handle >> kChunkShift]->live_mask &= ~(ULONGLONG(1) << (handle & (kChunkSize - 1)));
+	m_count--;
+}
+
+void ShortcutTable::clear() {
+	for (Shortcut& shortcut : *this) {
+		shortcut.~Shortcut();
+	}
+	const int chunk_count = (m_size + kChunkSize - 1) >> kChunkShift;
+	for (int i = 0; i < chunk_count; i++) {
+		delete m_chunks[i];
+	}
+	delete [] m_chunks;
+	m_chunks = nullptr;
+	m_chunk_capacity = m_size = m_count = 0;
+}
+
+void ShortcutTable::swap(ShortcutTable& other) {
+	std::swap(m_chunks, other.m_chunks);
+	std::swap(m_chunk_capacity, other.m_chunk_capacity);
+	std::swap(m_size, other.m_size);
+	std::swap(m_count, other.m_count);
+}
+
 
 Shortcut::Shortcut(const Shortcut& sh)
 	: Keystroke(sh),
@@ -153,12 +616,17 @@ Shortcut::Shortcut(const Shortcut& sh)
 	m_directory(sh.m_directory),
 	
 	m_programs(sh.m_programs),
-	m_usage_count(sh.m_usage_count),
 	
-	m_next_shortcut(nullptr),
+	m_program_set(sh.m_program_set),
+	m_macro(sh.m_macro),
+	m_command_line(sh.m_command_line),
+	
+	m_stats(sh.m_stats),
 	
 	m_small_icon_index(sh.m_small_icon_index),
-	m_icon(CopyIcon(sh.m_icon)) {}
+	m_icon(CopyIcon(sh.m_icon)) {
+	InterlockedIncrement(&m_stats->ref_count);
+}
 
 Shortcut::Shortcut(const Keystroke& ks)
 	: Keystroke(ks),
@@ -166,21 +634,19 @@ Shortcut::Shortcut(const Keystroke& ks)
 	m_show_option(SW_NORMAL),
 	m_programs_only(false),
 	
-	m_usage_count(0),
-	
-	m_next_shortcut(nullptr),
+	m_stats(new ShortcutStats{
+		.id = InterlockedIncrement(&s_last_shortcut_id),
+		.usage_count = 0,
+		.dispatch_stats = nullptr,
+		.ref_count = 1,
+	}),
 	
 	m_small_icon_index(kIconNeeded),
 	m_icon(NULL) {}
 
-
-void Shortcut::addToList() {
-	if (s_last_shortcut == nullptr) {
-		s_first_shortcut = this;
-	} else {
-		s_last_shortcut->m_next_shortcut = this;
-	}
-	s_last_shortcut = this;
+Shortcut::~Shortcut() {
+	clearIcons();
+	releaseStats(m_stats);
 }
 
 
@@ -260,7 +726,7 @@ void Shortcut::save(HANDLE file) {
 	}
 	
 	TCHAR strbuf_usage_count[i18n::kIntegerBufSize];
-	wsprintf(strbuf_usage_count, _T("%d"), m_usage_count);
+	wsprintf(strbuf_usage_count, _T("%d"), getUsageCount());
 	lines[line_count++] = { .key_token = Token::kUsageCount, .value = strbuf_usage_count };
 	
 	// Write all
@@ -383,6 +849,11 @@ bool Shortcut::load(LPTSTR* input) {
 				}
 				break;
 			
+			// Default delay between simulated input events
+			case Token::kPacing:
+				pacing::setDefaultEventDelay(DWORD(std::max(StrToInt(next_sep), 0)));
+				break;
+			
 			// Shortcut
 			case Token::kShortcut:
 				Keystroke::parseDisplayName(next_sep);
@@ -457,7 +928,7 @@ bool Shortcut::load(LPTSTR* input) {
 			
 			// Usage count
 			case Token::kUsageCount:
-				m_usage_count = std::max(0, StrToInt(next_sep));
+				setUsageCount(std::max(0, StrToInt(next_sep)));
 				break;
 			
 			// Ignore the other tokens.
@@ -472,46 +943,133 @@ bool Shortcut::load(LPTSTR* input) {
 	// No conflict between shortcuts, except concerning programs:
 	// there can be one programs-conditions-less shortcut
 	// and any count of shortcuts having different programs conditions
-	String *const programs = getPrograms();
-	bool ok = true;
-	for (Shortcut* sh = getFirst(); sh; sh = sh->getNext()) {
-		if (sh->testConflict(*this, programs, m_programs_only)) {
-			ok = false;
+	compilePrograms();
+	compileText();
+	compileCommand();
+	return !s_draft_snapshot->index.findConflict(*this);
+}
+
+
+void Shortcut::execute(metrics::Dispatch* dispatch) {
+	const bool can_release_special_keys = dispatch && canReleaseSpecialKeys();
+	
+	if (dispatch) {
+		InterlockedIncrement(&m_stats->usage_count);
+		
+		if (m_type == Type::kText) {
+			// Run the text in the executor: its delays must not block the dispatch thread.
+			// The task continues the dispatch, the outputs of the dispatch thread are over.
+			// Key the tasks by the identifier: the copies of the shortcut share their lane.
+			dispatch->suspendExecution();
+			executor::submit(
+				reinterpret_cast<const void*>(INT_PTR(getId())),
+				new TextTask(*this, can_release_special_keys, m_stats, *dispatch),
+				m_macro.getAdmission());
+			return;
+		}
+	}
+	
+	ExecutionContext context;
+	GetKeyboardState(context.keyboard_state);
+	context.task = nullptr;
+	prepareExecution(&context, m_vk, can_release_special_keys);
+	
+	switch (m_type) {
+		case Type::kCommand: {
+			// Required because the launched program
+			// can be a script that simulates keystrokes
+			if (can_release_special_keys) {
+				releaseSpecialKeys(context.keyboard_state, /* keep_down_mod_code= */ 0);
+			}
+			
+			metrics::markOutput();
+			ShellExecuteThread *const shell_execute_thread =
+				new ShellExecuteThread(m_command_line, m_show_option);
+			startThread(shell_execute_thread->thread, shell_execute_thread);
 			break;
 		}
+		
+		case Type::kText:
+			typeText(m_macro, &context).runSynchronously();
+			break;
 	}
-	delete [] programs;
 	
-	return ok;
+	if (dispatch) {
+		dispatch->endExecution();
+		recordDispatch(m_stats, *dispatch);
+	}
 }
 
+namespace {
 
-void Shortcut::execute(bool from_hotkey) {
-	if (from_hotkey) {
-		m_usage_count++;
-	}
-	
+TextTask::TextTask(const Shortcut& shortcut, bool can_release_special_keys,
+		ShortcutStats* stats, const metrics::Dispatch& dispatch)
+		: m_vk(shortcut.m_vk), m_can_release_special_keys(can_release_special_keys),
+			m_macro(shortcut.getMacro()), m_stats(stats), m_hotkey_dispatch(dispatch) {
+	// Capture the keyboard state now: it reflects the hotkey in the dispatch thread.
+	GetKeyboardState(m_keyboard_state);
+	InterlockedIncrement(&m_stats->ref_count);
+	m_dispatch = &m_hotkey_dispatch;
+}
+
+TextTask::~TextTask() {
+	m_hotkey_dispatch.endExecution();
+	recordDispatch(m_stats, m_hotkey_dispatch);
+	releaseStats(m_stats);
+}
+
+executor::Coroutine TextTask::run() {
 	ExecutionContext context;
-	GetKeyboardState(context.keyboard_state);
-	context.keep_down_mod_code = 0;
+	memcpy(context.keyboard_state, m_keyboard_state, sizeof(m_keyboard_state));
+	context.task = this;
+	prepareExecution(&context, m_vk, m_can_release_special_keys);
+	co_return co_await typeText(m_macro, &context);
+}
+
+
+void releaseStats(ShortcutStats* stats) {
+	if (!InterlockedDecrement(&stats->ref_count)) {
+		delete stats->dispatch_stats;
+		delete stats;
+	}
+}
+
+void recordDispatch(ShortcutStats* stats, const metrics::Dispatch& dispatch) {
+	// The dispatch thread and the executor record dispatches concurrently:
+	// publish the allocation atomically.
+	metrics::DispatchStats* dispatch_stats = stats->dispatch_stats;
+	if (!dispatch_stats) {
+		metrics::DispatchStats *const new_stats = new metrics::DispatchStats();
+		dispatch_stats = static_cast<metrics::DispatchStats*>(InterlockedCompareExchangePointer(
+			reinterpret_cast<PVOID volatile*>(&stats->dispatch_stats), new_stats, nullptr));
+		if (dispatch_stats) {
+			delete new_stats;
+		} else {
+			dispatch_stats = new_stats;
+		}
+	}
+	dispatch.record(dispatch_stats);
+}
+
+
+void prepareExecution(ExecutionContext* context, BYTE vk, bool can_release_special_keys) {
+	context->keep_down_mod_code = 0;
 	
 	// Typing simulation requires the application has the keyboard focus
-	Keystroke::catchKeyboardFocus(&context.input_window, &context.input_thread);
-	
-	const bool can_release_special_keys = from_hotkey && canReleaseSpecialKeys();
+	Keystroke::catchKeyboardFocus(&context->input_window, &context->input_thread);
 	
 	if (can_release_special_keys) {
 		BYTE new_keyboard_state[256];
-		memcpy(new_keyboard_state, context.keyboard_state, sizeof(context.keyboard_state));
+		memcpy(new_keyboard_state, context->keyboard_state, sizeof(context->keyboard_state));
 		
 		// Simulate special keys release via SetKeyboardState, to avoid side effects.
 		// Avoid to leave Alt and Shift down, alone, at the same time
 		// because it is one of Windows keyboard layout shortcut:
 		// simulate Ctrl down, release Alt and Shift, then release Ctrl
 		bool release_control = false;
-		if ((context.keyboard_state[VK_MENU] & kKeyDownMask) &&
-				(context.keyboard_state[VK_SHIFT] & kKeyDownMask) &&
-				!(context.keyboard_state[VK_CONTROL] & kKeyDownMask)) {
+		if ((context->keyboard_state[VK_MENU] & kKeyDownMask) &&
+				(context->keyboard_state[VK_SHIFT] & kKeyDownMask) &&
+				!(context->keyboard_state[VK_CONTROL] & kKeyDownMask)) {
 			release_control = true;
 			keybdEvent(VK_CONTROL, /* down= */ true);
 			new_keyboard_state[VK_CONTROL] = kKeyDownMask;
@@ -522,182 +1080,328 @@ void Shortcut::execute(bool from_hotkey) {
 			new_keyboard_state[special_key.vk_left] =
 			new_keyboard_state[special_key.vk_right] = 0;
 		}
-		new_keyboard_state[m_vk] = 0;
+		new_keyboard_state[vk] = 0;
 		SetKeyboardState(new_keyboard_state);
 		
 		if (release_control) {
 			keybdEvent(VK_CONTROL, /* down= */ false);
 		}
 	}
+}
+
+
+executor::Coroutine typeText(const macro::Program& program, ExecutionContext* context) {
+	// Whether to let the target process the simulated keystrokes before posting characters:
+	// at the start of the text, and after each keystroke or [].
+	bool pause_before_chars = true;
 	
-	switch (m_type) {
-		case Type::kCommand: {
-			// Required because the launched program
-			// can be a script that simulates keystrokes
-			if (can_release_special_keys) {
-				releaseSpecialKeys(context.keyboard_state, /* keep_down_mod_code= */ 0);
+	// Declared before the batch: restores the hotkeys after the last batch.
+	HotKeySuspension hotkey_suspension;
+	context->hotkey_suspension = &hotkey_suspension;
+	
+	input::InputBatch batch(&hotkey_suspension);
+	context->batch = &batch;
+	context->batch_delay_ms = 0;
+	
+	pacing::Pacer pacer;
+	context->pacer = &pacer;
+	
+	// Throttles the regular characters posted as WM_CHAR to the rate the target sustains.
+	pacing::FlowControl flow_control;
+	
+	// Pastes the long regular characters via the clipboard.
+	clipboard::Paster paster;
+	context->paste_min_length = kDefaultPasteMinLength;
+	
+	for (const macro::Instruction* instruction = program.begin(); instruction != program.end();
+			instruction = instruction->getNext()) {
+		const bool pasted = isPasted(*instruction, context);
+		const bool batched = isBatched(*instruction, context);
+		if (pasted || batched || instruction->opcode != macro::Opcode::kChars) {
+			// Keep the input in order: let the target process the posted characters first.
+			flow_control.drain();
+		}
+		
+		if (pasted) {
+			batch.send();
+			pause_before_chars = true;  // After Ctrl+V.
+			bool pasted_characters;
+			if (!co_await pasteCharacters(*instruction, context, &paster, &pasted_characters)) {
+				break;
 			}
-			
-			clipboardToEnvironment();
-			ShellExecuteThread *const shell_execute_thread =
-				new ShellExecuteThread(m_command, m_directory, m_show_option);
-			startThread(shell_execute_thread->thread, shell_execute_thread);
-			break;
+			if (pasted_characters) {
+				continue;
+			}
+			// The clipboard cannot hold the characters or the target ignored Ctrl+V: type them instead.
 		}
 		
-		case Type::kText:
-			// Special keys to keep down across commands.
-			
-			LastTextExecution lastTextExecution = LastTextExecution::None;
+		if (batched) {
+			pause_before_chars = true;
+			if (!co_await typeBatched(*instruction, context)) {
+				break;
+			}
+			continue;
+		}
+		
+		// Keep the input in order: send the batched input before any other input.
+		batch.send();
+		
+		if (instruction->opcode == macro::Opcode::kChars) {
+			// Regular characters: send WM_CHAR.
+			if (pause_before_chars) {
+				pause_before_chars = false;
+				pacer.pause();
+			}
 			
-			// Send the text to the window
-			bool escaping = false;  // whether the next character is '\'-escaped
-			LPCTSTR text = m_text;
-			for (size_t i = 0; text[i]; i++) {
-				const WORD c = WORD(text[i]);
-				if (c == _T('\n')) {
-					// Skip '\n': redundant with the expected '\r'.
-					continue;
-				}
+			const input::KeyboardLayout layout = input::KeyboardLayout::getCurrent();
+			flow_control.setTarget(context->input_window);
+			bool can_continue = true;
+			for (LPCTSTR chr = instruction->getString(0); *chr && can_continue; chr++) {
+				const WORD c = WORD(*chr);
+				const WORD vkMask = layout.vkKeyScan(*chr);
+				metrics::markOutput();
+				PostMessage(context->input_window, WM_CHAR, c,
+					MAKELPARAM(1, layout.vkToScanCode(LOBYTE(vkMask))));
 				
-				if (!escaping && c == _T('\\')) {
-					escaping = true;
-					continue;
-				}
-				
-				if (escaping || c != _T('[')) {
-					// Regular character: send WM_CHAR.
-					if (lastTextExecution != LastTextExecution::Text) {
-						lastTextExecution = LastTextExecution::Text;
-						sleepBackground(0);
-					}
-					
-					escaping = false;
-					const WORD vkMask = VkKeyScan(c);
-					PostMessage(context.input_window, WM_CHAR, c,
-						MAKELPARAM(1, MapVirtualKey(LOBYTE(vkMask), 0)));
-					
-				} else {
-					// '[': inline shortcut, or inline command line execution
-					
-					// Extract the inside of the shortcut.
-					// Take into account '\' escaping to detect the end of the shortcut, but do not unescape.
-					const LPCTSTR shortcut_start = text + i + 1;
-					const TCHAR *shortcut_end = shortcut_start;
-					bool escaping2 = false;
-					while (*shortcut_end && !(*shortcut_end == _T(']') && !escaping2)) {
-						escaping2 = !escaping2 && (*shortcut_end == _T('\\'));
-						shortcut_end++;
-					}
-					if (!*shortcut_end) {
-						// Non-terminated command.
-						break;
-					}
-					
-					if (!executeSpecialCommand(shortcut_start, shortcut_end, &context)) {
-						break;
-					}
-					
-					i = shortcut_end - text;
+				// Let the tasks of the other shortcuts run after each window of characters.
+				if (flow_control.onPosted()) {
+					can_continue = co_await executor::sleep(context->task, 0);
 				}
 			}
 			
-			// Release all special keys kept down in case the shortcut doesn't end with [{KeysDown}].
-			releaseSpecialKeys(context.keyboard_state, /* keep_down_mode_code= */ ~context.keep_down_mod_code);
+			// Same after each run of characters.
+			if (!can_continue || !co_await executor::sleep(context->task, 0)) {
+				break;
+			}
+			continue;
+		}
+		
+		if (isCancelled(context) || !co_await executeSpecialCommand(program, *instruction, context)) {
 			break;
+		}
+		switch (instruction->opcode) {
+			case macro::Opcode::kEmpty:
+			case macro::Opcode::kKeystroke:
+			case macro::Opcode::kKeystrokeChars:
+				pause_before_chars = true;
+				break;
+			
+			default:
+				break;
+		}
 	}
+	
+	flow_control.drain();
+	batch.send();
+	context->batch = nullptr;
+	context->hotkey_suspension = nullptr;
+	context->pacer = nullptr;
+	
+	// Release all special keys kept down in case the shortcut doesn't end with [{KeysDown}].
+	Shortcut::releaseSpecialKeys(context->keyboard_state, /* keep_down_mode_code= */ ~context->keep_down_mod_code);
+	co_return !isCancelled(context);
 }
 
-namespace {
 
-bool executeSpecialCommand(LPCTSTR shortcut_start, LPCTSTR& shortcut_end, ExecutionContext* context) {
-	String inside(shortcut_start, int(shortcut_end - shortcut_start));
+bool isCancelled(const ExecutionContext* context) {
+	return context->task && context->task->isCancelled();
+}
+
+
+bool isPasted(const macro::Instruction& instruction, const ExecutionContext* context) {
+	return instruction.opcode == macro::Opcode::kChars && context->paste_min_length &&
+		instruction.args[0] >= context->paste_min_length && !context->keep_down_mod_code;
+}
+
+
+executor::Coroutine pasteCharacters(
+		const macro::Instruction& instruction, ExecutionContext* context, clipboard::Paster* paster,
+		bool* pasted) {
+	Shortcut::releaseSpecialKeys(context->keyboard_state, context->keep_down_mod_code);
+	*pasted = paster->offer(instruction.getString(0), instruction.args[0]);
+	if (!*pasted) {
+		co_return true;
+	}
+	
+	Keystroke paste_keystroke;
+	paste_keystroke.m_vk = 'V';
+	paste_keystroke.m_sided_mod_code = MOD_CONTROL;
+	paste_keystroke.simulateTyping(
+		/* already_down_mod_code= */ 0, context->hotkey_suspension, context->pacer);
+	const bool can_continue = co_await paster->finish(context->task);
+	*pasted = paster->isRequested();
+	co_return can_continue;
+}
+
+
+bool isBatched(const macro::Instruction& instruction, const ExecutionContext* context) {
+	if (!context->batch->isEnabled()) {
+		return false;
+	}
 	
-	if (inside.isEmpty()) {
-		// []
+	switch (instruction.opcode) {
+		case macro::Opcode::kChars:
+			// Regular characters ignore the special keys kept down: WM_CHAR does.
+			return !context->keep_down_mod_code;
 		
-		context->lastTextExecution = LastTextExecution::None;
-		commandEmpty(context);
-		return true;
+		case macro::Opcode::kKeystroke:
+		case macro::Opcode::kKeystrokeChars:
+			return true;
+		
+		default:
+			return false;
+	}
+}
+
+
+executor::Coroutine typeBatched(const macro::Instruction& instruction, ExecutionContext* context) {
+	input::InputBatch *const batch = context->batch;
+	if (instruction.opcode != macro::Opcode::kChars && isCancelled(context)) {
+		co_return false;
+	}
+	
+	// Release the special keys not kept down, like commandKeystroke(). Required for the regular
+	// characters too: unlike WM_CHAR, the simulated keystrokes combine with the pressed keys.
+	if (hasSpecialKeysToRelease(context->keyboard_state, context->keep_down_mod_code)) {
+		batch->send();
+		Keystroke::releaseSpecialKeys(context->keyboard_state, context->keep_down_mod_code);
+	}
+	
+	const DWORD keep_down_mod_code = context->keep_down_mod_code;
+	if (instruction.opcode == macro::Opcode::kKeystroke) {
+		const Keystroke keystroke = getInstructionKeystroke(instruction, keep_down_mod_code);
+		if (!batch->addKeystroke(keystroke, keep_down_mod_code)) {
+			if (!co_await sendFullBatch(context)) {
+				co_return false;
+			}
+			batch->addKeystroke(keystroke, keep_down_mod_code);
+		}
+		co_return true;
+	}
+	
+	const input::KeyboardLayout layout = input::KeyboardLayout::getCurrent();
+	for (LPCTSTR chr = instruction.getString(0); *chr; chr++) {
+		Keystroke keystroke;
+		if (!getCharacterKeystroke(layout, *chr, keep_down_mod_code, &keystroke)) {
+			if (!canTypeUnicode(keep_down_mod_code)) {
+				// The character has no keystroke: simulate Alt + code, without batching.
+				batch->send();
+				simulateCharacter(context, layout, *chr);
+			} else if (!batch->addUnicode(*chr)) {
+				if (!co_await sendFullBatch(context)) {
+					co_return false;
+				}
+				batch->addUnicode(*chr);
+			}
+			continue;
+		}
+		
+		if (!batch->addKeystroke(keystroke, keep_down_mod_code)) {
+			if (!co_await sendFullBatch(context)) {
+				co_return false;
+			}
+			batch->addKeystroke(keystroke, keep_down_mod_code);
+		}
 	}
+	co_return true;
+}
+
+
+executor::Coroutine sendFullBatch(ExecutionContext* context) {
+	context->batch->send();
 	
-	if (*shortcut_start == _T('[') && *shortcut_end == _T(']')) {
-		// Double brackets: [[command line]]
+	// Let the tasks of the other shortcuts run after each batch, even without delay.
+	co_return co_await executor::sleep(context->task, context->batch_delay_ms);
+}
+
+
+executor::Coroutine executeSpecialCommand(const macro::Program& program, const macro::Instruction& instruction, ExecutionContext* context) {
+	const int* const args = instruction.args;
+	switch (instruction.opcode) {
+		case macro::Opcode::kEmpty:
+			co_return co_await commandEmpty(context);
 		
-		shortcut_end++;
-		const LPTSTR command_line = &inside[1];
-		unescape(command_line);
+		case macro::Opcode::kCommandLine:
+			executeCommandLine(instruction.getString(0), context);
+			break;
+		
+		case macro::Opcode::kWait:
+			co_return co_await commandWait(context, args[0]);
 		
-		executeCommandLine(command_line, context);
+		case macro::Opcode::kFocus:
+			co_return co_await commandFocus(
+				context, args[0], instruction.getString(0), program.getWindowPattern(instruction),
+				/* ignore_not_found= */ toBool(args[1]));
 		
-	} else if (*shortcut_start == _T('{') && shortcut_end[-1] == _T('}')) {
-		// Braces: [{command}]
+		case macro::Opcode::kFocusOrLaunch:
+			co_return co_await commandFocusOrLaunch(
+				context, program.getWindowPattern(instruction), instruction.getString(1), args[0]);
 		
-		inside[inside.getLength() - 1] = _T('\0');
-		LPTSTR arg = &inside[1];
+		case macro::Opcode::kCancel:
+			commandCancel(context);
+			break;
 		
-		// To support comma escaping, unescape the arguments one-by-one.
-		const LPCTSTR command = parseCommaSepArgUnescape(arg);
+		case macro::Opcode::kCopy:
+			commandCopy(instruction.getString(0));
+			break;
 		
-		if (!lstrcmpi(command, _T("Wait"))) {
-			commandWait(arg);
-		} else if (!lstrcmpi(command, _T("Focus"))) {
-			return commandFocus(context, arg);
-		} else if (!lstrcmpi(command, _T("FocusOrLaunch"))) {
-			commandFocusOrLaunch(context, arg);
-		} else if (!lstrcmpi(command, _T("Copy"))) {
-			commandCopy(arg);
-		} else if (!lstrcmpi(command, _T("MouseButton"))) {
-			commandMouseButton(arg);
-		} else if (!lstrcmpi(command, _T("MouseMoveTo"))) {
+		case macro::Opcode::kMouseButton:
+			commandMouseButton(context, DWORD(args[0]), /* click= */ toBool(args[1]));
+			break;
+		
+		case macro::Opcode::kMouseMoveTo: {
 			const POINT origin_point = { 0, 0 };
-			commandMouseMove(origin_point, arg);
-		} else if (!lstrcmpi(command, _T("MouseMoveToFocus"))) {
+			commandMouseMove(context, origin_point, args[0], args[1]);
+			break;
+		}
+		
+		case macro::Opcode::kMouseMoveToFocus: {
 			RECT focused_window_rect;
 			const HWND hwnd_owner = GetAncestor(context->input_window, GA_ROOT);
 			if (!hwnd_owner || !GetWindowRect(hwnd_owner, &focused_window_rect)) {
 				focused_window_rect.left = focused_window_rect.top = 0;
 			}
-			commandMouseMove(reinterpret_cast<const POINT&>(focused_window_rect), arg);
-		} else if (!lstrcmpi(command, _T("MouseMoveBy"))) {
+			commandMouseMove(context, reinterpret_cast<const POINT&>(focused_window_rect), args[0], args[1]);
+			break;
+		}
+		
+		case macro::Opcode::kMouseMoveBy: {
 			POINT origin_point;
 			GetCursorPos(&origin_point);
-			commandMouseMove(origin_point, arg);
-		} else if (!lstrcmpi(command, _T("MouseWheel"))) {
-			commandMouseWheel(arg);
-		} else if (!lstrcmpi(command, _T("KeysDown"))) {
-			commandKeysDown(context, arg);
+			commandMouseMove(context, origin_point, args[0], args[1]);
+			break;
 		}
-	} else {
-		// Simple brackets: [keystroke]
 		
-		Shortcut::releaseSpecialKeys(context->keyboard_state, context->keep_down_mod_code);
+		case macro::Opcode::kMouseWheel:
+			commandMouseWheel(context, args[0]);
+			break;
 		
-		context->lastTextExecution = LastTextExecution::Keystroke;
+		case macro::Opcode::kKeysDown:
+			commandKeysDown(context, DWORD(args[0]));
+			break;
 		
-		if (*shortcut_start == _T('|') && shortcut_end[-1] == _T('|')) {
-			// Brackets and pipe: [|characters as keystroke|]
-			
-			inside[inside.getLength() - 1] = _T('\0');
-			unescape(inside.get());
-			for (LPCTSTR chr_ptr = inside; *++chr_ptr;) {
-				if (*chr_ptr != _T('\n')) {  // '\n' is redundant with '\r'.
-					simulateCharacter(*chr_ptr, context->keep_down_mod_code);
-				}
-			}
-			
-		} else {
-			// Simple brackets: [keystroke]
-			
-			unescape(inside.get());
-			Keystroke keystroke;
-			keystroke.parseDisplayName(inside.get());
-			keystroke.m_sided_mod_code |= context->keep_down_mod_code;
-			keystroke.simulateTyping(/* already_down_mod_code= */ context->keep_down_mod_code);
-		}
+		case macro::Opcode::kBatch:
+			commandBatch(context, args[0], args[1]);
+			break;
+		
+		case macro::Opcode::kPacing:
+			commandPacing(context, DWORD(args[0]));
+			break;
+		
+		case macro::Opcode::kPaste:
+			commandPaste(context, args[0]);
+			break;
+		
+		case macro::Opcode::kKeystroke:
+		case macro::Opcode::kKeystrokeChars:
+			commandKeystroke(context, instruction);
+			break;
+		
+		default:
+			break;
 	}
 	
-	return true;
+	co_return true;
 }
 
 
@@ -705,22 +1409,33 @@ void executeCommandLine(LPCTSTR command, ExecutionContext* context) {
 	// Required because the command can be a script that simulates keystrokes.
 	Keystroke::releaseSpecialKeys(context->keyboard_state, context->keep_down_mod_code);
 	
-	clipboardToEnvironment();
+	// Launch in a thread, like the command shortcuts: the DDE wait must not block the executor.
+	metrics::markOutput();
 	shellExecuteCmdLine(command, /* directory= */ nullptr, SW_SHOWDEFAULT);
 }
 
 
-void simulateCharacter(TCHAR c, DWORD keep_down_mod_code) {
+void simulateCharacter(const ExecutionContext* context, const input::KeyboardLayout& layout, TCHAR c) {
+	const DWORD keep_down_mod_code = context->keep_down_mod_code;
+	HotKeySuspension *const hotkey_suspension = context->hotkey_suspension;
+	pacing::Pacer *const pacer = context->pacer;
+	
 	Keystroke ks;
-	const WORD key = VkKeyScan(c);
-	if (key == WORD(-1)) {
-		// The character has no keystroke: simulate Alt + code.
+	if (!getCharacterKeystroke(layout, c, keep_down_mod_code, &ks)) {
+		// The character has no keystroke: type it as Unicode input: 2 events instead of up to 12.
+		if (canTypeUnicode(keep_down_mod_code) && input::sendUnicode(c)) {
+			pacer->pause();
+			return;
+		}
+		
+		// Unicode input unavailable: simulate Alt + code.
 		
 		// Press Alt.
 		ks.m_vk = VK_MENU;
 		ks.m_sided_mod_code = 0;
-		const bool alt_is_hotkey = ks.unregisterHotKey();
-		const BYTE scan_code_alt = BYTE(MapVirtualKey(VK_MENU, MAPVK_VK_TO_VSC));
+		hotkey_suspension->suspend(ks);
+		const BYTE scan_code_alt = BYTE(layout.vkToScanCode(VK_MENU));
+		metrics::markOutput();
 		keybd_event(VK_MENU, scan_code_alt, 0, 0);
 		ks.m_sided_mod_code = MOD_ALT;
 		
@@ -734,7 +1449,8 @@ void simulateCharacter(TCHAR c, DWORD keep_down_mod_code) {
 			// Works only if HKEY_CURRENT_USER\Control Panel\Input Method
 			// contains EnableHexNumpad = 1.
 			ks.m_vk = VK_ADD;
-			ks.simulateTyping(/* already_down_mod_code= */ keep_down_mod_code | MOD_ALT);
+			ks.simulateTyping(
+				/* already_down_mod_code= */ keep_down_mod_code | MOD_ALT, hotkey_suspension, pacer);
 			wsprintfA(digits, "%04X", uc);
 		}
 		
@@ -742,35 +1458,65 @@ void simulateCharacter(TCHAR c, DWORD keep_down_mod_code) {
 		for (size_t i = 0; digits[i]; i++) {
 			char digit = digits[i];
 			ks.m_vk = ('0' <= digit && digit <= '9') ? (VK_NUMPAD0 + (digit - '0')) : digit;
-			ks.simulateTyping(/* already_down_mod_code= */ keep_down_mod_code | MOD_ALT);
+			ks.simulateTyping(
+				/* already_down_mod_code= */ keep_down_mod_code | MOD_ALT, hotkey_suspension, pacer);
 		}
 		
 		// Release Alt.
 		if (!(keep_down_mod_code & MOD_ALT)) {
 			keybd_event(VK_MENU, scan_code_alt, KEYEVENTF_KEYUP, /* dwExtraInfo= */ 0);
 		}
-		if (alt_is_hotkey) {
-			ks.registerHotKey();
-		}
 		
 	} else {
 		// The character has a keystroke: simulate it.
-		
-		const BYTE flags = HIBYTE(key);
-		ks.m_vk = LOBYTE(key);
-		ks.m_sided_mod_code = keep_down_mod_code;
-		if (flags & (1 << 0)) {
-			ks.m_sided_mod_code |= MOD_SHIFT;
-		}
-		if (flags & (1 << 1)) {
-			ks.m_sided_mod_code |= MOD_CONTROL;
-		}
-		if (flags & (1 << 2)) {
-			ks.m_sided_mod_code |= MOD_ALT;
+		ks.simulateTyping(/* already_down_mod_code= */ keep_down_mod_code, hotkey_suspension, pacer);
+	}
+}
+
+
+bool canTypeUnicode(DWORD keep_down_mod_code) {
+	return !(keep_down_mod_code & ~MOD_SHIFT);
+}
+
+
+bool getCharacterKeystroke(
+		const input::KeyboardLayout& layout, TCHAR c, DWORD keep_down_mod_code, Keystroke* keystroke) {
+	const WORD key = layout.vkKeyScan(c);
+	VERIF(key != WORD(-1));
+	
+	const BYTE flags = HIBYTE(key);
+	keystroke->m_vk = LOBYTE(key);
+	keystroke->m_sided_mod_code = keep_down_mod_code;
+	if (flags & (1 << 0)) {
+		keystroke->m_sided_mod_code |= MOD_SHIFT;
+	}
+	if (flags & (1 << 1)) {
+		keystroke->m_sided_mod_code |= MOD_CONTROL;
+	}
+	if (flags & (1 << 2)) {
+		keystroke->m_sided_mod_code |= MOD_ALT;
+	}
+	return true;
+}
+
+
+Keystroke getInstructionKeystroke(const macro::Instruction& instruction, DWORD keep_down_mod_code) {
+	Keystroke keystroke;
+	keystroke.m_vk = BYTE(instruction.args[0]);
+	keystroke.m_sided_mod_code = DWORD(instruction.args[1]) | keep_down_mod_code;
+	keystroke.m_sided = toBool(instruction.args[2]);
+	return keystroke;
+}
+
+
+bool hasSpecialKeysToRelease(const BYTE keyboard_state[], DWORD keep_down_mod_code) {
+	for (const auto& special_key : kSpecialKeys) {
+		if (!(keep_down_mod_code & special_key.mod_code) &&
+				((keyboard_state[special_key.vk_left] | keyboard_state[special_key.vk_right]) & kKeyDownMask)) {
+			return true;
 		}
-		
-		ks.simulateTyping(/* already_down_mod_code= */ keep_down_mod_code);
 	}
+	return false;
 }
 
 
@@ -785,128 +1531,95 @@ void focusWindow(HWND hwnd) {
 }
 
 
-void commandEmpty(ExecutionContext* context) {
-	sleepBackground(100);
+executor::Coroutine commandEmpty(ExecutionContext* context) {
+	if (!co_await executor::sleep(context->task, 100)) {
+		co_return false;
+	}
 	Keystroke::resetKeyboardFocus(&context->input_window, &context->input_thread);
+	co_return true;
 }
 
 
-void commandWait(LPTSTR arg) {
-	sleepBackground(StrToInt(parseCommaSepArgUnescape(arg)));
+executor::Coroutine commandWait(ExecutionContext* context, int duration_ms) {
+	co_return co_await executor::sleep(context->task, duration_ms);
 }
 
 
-bool commandFocus(ExecutionContext* context, LPTSTR arg) {
-	// Parse and apply the delay.
-	const int delay_ms = StrToInt(parseCommaSepArgUnescape(arg));
-	sleepBackground(delay_ms);
-	
-	// Unescape the window name argument. Detect the '!' prefix.
-	const bool ignore_not_found = (arg[0] == _T('!'));
-	if (ignore_not_found) {
-		arg++;
+executor::Coroutine commandFocus(ExecutionContext* context, int delay_ms, LPCTSTR window_name, const WildcardPattern& window_pattern, bool ignore_not_found) {
+	if (!co_await executor::sleep(context->task, delay_ms)) {
+		co_return false;
 	}
-	const LPCTSTR window_name = parseCommaSepArgUnescape(arg);
 	
 	if (*window_name) {
-		const HWND hwnd_target = findWindowByName(window_name);
+		const HWND hwnd_target = findWindowByName(window_pattern);
 		if (hwnd_target) {
 			// Window found: give it the focus.
 			focusWindow(hwnd_target);
 		} else if (!ignore_not_found) {
-			return false;
+			co_return false;
 		}
 	}
 	
 	Keystroke::resetKeyboardFocus(&context->input_window, &context->input_thread);
-	return true;
+	co_return true;
 }
 
 
-void commandFocusOrLaunch(ExecutionContext* context, LPTSTR arg) {
-	const LPCTSTR window_name = parseCommaSepArgUnescape(arg);
-	const HWND hwnd_target = findWindowByName(window_name);
+executor::Coroutine commandFocusOrLaunch(ExecutionContext* context, const WildcardPattern& window_pattern, LPCTSTR command, int delay_ms) {
+	const HWND hwnd_target = findWindowByName(window_pattern);
 	if (hwnd_target) {
 		// Window found: give it the focus.
 		focusWindow(hwnd_target);
 	} else {
 		// Window not found: execute the command then apply the delay.
-		executeCommandLine(parseCommaSepArgUnescape(arg), context);
-		const int delay_ms = StrToInt(parseCommaSepArgUnescape(arg));
-		sleepBackground(delay_ms);
+		executeCommandLine(command, context);
+		if (!co_await executor::sleep(context->task, delay_ms)) {
+			co_return false;
+		}
 	}
 	
 	Keystroke::resetKeyboardFocus(&context->input_window, &context->input_thread);
+	co_return true;
 }
 
 
-void commandCopy(LPTSTR arg) {
-	unescape(arg);
-	setClipboardText(arg);
+void commandCancel(ExecutionContext* context) {
+	executor::cancelAll(/* except_task= */ context->task);
 }
 
 
-void commandMouseButton(LPTSTR arg) {
-	unescape(arg);
-	CharUpper(arg);
-	
-	DWORD dwFlags = 0;
-	switch (lstrlen(arg)) {
-		case 2:
-			switch (MAKELONG(arg[1], arg[0])) {
-				case 'L\0D':  dwFlags = MOUSEEVENTF_LEFTDOWN;  break;
-				case 'L\0U':  dwFlags = MOUSEEVENTF_LEFTUP;  break;
-				case 'M\0D':  dwFlags = MOUSEEVENTF_MIDDLEDOWN;  break;
-				case 'M\0U':  dwFlags = MOUSEEVENTF_MIDDLEUP;  break;
-				case 'R\0D':  dwFlags = MOUSEEVENTF_RIGHTDOWN;  break;
-				case 'R\0U':  dwFlags = MOUSEEVENTF_RIGHTUP;  break;
-			}
-			if (dwFlags) {
-				mouse_event(dwFlags, 0, 0, 0, 0);
-				sleepBackground(0);
-			}
-			break;
-		
-		case 1:
-			switch (*arg) {
-				case 'L':  dwFlags = MOUSEEVENTF_LEFTDOWN;  break;
-				case 'M':  dwFlags = MOUSEEVENTF_MIDDLEDOWN;  break;
-				case 'R':  dwFlags = MOUSEEVENTF_RIGHTDOWN;  break;
-			}
-			if (dwFlags) {
-				mouse_event(dwFlags, 0, 0, 0, 0);
-				sleepBackground(0);
-				mouse_event(dwFlags * 2, 0, 0, 0, 0);
-				sleepBackground(0);
-			}
-			break;
+void commandCopy(LPCTSTR text) {
+	setClipboardText(text);
+}
+
+
+void commandMouseButton(ExecutionContext* context, DWORD flags, bool click) {
+	metrics::markOutput();
+	mouse_event(flags, 0, 0, 0, 0);
+	context->pacer->pause();
+	if (click) {
+		mouse_event(flags * 2, 0, 0, 0, 0);
+		context->pacer->pause();
 	}
 }
 
 
-void commandMouseMove(POINT origin_point, LPTSTR arg) {
-	origin_point.x += StrToInt(parseCommaSepArgUnescape(arg));
-	origin_point.y += StrToInt(parseCommaSepArgUnescape(arg));
-	SetCursorPos(origin_point.x, origin_point.y);
-	sleepBackground(0);
+void commandMouseMove(ExecutionContext* context, POINT origin_point, int x, int y) {
+	metrics::markOutput();
+	SetCursorPos(origin_point.x + x, origin_point.y + y);
+	context->pacer->pause();
 }
 
 
-void commandMouseWheel(LPTSTR arg) {
-	const int offset = -StrToInt(parseCommaSepArgUnescape(arg)) * WHEEL_DELTA;
-	if (offset) {
-		mouse_event(MOUSEEVENTF_WHEEL, 0, 0, DWORD(offset), 0);
-		sleepBackground(0);
-	}
+void commandMouseWheel(ExecutionContext* context, int offset) {
+	metrics::markOutput();
+	mouse_event(MOUSEEVENTF_WHEEL, 0, 0, DWORD(offset), 0);
+	context->pacer->pause();
 }
 
 
-void commandKeysDown(ExecutionContext* context, LPTSTR arg) {
-	unescape(arg);
-	
-	Keystroke keep_down_keystroke;
-	keep_down_keystroke.parseDisplayName(arg);
-	context->keep_down_mod_code = keep_down_keystroke.getUnsidedModCode();
+void commandKeysDown(ExecutionContext* context, DWORD keep_down_mod_code) {
+	context->keep_down_mod_code = keep_down_mod_code;
 	
 	// Release the old special keys.
 	Keystroke::releaseSpecialKeys(context->keyboard_state, /* keep_down_mod_code= */ 0);
@@ -922,6 +1635,40 @@ void commandKeysDown(ExecutionContext* context, LPTSTR arg) {
 	}
 }
 
+
+void commandBatch(ExecutionContext* context, int max_size, int delay_ms) {
+	context->batch->setMaxSize(max_size);
+	context->batch_delay_ms = delay_ms;
+}
+
+
+void commandPacing(ExecutionContext* context, DWORD delay_us) {
+	context->pacer->setEventDelay(delay_us);
+}
+
+
+void commandPaste(ExecutionContext* context, int min_length) {
+	context->paste_min_length = min_length;
+}
+
+
+void commandKeystroke(ExecutionContext* context, const macro::Instruction& instruction) {
+	Shortcut::releaseSpecialKeys(context->keyboard_state, context->keep_down_mod_code);
+	
+	if (instruction.opcode == macro::Opcode::kKeystrokeChars) {
+		const input::KeyboardLayout layout = input::KeyboardLayout::getCurrent();
+		for (LPCTSTR chr = instruction.getString(0); *chr; chr++) {
+			simulateCharacter(context, layout, *chr);
+		}
+		
+	} else {
+		const Keystroke keystroke = getInstructionKeystroke(instruction, context->keep_down_mod_code);
+		keystroke.simulateTyping(
+			/* already_down_mod_code= */ context->keep_down_mod_code, context->hotkey_suspension,
+			context->pacer);
+	}
+}
+
 }  // namespace
 
 
@@ -932,14 +1679,13 @@ void commandKeysDown(ExecutionContext* context, LPTSTR arg) {
 // Test for inclusion
 bool Shortcut::isSubset(const Keystroke& other_ks, LPCTSTR other_program) const {
 	VERIF(Keystroke::isSubset(other_ks));
-	
-	return (other_program && containsProgram(other_program)) == m_programs_only;
+	return matchesProgram(other_program);
 }
 
 // Test for intersection
-bool Shortcut::testConflict(
-		const Keystroke& other_ks, const String other_programs[], bool other_programs_only) const {
-	VERIF(other_programs_only == m_programs_only);
+bool Shortcut::testConflict(const Shortcut& other) const {
+	VERIF(other.m_programs_only == m_programs_only);
+	const Keystroke& other_ks = other;
 	
 	VERIF(m_vk == other_ks.m_vk);
 	
@@ -956,17 +1702,11 @@ bool Shortcut::testConflict(
 			m_conditions[i] == other_ks.m_conditions[i]);
 	}
 	
-	if (!m_programs_only || !other_programs_only) {
+	if (!m_programs_only) {
 		return true;
 	}
 	
-	VERIF(other_programs && m_programs.isSome());
-	for (int i = 0; other_programs[i].isSome(); i++) {
-		if (containsProgram(other_programs[i])) {
-			return true;
-		}
-	}
-	return false;
+	return m_program_set.intersects(other.m_program_set);
 }
 
 String* Shortcut::getPrograms() const {
@@ -996,48 +1736,151 @@ String* Shortcut::getPrograms() const {
 }
 
 void Shortcut::cleanPrograms() {
-	String *const programs = getPrograms();
-	m_programs.empty();
-	VERIFV(programs);
-	
-	for (int i = 0; programs[i].isSome(); i++) {
-		for (int j = 0; j < i; j++) {
-			if (!lstrcmpi(programs[i], programs[j])) {
-				goto Next;
-			}
+	String cleaned_programs;
+	m_program_set.compile(m_programs, &cleaned_programs);
+	m_programs = cleaned_programs;
+}
+
+
+ProgramSet::ProgramSet(const ProgramSet& other)
+	: m_names(nullptr),
+	m_names_size(other.m_names_size),
+	m_slots(nullptr),
+	m_slot_mask(other.m_slot_mask),
+	m_count(other.m_count) {
+	if (other.m_names) {
+		m_names = new TCHAR[m_names_size];
+		memcpy(m_names, other.m_names, m_names_size * sizeof(TCHAR));
+	}
+	if (other.m_slots) {
+		m_slots = new Slot[m_slot_mask + 1];
+		memcpy(m_slots, other.m_slots, (m_slot_mask + 1) * sizeof(Slot));
+	}
+}
+
+void ProgramSet::compile(LPCTSTR programs, String* cleaned_programs) {
+	clear();
+	if (cleaned_programs) {
+		cleaned_programs->empty();
+	}
+	VERIFV(!strIsEmpty(programs));
+	
+	// The lowercase entries and their null terminators are at most as long as the list.
+	m_names_size = lstrlen(programs) + 1;
+	m_names = new TCHAR[m_names_size];
+	
+	// Size the hash table for the worst case: no empty entries, no duplicates.
+	int max_count = 1;
+	for (LPCTSTR chr = programs; *chr; chr++) {
+		if (*chr == _T(';')) {
+			max_count++;
 		}
-		if (m_programs.isSome()) {
-			m_programs += _T(';');
+	}
+	DWORD slot_count = 4;
+	while (slot_count < DWORD(max_count) * 2) {
+		slot_count *= 2;
+	}
+	m_slot_mask = slot_count - 1;
+	m_slots = new Slot[slot_count];
+	for (DWORD i = 0; i < slot_count; i++) {
+		m_slots[i].name_offset = kNoName;
+	}
+	
+	int names_length = 0;
+	LPCTSTR program_begin = programs;
+	for (;;) {
+		LPCTSTR program_end = program_begin;
+		while (*program_end && *program_end != _T(';')) {
+			program_end++;
+		}
+		
+		const int program_length = int(program_end - program_begin);
+		if (program_length) {
+			const LPTSTR folded_name = m_names + names_length;
+			memcpy(folded_name, program_begin, program_length * sizeof(TCHAR));
+			folded_name[program_length] = _T('\0');
+			CharLowerBuff(folded_name, program_length);
+			
+			const DWORD hash = hashName(folded_name);
+			Slot& slot = findSlot(folded_name, hash);
+			if (slot.name_offset == kNoName) {
+				slot = { .hash = hash, .name_offset = names_length };
+				names_length += program_length + 1;
+				m_count++;
+				
+				if (cleaned_programs) {
+					if (cleaned_programs->isSome()) {
+						*cleaned_programs += _T(';');
+					}
+					*cleaned_programs += String(program_begin, program_length);
+				}
+			}
 		}
-		m_programs += programs[i];
 		
-	Next:
-		;
+		if (!*program_end) {
+			break;
+		}
+		program_begin = program_end + 1;
 	}
+}
+
+void ProgramSet::clear() {
+	delete [] m_names;
+	delete [] m_slots;
+	m_names = nullptr;
+	m_names_size = 0;
+	m_slots = nullptr;
+	m_slot_mask = 0;
+	m_count = 0;
+}
+
+bool ProgramSet::contains(LPCTSTR program) const {
+	VERIF(m_count);
 	
-	delete [] programs;
+	// Process names are at most MAX_PATH characters long.
+	TCHAR folded_name[MAX_PATH];
+	const int program_length = lstrlen(program);
+	VERIF(program_length < arrayLength(folded_name));
+	memcpy(folded_name, program, (program_length + 1) * sizeof(TCHAR));
+	CharLowerBuff(folded_name, program_length);
+	
+	return findSlot(folded_name, hashName(folded_name)).name_offset != kNoName;
 }
 
-bool Shortcut::containsProgram(LPCTSTR program) const {
-	LPCTSTR programs = m_programs;
-	VERIF(*programs);
+bool ProgramSet::intersects(const ProgramSet& other) const {
+	VERIF(m_count && other.m_count);
 	
-	const TCHAR* current_program_begin = programs;
-	for (;;) {
-		const TCHAR *current_process_end = current_program_begin;
-		while (*current_process_end && *current_process_end != _T(';')) {
-			current_process_end++;
-		}
-		
-		if (CSTR_EQUAL == CompareString(LOCALE_USER_DEFAULT, NORM_IGNORECASE,
-				current_program_begin, int(current_process_end - current_program_begin), program, -1)) {
+	// Probe the largest set with the entries of the smallest one.
+	const ProgramSet& small_set = (m_count <= other.m_count) ? *this : other;
+	const ProgramSet& large_set = (m_count <= other.m_count) ? other : *this;
+	for (DWORD i = 0; i <= small_set.m_slot_mask; i++) {
+		const Slot& slot = small_set.m_slots[i];
+		if (slot.name_offset != kNoName &&
+				large_set.findSlot(small_set.m_names + slot.name_offset, slot.hash).name_offset != kNoName) {
 			return true;
 		}
-		
-		if (!*current_process_end) {
-			return false;
+	}
+	return false;
+}
+
+DWORD ProgramSet::hashName(LPCTSTR folded_name) {
+	// FNV-1a
+	DWORD hash = 2166136261U;
+	for (; *folded_name; folded_name++) {
+		hash = (hash ^ WORD(*folded_name)) * 16777619U;
+	}
+	return hash;
+}
+
+ProgramSet::Slot& ProgramSet::findSlot(LPCTSTR folded_name, DWORD hash) const {
+	// Linear probing. The table always has empty slots, so the loop terminates.
+	for (DWORD i = hash & m_slot_mask;; i = (i + 1) & m_slot_mask) {
+		Slot& slot = m_slots[i];
+		if (slot.name_offset == kNoName ||
+				(slot.hash == hash && CSTR_EQUAL == CompareStringOrdinal(
+					m_names + slot.name_offset, -1, folded_name, -1, /* bIgnoreCase= */ false))) {
+			return slot;
 		}
-		current_program_begin = current_process_end + 1;
 	}
 }
 
@@ -1047,12 +1890,24 @@ bool Shortcut::containsProgram(LPCTSTR program) const {
 //------------------------------------------------------------------------
 
 void loadShortcuts() {
-	clearShortcuts();
-	mergeShortcuts(e_ini_filepath);
+	// Reloading is also the way to take newly installed programs into account.
+	clearFullPathCache();
+	detachShortcuts();
+	readShortcuts(e_ini_filepath);
+	commitShortcuts();
 }
 
 void mergeShortcuts(LPCTSTR ini_filepath) {
+	forkShortcuts();
+	readShortcuts(ini_filepath);
+	commitShortcuts();
+}
+
+namespace {
+
+void readShortcuts(LPCTSTR ini_filepath) {
 	e_icon_visible = true;
+	pacing::setDefaultEventDelay(pacing::kDefaultEventDelayUs);
 	
 	memcpy(e_column_widths, kDefaultColumnWidths, sizeof(kDefaultColumnWidths));
 	
@@ -1097,13 +1952,15 @@ Error:
 		file_contents = reinterpret_cast<BYTE*>(input);
 	}
 	
+	ShortcutTable& shortcuts = s_draft_snapshot->shortcuts;
 	do {
-		Shortcut *const shortcut = new Shortcut;
+		// Load in place. load() compiles the programs.
+		const ShortcutTable::Handle handle = shortcuts.append();
+		Shortcut *const shortcut = shortcuts.get(handle);
 		if (shortcut->load(&input)) {
-			shortcut->addToList();
-			shortcut->registerHotKey();
+			s_draft_snapshot->index.add(shortcut);
 		} else {
-			delete shortcut;
+			shortcuts.remove(handle);
 		}
 	} while (input);
 	
@@ -1111,6 +1968,8 @@ Error:
 	HeapCompact(e_heap, 0);
 }
 
+}  // namespace
+
 
 void saveShortcuts() {
 	HANDLE file;
@@ -1142,12 +2001,18 @@ void saveShortcuts() {
 		writeFile(file, buffer);
 	}
 	
-	wsprintf(buffer, _T("\r\n%s=%d\r\n\r\n"),
+	wsprintf(buffer, _T("\r\n%s=%d\r\n"),
 		getToken(Token::kSorting), Shortcut::s_sort_column);
 	writeFile(file, buffer);
 	
-	for (Shortcut* sh = getFirst(); sh; sh = sh->getNext()) {
-		sh->save(file);
+	if (pacing::getDefaultEventDelay() != pacing::kDefaultEventDelayUs) {
+		wsprintf(buffer, _T("%s=%lu\r\n"), getToken(Token::kPacing), pacing::getDefaultEventDelay());
+		writeFile(file, buffer);
+	}
+	writeFile(file, _T("\r\n"));
+	
+	for (Shortcut& sh : s_snapshot->shortcuts) {
+		sh.save(file);
 	}
 	
 	CloseHandle(file);
@@ -1155,14 +2020,39 @@ void saveShortcuts() {
 
 
 void clearShortcuts() {
-	Shortcut *sh = getFirst();
-	while (sh) {
-		Shortcut *const copy = sh;
-		sh = sh->getNext();
-		delete copy;
+	if (s_draft_snapshot) {
+		deleteSnapshot(s_draft_snapshot);
+		s_draft_snapshot = nullptr;
+	}
+	publishSnapshot(new Snapshot);
+}
+
+void detachShortcuts() {
+	assert(!s_draft_snapshot);
+	s_draft_snapshot = new Snapshot;
+}
+
+void forkShortcuts() {
+	detachShortcuts();
+	for (const Shortcut& sh : s_snapshot->shortcuts) {
+		ShortcutTable& shortcuts = s_draft_snapshot->shortcuts;
+		s_draft_snapshot->index.add(shortcuts.get(shortcuts.append(sh)));
 	}
+}
+
+void commitShortcuts() {
+	VERIFV(s_draft_snapshot);
+	
+	// The keystrokes present in both lists keep their hotkey untouched.
+	const Snapshot& previous = *s_snapshot;
+	s_draft_snapshot->index.registerHotKeysMissingFrom(previous.index);
+	previous.index.unregisterHotKeysMissingFrom(s_draft_snapshot->index);
+	
+	// Retry the hotkeys other programs prevented from registering so far.
+	Keystroke::registerFailedHotKeys();
 	
-	s_first_shortcut = s_last_shortcut = nullptr;
+	publishSnapshot(s_draft_snapshot);
+	s_draft_snapshot = nullptr;
 }
 
 }  // namespace shortcut
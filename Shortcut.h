@@ -20,6 +20,8 @@
 #pragma once
 
 #include "Keystroke.h"
+#include "Macro.h"
+#include "Metrics.h"
 
 namespace dialogs {
 
@@ -30,6 +32,84 @@ struct GETFILEICON;
 
 namespace shortcut {
 
+// Set of program names, case insensitive.
+// Compiled once from a ';'-separated list, then probed in constant time without allocating.
+class ProgramSet {
+public:
+	
+	ProgramSet() : m_names(nullptr), m_names_size(0), m_slots(nullptr), m_slot_mask(0), m_count(0) {}
+	ProgramSet(const ProgramSet& other);
+	ProgramSet& operator =(const ProgramSet& other) = delete;
+	
+	~ProgramSet() {
+		clear();
+	}
+	
+	// Replaces the contents of the set with the entries of a ';'-separated list.
+	// Skips empty entries and case insensitive duplicates.
+	//
+	// programs: the ';'-separated list of programs.
+	// cleaned_programs: if not null, receives the ';'-separated list of the entries kept,
+	//   in their original order and case.
+	void compile(LPCTSTR programs, String* cleaned_programs = nullptr);
+	
+	// Removes all entries.
+	void clear();
+	
+	bool isEmpty() const {
+		return !m_count;
+	}
+	
+	// Returns whether the set contains the given program. Case insensitive.
+	bool contains(LPCTSTR program) const;
+	
+	// Returns whether the set has at least one entry in common with another set.
+	bool intersects(const ProgramSet& other) const;
+	
+private:
+	
+	struct Slot {
+		DWORD hash;
+		int name_offset;  // In m_names, kNoName for empty slots.
+	};
+	
+	static constexpr int kNoName = -1;
+	
+	// Returns the hash of a lowercase program name.
+	static DWORD hashName(LPCTSTR folded_name);
+	
+	// Returns the slot containing the given lowercase program name,
+	// or the empty slot where to insert it if the set does not contain it.
+	Slot& findSlot(LPCTSTR folded_name, DWORD hash) const;
+	
+	// The lowercase entries, each one null-terminated.
+	TCHAR* m_names;
+	int m_names_size;
+	
+	// Open addressing hash table of the entries. The size is a power of 2, at least twice m_count.
+	Slot* m_slots;
+	DWORD m_slot_mask;
+	
+	int m_count;
+};
+
+
+// Mutable statistics of a shortcut, shared by all its copies: the dispatch thread updates them
+// while the snapshots are immutable, forked and committed concurrently.
+// Reference counted, deleted with the last copy.
+struct ShortcutStats {
+	// Identifies the shortcut across its copies, never reused.
+	LONG id;
+	
+	volatile LONG usage_count;
+	
+	// Allocated by the first dispatch recorded, then never replaced.
+	metrics::DispatchStats* volatile dispatch_stats;
+	
+	volatile LONG ref_count;
+};
+
+
 class Shortcut : public Keystroke {
 public:
 	
@@ -39,40 +119,87 @@ public:
 	
 	Shortcut& operator =(const Shortcut& other) = delete;
 	
-	~Shortcut() {
-		clearIcons();
-	}
+	~Shortcut();
 	
 	void save(HANDLE file);
 	
 	// Assumes the shortcut is initially empty.
+	// Fails if the shortcut conflicts with one of the snapshot being built.
 	bool load(LPTSTR* input);
 	
-	void execute(bool from_hotkey);
+	// dispatch: the hotkey dispatch executing the shortcut, null if not executed from a hotkey.
+	//   Ended and recorded in the statistics of the shortcut once the execution ends,
+	//   possibly later by the executor.
+	void execute(metrics::Dispatch* dispatch);
+	
+	// Returns the latency statistics of the hotkey dispatches that executed this shortcut,
+	// nullptr if none did.
+	const metrics::DispatchStats* getDispatchStats() const {
+		return m_stats->dispatch_stats;
+	}
+	
+	// Returns the identifier of the shortcut, shared by its copies and never reused.
+	LONG getId() const {
+		return m_stats->id;
+	}
 	
-	Shortcut* getNext() const {
-		return m_next_shortcut;
+	// Returns the number of times the shortcut has been used, including by its copies.
+	int getUsageCount() const {
+		return m_stats->usage_count;
 	}
 	
-	void addToList();
+	void setUsageCount(int usage_count) {
+		InterlockedExchange(&m_stats->usage_count, usage_count);
+	}
 	
 	// Returns the array of programs of this shortcut, with the last element nullptr,
 	// or nullptr if no programs.
 	String* getPrograms() const;
 	
-	// Removes duplicates from getPrograms().
+	// Removes duplicates from getPrograms(). Also compiles the programs, see compilePrograms().
 	void cleanPrograms();
 	
+	// Updates the compiled form of m_programs. Must be called after each m_programs change,
+	// before matching this shortcut. addShortcut() calls it.
+	void compilePrograms() {
+		m_program_set.compile(m_programs);
+	}
+	
+	// Updates the compiled form of m_text. Must be called after each m_text change,
+	// before executing this shortcut. addShortcut() calls it.
+	void compileText() {
+		m_macro.compile(m_text);
+	}
+	
+	// Updates the compiled form of m_command and m_directory. Must be called after each
+	// m_command or m_directory change, before executing this shortcut. addShortcut() calls it.
+	void compileCommand() {
+		m_command_line.compile(m_command, m_directory);
+	}
+	
+	// Returns the compiled form of m_text, see compileText().
+	const macro::Program& getMacro() const {
+		return m_macro;
+	}
+	
 	// Returns whether this shortcut would be a subset of a shortcut having the given attributes.
 	bool isSubset(const Keystroke& other_ks, LPCTSTR other_program) const;
 	
-	// Returns whether this shortcut would conflict (overlap) with a shortcut having the given attributes.
-	bool testConflict(const Keystroke& other_ks, const String other_programs[], bool other_programs_only) const;
+	// Returns whether this shortcut applies to the given program, regardless of its keystroke.
+	// Part of isSubset().
+	bool matchesProgram(LPCTSTR program) const {
+		return (program && containsProgram(program)) == m_programs_only;
+	}
+	
+	// Returns whether this shortcut would conflict (overlap) with another shortcut.
+	bool testConflict(const Shortcut& other) const;
 	
 private:
 	
 	// Returns whether getPrograms() contains the given entry. Case insentitive.
-	bool containsProgram(LPCTSTR program) const;
+	bool containsProgram(LPCTSTR program) const {
+		return m_program_set.contains(program);
+	}
 	
 public:
 	
@@ -143,12 +270,19 @@ public:
 	// "Test" and all Firefox windows.
 	String m_programs;
 	
-	// The number of times the shortcut has been used.
-	int m_usage_count;
-	
 private:
 	
-	Shortcut* m_next_shortcut;
+	// Compiled form of m_programs.
+	ProgramSet m_program_set;
+	
+	// Compiled form of m_text.
+	macro::Program m_macro;
+	
+	// Compiled form of m_command and m_directory.
+	CommandLine m_command_line;
+	
+	// Shared with the copies of the shortcut. Never null.
+	ShortcutStats* m_stats;
 	
 	// Special values for m_small_icon_index.
 	static constexpr int kIconInvalid = -1;
@@ -159,17 +293,259 @@ private:
 	HICON m_icon;
 };
 
+
+// Index of shortcuts by keystroke keys, for lookups whose cost does not depend on the total
+// number of shortcuts.
+//
+// Shortcuts are bucketed by virtual key code and unsided mod code: Shortcut::isSubset() and
+// Shortcut::testConflict() can only be true between keystrokes that share both.
+// Each bucket preserves the insertion order.
+// Does not own the shortcuts. To change the keys of an indexed shortcut, remove it beforehand
+// and add it back afterwards.
+class ShortcutIndex {
+public:
+	
+	constexpr ShortcutIndex() : m_buckets(nullptr) {}
+	
+	ShortcutIndex(const ShortcutIndex& other) = delete;
+	ShortcutIndex& operator =(const ShortcutIndex& other) = delete;
+	
+	// Appends a shortcut to its bucket.
+	void add(Shortcut* shortcut);
+	
+	// Removes a shortcut from its bucket, if present.
+	void remove(const Shortcut* shortcut);
+	
+	// Removes all shortcuts and frees the memory used by the index.
+	void clear();
+	
+	// Returns the shortcuts having the same keys as the given keystroke, in insertion order.
+	// Stores the number of shortcuts in count.
+	Shortcut* const* getBucket(const Keystroke& ks, int* count) const;
+	
+	// Returns the best shortcut to execute for a keystroke, nullptr if none matches.
+	// Gives precedence to the first m_programs_only = true match, then to the first match.
+	Shortcut* find(const Keystroke& ks, LPCTSTR program) const;
+	
+	// Returns the first shortcut conflicting with the given one, nullptr if none.
+	// Ignores the given shortcut itself if indexed. See Shortcut::testConflict().
+	Shortcut* findConflict(const Shortcut& shortcut) const;
+	
+	// Exchanges the contents of the two indexes.
+	void swap(ShortcutIndex& other);
+	
+	// Registers the hotkey of each keystroke of this index that the other index lacks.
+	// The shortcuts having the same keys share their hotkey: registers it once.
+	void registerHotKeysMissingFrom(const ShortcutIndex& other) const;
+	
+	// Unregisters the hotkey of each keystroke of this index that the other index lacks.
+	void unregisterHotKeysMissingFrom(const ShortcutIndex& other) const;
+	
+private:
+	
+	// The packed keystrokes of the shortcuts are stored in parallel arrays,
+	// to filter them in batches with Keystroke::findPackedMatch().
+	struct Bucket {
+		Shortcut** shortcuts;
+		DWORD* packed_keys;  // See Keystroke::packPattern().
+		DWORD* packed_masks;  // See Keystroke::packPattern().
+		int count;
+		int capacity;
+	};
+	
+	// Virtual key codes times unsided mod codes.
+	static constexpr int kModCodeBits = 4;
+	static constexpr int kBucketCount = 0x100 << kModCodeBits;
+	
+	static int getBucketIndex(const Keystroke& ks) {
+		return (ks.m_vk << kModCodeBits) | (ks.getUnsidedModCode() & ((1 << kModCodeBits) - 1));
+	}
+	
+	// Calls callback on the first shortcut of each bucket of this index
+	// whose counterpart in the other index is empty.
+	template<typename Callback>
+	void forEachKeystrokeMissingFrom(const ShortcutIndex& other, Callback callback) const;
+	
+	// Indexed by getBucketIndex(), allocated on the first add().
+	Bucket* m_buckets;
+};
+
+
+// Storage of shortcuts in fixed-size chunks: the shortcuts never move, pointers and handles
+// to them stay valid until they are removed. Appending is O(1) amortized. Removing leaves a
+// tombstone instead of moving the next shortcuts. Iteration visits the shortcuts in insertion
+// order, sequentially in memory, skipping the tombstones.
+class ShortcutTable {
+public:
+	
+	// Position of a shortcut in the table. Never reused until clear().
+	using Handle = int;
+	
+	class Iterator {
+	public:
+		
+		Iterator(const ShortcutTable& table, Handle handle) : m_table(table), m_handle(handle) {
+			skipTombstones();
+		}
+		
+		Shortcut& operator *() const {
+			return *m_table.getSlot(m_handle);
+		}
+		
+		Iterator& operator ++() {
+			m_handle++;
+			skipTombstones();
+			return *this;
+		}
+		
+		bool operator !=(const Iterator& other) const {
+			return m_handle != other.m_handle;
+		}
+		
+	private:
+		
+		void skipTombstones() {
+			while (m_handle < m_table.m_size && !m_table.isLive(m_handle)) {
+				m_handle++;
+			}
+		}
+		
+		const ShortcutTable& m_table;
+		Handle m_handle;
+	};
+	
+	constexpr ShortcutTable()
+		: m_chunks(nullptr), m_chunk_capacity(0), m_size(0), m_count(0) {}
+	
+	ShortcutTable(const ShortcutTable& other) = delete;
+	ShortcutTable& operator =(const ShortcutTable& other) = delete;
+	
+	// Appends an empty shortcut.
+	Handle append();
+	
+	// Appends a copy of a shortcut.
+	Handle append(const Shortcut& shortcut);
+	
+	// Returns the shortcut of a handle, nullptr if removed.
+	Shortcut* get(Handle handle) const {
+		return (0 <= handle && handle < m_size && isLive(handle)) ? getSlot(handle) : nullptr;
+	}
+	
+	// Deletes a shortcut, if not already removed. Leaves a tombstone, even at the end of the table:
+	// the handle stays invalid until clear().
+	void remove(Handle handle);
+	
+	// Deletes all shortcuts and frees the memory used by the table.
+	void clear();
+	
+	// Exchanges the contents of the two tables.
+	void swap(ShortcutTable& other);
+	
+	// Returns the number of shortcuts, excluding the tombstones.
+	int getCount() const {
+		return m_count;
+	}
+	
+	Iterator begin() const {
+		return Iterator(*this, 0);
+	}
+	
+	Iterator end() const {
+		return Iterator(*this, m_size);
+	}
+	
+private:
+	
+	static constexpr int kChunkShift = 6;
+	static constexpr int kChunkSize = 1 << kChunkShift;
+	
+	struct Chunk {
+		ULONGLONG live_mask;  // Bit i is set if slot i holds a shortcut.
+		alignas(Shortcut) BYTE slots[kChunkSize][sizeof(Shortcut)];
+	};
+	
+	Shortcut* getSlot(Handle handle) const {
+		return reinterpret_cast<Shortcut*>(
+			m_chunks[handle >> kChunkShift]->slots[handle & (kChunkSize - 1)]);
+	}
+	
+	bool isLive(Handle handle) const {
+		return toBool(
+			(m_chunks[handle >> kChunkShift]->live_mask >> (handle & (kChunkSize - 1))) & 1);
+	}
+	
+	// Returns the slot of a new handle, not constructed yet.
+	void* allocateSlot();
+	
+	Chunk** m_chunks;
+	int m_chunk_capacity;
+	int m_size;  // Number of handles allocated so far, including the tombstones.
+	int m_count;  // Number of shortcuts, excluding the tombstones.
+};
+
+
+// Version of the list of shortcuts. Never modified once published by commitShortcuts():
+// the statistics of the shortcuts live in their ShortcutStats.
+// Deleted once replaced and no longer pinned.
+struct Snapshot {
+	constexpr Snapshot() : version(0), next_retired(nullptr) {}
+	
+	ShortcutTable shortcuts;
+	ShortcutIndex index;  // Indexes shortcuts.
+	
+	// Incremented by each commitShortcuts().
+	int version;
+	
+	// Next snapshot waiting for deletion, see commitShortcuts().
+	Snapshot* next_retired;
+};
+
+// Pins the current snapshot without locking, from any thread.
+// The snapshot stays valid until the pin is destroyed, even if commitShortcuts() replaces it.
+// Each pin occupies a hazard slot until destroyed: keep them short-lived.
+class SnapshotPin {
+public:
+	
+	SnapshotPin();
+	~SnapshotPin();
+	
+	SnapshotPin(const SnapshotPin& other) = delete;
+	SnapshotPin& operator =(const SnapshotPin& other) = delete;
+	
+	const Snapshot& operator *() const {
+		return *m_snapshot;
+	}
+	
+	const Snapshot* operator ->() const {
+		return m_snapshot;
+	}
+	
+private:
+	
+	int m_slot;
+	const Snapshot* m_snapshot;
+};
+
+
 // Initializes the namespace variables. Should be called once.
 void initialize();
 
-// Deletes the namespace variables. Should be called once.
+// Deletes the namespace variables. Should be called once, once all pins are destroyed.
 void terminate();
 
-// Returns the first shortcut of the linked list.
-Shortcut* getFirst();
+// Returns the current snapshot.
+// Only for the thread modifying the shortcuts; the other threads must use SnapshotPin.
+const Snapshot& getSnapshot();
+
+// Returns the current list of shortcuts, in insertion order. Same restrictions as getSnapshot().
+const ShortcutTable& getShortcuts();
 
-// Find a shortcut in the linked list
-// Should not be called while the main dialog box is displayed
+// Appends a copy of a shortcut to the list being built and indexes it. Returns the copy.
+// Starts building a copy of the current list first if needed, see forkShortcuts().
+// The copy becomes visible once published by commitShortcuts().
+Shortcut* addShortcut(const Shortcut& shortcut);
+
+// Find a shortcut in the current list, via its index. Same restrictions as getSnapshot().
 Shortcut* find(const Keystroke& ks, LPCTSTR program);
 
 // Loads the list of shortcuts from e_ini_filepath.
@@ -181,9 +557,24 @@ void mergeShortcuts(LPCTSTR ini_filepath);
 // Saves the list of shortcuts into e_ini_filepath.
 void saveShortcuts();
 
-// Clears the list of shortcuts.
+// Publishes an empty list of shortcuts. Does not unregister the hotkeys.
 void clearShortcuts();
 
+// Starts building an empty list of shortcuts to replace the current one.
+// The current list stays in use, with its hotkeys registered, until commitShortcuts().
+// The new list should be built with addShortcut().
+void detachShortcuts();
+
+// Same as detachShortcuts(), but starts from a copy of the current list.
+void forkShortcuts();
+
+// Publishes the list built since detachShortcuts() or forkShortcuts() atomically,
+// as a new snapshot. Deletes the previous snapshot once no longer pinned.
+// Registers only the hotkeys of the new keystrokes and unregisters only the hotkeys
+// of the keystrokes no longer used: the unchanged hotkeys stay registered.
+// Retries the hotkeys that failed to register, see Keystroke::registerFailedHotKeys().
+void commitShortcuts();
+
 }  // namespace shortcut
 
 using shortcut::Shortcut;
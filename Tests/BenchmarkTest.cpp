@@ -0,0 +1,784 @@
+// Clavier+
+// Keyboard shortcuts manager
+//
+// Copyright (C) 2000-2008 Guillaume Ryder
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+
+// Benchmarks: log their timings, only assert the correctness of the benchmarked code.
+
+#include "StdAfx.h"
+#include "../Executor.h"
+#include "../Global.h"
+#include "../Input.h"
+#include "../Macro.h"
+#include "../Pacing.h"
+#include "../Shortcut.h"
+
+namespace BenchmarkTest {
+
+namespace {
+
+constexpr int kPasses = 20;
+
+// Returns the best duration of kPasses runs of a function, in performance counter ticks.
+template<typename Function>
+LONGLONG measure(Function function) {
+	LONGLONG best_ticks = MAXLONGLONG;
+	for (int pass = 0; pass < kPasses; pass++) {
+		LARGE_INTEGER start, end;
+		QueryPerformanceCounter(&start);
+		function();
+		QueryPerformanceCounter(&end);
+		best_ticks = std::min(best_ticks, end.QuadPart - start.QuadPart);
+	}
+	return best_ticks;
+}
+
+}  // namespace
+
+
+// Traversal of the shortcuts, in a ShortcutTable versus in an intrusive linked list of
+// individually allocated shortcuts, the storage ShortcutTable replaces.
+TEST_CLASS(ShortcutTraversalBenchmark) {
+public:
+	
+	TEST_METHOD(Traverse_1k) {
+		benchmark(1000);
+	}
+	
+	TEST_METHOD(Traverse_10k) {
+		benchmark(10000);
+	}
+	
+	TEST_METHOD(Traverse_100k) {
+		benchmark(100000);
+	}
+	
+private:
+	
+	struct LinkedShortcut {
+		explicit LinkedShortcut(const Keystroke& ks) : shortcut(ks), next(nullptr) {}
+		
+		Shortcut shortcut;
+		LinkedShortcut* next;
+	};
+	
+	static void benchmark(int shortcut_count) {
+		// Interleave the allocations of the linked shortcuts with their strings,
+		// as loading them from a file did.
+		shortcut::ShortcutTable table;
+		LinkedShortcut* first = nullptr;
+		LinkedShortcut* last = nullptr;
+		for (int i = 0; i < shortcut_count; i++) {
+			Keystroke ks;
+			ks.m_vk = BYTE('A' + i % 26);
+			ks.m_sided_mod_code = MOD_CONTROL;
+			auto *linked = new LinkedShortcut(ks);
+			linked->shortcut.m_description = StringPrintf(_T("Shortcut %d"), i);
+			linked->shortcut.setUsageCount(i);
+			(last ? last->next : first) = linked;
+			last = linked;
+			table.append(linked->shortcut);
+		}
+		
+		LONGLONG linked_sum = 0;
+		const LONGLONG linked_ticks = measure([&] {
+			for (const LinkedShortcut* linked = first; linked; linked = linked->next) {
+				linked_sum += linked->shortcut.m_vk + linked->shortcut.getUsageCount();
+			}
+		});
+		
+		LONGLONG table_sum = 0;
+		const LONGLONG table_ticks = measure([&] {
+			for (const Shortcut& sh : table) {
+				table_sum += sh.m_vk + sh.getUsageCount();
+			}
+		});
+		
+		Assert::AreEqual(linked_sum, table_sum);
+		Logger::WriteMessage(StringPrintf(
+			_T("%d shortcuts: linked list %lld ticks, table %lld ticks, speedup x%d.%02d\n"),
+			shortcut_count, linked_ticks, table_ticks,
+			int(linked_ticks / std::max(table_ticks, LONGLONG(1))),
+			int(linked_ticks * 100 / std::max(table_ticks, LONGLONG(1)) % 100)));
+		
+		while (first) {
+			LinkedShortcut *const next = first->next;
+			delete first;
+			first = next;
+		}
+		table.clear();
+	}
+};
+
+
+// Lookup of a keystroke among shortcuts sharing its keys and differing by their sided-ness
+// and conditions: packed batch matching versus Shortcut::isSubset() on each shortcut.
+TEST_CLASS(ShortcutMatchBenchmark) {
+public:
+	
+	TEST_METHOD(Find_16) {
+		benchmark(16);
+	}
+	
+	TEST_METHOD(Find_256) {
+		benchmark(256);
+	}
+	
+	TEST_METHOD(Find_4096) {
+		benchmark(4096);
+	}
+	
+private:
+	
+	static constexpr int kLookups = 100;
+	
+	static void benchmark(int shortcut_count) {
+		// Only the last shortcut matches: the lookups scan the whole bucket.
+		Keystroke ks;
+		ks.m_vk = 'A';
+		ks.m_sided = true;
+		ks.m_sided_mod_code = MOD_CONTROL << kRightModCodeOffset;
+		for (auto& condition : ks.m_conditions) {
+			condition = Keystroke::Condition::kYes;
+		}
+		
+		shortcut::ShortcutTable table;
+		shortcut::ShortcutIndex index;
+		for (int i = 0; i < shortcut_count; i++) {
+			Keystroke sh_ks;
+			sh_ks.m_vk = 'A';
+			sh_ks.m_sided_mod_code = MOD_CONTROL;
+			if (i < shortcut_count - 1) {
+				sh_ks.m_sided = (i % 2 == 0);
+				sh_ks.m_conditions[i % Keystroke::kCondTypeCount] = Keystroke::Condition::kNo;
+			}
+			index.add(table.get(table.append(Shortcut(sh_ks))));
+		}
+		
+		int count;
+		Shortcut* const* const shortcuts = index.getBucket(ks, &count);
+		Assert::AreEqual(shortcut_count, count);
+		
+		const Shortcut* subset_found = nullptr;
+		const LONGLONG subset_ticks = measure([&] {
+			for (int lookup = 0; lookup < kLookups; lookup++) {
+				subset_found = nullptr;
+				for (int i = 0; i < count && !subset_found; i++) {
+					if (shortcuts[i]->isSubset(ks, /* program= */ nullptr)) {
+						subset_found = shortcuts[i];
+					}
+				}
+			}
+		});
+		
+		const Shortcut* packed_found = nullptr;
+		const LONGLONG packed_ticks = measure([&] {
+			for (int lookup = 0; lookup < kLookups; lookup++) {
+				packed_found = index.find(ks, /* program= */ nullptr);
+			}
+		});
+		
+		Assert::IsTrue(subset_found == shortcuts[count - 1]);
+		Assert::IsTrue(packed_found == shortcuts[count - 1]);
+		Logger::WriteMessage(StringPrintf(
+			_T("%d shortcuts: isSubset %lld ticks, packed %lld ticks, speedup x%d.%02d\n"),
+			shortcut_count, subset_ticks, packed_ticks,
+			int(subset_ticks / std::max(packed_ticks, LONGLONG(1))),
+			int(subset_ticks * 100 / std::max(packed_ticks, LONGLONG(1)) % 100)));
+		
+		index.clear();
+		table.clear();
+	}
+};
+
+
+// Concurrent macros made of many delays, run by a virtual clock scheduler:
+// the run time measures the scheduling overhead only.
+TEST_CLASS(SchedulerBenchmark) {
+public:
+	
+	TEST_METHOD(Run_10Macros) {
+		benchmark(10);
+	}
+	
+	TEST_METHOD(Run_1000Macros) {
+		benchmark(1000);
+	}
+	
+private:
+	
+	static constexpr int kSleepsPerMacro = 100;
+	static constexpr DWORD kSleepMillis = 1000;
+	
+	class SleepingTask : public executor::Task {
+	public:
+		explicit SleepingTask(int* completed_count) : m_completed_count(completed_count) {}
+		
+		executor::Coroutine run() override {
+			for (int i = 0; i < kSleepsPerMacro; i++) {
+				co_await executor::sleep(this, kSleepMillis);
+			}
+			(*m_completed_count)++;
+			co_return true;
+		}
+		
+	private:
+		int* m_completed_count;
+	};
+	
+	static void benchmark(int macro_count) {
+		BYTE *const keys = new BYTE[macro_count];  // One key per macro: all run concurrently.
+		int completed_count = 0;
+		DWORD virtual_millis = 0;
+		const LONGLONG ticks = measure([&] {
+			executor::Scheduler scheduler(executor::Scheduler::Clock::kVirtual);
+			for (int i = 0; i < macro_count; i++) {
+				scheduler.submit(&keys[i], new SleepingTask(&completed_count));
+			}
+			scheduler.runUntilIdle();
+			virtual_millis = scheduler.now();
+		});
+		delete[] keys;
+		
+		Assert::AreEqual(macro_count * kPasses, completed_count);
+		Assert::AreEqual(kSleepsPerMacro * kSleepMillis, virtual_millis);
+		
+		LARGE_INTEGER frequency;
+		QueryPerformanceFrequency(&frequency);
+		Logger::WriteMessage(StringPrintf(
+			_T("%d macros, %lu virtual ms: %lld us\n"),
+			macro_count, virtual_millis, ticks * 1000000 / frequency.QuadPart));
+	}
+};
+
+
+// Decoding of a text shortcut before each execution, by parsing its text versus by walking its
+// compiled macro::Program. Parsing the text is what the execution did before the compilation:
+// the benchmark skips the simulated input, identical in both cases.
+TEST_CLASS(MacroBenchmark) {
+public:
+	
+	TEST_METHOD(Execute_short) {
+		benchmark(1);
+	}
+	
+	TEST_METHOD(Execute_long) {
+		benchmark(50);
+	}
+	
+private:
+	
+	static constexpr int kExecutions = 1000;
+	
+	static constexpr LPCTSTR kTextPart =
+		_T("Hello, \\\\world \\[1\\]![Ctrl+A][{Wait,10}][{Focus,10,!Notepad}]")
+		_T("[|abc|][{MouseMoveTo,10,20}][Ctrl+Shift+Home][{KeysDown,Shift}]x[{KeysDown,}]\r\n");
+	
+	// Names of the [{command}] commands, in the order the former interpreter compared them.
+	static constexpr LPCTSTR kCommandNames[] = {
+		_T("Wait"), _T("Focus"), _T("FocusOrLaunch"), _T("Cancel"), _T("Copy"), _T("MouseButton"),
+		_T("MouseMoveTo"), _T("MouseMoveToFocus"), _T("MouseMoveBy"), _T("MouseWheel"),
+		_T("KeysDown"),
+	};
+	
+	// Returns a checksum of the instructions of a program, to avoid optimizing the walk away:
+	// the sum of the regular characters, plus 1 per other instruction.
+	static int walk(const macro::Program& program) {
+		int checksum = 0;
+		for (const macro::Instruction* instruction = program.begin(); instruction != program.end();
+				instruction = instruction->getNext()) {
+			if (instruction->opcode == macro::Opcode::kChars) {
+				for (LPCTSTR chr = instruction->getString(0); *chr; chr++) {
+					checksum += *chr;
+				}
+			} else {
+				checksum += 1;
+			}
+		}
+		return checksum;
+	}
+	
+	// Decodes a text as the former interpreter did before each execution: scans the text,
+	// copies and unescapes the inside of each [], looks up the command names, parses the arguments
+	// and the keystrokes. Returns the same checksum as walk().
+	static int interpret(LPCTSTR text) {
+		int checksum = 0;
+		bool escaping = false;
+		for (size_t i = 0; text[i]; i++) {
+			const TCHAR c = text[i];
+			if (c == _T('\n')) {
+				continue;
+			}
+			if (!escaping && c == _T('\\')) {
+				escaping = true;
+				continue;
+			}
+			if (escaping || c != _T('[')) {
+				escaping = false;
+				checksum += c;
+				continue;
+			}
+			
+			const LPCTSTR shortcut_start = text + i + 1;
+			LPCTSTR shortcut_end = shortcut_start;
+			bool escaping2 = false;
+			while (*shortcut_end && !(*shortcut_end == _T(']') && !escaping2)) {
+				escaping2 = !escaping2 && (*shortcut_end == _T('\\'));
+				shortcut_end++;
+			}
+			if (!*shortcut_end) {
+				break;
+			}
+			
+			String inside(shortcut_start, int(shortcut_end - shortcut_start));
+			if (inside.isEmpty()) {
+				// []
+			} else if (*shortcut_start == _T('[') && *shortcut_end == _T(']')) {
+				// [[command line]]
+				shortcut_end++;
+				unescape(&inside[1]);
+			} else if (*shortcut_start == _T('{') && shortcut_end[-1] == _T('}')) {
+				// [{command,arguments}]
+				inside[inside.getLength() - 1] = _T('\0');
+				LPTSTR arg = &inside[1];
+				const LPCTSTR command = parseCommaSepArgUnescape(arg);
+				for (const LPCTSTR command_name : kCommandNames) {
+					if (!lstrcmpi(command, command_name)) {
+						break;
+					}
+				}
+				while (*arg) {
+					StrToInt(parseCommaSepArgUnescape(arg));
+				}
+			} else if (*shortcut_start == _T('|') && shortcut_end[-1] == _T('|')) {
+				// [|characters as keystrokes|]
+				inside[inside.getLength() - 1] = _T('\0');
+				unescape(inside.get());
+			} else {
+				// [keystroke]
+				unescape(inside.get());
+				Keystroke keystroke;
+				keystroke.parseDisplayName(inside.get());
+			}
+			checksum += 1;
+			i = shortcut_end - text;
+		}
+		return checksum;
+	}
+	
+	static void benchmark(int text_parts) {
+		String text;
+		for (int i = 0; i < text_parts; i++) {
+			text += kTextPart;
+		}
+		
+		macro::Program compiled_program;
+		compiled_program.compile(text);
+		const int expected_checksum = walk(compiled_program);
+		
+		int parse_checksum = 0;
+		const LONGLONG parse_ticks = measure([&] {
+			for (int execution = 0; execution < kExecutions; execution++) {
+				parse_checksum = interpret(text);
+			}
+		});
+		
+		int compiled_checksum = 0;
+		const LONGLONG compiled_ticks = measure([&] {
+			for (int execution = 0; execution < kExecutions; execution++) {
+				compiled_checksum = walk(compiled_program);
+			}
+		});
+		
+		Assert::AreEqual(expected_checksum, parse_checksum);
+		Assert::AreEqual(expected_checksum, compiled_checksum);
+		Logger::WriteMessage(StringPrintf(
+			_T("%d characters, %d bytes compiled: text %lld ticks, compiled %lld ticks, speedup x%d.%02d\n"),
+			text.getLength(), compiled_program.getSize(), parse_ticks, compiled_ticks,
+			int(parse_ticks / std::max(compiled_ticks, LONGLONG(1))),
+			int(parse_ticks * 100 / std::max(compiled_ticks, LONGLONG(1)) % 100)));
+	}
+};
+
+
+// Translation of the characters of a text to virtual keys and scan codes, as typing it does,
+// by calling VkKeyScan() and MapVirtualKey() versus via the input::KeyboardLayout cache.
+TEST_CLASS(KeyboardLayoutBenchmark) {
+public:
+	
+	TEST_METHOD(Translate_10k) {
+		benchmark(10000);
+	}
+	
+private:
+	
+	static void benchmark(int char_count) {
+		String text;
+		for (int i = 0; i < char_count; i++) {
+			text += TCHAR(_T(' ') + i % 95);
+		}
+		
+		UINT api_checksum = 0;
+		const LONGLONG api_ticks = measure([&] {
+			api_checksum = 0;
+			for (int i = 0; i < char_count; i++) {
+				const SHORT vk_and_shift = VkKeyScan(text[i]);
+				api_checksum += vk_and_shift + MapVirtualKey(LOBYTE(vk_and_shift), MAPVK_VK_TO_VSC);
+			}
+		});
+		
+		UINT cached_checksum = 0;
+		const LONGLONG cached_ticks = measure([&] {
+			cached_checksum = 0;
+			const input::KeyboardLayout layout = input::KeyboardLayout::getCurrent();
+			for (int i = 0; i < char_count; i++) {
+				const SHORT vk_and_shift = layout.vkKeyScan(text[i]);
+				cached_checksum += vk_and_shift + layout.vkToScanCode(LOBYTE(vk_and_shift));
+			}
+		});
+		
+		Assert::AreEqual(api_checksum, cached_checksum);
+		Logger::WriteMessage(StringPrintf(
+			_T("%d characters: API %lld ticks, cached %lld ticks, speedup x%d.%02d\n"),
+			char_count, api_ticks, cached_ticks,
+			int(api_ticks / std::max(cached_ticks, LONGLONG(1))),
+			int(api_ticks * 100 / std::max(cached_ticks, LONGLONG(1)) % 100)));
+	}
+};
+
+
+// Injection of regular characters, one posted WM_CHAR message per character versus keystrokes
+// coalesced into input::InputBatch batches. The benchmark does not inject input: both paths post
+// their messages to the message queue of the test thread, once per character for WM_CHAR and once
+// per batch in place of SendInput(), then drain the queue.
+TEST_CLASS(InputBenchmark) {
+public:
+	
+	TEST_METHOD(Type_short) {
+		benchmark(1, input::InputBatch::kMaxSize);
+	}
+	
+	TEST_METHOD(Type_long) {
+		benchmark(100, input::InputBatch::kMaxSize);
+	}
+	
+	TEST_METHOD(Type_long_smallBatches) {
+		benchmark(100, input::InputBatch::kMinSize);
+	}
+	
+	TEST_METHOD(Type_nonLayoutChars) {
+		benchmarkNonLayout(1000);
+	}
+	
+private:
+	
+	static constexpr LPCTSTR kTextPart = _T("The quick brown fox jumps over the lazy dog. ");
+	
+	// Replacement of SendInput() posting one message per call.
+	static UINT WINAPI postInput(UINT count, INPUT* inputs, int input_size) {
+		PostThreadMessage(GetCurrentThreadId(), WM_NULL, count, LPARAM(inputs));
+		return count;
+	}
+	
+	// Removes the messages of the message queue of the thread. Returns their number.
+	static int drainMessages() {
+		int count = 0;
+		MSG msg;
+		while (PeekMessage(&msg, NULL, 0, 0, PM_REMOVE)) {
+			count++;
+		}
+		return count;
+	}
+	
+	static void benchmark(int text_parts, int batch_size) {
+		String text;
+		for (int i = 0; i < text_parts; i++) {
+			text += kTextPart;
+		}
+		const int char_count = text.getLength();
+		
+		Keystroke* const keystrokes = new Keystroke[char_count];
+		for (int i = 0; i < char_count; i++) {
+			const SHORT vk_and_shift = VkKeyScan(text[i]);
+			Assert::AreNotEqual(SHORT(-1), vk_and_shift);
+			keystrokes[i].m_vk = LOBYTE(vk_and_shift);
+			keystrokes[i].m_sided_mod_code = (HIBYTE(vk_and_shift) & 1) ? MOD_SHIFT : 0;
+		}
+		drainMessages();
+		
+		int char_messages = 0;
+		const LONGLONG char_ticks = measure([&] {
+			for (int i = 0; i < char_count; i++) {
+				PostThreadMessage(GetCurrentThreadId(), WM_CHAR, text[i], 0);
+			}
+			char_messages = drainMessages();
+		});
+		
+		int batch_messages = 0;
+		int batch_events = 0;
+		const LONGLONG batch_ticks = measure([&] {
+			HotKeySuspension hotkey_suspension;
+			input::InputBatch batch(&hotkey_suspension, postInput);
+			batch.setMaxSize(batch_size);
+			for (int i = 0; i < char_count; i++) {
+				if (!batch.addKeystroke(keystrokes[i], /* already_down_mod_code= */ 0)) {
+					batch.send();
+					batch.addKeystroke(keystrokes[i], /* already_down_mod_code= */ 0);
+				}
+			}
+			batch.send();
+			batch_messages = drainMessages();
+			batch_events = batch.getSentEventCount();
+		});
+		delete[] keystrokes;
+		
+		Assert::AreEqual(char_count, char_messages);
+		Assert::IsTrue(batch_messages <= char_count);
+		
+		LARGE_INTEGER frequency;
+		QueryPerformanceFrequency(&frequency);
+		const auto chars_per_second = [&](LONGLONG ticks) {
+			return LONGLONG(char_count) * frequency.QuadPart / std::max(ticks, LONGLONG(1));
+		};
+		Logger::WriteMessage(StringPrintf(
+			_T("%d characters: WM_CHAR %d events in %d calls, %lld chars/s; ")
+			_T("batches of %d: %d events in %d calls, %lld chars/s\n"),
+			char_count, char_count, char_messages, chars_per_second(char_ticks),
+			batch_size, batch_events, batch_messages, chars_per_second(batch_ticks)));
+	}
+	
+	// Characters absent from the keyboard layout: Alt + '+' + hexadecimal code keystrokes versus
+	// Unicode input events, both batched. The Alt + code keystrokes of simulateCharacter() are not
+	// batched: their timing is a lower bound.
+	static void benchmarkNonLayout(int char_count) {
+		constexpr WORD kFirstChar = 0x4E00;  // CJK ideographs.
+		drainMessages();
+		
+		int alt_events = 0;
+		int alt_messages = 0;
+		const LONGLONG alt_ticks = measure([&] {
+			HotKeySuspension hotkey_suspension;
+			input::InputBatch batch(&hotkey_suspension, postInput);
+			batch.setMaxSize(input::InputBatch::kMaxSize);
+			for (int i = 0; i < char_count; i++) {
+				int count;
+				batch.getEvents(&count);
+				if (count + 12 > input::InputBatch::kMaxSize) {
+					batch.send();
+				}
+				
+				char digits[6];
+				wsprintfA(digits, "+%04X", kFirstChar + i);
+				batch.addKey(VK_MENU, /* down= */ true);
+				for (const char* digit = digits; *digit; digit++) {
+					Keystroke keystroke;
+					keystroke.m_vk = BYTE(*digit == '+' ? VK_ADD : *digit);
+					keystroke.m_sided_mod_code = MOD_ALT;
+					batch.addKeystroke(keystroke, /* already_down_mod_code= */ MOD_ALT);
+				}
+				batch.addKey(VK_MENU, /* down= */ false);
+			}
+			batch.send();
+			alt_messages = drainMessages();
+			alt_events = batch.getSentEventCount();
+		});
+		
+		int unicode_events = 0;
+		int unicode_messages = 0;
+		const LONGLONG unicode_ticks = measure([&] {
+			HotKeySuspension hotkey_suspension;
+			input::InputBatch batch(&hotkey_suspension, postInput);
+			batch.setMaxSize(input::InputBatch::kMaxSize);
+			for (int i = 0; i < char_count; i++) {
+				if (!batch.addUnicode(TCHAR(kFirstChar + i))) {
+					batch.send();
+					batch.addUnicode(TCHAR(kFirstChar + i));
+				}
+			}
+			batch.send();
+			unicode_messages = drainMessages();
+			unicode_events = batch.getSentEventCount();
+		});
+		
+		Assert::AreEqual(char_count * 2, unicode_events);
+		Assert::IsTrue(unicode_messages < alt_messages);
+		
+		LARGE_INTEGER frequency;
+		QueryPerformanceFrequency(&frequency);
+		const auto chars_per_second = [&](LONGLONG ticks) {
+			return LONGLONG(char_count) * frequency.QuadPart / std::max(ticks, LONGLONG(1));
+		};
+		Logger::WriteMessage(StringPrintf(
+			_T("%d non-layout characters: Alt + code %d events in %d calls, %lld chars/s; ")
+			_T("Unicode %d events in %d calls, %lld chars/s\n"),
+			char_count, alt_events, alt_messages, chars_per_second(alt_ticks),
+			unicode_events, unicode_messages, chars_per_second(unicode_ticks)));
+	}
+};
+
+
+// Accuracy of the waits between input events: Sleep() versus pacing::Pacer.
+// Logs the mean and the maximum of the actual duration minus the requested one (the jitter).
+TEST_CLASS(PacingBenchmark) {
+public:
+	
+	TEST_METHOD(Wait_1ms) {
+		benchmark(1000);
+	}
+	
+	TEST_METHOD(Wait_500us) {
+		benchmark(500);
+	}
+	
+	TEST_METHOD(Wait_100us) {
+		benchmark(100);
+	}
+
+private:
+	
+	static constexpr int kWaits = 100;
+	
+	// Calls a waiting function kWaits times. Outputs the mean and maximum overshoots in microseconds.
+	template<typename Function>
+	static void measureWaits(LONGLONG duration_us, Function wait,
+			LONGLONG* mean_overshoot_us, LONGLONG* max_overshoot_us) {
+		LONGLONG total_overshoot_us = 0;
+		*max_overshoot_us = 0;
+		for (int i = 0; i < kWaits; i++) {
+			const LONGLONG start = pacing::getMicroseconds();
+			wait();
+			const LONGLONG overshoot_us = pacing::getMicroseconds() - start - duration_us;
+			total_overshoot_us += overshoot_us;
+			*max_overshoot_us = std::max(*max_overshoot_us, overshoot_us);
+		}
+		*mean_overshoot_us = total_overshoot_us / kWaits;
+	}
+	
+	static void benchmark(LONGLONG duration_us) {
+		LONGLONG sleep_mean_us, sleep_max_us;
+		measureWaits(duration_us, [&] { Sleep(DWORD((duration_us + 999) / 1000)); },
+			&sleep_mean_us, &sleep_max_us);
+		
+		pacing::Pacer pacer;
+		LONGLONG pacer_mean_us, pacer_max_us;
+		measureWaits(duration_us, [&] { pacer.wait(duration_us); }, &pacer_mean_us, &pacer_max_us);
+		
+		Assert::IsTrue(pacer_mean_us >= 0);
+		Logger::WriteMessage(StringPrintf(
+			_T("%d waits of %lld us: Sleep() overshoot mean %lld us, max %lld us; ")
+			_T("Pacer (%s timer) overshoot mean %lld us, max %lld us\n"),
+			kWaits, duration_us, sleep_mean_us, sleep_max_us,
+			pacer.isHighResolution() ? _T("high-resolution") : _T("regular"),
+			pacer_mean_us, pacer_max_us));
+	}
+};
+
+
+// Per-launch cost of a command line: the parsing at each launch that shellExecuteCmdLine() did
+// (ExpandEnvironmentStrings(), splitting, uncached findFullPath()) versus CommandLine::prepare()
+// on a precompiled template. Logs the breakdown: variables, file search, total.
+// The benchmark does not launch the command.
+TEST_CLASS(CommandLineBenchmark) {
+public:
+	
+	TEST_METHOD(Prepare_1k) {
+		benchmark(1000);
+	}
+	
+private:
+	
+	static constexpr LPCTSTR kCommand =
+		_T("notepad.exe \"%CLAVIER_BENCHMARK_DIR%\\notes.txt\" /A %CLAVIER_BENCHMARK_DIR%");
+	
+	static void benchmark(int launch_count) {
+		SetEnvironmentVariable(_T("CLAVIER_BENCHMARK_DIR"), _T("C:\\Some directory"));
+		
+		// Variables: ExpandEnvironmentStrings() versus EnvTemplate::expand().
+		TCHAR expanded[1024];
+		const LONGLONG api_expand_ticks = measure([&] {
+			for (int i = 0; i < launch_count; i++) {
+				ExpandEnvironmentStrings(kCommand, expanded, arrayLength(expanded));
+			}
+		});
+		EnvTemplate env_template;
+		env_template.compile(kCommand);
+		String template_expanded;
+		const LONGLONG template_expand_ticks = measure([&] {
+			for (int i = 0; i < launch_count; i++) {
+				env_template.expand(&template_expanded);
+			}
+		});
+		Assert::AreEqual(LPCTSTR(expanded), template_expanded);
+		
+		// File search: uncached versus cached findFullPath().
+		TCHAR file[MAX_PATH], full_path[MAX_PATH];
+		const LONGLONG search_ticks = measure([&] {
+			for (int i = 0; i < launch_count; i++) {
+				clearFullPathCache();
+				StringCchCopy(file, arrayLength(file), _T("notepad.exe"));
+				findFullPath(file, full_path);
+			}
+		});
+		const LONGLONG cached_search_ticks = measure([&] {
+			for (int i = 0; i < launch_count; i++) {
+				StringCchCopy(file, arrayLength(file), _T("notepad.exe"));
+				findFullPath(file, full_path);
+			}
+		});
+		
+		// Total: the former parsing at each launch versus CommandLine::prepare().
+		TCHAR parsed_file[MAX_PATH], parsed_directory[MAX_PATH];
+		String parsed_parameters;
+		const LONGLONG parse_ticks = measure([&] {
+			for (int i = 0; i < launch_count; i++) {
+				ExpandEnvironmentStrings(kCommand, expanded, arrayLength(expanded));
+				StringCchCopy(parsed_file, arrayLength(parsed_file), expanded);
+				PathRemoveArgs(parsed_file);
+				parsed_parameters = PathGetArgs(expanded);
+				clearFullPathCache();
+				findFullPath(parsed_file, parsed_directory);
+				PathRemoveFileSpec(parsed_directory);
+				PathQuoteSpaces(parsed_file);
+			}
+		});
+		CommandLine command_line;
+		command_line.compile(kCommand, _T(""));
+		CommandLine::Launch launch;
+		const LONGLONG prepare_ticks = measure([&] {
+			for (int i = 0; i < launch_count; i++) {
+				command_line.prepare(&launch);
+			}
+		});
+		Assert::AreEqual(LPCTSTR(parsed_file), launch.file);
+		Assert::AreEqual(LPCTSTR(parsed_parameters), launch.parameters);
+		Assert::AreEqual(LPCTSTR(parsed_directory), launch.directory);
+		
+		SetEnvironmentVariable(_T("CLAVIER_BENCHMARK_DIR"), nullptr);
+		clearFullPathCache();
+		Logger::WriteMessage(StringPrintf(
+			_T("%d launches: variables: API %lld ticks, template %lld ticks; ")
+			_T("file search: uncached %lld ticks, cached %lld ticks; ")
+			_T("total: parsing %lld ticks, template %lld ticks, speedup x%d.%02d\n"),
+			launch_count, api_expand_ticks, template_expand_ticks,
+			search_ticks, cached_search_ticks,
+			parse_ticks, prepare_ticks,
+			int(parse_ticks / std::max(prepare_ticks, LONGLONG(1))),
+			int(parse_ticks * 100 / std::max(prepare_ticks, LONGLONG(1)) % 100)));
+	}
+};
+
+}  // namespace BenchmarkTest
@@ -0,0 +1,177 @@
+// Clavier+
+// Keyboard shortcuts manager
+//
+// Copyright (C) 2000-2008 Guillaume Ryder
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+
+#include "StdAfx.h"
+#include "../Clipboard.h"
+#include "../Global.h"
+#include "../MyString.h"
+
+namespace ClipboardTest {
+
+using clipboard::Paster;
+using clipboard::SavedContents;
+
+// Returns the Unicode text of the clipboard, or "<none>".
+String getClipboardText() {
+	String text = _T("<none>");
+	Assert::IsTrue(OpenClipboard(/* hWndNewOwner= */ NULL));
+	const HGLOBAL data = HGLOBAL(GetClipboardData(CF_UNICODETEXT));
+	if (data) {
+		text = LPCTSTR(GlobalLock(data));
+		GlobalUnlock(data);
+	}
+	Assert::IsTrue(CloseClipboard());
+	return text;
+}
+
+// Adds a private format to the clipboard, which SavedContents cannot save.
+// Returns the data of the format, to free once the clipboard no longer holds it.
+HGLOBAL addPrivateFormat() {
+	const HGLOBAL data = GlobalAlloc(GMEM_MOVEABLE, 1);
+	Assert::IsTrue(OpenClipboard(/* hWndNewOwner= */ NULL));
+	Assert::IsTrue(SetClipboardData(CF_PRIVATEFIRST, data) != NULL);
+	Assert::IsTrue(CloseClipboard());
+	return data;
+}
+
+
+TEST_CLASS(SavedContentsTest) {
+public:
+	
+	TEST_METHOD(SaveRestore_text) {
+		setClipboardText(_T("Saved text"));
+		
+		SavedContents saved_contents;
+		Assert::IsTrue(OpenClipboard(/* hWndNewOwner= */ NULL));
+		Assert::IsTrue(saved_contents.save());
+		Assert::AreEqual(1, saved_contents.getFormatCount());  // CF_TEXT and CF_OEMTEXT are synthesized.
+		EmptyClipboard();
+		Assert::IsTrue(CloseClipboard());
+		Assert::AreEqual(_T("<none>"), getClipboardText());
+		
+		Assert::IsTrue(OpenClipboard(/* hWndNewOwner= */ NULL));
+		EmptyClipboard();
+		saved_contents.restore();
+		Assert::IsTrue(CloseClipboard());
+		Assert::AreEqual(0, saved_contents.getFormatCount());
+		Assert::AreEqual(_T("Saved text"), getClipboardText());
+	}
+	
+	TEST_METHOD(Save_emptyClipboard) {
+		Assert::IsTrue(OpenClipboard(/* hWndNewOwner= */ NULL));
+		EmptyClipboard();
+		SavedContents saved_contents;
+		Assert::IsTrue(saved_contents.save());
+		Assert::IsTrue(CloseClipboard());
+		Assert::AreEqual(0, saved_contents.getFormatCount());
+	}
+	
+	TEST_METHOD(Save_unsupportedFormat) {
+		setClipboardText(_T("Saved text"));
+		const HGLOBAL private_data = addPrivateFormat();
+		
+		SavedContents saved_contents;
+		Assert::IsTrue(OpenClipboard(/* hWndNewOwner= */ NULL));
+		Assert::IsFalse(saved_contents.save());
+		Assert::IsTrue(CloseClipboard());
+		Assert::AreEqual(0, saved_contents.getFormatCount());
+		
+		setClipboardText(_T("Saved text"));
+		GlobalFree(private_data);
+	}
+	
+	TEST_METHOD(Save_tooLarge) {
+		const HGLOBAL data = GlobalAlloc(GMEM_MOVEABLE | GMEM_ZEROINIT, SavedContents::kMaxSize + 1);
+		Assert::IsTrue(OpenClipboard(/* hWndNewOwner= */ NULL));
+		EmptyClipboard();
+		Assert::IsTrue(SetClipboardData(RegisterClipboardFormat(_T("ClavierTest")), data) != NULL);
+		
+		SavedContents saved_contents;
+		Assert::IsFalse(saved_contents.save());
+		Assert::IsTrue(CloseClipboard());
+		Assert::AreEqual(0, saved_contents.getFormatCount());
+	}
+};
+
+
+// The test thread plays the target: it reads the clipboard between offer() and finish().
+TEST_CLASS(PasterTest) {
+public:
+	
+	TEST_METHOD_INITIALIZE(setUp) {
+		setClipboardText(_T("Previous"));
+	}
+	
+	TEST_METHOD(Finish_pasted) {
+		Paster paster;
+		Assert::IsTrue(paster.offer(_T("Pasted text"), 11));
+		Assert::AreEqual(_T("Pasted text"), getClipboardText());
+		Assert::IsTrue(paster.finish(/* task= */ nullptr).runSynchronously());
+		Assert::IsTrue(paster.isRequested());
+		Assert::AreEqual(_T("Previous"), getClipboardText());
+	}
+	
+	TEST_METHOD(Finish_notRequested_restores) {
+		Paster paster;
+		Assert::IsTrue(paster.offer(_T("Ignored text"), 12));
+		Assert::IsTrue(paster.finish(/* task= */ nullptr).runSynchronously());
+		Assert::IsFalse(paster.isRequested());
+		Assert::AreEqual(_T("Previous"), getClipboardText());
+		
+		// The text is withdrawn: reoffering it works as usual.
+		Assert::IsTrue(paster.offer(_T("Pasted text"), 11));
+		Assert::AreEqual(_T("Pasted text"), getClipboardText());
+		Assert::IsTrue(paster.finish(/* task= */ nullptr).runSynchronously());
+		Assert::IsTrue(paster.isRequested());
+		Assert::AreEqual(_T("Previous"), getClipboardText());
+	}
+	
+	TEST_METHOD(Finish_clipboardChangedMeanwhile) {
+		Paster paster;
+		Assert::IsTrue(paster.offer(_T("Pasted text"), 11));
+		setClipboardText(_T("Copied meanwhile"));
+		Assert::IsTrue(paster.finish(/* task= */ nullptr).runSynchronously());
+		Assert::IsFalse(paster.isRequested());
+		Assert::AreEqual(_T("Copied meanwhile"), getClipboardText());
+	}
+	
+	TEST_METHOD(Offer_unsupportedFormat_keepsClipboard) {
+		const HGLOBAL private_data = addPrivateFormat();
+		
+		Paster paster;
+		Assert::IsFalse(paster.offer(_T("Typed text"), 10));
+		Assert::AreEqual(_T("Previous"), getClipboardText());
+		Assert::IsTrue(IsClipboardFormatAvailable(CF_PRIVATEFIRST));
+		
+		setClipboardText(_T("Previous"));
+		GlobalFree(private_data);
+	}
+	
+	TEST_METHOD(Offer_reusable) {
+		Paster paster;
+		for (int i = 0; i < 3; i++) {
+			Assert::IsTrue(paster.offer(_T("Pasted text"), 11));
+			Assert::AreEqual(_T("Pasted text"), getClipboardText());
+			Assert::IsTrue(paster.finish(/* task= */ nullptr).runSynchronously());
+		}
+		Assert::AreEqual(_T("Previous"), getClipboardText());
+	}
+};
+
+}  // namespace ClipboardTest
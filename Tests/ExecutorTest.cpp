@@ -0,0 +1,378 @@
+// Clavier+
+// Keyboard shortcuts manager
+//
+// Copyright (C) 2000-2008 Guillaume Ryder
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+#include "StdAfx.h"
+#include "../Executor.h"
+#include "../Metrics.h"
+
+namespace ExecutorTest {
+
+using executor::Admission;
+using executor::ExecutorStats;
+using executor::Scheduler;
+
+// Keys of the tasks: only their addresses matter.
+const int kKey1 = 1;
+const int kKey2 = 2;
+const int kKey3 = 3;
+
+// Records the runs of the TestTasks sharing it.
+struct RunLog {
+	static constexpr int kMaxRuns = 64;
+	
+	int run_count;
+	int runs[kMaxRuns];  // Task IDs, in order of run start.
+	DWORD end_times[kMaxRuns];  // Scheduler::now() at the end of each run, in order of run start.
+	bool sleep_results[kMaxRuns];  // Result of the sleep of each run, in order of run start.
+};
+
+// Task appending its ID to a RunLog, then sleeping, then optionally cancelling the other tasks.
+class TestTask : public executor::Task {
+public:
+	
+	TestTask(Scheduler* scheduler, RunLog* log, int id, DWORD sleep_ms, bool cancel_others = false)
+			: m_scheduler(scheduler), m_log(log), m_id(id), m_sleep_ms(sleep_ms),
+				m_cancel_others(cancel_others) {}
+	
+	executor::Coroutine run() override {
+		const int run = m_log->run_count++;
+		m_log->runs[run] = m_id;
+		m_log->sleep_results[run] = co_await executor::sleep(this, m_sleep_ms);
+		if (m_cancel_others) {
+			m_scheduler->cancelAll(/* except_task= */ this);
+		}
+		m_log->end_times[run] = m_scheduler->now();
+		co_return true;
+	}
+	
+private:
+	
+	Scheduler* m_scheduler;
+	RunLog* m_log;
+	int m_id;
+	DWORD m_sleep_ms;
+	bool m_cancel_others;
+};
+
+// Records the runs of characters of the TypingTasks sharing it.
+struct TypingLog {
+	static constexpr int kMaxRuns = 64;
+	
+	int run_count;
+	int runs[kMaxRuns];  // Task IDs, in order of typing.
+};
+
+// Task typing runs of characters without delay, yielding after each run like typeText().
+class TypingTask : public executor::Task {
+public:
+	
+	TypingTask(TypingLog* log, int id, int run_count)
+		: m_log(log), m_id(id), m_run_count(run_count) {}
+	
+	executor::Coroutine run() override {
+		for (int run = 0; run < m_run_count; run++) {
+			m_log->runs[m_log->run_count++] = m_id;
+			if (!co_await executor::sleep(this, 0)) {
+				co_return false;
+			}
+		}
+		co_return true;
+	}
+	
+private:
+	
+	TypingLog* m_log;
+	int m_id;
+	int m_run_count;
+};
+
+// Task executing a hotkey dispatch: marks its first output after sleeping.
+class DispatchTask : public executor::Task {
+public:
+	
+	explicit DispatchTask(metrics::Dispatch* dispatch) {
+		m_dispatch = dispatch;
+	}
+	
+	executor::Coroutine run() override {
+		co_await executor::sleep(this, 10);
+		metrics::markOutput();
+		co_return true;
+	}
+};
+
+
+TEST_CLASS(SchedulerTest) {
+public:
+	
+	TEST_METHOD_INITIALIZE(setUp) {
+		m_scheduler = new Scheduler(Scheduler::Clock::kVirtual);
+		m_log = {};
+	}
+	
+	TEST_METHOD_CLEANUP(tearDown) {
+		m_scheduler->runUntilIdle();
+		delete m_scheduler;
+	}
+	
+	TEST_METHOD(Submit_runsAfterVirtualSleep) {
+		const metrics::Histogram& run_histogram =
+			metrics::getGlobalStats().stages[int(metrics::Stage::kMacroRun)];
+		const DWORD initial_run_count = run_histogram.getCount();
+		
+		submit(&kKey1, 1, /* sleep_ms= */ 3600 * 1000);
+		m_scheduler->runUntilIdle();
+		
+		Assert::AreEqual(1, m_log.run_count);
+		Assert::AreEqual(1, m_log.runs[0]);
+		Assert::IsTrue(m_log.sleep_results[0]);
+		Assert::AreEqual(DWORD(3600 * 1000), m_log.end_times[0]);
+		Assert::AreEqual(DWORD(3600 * 1000), m_scheduler->now());
+		Assert::AreEqual(initial_run_count + 1, run_histogram.getCount());
+		checkStats(/* submitted= */ 1, /* completed= */ 1, /* cancelled= */ 0, /* coalesced= */ 0,
+			/* dropped= */ 0);
+	}
+	
+	TEST_METHOD(RunFor_stopsAtDuration) {
+		submit(&kKey1, 1, /* sleep_ms= */ 1000);
+		
+		m_scheduler->runFor(999);
+		Assert::AreEqual(DWORD(999), m_scheduler->now());
+		Assert::AreEqual(DWORD(0), m_log.end_times[0]);
+		
+		m_scheduler->runFor(1);
+		Assert::AreEqual(DWORD(1000), m_log.end_times[0]);
+	}
+	
+	TEST_METHOD(Submit_sameKey_serializesAndCoalesces) {
+		submit(&kKey1, 1, /* sleep_ms= */ 1000);
+		m_scheduler->runReady();
+		
+		// Task 1 is running: task 2 waits, task 3 is coalesced into it.
+		submit(&kKey1, 2, /* sleep_ms= */ 500);
+		submit(&kKey1, 3, /* sleep_ms= */ 500);
+		m_scheduler->runUntilIdle();
+		
+		Assert::AreEqual(2, m_log.run_count);
+		Assert::AreEqual(1, m_log.runs[0]);
+		Assert::AreEqual(2, m_log.runs[1]);
+		Assert::AreEqual(DWORD(1000), m_log.end_times[0]);
+		Assert::AreEqual(DWORD(1500), m_log.end_times[1]);
+		checkStats(/* submitted= */ 3, /* completed= */ 2, /* cancelled= */ 0, /* coalesced= */ 1,
+			/* dropped= */ 0);
+	}
+	
+	TEST_METHOD(Submit_queue_runsAllInOrderUpToLimit) {
+		for (int id = 1; id <= Scheduler::kMaxWaitingTasks + 2; id++) {
+			submit(&kKey1, id, /* sleep_ms= */ 10, Admission::kQueue);
+		}
+		m_scheduler->runUntilIdle();
+		
+		// Task 1 is admitted then kMaxWaitingTasks tasks wait behind it: the last one is dropped.
+		Assert::AreEqual(Scheduler::kMaxWaitingTasks + 1, m_log.run_count);
+		for (int run = 0; run < m_log.run_count; run++) {
+			Assert::AreEqual(run + 1, m_log.runs[run]);
+		}
+		checkStats(
+			/* submitted= */ Scheduler::kMaxWaitingTasks + 2,
+			/* completed= */ Scheduler::kMaxWaitingTasks + 1, /* cancelled= */ 0, /* coalesced= */ 0,
+			/* dropped= */ 1);
+		Assert::AreEqual(LONG(Scheduler::kMaxWaitingTasks), m_scheduler->getStats().max_waiting);
+	}
+	
+	TEST_METHOD(Submit_drop_dropsWhileRunning) {
+		submit(&kKey1, 1, /* sleep_ms= */ 100, Admission::kDrop);
+		m_scheduler->runFor(50);
+		submit(&kKey1, 2, /* sleep_ms= */ 100, Admission::kDrop);
+		m_scheduler->runFor(100);
+		submit(&kKey1, 3, /* sleep_ms= */ 100, Admission::kDrop);
+		m_scheduler->runUntilIdle();
+		
+		Assert::AreEqual(2, m_log.run_count);
+		Assert::AreEqual(1, m_log.runs[0]);
+		Assert::AreEqual(3, m_log.runs[1]);
+		checkStats(/* submitted= */ 3, /* completed= */ 2, /* cancelled= */ 0, /* coalesced= */ 0,
+			/* dropped= */ 1);
+	}
+	
+	// Replays a storm of auto-repeated hotkeys: one press every 30 ms for 600 ms, on 3 shortcuts
+	// taking 100 ms each, one per admission policy.
+	TEST_METHOD(Submit_hotkeyStorm_appliesEachPolicy) {
+		constexpr int kPresses = 20;
+		constexpr DWORD kPressIntervalMs = 30;
+		constexpr DWORD kRunMs = 100;
+		constexpr int kQueueBase = 100;
+		constexpr int kCoalesceBase = 200;
+		constexpr int kDropBase = 300;
+		for (int press = 0; press < kPresses; press++) {
+			submit(&kKey1, kQueueBase + press, kRunMs, Admission::kQueue);
+			submit(&kKey2, kCoalesceBase + press, kRunMs, Admission::kCoalesce);
+			submit(&kKey3, kDropBase + press, kRunMs, Admission::kDrop);
+			m_scheduler->runFor(kPressIntervalMs);
+		}
+		m_scheduler->runUntilIdle();
+		
+		// Queue: every press runs, in order. Coalesce: the runs are in order and the last one
+		// starts after the last press. Drop: only the presses received while idle run.
+		int queue_runs = 0, coalesce_runs = 0, drop_runs = 0;
+		int last_coalesce_run = -1;
+		for (int run = 0; run < m_log.run_count; run++) {
+			const int id = m_log.runs[run];
+			if (id >= kDropBase) {
+				drop_runs++;
+			} else if (id >= kCoalesceBase) {
+				Assert::IsTrue(last_coalesce_run < 0 || id > m_log.runs[last_coalesce_run]);
+				last_coalesce_run = run;
+				coalesce_runs++;
+			} else {
+				Assert::AreEqual(kQueueBase + queue_runs, id);
+				queue_runs++;
+			}
+		}
+		Assert::AreEqual(kPresses, queue_runs);
+		Assert::IsTrue(m_log.end_times[last_coalesce_run] - kRunMs >= (kPresses - 1) * kPressIntervalMs);
+		
+		// Runs start at 0, 100, 200... ms until the one waiting after the last press, at 600 ms.
+		Assert::AreEqual(7, coalesce_runs);
+		
+		// The presses at 0, 120, 240, 360 and 480 ms start a run: the others arrive during a run.
+		Assert::AreEqual(5, drop_runs);
+		
+		const ExecutorStats& stats = m_scheduler->getStats();
+		Assert::AreEqual(LONG(3 * kPresses), stats.submitted);
+		Assert::AreEqual(LONG(kPresses + coalesce_runs + drop_runs), stats.completed);
+		Assert::AreEqual(LONG(kPresses - coalesce_runs), stats.coalesced);
+		Assert::AreEqual(LONG(kPresses - drop_runs), stats.dropped);
+	}
+	
+	TEST_METHOD(Submit_otherKeys_runConcurrently) {
+		submit(&kKey1, 1, /* sleep_ms= */ 1000);
+		submit(&kKey2, 2, /* sleep_ms= */ 300);
+		m_scheduler->runUntilIdle();
+		
+		Assert::AreEqual(2, m_log.run_count);
+		Assert::AreEqual(DWORD(1000), m_scheduler->now());
+		checkStats(/* submitted= */ 2, /* completed= */ 2, /* cancelled= */ 0, /* coalesced= */ 0,
+			/* dropped= */ 0);
+	}
+	
+	TEST_METHOD(Submit_otherKeys_interleaveWhileTyping) {
+		TypingLog typing_log = {};
+		m_scheduler->submit(&kKey1, new TypingTask(&typing_log, 1, /* run_count= */ 10));
+		m_scheduler->submit(&kKey2, new TypingTask(&typing_log, 2, /* run_count= */ 3));
+		m_scheduler->runUntilIdle();
+		
+		// Task 2 does not wait for task 1 to finish: they alternate runs, without sleeping.
+		Assert::AreEqual(13, typing_log.run_count);
+		Assert::AreEqual(DWORD(0), m_scheduler->now());
+		for (int run = 1; run < 3 * 2; run++) {
+			Assert::AreNotEqual(typing_log.runs[run - 1], typing_log.runs[run]);
+		}
+		for (int run = 3 * 2; run < typing_log.run_count; run++) {
+			Assert::AreEqual(1, typing_log.runs[run]);
+		}
+	}
+	
+	TEST_METHOD(CancelAll_runningAndWaiting) {
+		submit(&kKey1, 1, /* sleep_ms= */ 5000);
+		m_scheduler->runFor(1000);
+		submit(&kKey1, 2, /* sleep_ms= */ 5000);
+		
+		m_scheduler->cancelAll(/* except_task= */ nullptr);
+		m_scheduler->runUntilIdle();
+		
+		// Task 1 wakes up immediately, task 2 never runs.
+		Assert::AreEqual(1, m_log.run_count);
+		Assert::IsFalse(m_log.sleep_results[0]);
+		Assert::AreEqual(DWORD(1000), m_log.end_times[0]);
+		checkStats(/* submitted= */ 2, /* completed= */ 0, /* cancelled= */ 2, /* coalesced= */ 0,
+			/* dropped= */ 0);
+	}
+	
+	TEST_METHOD(CancelAll_exceptCaller) {
+		submit(&kKey1, 1, /* sleep_ms= */ 5000);
+		submit(&kKey2, 2, /* sleep_ms= */ 100, /* cancel_others= */ true);
+		m_scheduler->runUntilIdle();
+		
+		Assert::AreEqual(DWORD(100), m_scheduler->now());
+		checkStats(/* submitted= */ 2, /* completed= */ 1, /* cancelled= */ 1, /* coalesced= */ 0,
+			/* dropped= */ 0);
+	}
+	
+	TEST_METHOD(CancelAll_exceptCaller_cancelsItsWaitingTasks) {
+		for (int id = 1; id <= 3; id++) {
+			m_scheduler->submit(&kKey1,
+				new TestTask(m_scheduler, &m_log, id, /* sleep_ms= */ 100, /* cancel_others= */ true),
+				Admission::kQueue);
+		}
+		m_scheduler->runUntilIdle();
+		
+		// The queued presses of a cancelling shortcut do not run it again.
+		Assert::AreEqual(1, m_log.run_count);
+		Assert::AreEqual(DWORD(100), m_scheduler->now());
+		checkStats(/* submitted= */ 3, /* completed= */ 1, /* cancelled= */ 2, /* coalesced= */ 0,
+			/* dropped= */ 0);
+	}
+	
+	TEST_METHOD(Submit_dispatch_resumedWhileRunning) {
+		metrics::Dispatch dispatch(GetTickCount());
+		dispatch.beginExecution();
+		dispatch.suspendExecution();
+		m_scheduler->submit(&kKey1, new DispatchTask(&dispatch));
+		
+		m_scheduler->runUntilIdle();
+		metrics::markOutput();  // Suspended again once the task ended: noop.
+		dispatch.endExecution();
+		
+		metrics::DispatchStats stats = {};
+		dispatch.record(&stats);
+		Assert::AreEqual(DWORD(1), stats.stages[int(metrics::Stage::kFirstOutput)].getCount());
+		Assert::AreEqual(DWORD(1), stats.stages[int(metrics::Stage::kTotal)].getCount());
+	}
+	
+	TEST_METHOD(Sleep_withoutTask_runsSynchronously) {
+		const auto coroutine = []() -> executor::Coroutine {
+			co_return co_await executor::sleep(/* task= */ nullptr, 0);
+		};
+		Assert::IsTrue(coroutine().runSynchronously());
+	}
+	
+private:
+	
+	void submit(const void* key, int id, DWORD sleep_ms, Admission admission) {
+		m_scheduler->submit(key, new TestTask(m_scheduler, &m_log, id, sleep_ms), admission);
+	}
+	
+	void submit(const void* key, int id, DWORD sleep_ms, bool cancel_others = false) {
+		m_scheduler->submit(key, new TestTask(m_scheduler, &m_log, id, sleep_ms, cancel_others));
+	}
+	
+	void checkStats(LONG submitted, LONG completed, LONG cancelled, LONG coalesced, LONG dropped) {
+		const ExecutorStats& stats = m_scheduler->getStats();
+		Assert::AreEqual(submitted, stats.submitted);
+		Assert::AreEqual(completed, stats.completed);
+		Assert::AreEqual(cancelled, stats.cancelled);
+		Assert::AreEqual(coalesced, stats.coalesced);
+		Assert::AreEqual(dropped, stats.dropped);
+	}
+	
+	Scheduler* m_scheduler;
+	RunLog m_log;
+};
+
+}  // namespace ExecutorTest
@@ -328,6 +328,22 @@ public:
 		checkClipboardEnvVariable(_T(""));
 	}
 	
+	TEST_METHOD(ClipboardToEnvironment_longText) {
+		checkLongTextLength(/* clipboard_length= */ 10000, /* expected_length= */ 10000);
+	}
+	
+	TEST_METHOD(ClipboardToEnvironment_tooLongText_truncated) {
+		checkLongTextLength(/* clipboard_length= */ 40000, /* expected_length= */ kMaxEnvVariableLength);
+	}
+	
+	TEST_METHOD(ReferencesClipboardVariable) {
+		Assert::IsTrue(referencesClipboardVariable(_T("iexplore.exe %CLIPBOARD%")));
+		Assert::IsTrue(referencesClipboardVariable(_T("\"%clipboard%\\a\"")));
+		Assert::IsFalse(referencesClipboardVariable(_T("notepad.exe CLIPBOARD")));
+		Assert::IsFalse(referencesClipboardVariable(_T("%CLIPBOARD")));
+		Assert::IsFalse(referencesClipboardVariable(nullptr));
+	}
+	
 private:
 	
 	void setClipboardData(UINT format, const void* data, size_t size) {
@@ -342,6 +358,18 @@ private:
 		Assert::IsTrue(CloseClipboard());
 	}
 	
+	void checkLongTextLength(int clipboard_length, int expected_length) {
+		wchar_t *const text = new wchar_t[clipboard_length + 1];
+		wmemset(text, L'a', clipboard_length);
+		text[clipboard_length] = L'\0';
+		setClipboardData(CF_UNICODETEXT, text, (clipboard_length + 1) * sizeof(wchar_t));
+		delete[] text;
+		
+		clipboardToEnvironment();
+		Assert::AreEqual(
+			DWORD(expected_length + 1), GetEnvironmentVariable(kClipboardEnvVariableName, nullptr, 0));
+	}
+	
 	void checkClipboardEnvVariable(LPCTSTR expected) {
 		TCHAR actual[256];
 		GetEnvironmentVariable(kClipboardEnvVariableName, actual, arrayLength(actual));
@@ -349,6 +377,186 @@ private:
 	}
 };
 
+TEST_CLASS(CommandLineTest) {
+public:
+	
+	TEST_METHOD_INITIALIZE(setUp) {
+		SetEnvironmentVariable(_T("CLAVIER_TEST_VALUE"), _T("value"));
+		SetEnvironmentVariable(_T("CLAVIER_TEST_DIR"), _T("C:\\Some dir"));
+		SetEnvironmentVariable(_T("CLAVIER_TEST_UNDEFINED"), nullptr);
+		clearFullPathCache();
+	}
+	
+	TEST_METHOD_CLEANUP(tearDown) {
+		SetEnvironmentVariable(_T("CLAVIER_TEST_VALUE"), nullptr);
+		SetEnvironmentVariable(_T("CLAVIER_TEST_DIR"), nullptr);
+		clearFullPathCache();
+	}
+	
+	TEST_METHOD(EnvTemplate_noReference) {
+		checkExpand(_T("notepad.exe 100%%"), _T("notepad.exe 100%%"));
+		checkExpand(_T(""), _T(""));
+	}
+	
+	TEST_METHOD(EnvTemplate_substitutesVariables) {
+		checkExpand(_T("a %CLAVIER_TEST_VALUE% b %clavier_test_value%"), _T("a value b value"));
+		checkExpand(_T("%CLAVIER_TEST_VALUE%%CLAVIER_TEST_VALUE%"), _T("valuevalue"));
+	}
+	
+	TEST_METHOD(EnvTemplate_undefinedVariable_kept) {
+		checkExpand(_T("%CLAVIER_TEST_UNDEFINED%-%CLAVIER_TEST_VALUE%"), _T("%CLAVIER_TEST_UNDEFINED%-value"));
+		checkExpand(_T("%CLAVIER_TEST_VALUE"), _T("%CLAVIER_TEST_VALUE"));
+	}
+	
+	TEST_METHOD(EnvTemplate_expandsCurrentValues) {
+		EnvTemplate env_template;
+		env_template.compile(_T("<%CLAVIER_TEST_VALUE%>"));
+		
+		SetEnvironmentVariable(_T("CLAVIER_TEST_VALUE"), _T("new value"));
+		String output;
+		env_template.expand(&output);
+		Assert::AreEqual(_T("<new value>"), output);
+	}
+	
+	TEST_METHOD(EnvTemplate_references) {
+		EnvTemplate env_template;
+		env_template.compile(_T("a %Clipboard% b"));
+		Assert::IsTrue(env_template.references(_T("CLIPBOARD")));
+		Assert::IsFalse(env_template.references(_T("CLIP")));
+		
+		const EnvTemplate copy(env_template);
+		Assert::IsTrue(copy.references(_T("clipboard")));
+	}
+	
+	TEST_METHOD(Prepare_splitAtCompile) {
+		CommandLine command_line;
+		command_line.compile(_T("notepad.exe \"%CLAVIER_TEST_VALUE%.txt\""), _T("%CLAVIER_TEST_DIR%"));
+		
+		CommandLine::Launch launch;
+		command_line.prepare(&launch);
+		Assert::AreEqual(_T("notepad.exe"), launch.file);
+		Assert::AreEqual(_T("\"value.txt\""), launch.parameters);
+		Assert::AreEqual(_T("C:\\Some dir"), launch.directory);
+		Assert::AreEqual(_T(""), launch.program);
+	}
+	
+	TEST_METHOD(Prepare_splitAtLaunch) {
+		CommandLine command_line;
+		command_line.compile(_T("\"%CLAVIER_TEST_DIR%\\app.exe\" arg"), _T("C:\\"));
+		
+		CommandLine::Launch launch;
+		command_line.prepare(&launch);
+		Assert::AreEqual(_T("\"C:\\Some dir\\app.exe\""), launch.file);
+		Assert::AreEqual(_T("arg"), launch.parameters);
+		Assert::AreEqual(_T("C:\\"), launch.directory);
+		Assert::AreEqual(_T(""), launch.program);
+	}
+	
+	TEST_METHOD(Prepare_noDirectory_searchesFile) {
+		TCHAR expected_directory[MAX_PATH];
+		GetSystemDirectory(expected_directory, arrayLength(expected_directory));
+		TCHAR expected_program[MAX_PATH];
+		PathCombine(expected_program, expected_directory, _T("notepad.exe"));
+		
+		CommandLine command_line;
+		command_line.compile(_T("notepad.exe"), _T(""));
+		
+		// The second launch uses the cached search.
+		for (int i = 0; i < 2; i++) {
+			CommandLine::Launch launch;
+			command_line.prepare(&launch);
+			Assert::AreEqual(_T("notepad.exe"), launch.file);
+			Assert::AreEqual(_T(""), launch.parameters);
+			Assert::AreEqual(0, lstrcmpi(expected_directory, launch.directory));
+			Assert::AreEqual(0, lstrcmpi(expected_program, launch.program));
+		}
+	}
+	
+	TEST_METHOD(Prepare_cachedProgramDeleted_searchedAgain) {
+		// SearchPath() searches the current directory.
+		TCHAR previous_directory[MAX_PATH];
+		GetCurrentDirectory(arrayLength(previous_directory), previous_directory);
+		TCHAR directory[MAX_PATH];
+		GetTempPath(arrayLength(directory), directory);
+		Assert::IsTrue(SetCurrentDirectory(directory));
+		TCHAR program[MAX_PATH];
+		PathCombine(program, directory, _T("clavier_test_program.exe"));
+		const HANDLE file = CreateFile(program, GENERIC_WRITE, /* dwShareMode= */ 0,
+			/* lpSecurityAttributes= */ nullptr, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL,
+			/* hTemplateFile= */ NULL);
+		Assert::IsTrue(file != INVALID_HANDLE_VALUE);
+		CloseHandle(file);
+		
+		CommandLine command_line;
+		command_line.compile(_T("clavier_test_program.exe"), _T(""));
+		CommandLine::Launch launch;
+		command_line.prepare(&launch);
+		Assert::AreEqual(0, lstrcmpi(program, launch.program));
+		
+		// The cached search is ignored once the program is deleted.
+		Assert::IsTrue(DeleteFile(program));
+		command_line.prepare(&launch);
+		Assert::AreEqual(_T(""), launch.program);
+		
+		SetCurrentDirectory(previous_directory);
+	}
+	
+	TEST_METHOD(Prepare_programNotFound_shellExecute) {
+		CommandLine command_line;
+		command_line.compile(_T("clavier_missing_program.exe /a"), _T(""));
+		Assert::IsTrue(command_line.getBackend() == LaunchBackend::kCreateProcess);
+		
+		CommandLine::Launch launch;
+		command_line.prepare(&launch);
+		Assert::AreEqual(_T("clavier_missing_program.exe"), launch.file);
+		Assert::AreEqual(_T("/a"), launch.parameters);
+		Assert::AreEqual(_T(""), launch.program);
+	}
+	
+	TEST_METHOD(GetBackend) {
+		checkBackend(LaunchBackend::kCreateProcess, _T("notepad.exe %CLAVIER_TEST_VALUE%"), _T(""));
+		checkBackend(LaunchBackend::kCreateProcess, _T("\"C:\\Some dir\\app.EXE\" arg"), _T(""));
+		checkBackend(LaunchBackend::kCreateProcess, _T("C:\\app.exe"), _T("C:\\Temp"));
+		
+		// Relative program with a directory: ShellExecuteEx() searches the directory first.
+		checkBackend(LaunchBackend::kShellExecute, _T("app.exe"), _T("C:\\Temp"));
+		
+		// Documents, URLs, UWP apps, variables in the file.
+		checkBackend(LaunchBackend::kShellExecute, _T("C:\\TODO.txt"), _T(""));
+		checkBackend(LaunchBackend::kShellExecute, _T("explorer.exe.lnk"), _T(""));
+		checkBackend(LaunchBackend::kShellExecute, _T("https://example.com/setup.exe"), _T(""));
+		checkBackend(LaunchBackend::kShellExecute,
+			_T("shell:AppsFolder\\Microsoft.WindowsCalculator_8wekyb3d8bbwe!App"), _T(""));
+		checkBackend(LaunchBackend::kShellExecute, _T("%WINDIR%\\notepad.exe"), _T(""));
+	}
+	
+	TEST_METHOD(ReferencesClipboard) {
+		CommandLine command_line;
+		command_line.compile(_T("notepad.exe"), _T("%CLIPBOARD%"));
+		Assert::IsTrue(command_line.referencesClipboard());
+		command_line.compile(_T("notepad.exe %clipboard%"), _T(""));
+		Assert::IsTrue(command_line.referencesClipboard());
+		command_line.compile(_T("notepad.exe"), _T(""));
+		Assert::IsFalse(command_line.referencesClipboard());
+	}
+	
+private:
+	
+	static void checkBackend(LaunchBackend expected, LPCTSTR command, LPCTSTR directory) {
+		CommandLine command_line;
+		command_line.compile(command, directory);
+		Assert::IsTrue(expected == command_line.getBackend(), command);
+	}
+	
+	static void checkExpand(LPCTSTR text, LPCTSTR expected) {
+		EnvTemplate env_template;
+		env_template.compile(text);
+		String output;
+		env_template.expand(&output);
+		Assert::AreEqual(expected, output);
+	}
+};
+
 TEST_CLASS(MatchWildcardsTest) {
 public:
 	
@@ -425,6 +633,164 @@ public:
 		const LPCTSTR pattern = _T("*tl?XXX");
 		Assert::IsTrue(matchWildcards(pattern, _T("Title"), pattern + 4));
 	}
+	
+	TEST_METHOD(Star_backtracks) {
+		Assert::IsTrue(matchWildcards(_T("ab*a?"), _T("ababaab")));
+		Assert::IsTrue(matchWildcards(_T("*a*b"), _T("xaxbxb")));
+		Assert::IsFalse(matchWildcards(_T("*a*b"), _T("xaxbxa")));
+	}
+	
+	TEST_METHOD(Star_manyStars_linear) {
+		String subject;
+		for (int i = 0; i < 1000; i++) {
+			subject += _T('a');
+		}
+		Assert::IsFalse(matchWildcards(_T("*a*a*a*a*a*a*a*a*a*a*b"), subject));
+	}
+};
+
+TEST_CLASS(WildcardPatternTest) {
+public:
+	
+	TEST_METHOD(Empty) {
+		check(_T(""), _T(""));
+		check(_T(""), _T("Subject"));
+	}
+	
+	TEST_METHOD(NoWildcards) {
+		check(_T("Test"), _T("Test"));
+		check(_T("Test"), _T("Tes"));
+		check(_T("Test"), _T("Tests"));
+		check(_T("test"), _T("Test"));
+	}
+	
+	TEST_METHOD(QuestionMark) {
+		check(_T("te?t"), _T("test"));
+		check(_T("?e?t"), _T("test"));
+		check(_T("te?t"), _T("xxxx"));
+		check(_T("?????"), _T("test"));
+		check(_T("???"), _T("test"));
+	}
+	
+	TEST_METHOD(Star) {
+		check(_T("*"), _T(""));
+		check(_T("*"), _T("Subject"));
+		check(_T("**"), _T("Subject"));
+		check(_T("*end"), _T("blah end"));
+		check(_T("*end"), _T("blah Xnd"));
+		check(_T("beginning*"), _T("beginning blah"));
+		check(_T("beginning*"), _T("beginninX blah"));
+		check(_T("*middle*"), _T("first middle last"));
+		check(_T("*middle*"), _T("first Xiddle last"));
+		check(_T("first*last"), _T("first blah last"));
+		check(_T("first*last"), _T("firstlast"));
+		check(_T("first*last"), _T("firslast"));
+		check(_T("ab*ba"), _T("aba"));
+	}
+	
+	TEST_METHOD(Star_middleSegments) {
+		check(_T("*a*b*c*"), _T("xxaxxbxxcxx"));
+		check(_T("*a*b*c*"), _T("xxaxxcxxbxx"));
+		check(_T("*a?c*a?c"), _T("abcabc"));
+		check(_T("*?b*"), _T("b"));
+		check(_T("*b?*"), _T("xb"));
+	}
+	
+	TEST_METHOD(Star_longSubject) {
+		// Longer than the SIMD block size, match at various offsets.
+		const LPCTSTR subject = _T("0123456789abcdefghijklmnopqrstuvwxyz0123456789");
+		check(_T("*a*"), subject);
+		check(_T("*h*"), subject);
+		check(_T("*i*"), subject);
+		check(_T("*z0*9"), subject);
+		check(_T("*Z*"), subject);
+		check(_T("*9?1*"), subject);
+	}
+	
+	TEST_METHOD(PatternEnd) {
+		const LPCTSTR pattern = _T("te*tXXX");
+		WildcardPattern compiled;
+		compiled.compile(pattern, pattern + 4);
+		Assert::IsTrue(compiled.match(_T("tessst")));
+		compiled.compile(pattern, pattern + 5);
+		Assert::IsFalse(compiled.match(_T("tessst")));
+	}
+	
+	TEST_METHOD(ManyStars_linear) {
+		String subject;
+		for (int i = 0; i < 1000; i++) {
+			subject += _T('a');
+		}
+		check(_T("*a*a*a*a*a*a*a*a*a*a*b"), subject);
+		check(_T("*a*a*a*a*a*a*a*a*a*a*a"), subject);
+	}
+	
+private:
+	
+	// Verifies that WildcardPattern and matchWildcards() agree.
+	static void check(LPCTSTR pattern, LPCTSTR subject) {
+		WildcardPattern compiled;
+		compiled.compile(pattern);
+		Assert::AreEqual(matchWildcards(pattern, subject), compiled.match(subject),
+			StringPrintf(_T("pattern=\"%s\" subject=\"%s\""), pattern, subject));
+	}
+};
+
+TEST_CLASS(ProcessNameCacheTest) {
+public:
+	
+	TEST_METHOD_INITIALIZE(setUp) {
+		clearProcessNameCache();
+		m_hwnd = CreateWindow(
+			_T("STATIC"), _T("ProcessNameCacheTest"),
+			/* dwStyle=*/ 0,
+			/* x,y,nWidth,nHeight=*/ 0,0,0,0,
+			/* hWndParent= */ NULL, /* hMenu= */ NULL, /* hInstance= */ NULL, /* lpParam= */ nullptr);
+	}
+	
+	TEST_METHOD_CLEANUP(tearDown) {
+		DestroyWindow(m_hwnd);
+		clearProcessNameCache();
+	}
+	
+	TEST_METHOD(MissThenHit) {
+		TCHAR expected_name[MAX_PATH];
+		GetModuleFileName(/* hModule= */ NULL, expected_name, arrayLength(expected_name));
+		PathStripPath(expected_name);
+		CharLower(expected_name);
+		
+		TCHAR process_name[MAX_PATH];
+		Assert::IsTrue(getWindowProcessName(m_hwnd, process_name));
+		Assert::AreEqual(expected_name, process_name);
+		Assert::AreEqual(0UL, getProcessNameCacheStats().hits);
+		Assert::AreEqual(1UL, getProcessNameCacheStats().misses);
+		
+		Assert::IsTrue(getWindowProcessName(m_hwnd, process_name));
+		Assert::AreEqual(expected_name, process_name);
+		Assert::AreEqual(1UL, getProcessNameCacheStats().hits);
+		Assert::AreEqual(1UL, getProcessNameCacheStats().misses);
+	}
+	
+	TEST_METHOD(Clear) {
+		TCHAR process_name[MAX_PATH];
+		Assert::IsTrue(getWindowProcessName(m_hwnd, process_name));
+		
+		clearProcessNameCache();
+		Assert::AreEqual(0UL, getProcessNameCacheStats().misses);
+		
+		Assert::IsTrue(getWindowProcessName(m_hwnd, process_name));
+		Assert::AreEqual(0UL, getProcessNameCacheStats().hits);
+		Assert::AreEqual(1UL, getProcessNameCacheStats().misses);
+	}
+	
+	TEST_METHOD(InvalidWindow) {
+		TCHAR process_name[MAX_PATH];
+		Assert::IsFalse(getWindowProcessName(/* hwnd= */ NULL, process_name));
+	}
+	
+private:
+	
+	HWND m_hwnd;
 };
 
 TEST_CLASS(GlobalTest) {
@@ -0,0 +1,228 @@
+// Clavier+
+// Keyboard shortcuts manager
+//
+// Copyright (C) 2000-2008 Guillaume Ryder
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+#include "StdAfx.h"
+#include "../Input.h"
+
+namespace InputTest {
+
+using input::InputBatch;
+using input::KeyboardLayout;
+
+// Replacement of SendInput() recording the number of calls and events.
+struct SendLog {
+	int call_count;
+	int event_count;
+};
+
+SendLog send_log;
+
+UINT WINAPI sendInputForTest(UINT count, INPUT* inputs, int input_size) {
+	Assert::AreEqual(int(sizeof(INPUT)), input_size);
+	Assert::IsNotNull(inputs);
+	send_log.call_count++;
+	send_log.event_count += count;
+	return count;
+}
+
+// Replacement of SendInput() rejecting the events, like UIPI does.
+UINT WINAPI rejectInputForTest(UINT UNUSED(count), INPUT* UNUSED(inputs), int UNUSED(input_size)) {
+	return 0;
+}
+
+Keystroke buildKeystroke(BYTE vk, DWORD sided_mod_code = 0) {
+	Keystroke keystroke;
+	keystroke.m_vk = vk;
+	keystroke.m_sided_mod_code = sided_mod_code;
+	return keystroke;
+}
+
+
+TEST_CLASS(KeyboardLayoutTest) {
+public:
+	
+	TEST_METHOD(GetCurrent_layoutOfThread) {
+		Assert::IsTrue(GetKeyboardLayout(0) == KeyboardLayout::getCurrent().getHkl());
+		Assert::IsTrue(KeyboardLayout::getCurrent().getHkl() == KeyboardLayout::getCurrent().getHkl());
+	}
+	
+	TEST_METHOD(VkKeyScan_sameAsApi) {
+		const KeyboardLayout layout = KeyboardLayout::getCurrent();
+		for (int pass = 0; pass < 2; pass++) {  // The second pass reads the cache.
+			for (int c = 0; c < 0x3000; c++) {
+				Assert::AreEqual(VkKeyScanEx(TCHAR(c), layout.getHkl()), layout.vkKeyScan(TCHAR(c)));
+			}
+		}
+	}
+	
+	TEST_METHOD(VkToScanCode_sameAsApi) {
+		const KeyboardLayout layout = KeyboardLayout::getCurrent();
+		for (int pass = 0; pass < 2; pass++) {  // The second pass reads the cache.
+			for (UINT vk = 0; vk < 0x120; vk++) {
+				Assert::AreEqual(
+					MapVirtualKeyEx(vk, MAPVK_VK_TO_VSC, layout.getHkl()), layout.vkToScanCode(vk));
+			}
+		}
+	}
+};
+
+
+TEST_CLASS(InputBatchTest) {
+public:
+	
+	TEST_METHOD_INITIALIZE(setUp) {
+		send_log = {};
+	}
+	
+	TEST_METHOD(Constructor_disabled) {
+		InputBatch batch(&m_hotkey_suspension, sendInputForTest);
+		Assert::IsFalse(batch.isEnabled());
+		Assert::IsTrue(batch.isEmpty());
+		Assert::IsFalse(batch.addKey('A', /* down= */ true));
+	}
+	
+	TEST_METHOD(SetMaxSize_clamps) {
+		InputBatch batch(&m_hotkey_suspension, sendInputForTest);
+		batch.setMaxSize(1);
+		Assert::IsTrue(batch.isEnabled());
+		Assert::IsTrue(fillWithKeys(&batch) == InputBatch::kMinSize);
+		
+		batch.send();
+		batch.setMaxSize(100000);
+		Assert::IsTrue(fillWithKeys(&batch) == InputBatch::kMaxSize);
+		
+		batch.send();
+		batch.setMaxSize(0);
+		Assert::IsFalse(batch.isEnabled());
+	}
+	
+	TEST_METHOD(AddKeystroke_pressesAndReleasesSpecialKeys) {
+		InputBatch batch(&m_hotkey_suspension, sendInputForTest);
+		batch.setMaxSize(InputBatch::kMaxSize);
+		Assert::IsTrue(batch.addKeystroke(
+			buildKeystroke('A', MOD_SHIFT | MOD_CONTROL), /* already_down_mod_code= */ MOD_CONTROL));
+		
+		int count;
+		const INPUT* const events = batch.getEvents(&count);
+		Assert::AreEqual(4, count);
+		checkKeyEvent(events[0], VK_SHIFT, /* down= */ true);
+		checkKeyEvent(events[1], 'A', /* down= */ true);
+		checkKeyEvent(events[2], 'A', /* down= */ false);
+		checkKeyEvent(events[3], VK_SHIFT, /* down= */ false);
+	}
+	
+	TEST_METHOD(AddKeystroke_full_appendsNothing) {
+		InputBatch batch(&m_hotkey_suspension, sendInputForTest);
+		batch.setMaxSize(InputBatch::kMinSize);
+		for (int i = 0; i < InputBatch::kMinSize - 3; i++) {
+			Assert::IsTrue(batch.addKey('A', /* down= */ true));
+		}
+		
+		Assert::IsFalse(
+			batch.addKeystroke(buildKeystroke('A', MOD_SHIFT), /* already_down_mod_code= */ 0));
+		int count;
+		batch.getEvents(&count);
+		Assert::AreEqual(InputBatch::kMinSize - 3, count);
+		
+		Assert::IsTrue(batch.addKeystroke(buildKeystroke('A'), /* already_down_mod_code= */ 0));
+	}
+	
+	TEST_METHOD(Send_oneCallPerBatch) {
+		InputBatch batch(&m_hotkey_suspension, sendInputForTest);
+		batch.setMaxSize(InputBatch::kMaxSize);
+		batch.send();
+		Assert::AreEqual(0, send_log.call_count);
+		
+		Assert::IsTrue(batch.addKeystroke(buildKeystroke('A'), /* already_down_mod_code= */ 0));
+		Assert::IsTrue(batch.addKeystroke(buildKeystroke('B', MOD_ALT), /* already_down_mod_code= */ 0));
+		batch.send();
+		Assert::IsTrue(batch.isEmpty());
+		Assert::AreEqual(1, send_log.call_count);
+		Assert::AreEqual(6, send_log.event_count);
+		
+		Assert::IsTrue(batch.addKey('C', /* down= */ true));
+		batch.send();
+		Assert::AreEqual(2, send_log.call_count);
+		Assert::AreEqual(7, send_log.event_count);
+		Assert::AreEqual(2, batch.getSentBatchCount());
+		Assert::AreEqual(7, batch.getSentEventCount());
+	}
+	
+	TEST_METHOD(AddUnicode_surrogatePair) {
+		InputBatch batch(&m_hotkey_suspension, sendInputForTest);
+		batch.setMaxSize(InputBatch::kMaxSize);
+		Assert::IsTrue(batch.addUnicode(TCHAR(0xD83D)));
+		Assert::IsTrue(batch.addUnicode(TCHAR(0xDE00)));
+		
+		int count;
+		const INPUT* const events = batch.getEvents(&count);
+		Assert::AreEqual(4, count);
+		checkUnicodeEvent(events[0], 0xD83D, /* down= */ true);
+		checkUnicodeEvent(events[1], 0xD83D, /* down= */ false);
+		checkUnicodeEvent(events[2], 0xDE00, /* down= */ true);
+		checkUnicodeEvent(events[3], 0xDE00, /* down= */ false);
+	}
+	
+	TEST_METHOD(AddUnicode_full_appendsNothing) {
+		InputBatch batch(&m_hotkey_suspension, sendInputForTest);
+		batch.setMaxSize(InputBatch::kMinSize);
+		for (int i = 0; i < InputBatch::kMinSize - 1; i++) {
+			Assert::IsTrue(batch.addKey('A', /* down= */ true));
+		}
+		
+		Assert::IsFalse(batch.addUnicode(_T('A')));
+		int count;
+		batch.getEvents(&count);
+		Assert::AreEqual(InputBatch::kMinSize - 1, count);
+	}
+	
+	TEST_METHOD(SendUnicode_oneCall) {
+		Assert::IsTrue(input::sendUnicode(TCHAR(0x4E2D), sendInputForTest));
+		Assert::AreEqual(1, send_log.call_count);
+		Assert::AreEqual(2, send_log.event_count);
+		
+		Assert::IsFalse(input::sendUnicode(TCHAR(0x4E2D), rejectInputForTest));
+	}
+	
+private:
+	
+	HotKeySuspension m_hotkey_suspension;
+	
+	// Appends key events until the batch is full. Returns the number of events appended.
+	static int fillWithKeys(InputBatch* batch) {
+		int count = 0;
+		while (batch->addKey('A', /* down= */ true)) {
+			count++;
+		}
+		return count;
+	}
+	
+	static void checkKeyEvent(const INPUT& event, UINT expected_vk, bool expected_down) {
+		Assert::AreEqual(DWORD(INPUT_KEYBOARD), event.type);
+		Assert::AreEqual(int(expected_vk), int(event.ki.wVk));
+		Assert::AreEqual(!expected_down, toBool(event.ki.dwFlags & KEYEVENTF_KEYUP));
+	}
+	
+	static void checkUnicodeEvent(const INPUT& event, WORD expected_code_unit, bool expected_down) {
+		checkKeyEvent(event, /* expected_vk= */ 0, expected_down);
+		Assert::AreEqual(int(expected_code_unit), int(event.ki.wScan));
+		Assert::IsTrue(toBool(event.ki.dwFlags & KEYEVENTF_UNICODE));
+	}
+};
+
+}  // namespace InputTest
@@ -422,6 +422,71 @@ private:
 		Assert::AreEqual(
 			expected_result, keystroke.isSubset(other),
 			StringPrintf(_T("<%s> isSubset <%s>"), keystroke.debugString().getSafe(), other.debugString().getSafe()));
+		
+		DWORD key, mask;
+		keystroke.packPattern(&key, &mask);
+		Assert::AreEqual(
+			expected_result, (other.pack() & mask) == key,
+			StringPrintf(_T("<%s> packPattern <%s>"), keystroke.debugString().getSafe(), other.debugString().getSafe()));
+	}
+};
+
+
+TEST_CLASS(FindPackedMatchTest) {
+public:
+	
+	TEST_METHOD(Empty) {
+		checkFindPackedMatch(0, buildKeystroke('A', kUnsided, 0), {}, 0);
+	}
+	
+	TEST_METHOD(NoMatch) {
+		checkFindPackedMatch(
+			5,
+			buildKeystroke('A', kUnsided, 0),
+			{
+				buildKeystroke('B', kUnsided, 0),
+				buildKeystroke('A', kUnsided, MOD_SHIFT),
+				buildKeystroke('A', kSided, 0),
+				buildKeystroke('A', kUnsided, 0, _T("C+N/S/")),
+				buildKeystroke('A', kUnsided, 0, _T("C/N/S-")),
+			},
+			0);
+	}
+	
+	TEST_METHOD(FirstMatch) {
+		const Keystroke ks = buildKeystroke('A', kSided, MOD_SHIFT << kRightModCodeOffset, _T("C-N+S-"));
+		const Keystroke other = buildKeystroke('A', kSided, MOD_SHIFT, _T("C-N+S-"));
+		const Keystroke match_sided = buildKeystroke('A', kSided, MOD_SHIFT << kRightModCodeOffset);
+		const Keystroke match_unsided = buildKeystroke('A', kUnsided, MOD_SHIFT, _T("C/N+S/"));
+		
+		// Cover every position of the first match relatively to the SSE2 batches.
+		for (int count = 1; count <= 13; count++) {
+			for (int match = 0; match < count; match++) {
+				std::vector<Keystroke> patterns(count, other);
+				patterns[match] = (match % 2) ? match_sided : match_unsided;
+				if (match + 1 < count) {
+					patterns[match + 1] = match_sided;
+				}
+				for (int start = 0; start <= match; start++) {
+					checkFindPackedMatch(match, ks, patterns, start);
+				}
+				checkFindPackedMatch(match + 1 < count ? match + 1 : count, ks, patterns, match + 1);
+			}
+		}
+	}
+	
+private:
+	
+	void checkFindPackedMatch(int expected_index, const Keystroke& ks, const std::vector<Keystroke>& patterns, int start) {
+		std::vector<DWORD> keys(patterns.size()), masks(patterns.size());
+		for (size_t i = 0; i < patterns.size(); i++) {
+			patterns[i].packPattern(&keys[i], &masks[i]);
+		}
+		const int count = int(patterns.size());
+		Assert::AreEqual(
+			expected_index, Keystroke::findPackedMatch(ks.pack(), keys.data(), masks.data(), start, count));
+		Assert::AreEqual(
+			expected_index, Keystroke::findPackedMatchScalar(ks.pack(), keys.data(), masks.data(), start, count));
 	}
 };
 
@@ -553,4 +618,122 @@ private:
 	}
 };
 
+
+TEST_CLASS(HotKeySuspensionTest) {
+public:
+	
+	TEST_METHOD_INITIALIZE(setUp) {
+		buildKeystroke(VK_F16).registerHotKey();
+		buildKeystroke(VK_F16, kUnsided, MOD_CONTROL).registerHotKey();
+	}
+	
+	TEST_METHOD_CLEANUP(tearDown) {
+		buildKeystroke(VK_F16).unregisterHotKey();
+		buildKeystroke(VK_F16, kUnsided, MOD_CONTROL).unregisterHotKey();
+	}
+	
+	TEST_METHOD(Suspend_unregistersOnce) {
+		HotKeySuspension suspension;
+		suspension.suspend(buildKeystroke(VK_F16));
+		suspension.suspend(buildKeystroke(VK_F16));
+		suspension.suspend(buildKeystroke(VK_F17));  // Not registered.
+		Assert::AreEqual(1, suspension.getSuspendedCount());
+		Assert::IsFalse(buildKeystroke(VK_F16).unregisterHotKey());
+		Assert::IsTrue(buildKeystroke(VK_F16, kUnsided, MOD_CONTROL).unregisterHotKey());
+		buildKeystroke(VK_F16, kUnsided, MOD_CONTROL).registerHotKey();
+	}
+	
+	TEST_METHOD(Suspend_sidedKeystroke_unsidedHotKey) {
+		HotKeySuspension suspension;
+		suspension.suspend(buildKeystroke(VK_F16, kSided, MOD_CONTROL << kRightModCodeOffset));
+		Assert::AreEqual(1, suspension.getSuspendedCount());
+		Assert::IsFalse(buildKeystroke(VK_F16, kUnsided, MOD_CONTROL).unregisterHotKey());
+	}
+	
+	TEST_METHOD(Restore_registersSuspendedHotKeys) {
+		HotKeySuspension suspension;
+		suspension.suspend(buildKeystroke(VK_F16));
+		suspension.suspend(buildKeystroke(VK_F16, kUnsided, MOD_CONTROL));
+		Assert::AreEqual(2, suspension.getSuspendedCount());
+		
+		suspension.restore();
+		Assert::AreEqual(0, suspension.getSuspendedCount());
+		Assert::IsTrue(buildKeystroke(VK_F16).unregisterHotKey());
+		Assert::IsTrue(buildKeystroke(VK_F16, kUnsided, MOD_CONTROL).unregisterHotKey());
+		
+		// Restored hotkeys can be suspended again.
+		buildKeystroke(VK_F16).registerHotKey();
+		suspension.suspend(buildKeystroke(VK_F16));
+		Assert::AreEqual(1, suspension.getSuspendedCount());
+	}
+	
+	TEST_METHOD(Destructor_restores) {
+		{
+			HotKeySuspension suspension;
+			suspension.suspend(buildKeystroke(VK_F16));
+		}
+		Assert::IsTrue(buildKeystroke(VK_F16).unregisterHotKey());
+		buildKeystroke(VK_F16).registerHotKey();
+	}
+	
+	TEST_METHOD(Restore_concurrentSuspensions_registersAfterLast) {
+		HotKeySuspension suspension1, suspension2;
+		suspension1.suspend(buildKeystroke(VK_F16));
+		suspension2.suspend(buildKeystroke(VK_F16));
+		Assert::AreEqual(1, suspension1.getSuspendedCount());
+		Assert::AreEqual(0, suspension2.getSuspendedCount());
+		
+		suspension1.restore();
+		Assert::IsFalse(isRegistered(VK_F16));
+		suspension2.restore();
+		Assert::IsTrue(isRegistered(VK_F16));
+	}
+	
+	TEST_METHOD(Restore_unregisteredMeanwhile_staysUnregistered) {
+		HotKeySuspension suspension;
+		suspension.suspend(buildKeystroke(VK_F16));
+		Assert::IsFalse(buildKeystroke(VK_F16).unregisterHotKey());
+		
+		suspension.restore();
+		Assert::IsFalse(isRegistered(VK_F16));
+		buildKeystroke(VK_F16).registerHotKey();
+	}
+	
+	TEST_METHOD(RegisterHotKey_suspended_registersOnRestore) {
+		HotKeySuspension suspension;
+		suspension.suspend(buildKeystroke(VK_F17));
+		buildKeystroke(VK_F17).registerHotKey();
+		Assert::IsFalse(isRegistered(VK_F17));
+		
+		suspension.restore();
+		Assert::IsTrue(buildKeystroke(VK_F17).unregisterHotKey());
+	}
+	
+	TEST_METHOD(RegisterFailedHotKeys_retries) {
+		// Another registration of the key combination makes registerHotKey() fail.
+		Assert::IsTrue(RegisterHotKey(/* hWnd= */ NULL, kOtherHotKeyId, /* fsModifiers= */ 0, VK_F18));
+		buildKeystroke(VK_F18).registerHotKey();
+		Keystroke::registerFailedHotKeys();
+		Assert::IsTrue(UnregisterHotKey(/* hWnd= */ NULL, kOtherHotKeyId));
+		Assert::IsFalse(isRegistered(VK_F18));
+		
+		Keystroke::registerFailedHotKeys();
+		Assert::IsTrue(buildKeystroke(VK_F18).unregisterHotKey());
+	}
+	
+private:
+	
+	// Hotkey ID outside of the range of the Keystroke ones.
+	static constexpr int kOtherHotKeyId = 0xBFFF;
+	
+	// Returns whether a hotkey without modifiers is registered, without changing its state.
+	static bool isRegistered(BYTE vk) {
+		if (RegisterHotKey(/* hWnd= */ NULL, kOtherHotKeyId, /* fsModifiers= */ 0, vk)) {
+			UnregisterHotKey(/* hWnd= */ NULL, kOtherHotKeyId);
+			return false;
+		}
+		return true;
+	}
+};
+
 }  // namespace KeystrokeTest
@@ -0,0 +1,185 @@
+// Clavier+
+// Keyboard shortcuts manager
+//
+// Copyright (C) 2000-2008 Guillaume Ryder
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+#include "StdAfx.h"
+#include "../Global.h"
+#include "../Macro.h"
+
+namespace MacroTest {
+
+using macro::Opcode;
+using macro::Program;
+
+TEST_CLASS(ProgramTest) {
+public:
+	
+	TEST_METHOD(Compile_emptyText) {
+		Program program;
+		program.compile(_T(""));
+		Assert::IsTrue(program.isEmpty());
+		Assert::IsTrue(program.begin() == program.end());
+	}
+	
+	TEST_METHOD(Compile_regularCharacters_oneRun) {
+		checkDisassembly(_T("ab\\[c\\\\\r\nd"), _T("Chars 7 \"ab[c\\\\\\rd\"\r\n"));
+	}
+	
+	TEST_METHOD(Compile_emptyBrackets) {
+		checkDisassembly(_T("a[]b"), _T("Chars 1 \"a\"\r\nEmpty\r\nChars 1 \"b\"\r\n"));
+	}
+	
+	TEST_METHOD(Compile_commandLine_skipsSecondBracket) {
+		checkDisassembly(
+			_T("[[notepad.exe C:\\\\a\\]b.txt]]c"),
+			_T("CommandLine \"notepad.exe C:\\\\a]b.txt\"\r\nChars 1 \"c\"\r\n"));
+	}
+	
+	TEST_METHOD(Compile_delayCommands) {
+		checkDisassembly(
+			_T("[{Wait,100}][{focus,50,!Note\\,pad}][{Focus,0,\\!Window}][{FocusOrLaunch,Window,cmd.exe /c,200}]"),
+			_T("Wait 100\r\n")
+			_T("Focus 50 1 \"Note,pad\"\r\n")
+			_T("Focus 0 0 \"!Window\"\r\n")
+			_T("FocusOrLaunch 200 \"Window\" \"cmd.exe /c\"\r\n"));
+	}
+	
+	TEST_METHOD(Compile_otherCommands) {
+		checkDisassembly(
+			_T("[{Cancel}][{Copy,a,b\\]c}][{KeysDown,Ctrl+Shift}][{Batch,64,10}][{Batch,0}]")
+			_T("[{Pacing,250}][{Pacing,-1}][{Paste,1000}][{Paste,-5}][{Overlap,queue}][{Overlap,Drop}]"),
+			_T("Cancel\r\n")
+			_T("Copy \"a,b]c\"\r\n")
+			_T("KeysDown 6\r\n")
+			_T("Batch 64 10\r\n")
+			_T("Batch 0 0\r\n")
+			_T("Pacing 250\r\n")
+			_T("Pacing 0\r\n")
+			_T("Paste 1000\r\n")
+			_T("Paste 0\r\n")
+			_T("Overlap 1\r\n")
+			_T("Overlap 2\r\n"));
+	}
+	
+	TEST_METHOD(Compile_mouseCommands) {
+		checkDisassembly(
+			_T("[{MouseButton,l}][{MouseButton,RU}][{MouseMoveTo,1,2}][{MouseMoveToFocus,3,4}]")
+			_T("[{MouseMoveBy,-5,6}][{MouseWheel,2}]"),
+			_T("MouseButton 2 1\r\n")
+			_T("MouseButton 16 0\r\n")
+			_T("MouseMoveTo 1 2\r\n")
+			_T("MouseMoveToFocus 3 4\r\n")
+			_T("MouseMoveBy -5 6\r\n")
+			_T("MouseWheel -240\r\n"));
+	}
+	
+	TEST_METHOD(Compile_noopCommands_skipped) {
+		checkDisassembly(_T("[{Unknown,1}][{MouseButton,X}][{MouseWheel,0}][{Overlap,X}]a"), _T("Chars 1 \"a\"\r\n"));
+	}
+	
+	TEST_METHOD(Compile_keystrokes) {
+		checkDisassembly(
+			_T("[Ctrl+A][|a\r\nb|][|]"),
+			_T("Keystroke 65 2 0\r\n")
+			_T("KeystrokeChars \"a\\rb\"\r\n")
+			_T("KeystrokeChars \"\"\r\n"));
+	}
+	
+	TEST_METHOD(Compile_nonTerminatedCommand_stopsText) {
+		checkDisassembly(_T("a[{Wait,100}b"), _T("Chars 1 \"a\"\r\n"));
+	}
+	
+	TEST_METHOD(Compile_replacesPreviousInstructions) {
+		Program program;
+		program.compile(_T("a[]"));
+		program.compile(_T("[{Cancel}]"));
+		Assert::AreEqual(int(Opcode::kCancel), int(program.begin()->opcode));
+		Assert::IsTrue(program.begin()->getNext() == program.end());
+	}
+	
+	TEST_METHOD(Compile_longText_oneInstruction) {
+		String text;
+		for (int i = 0; i < 10000; i++) {
+			text += _T("abcdefghij");
+		}
+		Program program;
+		program.compile(text);
+		
+		const macro::Instruction* instruction = program.begin();
+		Assert::AreEqual(int(Opcode::kChars), int(instruction->opcode));
+		Assert::AreEqual(100000, instruction->args[0]);
+		Assert::AreEqual(LPCTSTR(text), instruction->getString(0));
+		Assert::IsTrue(instruction->getNext() == program.end());
+	}
+	
+	TEST_METHOD(GetAdmission_lastOverlapCommand) {
+		Program program;
+		Assert::AreEqual(int(executor::Admission::kCoalesce), int(program.getAdmission()));
+		
+		program.compile(_T("[{Overlap,Queue}]a[{Overlap,Drop}]"));
+		Assert::AreEqual(int(executor::Admission::kDrop), int(program.getAdmission()));
+		Assert::AreEqual(int(executor::Admission::kDrop), int(Program(program).getAdmission()));
+		
+		program.compile(_T("a"));
+		Assert::AreEqual(int(executor::Admission::kCoalesce), int(program.getAdmission()));
+	}
+	
+	TEST_METHOD(GetString_secondString) {
+		Program program;
+		program.compile(_T("[{FocusOrLaunch,abc,de,0}]"));
+		Assert::AreEqual(_T("abc"), program.begin()->getString(0));
+		Assert::AreEqual(_T("de"), program.begin()->getString(1));
+	}
+	
+	TEST_METHOD(GetWindowPattern_compiledWindowNames) {
+		Program* const program = new Program();
+		program->compile(_T("[{Focus,0,Note*}]a[{FocusOrLaunch,*Word,winword.exe,0}]"));
+		const Program copy(*program);
+		delete program;
+		
+		const macro::Instruction* const focus = copy.begin();
+		Assert::IsTrue(copy.getWindowPattern(*focus).match(_T("Notepad")));
+		Assert::IsFalse(copy.getWindowPattern(*focus).match(_T("Microsoft Word")));
+		
+		const macro::Instruction* const focus_or_launch = focus->getNext()->getNext();
+		Assert::IsTrue(copy.getWindowPattern(*focus_or_launch).match(_T("Microsoft Word")));
+		Assert::IsFalse(copy.getWindowPattern(*focus_or_launch).match(_T("Notepad")));
+	}
+	
+	TEST_METHOD(CopyConstructor_copiesInstructions) {
+		Program* const program = new Program();
+		program->compile(_T("ab[{Wait,1}]"));
+		const Program copy(*program);
+		delete program;
+		
+		String output;
+		copy.disassemble(&output);
+		Assert::AreEqual(_T("Chars 2 \"ab\"\r\nWait 1\r\n"), LPCTSTR(output));
+	}
+	
+private:
+	
+	static void checkDisassembly(LPCTSTR text, LPCTSTR expected_disassembly) {
+		Program program;
+		program.compile(text);
+		String output;
+		program.disassemble(&output);
+		Assert::AreEqual(expected_disassembly, LPCTSTR(output));
+	}
+};
+
+}  // namespace MacroTest
@@ -0,0 +1,250 @@
+// Clavier+
+// Keyboard shortcuts manager
+//
+// Copyright (C) 2000-2008 Guillaume Ryder
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+
+#include "StdAfx.h"
+#include "../Metrics.h"
+#include "../MyString.h"
+
+namespace MetricsTest {
+
+using metrics::DispatchStats;
+using metrics::Histogram;
+using metrics::Stage;
+using metrics::Unit;
+
+TEST_CLASS(HistogramTest) {
+public:
+	
+	TEST_METHOD_INITIALIZE(setUp) {
+		m_histogram = new Histogram();
+	}
+	
+	TEST_METHOD_CLEANUP(tearDown) {
+		delete m_histogram;
+	}
+	
+	TEST_METHOD(Empty) {
+		Assert::AreEqual(DWORD(0), m_histogram->getCount());
+		Assert::AreEqual(DWORD(0), m_histogram->getPercentile(50));
+	}
+	
+	TEST_METHOD(Add_buckets) {
+		m_histogram->add(0);
+		m_histogram->add(1);
+		m_histogram->add(2);
+		m_histogram->add(3);
+		m_histogram->add(1000);
+		m_histogram->add(MAXDWORD);
+		
+		Assert::AreEqual(DWORD(6), m_histogram->getCount());
+		Assert::AreEqual(DWORD(1), m_histogram->getBucketCount(0));
+		Assert::AreEqual(DWORD(1), m_histogram->getBucketCount(1));
+		Assert::AreEqual(DWORD(2), m_histogram->getBucketCount(2));
+		Assert::AreEqual(DWORD(1), m_histogram->getBucketCount(10));
+		Assert::AreEqual(DWORD(1), m_histogram->getBucketCount(Histogram::kBucketCount - 1));
+	}
+	
+	TEST_METHOD(GetPercentile) {
+		for (int i = 0; i < 90; i++) {
+			m_histogram->add(5);
+		}
+		for (int i = 0; i < 9; i++) {
+			m_histogram->add(100);
+		}
+		m_histogram->add(5000);
+		
+		Assert::AreEqual(DWORD(8), m_histogram->getPercentile(0));
+		Assert::AreEqual(DWORD(8), m_histogram->getPercentile(50));
+		Assert::AreEqual(DWORD(8), m_histogram->getPercentile(90));
+		Assert::AreEqual(DWORD(128), m_histogram->getPercentile(91));
+		Assert::AreEqual(DWORD(128), m_histogram->getPercentile(99));
+		Assert::AreEqual(DWORD(8192), m_histogram->getPercentile(100));
+	}
+	
+private:
+	
+	Histogram* m_histogram;
+};
+
+
+TEST_CLASS(DispatchTest) {
+public:
+	
+	TEST_METHOD_INITIALIZE(setUp) {
+		m_stats = new DispatchStats();
+	}
+	
+	TEST_METHOD_CLEANUP(tearDown) {
+		delete m_stats;
+	}
+	
+	TEST_METHOD(Record_noOutput) {
+		metrics::Dispatch dispatch(GetTickCount());
+		dispatch.endStage(Stage::kSidedness);
+		dispatch.endStage(Stage::kProcessName);
+		dispatch.endStage(Stage::kFind);
+		dispatch.beginExecution();
+		dispatch.endExecution();
+		dispatch.record(m_stats);
+		
+		for (Stage stage : {
+				Stage::kQueue, Stage::kSidedness, Stage::kProcessName, Stage::kFind, Stage::kExecute}) {
+			Assert::AreEqual(DWORD(1), getCount(stage));
+		}
+		Assert::AreEqual(DWORD(0), getCount(Stage::kFirstOutput));
+		Assert::AreEqual(DWORD(0), getCount(Stage::kTotal));
+		Assert::AreEqual(DWORD(0), getCount(Stage::kShellLaunch));
+		Assert::AreEqual(DWORD(0), getCount(Stage::kProcessLaunch));
+	}
+	
+	TEST_METHOD(Record_output) {
+		metrics::markOutput();  // No dispatch running: noop.
+		
+		metrics::Dispatch dispatch(GetTickCount());
+		dispatch.beginExecution();
+		metrics::markOutput();
+		metrics::markOutput();
+		dispatch.endExecution();
+		metrics::markOutput();
+		dispatch.record(m_stats);
+		
+		Assert::AreEqual(DWORD(1), getCount(Stage::kQueue));
+		Assert::AreEqual(DWORD(1), getCount(Stage::kExecute));
+		Assert::AreEqual(DWORD(1), getCount(Stage::kFirstOutput));
+		Assert::AreEqual(DWORD(1), getCount(Stage::kTotal));
+		Assert::AreEqual(DWORD(0), getCount(Stage::kFind));
+	}
+	
+	TEST_METHOD(Record_outputFromOtherThread) {
+		metrics::Dispatch dispatch(GetTickCount());
+		dispatch.beginExecution();
+		const HANDLE thread = CreateThread(
+			/* lpThreadAttributes= */ nullptr, /* dwStackSize= */ 0,
+			[](void*) -> DWORD {
+				metrics::markOutput();
+				return 0;
+			},
+			/* lpParameter= */ nullptr, /* dwCreationFlags= */ 0, /* lpThreadId= */ nullptr);
+		WaitForSingleObject(thread, INFINITE);
+		CloseHandle(thread);
+		dispatch.endExecution();
+		dispatch.record(m_stats);
+		
+		Assert::AreEqual(DWORD(1), getCount(Stage::kExecute));
+		Assert::AreEqual(DWORD(0), getCount(Stage::kFirstOutput));
+	}
+	
+	TEST_METHOD(Record_outputFromResumedThread) {
+		metrics::Dispatch dispatch(GetTickCount());
+		dispatch.beginExecution();
+		dispatch.suspendExecution();
+		metrics::markOutput();  // Suspended: noop.
+		
+		const HANDLE thread = CreateThread(
+			/* lpThreadAttributes= */ nullptr, /* dwStackSize= */ 0,
+			[](void* param) -> DWORD {
+				metrics::Dispatch *const dispatch = static_cast<metrics::Dispatch*>(param);
+				dispatch->resumeExecution();
+				metrics::markOutput();
+				dispatch->suspendExecution();
+				return 0;
+			},
+			/* lpParameter= */ &dispatch, /* dwCreationFlags= */ 0, /* lpThreadId= */ nullptr);
+		WaitForSingleObject(thread, INFINITE);
+		CloseHandle(thread);
+		dispatch.endExecution();
+		dispatch.record(m_stats);
+		
+		Assert::AreEqual(DWORD(1), getCount(Stage::kExecute));
+		Assert::AreEqual(DWORD(1), getCount(Stage::kFirstOutput));
+		Assert::AreEqual(DWORD(1), getCount(Stage::kTotal));
+	}
+	
+	TEST_METHOD(RecordQueueDepth) {
+		const Histogram& histogram = metrics::getGlobalStats().stages[int(Stage::kQueueDepth)];
+		const DWORD initial_count = histogram.getBucketCount(2);
+		
+		metrics::recordQueueDepth(3);
+		
+		Assert::AreEqual(initial_count + 1, histogram.getBucketCount(2));
+	}
+	
+	TEST_METHOD(Record_global) {
+		const DWORD initial_count = metrics::getGlobalStats().stages[int(Stage::kQueue)].getCount();
+		
+		metrics::Dispatch dispatch(GetTickCount());
+		dispatch.record(/* shortcut_stats= */ nullptr);
+		
+		Assert::AreEqual(initial_count + 1,
+			metrics::getGlobalStats().stages[int(Stage::kQueue)].getCount());
+	}
+	
+	TEST_METHOD(AppendToString) {
+		m_stats->stages[int(Stage::kFind)].add(3);
+		
+		String output;
+		m_stats->appendToString(output, _T("name"));
+		
+		String expected = _T("name\tFind\t1\t4\t4\t4\t4\t0\t0\t1");
+		for (int bucket = 3; bucket < Histogram::kBucketCount; bucket++) {
+			expected += _T("\t0");
+		}
+		expected += _T("\r\n");
+		Assert::AreEqual(LPCTSTR(expected), LPCTSTR(output));
+	}
+	
+	TEST_METHOD(AppendToString_countsSeparately) {
+		m_stats->stages[int(Stage::kFind)].add(3);
+		m_stats->stages[int(Stage::kQueueDepth)].add(3);
+		
+		String durations_output;
+		m_stats->appendToString(durations_output, _T("name"));
+		Assert::AreEqual(0, StrCmpN(durations_output, _T("name\tFind\t"), 10));
+		Assert::IsNull(StrStr(durations_output, _T("QueueDepth")));
+		
+		String counts_output;
+		m_stats->appendToString(counts_output, _T("name"), Unit::kCount);
+		String expected = _T("name\tQueueDepth\t1\t4\t4\t4\t4\t0\t0\t1");
+		for (int bucket = 3; bucket < Histogram::kBucketCount; bucket++) {
+			expected += _T("\t0");
+		}
+		expected += _T("\r\n");
+		Assert::AreEqual(LPCTSTR(expected), LPCTSTR(counts_output));
+	}
+	
+	TEST_METHOD(AppendHeaderToString_units) {
+		String durations_header;
+		DispatchStats::appendHeaderToString(durations_header);
+		Assert::AreEqual(0, StrCmpN(durations_header, _T("Name\tStage\tCount\tP50 (us)\t"), 26));
+		
+		String counts_header;
+		DispatchStats::appendHeaderToString(counts_header, Unit::kCount);
+		Assert::AreEqual(0, StrCmpN(counts_header, _T("Name\tStage\tCount\tP50\tP90\t"), 25));
+	}
+	
+private:
+	
+	DispatchStats* m_stats;
+	
+	DWORD getCount(Stage stage) const {
+		return m_stats->stages[int(stage)].getCount();
+	}
+};
+
+}  // namespace MetricsTest
@@ -0,0 +1,306 @@
+// Clavier+
+// Keyboard shortcuts manager
+//
+// Copyright (C) 2000-2008 Guillaume Ryder
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+
+#include "StdAfx.h"
+#include "../MyString.h"
+#include "../Pacing.h"
+
+namespace PacingTest {
+
+using pacing::FlowControl;
+using pacing::Pacer;
+
+
+TEST_CLASS(DefaultEventDelayTest) {
+public:
+	
+	TEST_METHOD_CLEANUP(tearDown) {
+		pacing::setDefaultEventDelay(pacing::kDefaultEventDelayUs);
+	}
+	
+	TEST_METHOD(Default) {
+		Assert::AreEqual(pacing::kDefaultEventDelayUs, pacing::getDefaultEventDelay());
+		Assert::AreEqual(pacing::kDefaultEventDelayUs, Pacer().getEventDelay());
+	}
+	
+	TEST_METHOD(Set_usedByNewPacers) {
+		pacing::setDefaultEventDelay(250);
+		Assert::AreEqual(DWORD(250), pacing::getDefaultEventDelay());
+		Assert::AreEqual(DWORD(250), Pacer().getEventDelay());
+		Assert::AreEqual(DWORD(10), Pacer(10).getEventDelay());
+	}
+};
+
+
+TEST_CLASS(PacerTest) {
+public:
+	
+	TEST_METHOD(GetMicroseconds_monotonic) {
+		LONGLONG previous = pacing::getMicroseconds();
+		for (int i = 0; i < 1000; i++) {
+			const LONGLONG now = pacing::getMicroseconds();
+			Assert::IsTrue(previous <= now);
+			previous = now;
+		}
+	}
+	
+	TEST_METHOD(Wait_atLeastDuration) {
+		Pacer pacer;
+		for (const LONGLONG duration_us : { 0, 100, 2000 }) {
+			const LONGLONG start = pacing::getMicroseconds();
+			pacer.wait(duration_us);
+			Assert::IsTrue(pacing::getMicroseconds() - start >= duration_us);
+		}
+	}
+	
+	TEST_METHOD(Pause_waitsForEventDelay) {
+		Pacer pacer(1500);
+		const LONGLONG start = pacing::getMicroseconds();
+		pacer.pause();
+		Assert::IsTrue(pacing::getMicroseconds() - start >= 1500);
+		
+		pacer.setEventDelay(0);
+		pacer.pause();
+	}
+	
+	TEST_METHOD(WaitForEvent_signaled) {
+		const HANDLE event = CreateEvent(nullptr, /* bManualReset= */ TRUE, /* bInitialState= */ TRUE,
+			/* lpName= */ nullptr);
+		Pacer pacer;
+		const LONGLONG start = pacing::getMicroseconds();
+		Assert::IsTrue(pacer.waitForEvent(event, 10 * 1000 * 1000));
+		Assert::IsTrue(pacing::getMicroseconds() - start < 5 * 1000 * 1000);
+		CloseHandle(event);
+	}
+	
+	TEST_METHOD(WaitForEvent_timeout) {
+		const HANDLE event = CreateEvent(nullptr, /* bManualReset= */ TRUE, /* bInitialState= */ FALSE,
+			/* lpName= */ nullptr);
+		Pacer pacer;
+		const LONGLONG start = pacing::getMicroseconds();
+		Assert::IsFalse(pacer.waitForEvent(event, 2000));
+		Assert::IsTrue(pacing::getMicroseconds() - start >= 2000);
+		CloseHandle(event);
+	}
+};
+
+
+// Target window of its own thread, processing each WM_APP message in a fixed duration
+// by spinning, more precise than Sleep().
+// Stands for a program receiving characters faster than it can process them.
+class SlowTarget {
+public:
+	
+	explicit SlowTarget(LONGLONG delay_us) : m_delay_us(delay_us), m_hwnd(NULL), m_processed_count(0) {
+		const HANDLE ready = CreateEvent(
+			/* lpEventAttributes= */ nullptr, /* bManualReset= */ true, /* bInitialState= */ false,
+			/* lpName= */ nullptr);
+		m_ready = ready;
+		m_thread = CreateThread(
+			/* lpThreadAttributes= */ nullptr, /* dwStackSize= */ 0, threadProc,
+			/* lpParameter= */ this, /* dwCreationFlags= */ 0, &m_thread_id);
+		WaitForSingleObject(ready, INFINITE);
+		CloseHandle(ready);
+	}
+	
+	// Processes the remaining messages, then destroys the window.
+	~SlowTarget() {
+		PostThreadMessage(m_thread_id, WM_QUIT, 0, 0);
+		WaitForSingleObject(m_thread, INFINITE);
+		CloseHandle(m_thread);
+	}
+	
+	HWND getWindow() const {
+		return m_hwnd;
+	}
+	
+	int getProcessedCount() const {
+		return m_processed_count;
+	}
+	
+private:
+	
+	static DWORD WINAPI threadProc(void* param) {
+		SlowTarget *const target = static_cast<SlowTarget*>(param);
+		target->m_hwnd = CreateWindow(
+			_T("STATIC"), _T("SlowTarget"),
+			/* dwStyle=*/ 0,
+			/* x,y,nWidth,nHeight=*/ 0,0,0,0,
+			/* hWndParent= */ NULL, /* hMenu= */ NULL, /* hInstance= */ NULL, /* lpParam= */ nullptr);
+		SetEvent(target->m_ready);
+		
+		MSG msg;
+		while (GetMessage(&msg, NULL, 0, 0) > 0) {
+			if (msg.message == WM_APP) {
+				const LONGLONG end_us = pacing::getMicroseconds() + target->m_delay_us;
+				while (pacing::getMicroseconds() < end_us) {}
+				InterlockedIncrement(&target->m_processed_count);
+			} else {
+				DispatchMessage(&msg);
+			}
+		}
+		DestroyWindow(target->m_hwnd);
+		return 0;
+	}
+	
+	LONGLONG m_delay_us;
+	HWND m_hwnd;
+	HANDLE m_ready;
+	HANDLE m_thread;
+	DWORD m_thread_id;
+	volatile LONG m_processed_count;
+};
+
+
+// The target windows belong to the test thread unless stated otherwise:
+// FlowControl processes their messages itself while probing them, hence answers fast.
+TEST_CLASS(FlowControlTest) {
+public:
+	
+	TEST_METHOD_INITIALIZE(setUp) {
+		pacing::clearTargetStats();
+		m_hwnd = CreateWindow(
+			_T("STATIC"), _T("FlowControlTest"),
+			/* dwStyle=*/ 0,
+			/* x,y,nWidth,nHeight=*/ 0,0,0,0,
+			/* hWndParent= */ NULL, /* hMenu= */ NULL, /* hInstance= */ NULL, /* lpParam= */ nullptr);
+	}
+	
+	TEST_METHOD_CLEANUP(tearDown) {
+		DestroyWindow(m_hwnd);
+		MSG msg;
+		while (PeekMessage(&msg, NULL, 0, 0, PM_REMOVE)) {}
+		pacing::clearTargetStats();
+	}
+	
+	TEST_METHOD(OnPosted_growsWindowWhileTargetAnswers) {
+		FlowControl flow_control;
+		flow_control.setTarget(m_hwnd);
+		Assert::AreEqual(FlowControl::kInitialWindow, flow_control.getWindow());
+		
+		post(&flow_control, FlowControl::kInitialWindow - 1);
+		Assert::AreEqual(FlowControl::kInitialWindow, flow_control.getWindow());
+		post(&flow_control, 1);
+		Assert::AreEqual(FlowControl::kInitialWindow * 2, flow_control.getWindow());
+		
+		post(&flow_control, FlowControl::kMaxWindow * 4);
+		Assert::AreEqual(FlowControl::kMaxWindow, flow_control.getWindow());
+	}
+	
+	TEST_METHOD(Drain_recordsTargetStats) {
+		FlowControl flow_control;
+		flow_control.setTarget(m_hwnd);
+		post(&flow_control, 10);
+		flow_control.drain();
+		flow_control.drain();  // Noop: no character posted since the last drain.
+		
+		String stats;
+		pacing::appendTargetStatsToString(stats);
+		Assert::IsNotNull(StrStr(stats, _T("\tCharacters\t10\t")));
+		Assert::IsNotNull(StrStr(stats, _T("\tProbes\t1\tTimeouts\t0\t")));
+		
+		pacing::clearTargetStats();
+		stats.empty();
+		pacing::appendTargetStatsToString(stats);
+		Assert::IsTrue(stats.isEmpty());
+	}
+	
+	TEST_METHOD(OnPosted_slowTarget_waitsForBacklog) {
+		SlowTarget target(/* delay_us= */ 2000);
+		FlowControl flow_control;
+		flow_control.setTarget(target.getWindow());
+		
+		post(&flow_control, target.getWindow(), FlowControl::kInitialWindow);
+		
+		// The probe waited for the posted messages, not only for the target to answer.
+		Assert::AreEqual(FlowControl::kInitialWindow, target.getProcessedCount());
+		Assert::AreEqual(FlowControl::kInitialWindow, flow_control.getWindow());
+	}
+	
+	TEST_METHOD(OnPosted_laggingTarget_shrinksWindow) {
+		// The target needs longer than kProbeTimeoutMs to process each window.
+		SlowTarget target(/* delay_us= */ FlowControl::kProbeTimeoutMs * 1000 / 8);
+		FlowControl flow_control;
+		flow_control.setTarget(target.getWindow());
+		
+		post(&flow_control, target.getWindow(), FlowControl::kInitialWindow);
+		Assert::AreEqual(FlowControl::kInitialWindow / 2, flow_control.getWindow());
+		Assert::IsTrue(target.getProcessedCount() < FlowControl::kInitialWindow);
+		
+		post(&flow_control, target.getWindow(), FlowControl::kInitialWindow / 2);
+		Assert::AreEqual(FlowControl::kInitialWindow / 4, flow_control.getWindow());
+		
+		flow_control.drain();
+		String stats;
+		pacing::appendTargetStatsToString(stats);
+		Assert::IsNotNull(StrStr(stats, _T("\tTimeouts\t2\t")));
+	}
+	
+	TEST_METHOD(SetTarget_afterTimeout_ignoresStaleMarkers) {
+		// The target needs longer than kProbeTimeoutMs to process the first window only.
+		SlowTarget target(/* delay_us= */ FlowControl::kProbeTimeoutMs * 1000 / 12);
+		
+		// Leaves a marker in the queue of the target, then is destroyed.
+		FlowControl *const lagging_flow_control = new FlowControl;
+		lagging_flow_control->setTarget(target.getWindow());
+		post(lagging_flow_control, target.getWindow(), FlowControl::kInitialWindow);
+		delete lagging_flow_control;
+		
+		// Hooks the thread of the target again before it retrieves the stale marker.
+		FlowControl flow_control;
+		flow_control.setTarget(target.getWindow());
+		post(&flow_control, target.getWindow(), 1);
+		flow_control.drain();
+		Assert::AreEqual(FlowControl::kInitialWindow + 1, target.getProcessedCount());
+	}
+	
+	TEST_METHOD(SetTarget_startsWithLastWindowOfProcess) {
+		{
+			FlowControl flow_control;
+			flow_control.setTarget(m_hwnd);
+			post(&flow_control, FlowControl::kMaxWindow * 4);
+		}
+		
+		FlowControl flow_control;
+		flow_control.setTarget(m_hwnd);
+		Assert::AreEqual(FlowControl::kMaxWindow, flow_control.getWindow());
+	}
+	
+private:
+	
+	// Posts characters to the target and counts them.
+	void post(FlowControl* flow_control, int count) {
+		for (int i = 0; i < count; i++) {
+			PostMessage(m_hwnd, WM_NULL, 0, 0);
+			flow_control->onPosted();
+		}
+	}
+	
+	// Posts characters to a SlowTarget and counts them.
+	static void post(FlowControl* flow_control, HWND target, int count) {
+		for (int i = 0; i < count; i++) {
+			PostMessage(target, WM_APP, 0, 0);
+			flow_control->onPosted();
+		}
+	}
+	
+	HWND m_hwnd;
+};
+
+}  // namespace PacingTest
@@ -173,6 +173,7 @@ public:
 		Shortcut shortcut(m_ks);
 		shortcut.m_programs_only = programsOnly;
 		shortcut.m_programs = _T("prog1;prog2;prog3");
+		shortcut.compilePrograms();
 		
 		Assert::AreEqual(!programsOnly, shortcut.isSubset(m_ks, /* other_program= */ nullptr));
 		Assert::AreEqual(programsOnly, shortcut.isSubset(m_ks, _T("prog1")));
@@ -187,11 +188,257 @@ public:
 		Assert::AreEqual(!programsOnly, shortcut.isSubset(m_ks, _T("other")));
 	}
 	
+	TEST_METHOD(ProgramsOnly_many) {
+		Shortcut shortcut(m_ks);
+		shortcut.m_programs_only = true;
+		String programs;
+		for (int i = 0; i < 100; i++) {
+			programs += StringPrintf(_T("prog%d;"), i);
+		}
+		shortcut.m_programs = programs;
+		shortcut.compilePrograms();
+		
+		Assert::IsTrue(shortcut.isSubset(m_ks, _T("prog0")));
+		Assert::IsTrue(shortcut.isSubset(m_ks, _T("PROG42")));
+		Assert::IsTrue(shortcut.isSubset(m_ks, _T("prog99")));
+		Assert::IsFalse(shortcut.isSubset(m_ks, _T("prog100")));
+		Assert::IsFalse(shortcut.isSubset(m_ks, _T("prog")));
+	}
+	
 private:
 	
 	Keystroke m_ks;
 };
 
+TEST_CLASS(ShortcutConflictTest) {
+public:
+	
+	TEST_METHOD_INITIALIZE(setUp) {
+		Keystroke ks;
+		ks.m_vk = 'A';
+		ks.m_sided_mod_code = MOD_CONTROL;
+		m_shortcut1 = new Shortcut(ks);
+		m_shortcut2 = new Shortcut(ks);
+	}
+	
+	TEST_METHOD_CLEANUP(tearDown) {
+		delete m_shortcut1;
+		delete m_shortcut2;
+	}
+	
+	TEST_METHOD(NoPrograms) {
+		checkConflict(true);
+	}
+	
+	TEST_METHOD(DifferentProgramsOnly) {
+		m_shortcut1->m_programs_only = true;
+		checkConflict(false);
+	}
+	
+	TEST_METHOD(AllProgramsBut) {
+		m_shortcut1->m_programs = _T("prog1");
+		m_shortcut2->m_programs = _T("prog2");
+		checkConflict(true);
+	}
+	
+	TEST_METHOD(ProgramsOnly_disjoint) {
+		m_shortcut1->m_programs_only = m_shortcut2->m_programs_only = true;
+		m_shortcut1->m_programs = _T("prog1;prog2");
+		m_shortcut2->m_programs = _T("prog3");
+		checkConflict(false);
+	}
+	
+	TEST_METHOD(ProgramsOnly_overlap) {
+		m_shortcut1->m_programs_only = m_shortcut2->m_programs_only = true;
+		m_shortcut1->m_programs = _T("prog1;prog2");
+		m_shortcut2->m_programs = _T("prog3;PROG2");
+		checkConflict(true);
+	}
+	
+	TEST_METHOD(DifferentKeystroke) {
+		m_shortcut2->m_vk = 'B';
+		checkConflict(false);
+	}
+	
+private:
+	
+	Shortcut* m_shortcut1;
+	Shortcut* m_shortcut2;
+	
+	void checkConflict(bool expected_conflict) {
+		m_shortcut1->compilePrograms();
+		m_shortcut2->compilePrograms();
+		Assert::AreEqual(expected_conflict, m_shortcut1->testConflict(*m_shortcut2));
+		Assert::AreEqual(expected_conflict, m_shortcut2->testConflict(*m_shortcut1));
+	}
+};
+
+TEST_CLASS(ShortcutIndexTest) {
+public:
+	
+	TEST_METHOD_INITIALIZE(setUp) {
+		Keystroke ks;
+		ks.m_vk = 'A';
+		ks.m_sided_mod_code = MOD_CONTROL;
+		m_shortcut1 = new Shortcut(ks);
+		m_shortcut2 = new Shortcut(ks);
+		ks.m_vk = 'B';
+		m_shortcut3 = new Shortcut(ks);
+	}
+	
+	TEST_METHOD_CLEANUP(tearDown) {
+		m_index.clear();
+		delete m_shortcut1;
+		delete m_shortcut2;
+		delete m_shortcut3;
+	}
+	
+	TEST_METHOD(FindConflict_empty) {
+		Assert::IsNull(m_index.findConflict(*m_shortcut1));
+	}
+	
+	TEST_METHOD(FindConflict_ignoresItself) {
+		m_index.add(m_shortcut1);
+		Assert::IsNull(m_index.findConflict(*m_shortcut1));
+	}
+	
+	TEST_METHOD(FindConflict_sameKeystroke) {
+		m_index.add(m_shortcut1);
+		m_index.add(m_shortcut3);
+		Assert::AreSame(*m_shortcut1, *m_index.findConflict(*m_shortcut2));
+		Assert::IsNull(m_index.findConflict(*m_shortcut3));
+	}
+	
+	TEST_METHOD(FindConflict_differentPrograms) {
+		m_shortcut1->m_programs_only = m_shortcut2->m_programs_only = true;
+		m_shortcut1->m_programs = _T("prog1");
+		m_shortcut2->m_programs = _T("prog2");
+		m_shortcut1->compilePrograms();
+		m_shortcut2->compilePrograms();
+		m_index.add(m_shortcut1);
+		Assert::IsNull(m_index.findConflict(*m_shortcut2));
+	}
+	
+	TEST_METHOD(Remove) {
+		m_index.add(m_shortcut1);
+		m_index.add(m_shortcut2);
+		
+		m_index.remove(m_shortcut1);
+		Assert::IsNull(m_index.findConflict(*m_shortcut2));
+		Assert::AreSame(*m_shortcut2, *m_index.findConflict(*m_shortcut1));
+		
+		// Noop if absent.
+		m_index.remove(m_shortcut3);
+		m_index.remove(m_shortcut1);
+		Assert::AreSame(*m_shortcut2, *m_index.findConflict(*m_shortcut1));
+	}
+	
+private:
+	
+	shortcut::ShortcutIndex m_index;
+	Shortcut* m_shortcut1;
+	Shortcut* m_shortcut2;
+	Shortcut* m_shortcut3;
+};
+
+TEST_CLASS(ShortcutTableTest) {
+public:
+	
+	TEST_METHOD_CLEANUP(tearDown) {
+		m_table.clear();
+	}
+	
+	TEST_METHOD(Empty) {
+		Assert::AreEqual(0, m_table.getCount());
+		Assert::AreEqual(std::wstring(), getKeys());
+		Assert::IsNull(m_table.get(0));
+	}
+	
+	TEST_METHOD(Append) {
+		const auto handle_a = append('A');
+		const auto handle_b = append('B');
+		
+		Assert::AreEqual(2, m_table.getCount());
+		Assert::AreEqual(std::wstring(L"AB"), getKeys());
+		Assert::AreEqual(BYTE('A'), m_table.get(handle_a)->m_vk);
+		Assert::AreEqual(BYTE('B'), m_table.get(handle_b)->m_vk);
+	}
+	
+	TEST_METHOD(Append_manyChunks_stablePointers) {
+		Shortcut *const first = m_table.get(append('0'));
+		for (int i = 1; i < 1000; i++) {
+			append(BYTE('0' + i % 10));
+		}
+		
+		Assert::AreEqual(1000, m_table.getCount());
+		Assert::AreSame(*first, *m_table.get(0));
+		Assert::AreEqual(BYTE('9'), m_table.get(999)->m_vk);
+	}
+	
+	TEST_METHOD(Remove_leavesTombstone) {
+		append('A');
+		const auto handle_b = append('B');
+		const auto handle_c = append('C');
+		Shortcut *const shortcut_c = m_table.get(handle_c);
+		
+		m_table.remove(handle_b);
+		
+		Assert::AreEqual(2, m_table.getCount());
+		Assert::AreEqual(std::wstring(L"AC"), getKeys());
+		Assert::IsNull(m_table.get(handle_b));
+		Assert::AreSame(*shortcut_c, *m_table.get(handle_c));
+		
+		// Noop if already removed.
+		m_table.remove(handle_b);
+		Assert::AreEqual(2, m_table.getCount());
+	}
+	
+	TEST_METHOD(Remove_last_handleNotReused) {
+		append('A');
+		const auto handle_b = append('B');
+		m_table.remove(handle_b);
+		
+		const auto handle_c = append('C');
+		Assert::AreNotEqual(handle_b, handle_c);
+		Assert::IsNull(m_table.get(handle_b));
+		Assert::AreEqual(BYTE('C'), m_table.get(handle_c)->m_vk);
+		Assert::AreEqual(std::wstring(L"AC"), getKeys());
+	}
+	
+	TEST_METHOD(Swap) {
+		append('A');
+		shortcut::ShortcutTable other;
+		Keystroke ks;
+		ks.m_vk = 'B';
+		other.append(Shortcut(ks));
+		
+		m_table.swap(other);
+		
+		Assert::AreEqual(std::wstring(L"B"), getKeys());
+		Assert::AreEqual(BYTE('A'), other.get(0)->m_vk);
+		other.clear();
+	}
+	
+private:
+	
+	shortcut::ShortcutTable m_table;
+	
+	shortcut::ShortcutTable::Handle append(BYTE vk) {
+		Keystroke ks;
+		ks.m_vk = vk;
+		return m_table.append(Shortcut(ks));
+	}
+	
+	// Returns the virtual key codes of the shortcuts, in iteration order.
+	std::wstring getKeys() const {
+		std::wstring keys;
+		for (const Shortcut& sh : m_table) {
+			keys += wchar_t(sh.m_vk);
+		}
+		return keys;
+	}
+};
+
 TEST_CLASS(ShortcutCompareTest) {
 public:
 	
@@ -325,8 +572,8 @@ public:
 	}
 	
 	TEST_METHOD_CLEANUP(tearDown) {
-		for (Shortcut* sh = shortcut::getFirst(); sh; sh = sh->getNext()) {
-			sh->unregisterHotKey();
+		for (const Shortcut& sh : shortcut::getShortcuts()) {
+			sh.unregisterHotKey();
 		}
 		shortcut::clearShortcuts();
 		shortcut::terminate();
@@ -334,31 +581,34 @@ public:
 	}
 	
 	TEST_METHOD(InitiallyEmpty) {
-		Assert::IsNull(shortcut::getFirst());
+		Assert::AreEqual(0, shortcut::getShortcuts().getCount());
 	}
 	
-	TEST_METHOD(AddToList_one) {
-		auto *shortcut = createShortcut('A');
-		
-		shortcut->addToList();
+	TEST_METHOD(AddShortcut_one) {
+		Shortcut shortcut;
+		shortcut.m_vk = 'A';
+		shortcut.m_description = _T("description");
 		
-		Assert::AreSame(*shortcut, *shortcut::getFirst());
-		Assert::IsNull(shortcut->getNext());
-	}
-	
-	TEST_METHOD(AddToList_three) {
-		auto *shortcut1 = createShortcut('1');
-		auto *shortcut2 = createShortcut('2');
-		auto *shortcut3 = createShortcut('3');
+		Shortcut *const copy = shortcut::addShortcut(shortcut);
+		shortcut::commitShortcuts();
 		
-		shortcut1->addToList();
-		shortcut2->addToList();
-		shortcut3->addToList();
+		Assert::AreNotSame(shortcut, *copy);
+		Assert::AreEqual(BYTE('A'), copy->m_vk);
+		Assert::AreEqual(_T("description"), copy->m_description);
+		Assert::AreEqual(1, getShortcutCount());
+		Assert::AreSame(*copy, getShortcut(0));
+	}
+	
+	TEST_METHOD(AddShortcut_three) {
+		Shortcut *const shortcut1 = addShortcut('1');
+		Shortcut *const shortcut2 = addShortcut('2');
+		Shortcut *const shortcut3 = addShortcut('3');
+		shortcut::commitShortcuts();
 		
-		Assert::AreSame(*shortcut1, *shortcut::getFirst());
-		Assert::AreSame(*shortcut2, *shortcut1->getNext());
-		Assert::AreSame(*shortcut3, *shortcut2->getNext());
-		Assert::IsNull(shortcut3->getNext());
+		Assert::AreEqual(3, getShortcutCount());
+		Assert::AreSame(*shortcut1, getShortcut(0));
+		Assert::AreSame(*shortcut2, getShortcut(1));
+		Assert::AreSame(*shortcut3, getShortcut(2));
 	}
 	
 	TEST_METHOD(Find) {
@@ -370,33 +620,13 @@ public:
 		ks_ctrlB.m_vk = 'B';
 		ks_ctrlB.m_sided_mod_code = MOD_CONTROL;
 		
-		auto *shortcut_ctrlA_notProg1 = new Shortcut(ks_ctrlA);
-		shortcut_ctrlA_notProg1->m_programs = _T("prog1");
-		shortcut_ctrlA_notProg1->addToList();
-		
-		auto *shortcut_ctrlB_prog123 = new Shortcut(ks_ctrlB);
-		shortcut_ctrlB_prog123->m_programs = _T("prog1;prog2;prog3");
-		shortcut_ctrlB_prog123->m_programs_only = true;
-		shortcut_ctrlB_prog123->addToList();
-		
-		auto *shortcut_ctrlA_notProg2 = new Shortcut(ks_ctrlA);
-		shortcut_ctrlA_notProg2->m_programs = _T("prog2");
-		shortcut_ctrlA_notProg2->addToList();
-		
-		auto *shortcut_ctrlA_prog1 = new Shortcut(ks_ctrlA);
-		shortcut_ctrlA_prog1->m_programs = _T("prog1");
-		shortcut_ctrlA_prog1->m_programs_only = true;
-		shortcut_ctrlA_prog1->addToList();
-		
-		auto *shortcut_ctrlA_prog23 = new Shortcut(ks_ctrlA);
-		shortcut_ctrlA_prog23->m_programs = _T("prog2;prog3");
-		shortcut_ctrlA_prog23->m_programs_only = true;
-		shortcut_ctrlA_prog23->addToList();
-		
-		auto *shortcut_ctrlA_prog2 = new Shortcut(ks_ctrlA);
-		shortcut_ctrlA_prog2->m_programs = _T("prog2");
-		shortcut_ctrlA_prog2->m_programs_only = true;
-		shortcut_ctrlA_prog2->addToList();
+		auto *shortcut_ctrlA_notProg1 = addShortcut(ks_ctrlA, _T("prog1"), /* programs_only= */ false);
+		auto *shortcut_ctrlB_prog123 = addShortcut(ks_ctrlB, _T("prog1;prog2;prog3"), /* programs_only= */ true);
+		addShortcut(ks_ctrlA, _T("prog2"), /* programs_only= */ false);
+		auto *shortcut_ctrlA_prog1 = addShortcut(ks_ctrlA, _T("prog1"), /* programs_only= */ true);
+		auto *shortcut_ctrlA_prog23 = addShortcut(ks_ctrlA, _T("prog2;prog3"), /* programs_only= */ true);
+		addShortcut(ks_ctrlA, _T("prog2"), /* programs_only= */ true);
+		shortcut::commitShortcuts();
 		
 		// No match.
 		Assert::IsNull(shortcut::find(ks_ctrlB, /* program= */ _T("other")));
@@ -416,11 +646,46 @@ public:
 		Assert::AreSame(*shortcut_ctrlA_notProg1, *shortcut::find(ks_ctrlA, /* program= */ _T("other")));
 	}
 	
+	TEST_METHOD(Find_modCodes) {
+		Keystroke ks_ctrlA;
+		ks_ctrlA.m_vk = 'A';
+		ks_ctrlA.m_sided_mod_code = MOD_CONTROL;
+		
+		Keystroke ks_rightCtrlA;
+		ks_rightCtrlA.m_vk = 'A';
+		ks_rightCtrlA.m_sided_mod_code = MOD_CONTROL << kRightModCodeOffset;
+		ks_rightCtrlA.m_sided = true;
+		
+		Keystroke ks_ctrlShiftA;
+		ks_ctrlShiftA.m_vk = 'A';
+		ks_ctrlShiftA.m_sided_mod_code = MOD_CONTROL | MOD_SHIFT;
+		
+		auto *shortcut_rightCtrlA = shortcut::addShortcut(Shortcut(ks_rightCtrlA));
+		auto *shortcut_ctrlShiftA = shortcut::addShortcut(Shortcut(ks_ctrlShiftA));
+		shortcut::commitShortcuts();
+		
+		Assert::IsNull(shortcut::find(ks_ctrlA, /* program= */ nullptr));
+		Assert::AreSame(*shortcut_rightCtrlA, *shortcut::find(ks_rightCtrlA, /* program= */ nullptr));
+		Assert::AreSame(*shortcut_ctrlShiftA, *shortcut::find(ks_ctrlShiftA, /* program= */ nullptr));
+	}
+	
+	TEST_METHOD(Find_afterClearShortcuts) {
+		addShortcut('A');
+		shortcut::commitShortcuts();
+		
+		shortcut::clearShortcuts();
+		
+		Keystroke ks;
+		ks.m_vk = 'A';
+		Assert::IsNull(shortcut::find(ks, /* program= */ nullptr));
+	}
+	
 	TEST_METHOD(LoadShortcuts_overwritesSettings) {
 		setNonDefaultGlobalValues();
 		
-		createShortcut('1')->addToList();
-		createShortcut('2')->addToList();
+		addShortcut('1');
+		addShortcut('2');
+		shortcut::commitShortcuts();
 		
 		// Load the test config.
 		testing::getProjectDir(e_ini_filepath);
@@ -434,8 +699,9 @@ public:
 	TEST_METHOD(LoadShortcuts_overwritesGlobalSettingsAppendsShortcuts) {
 		setNonDefaultGlobalValues();
 		
-		createShortcut('1')->addToList();
-		createShortcut('2')->addToList();
+		addShortcut('1');
+		addShortcut('2');
+		shortcut::commitShortcuts();
 		
 		// Merge the test config.
 		TCHAR merged_ini_filepath[MAX_PATH];
@@ -448,12 +714,120 @@ public:
 	}
 	
 	TEST_METHOD(ClearShortcuts) {
-		createShortcut('1')->addToList();
-		createShortcut('2')->addToList();
+		addShortcut('1');
+		addShortcut('2');
+		shortcut::commitShortcuts();
 		
 		shortcut::clearShortcuts();
 		
-		Assert::IsNull(shortcut::getFirst());
+		Assert::AreEqual(0, getShortcutCount());
+	}
+	
+	TEST_METHOD(AddShortcut_visibleOnceCommitted) {
+		addShortcut('1');
+		shortcut::commitShortcuts();
+		
+		addShortcut('2');
+		Assert::AreEqual(1, getShortcutCount());
+		
+		shortcut::commitShortcuts();
+		Assert::AreEqual(2, getShortcutCount());
+		Assert::AreEqual(BYTE('1'), getShortcut(0).m_vk);
+		Assert::AreEqual(BYTE('2'), getShortcut(1).m_vk);
+	}
+	
+	TEST_METHOD(CommitShortcuts_incrementsVersion) {
+		const int initial_version = shortcut::getSnapshot().version;
+		
+		shortcut::detachShortcuts();
+		shortcut::commitShortcuts();
+		Assert::AreEqual(initial_version + 1, shortcut::getSnapshot().version);
+		
+		shortcut::forkShortcuts();
+		shortcut::commitShortcuts();
+		Assert::AreEqual(initial_version + 2, shortcut::getSnapshot().version);
+	}
+	
+	TEST_METHOD(SnapshotPin_keepsReplacedSnapshot) {
+		auto *shortcut_a = addShortcut('A');
+		shortcut::commitShortcuts();
+		
+		const shortcut::SnapshotPin pin;
+		Assert::AreSame(shortcut::getSnapshot(), *pin);
+		
+		// Replace the snapshot twice: the second commit reclaims the unpinned snapshots only.
+		for (int i = 0; i < 2; i++) {
+			shortcut::detachShortcuts();
+			addShortcut('B');
+			shortcut::commitShortcuts();
+		}
+		
+		Assert::AreNotSame(shortcut::getSnapshot(), *pin);
+		Assert::AreEqual(1, pin->shortcuts.getCount());
+		Assert::AreEqual(BYTE('A'), pin->shortcuts.get(0)->m_vk);
+		Assert::AreSame(*shortcut_a, *pin->shortcuts.get(0));
+		
+		Keystroke ks;
+		ks.m_vk = 'A';
+		Assert::AreSame(*shortcut_a, *pin->index.find(ks, /* program= */ nullptr));
+		Assert::IsNull(shortcut::find(ks, /* program= */ nullptr));
+	}
+	
+	TEST_METHOD(SnapshotPin_pinsCurrentSnapshot) {
+		addShortcut('A');
+		shortcut::commitShortcuts();
+		
+		for (int i = 0; i < 3; i++) {
+			const shortcut::SnapshotPin pin;
+			Assert::AreSame(shortcut::getSnapshot(), *pin);
+			
+			shortcut::forkShortcuts();
+			addShortcut('B');
+			shortcut::commitShortcuts();
+			Assert::AreEqual(i + 1, pin->shortcuts.getCount());
+		}
+		Assert::AreEqual(4, getShortcutCount());
+	}
+	
+	TEST_METHOD(ForkShortcuts_sharesStatistics) {
+		auto *shortcut_a = addShortcut('A');
+		shortcut::commitShortcuts();
+		const shortcut::SnapshotPin pin;
+		
+		// Use the shortcut of the published snapshot between the fork and the commit.
+		shortcut::forkShortcuts();
+		shortcut_a->setUsageCount(3);
+		shortcut::commitShortcuts();
+		
+		Assert::AreNotSame(*shortcut_a, getShortcut(0));
+		Assert::AreEqual(shortcut_a->getId(), getShortcut(0).getId());
+		Assert::AreEqual(3, getShortcut(0).getUsageCount());
+		Assert::AreNotEqual(shortcut_a->getId(), Shortcut().getId());
+	}
+	
+	TEST_METHOD(CommitShortcuts_updatesChangedHotKeys) {
+		shortcut::detachShortcuts();
+		addShortcut(VK_F13);
+		addShortcut(VK_F14);
+		shortcut::commitShortcuts();
+		
+		shortcut::detachShortcuts();
+		auto *shortcut_f14 = addShortcut(VK_F14);
+		addShortcut(VK_F15);
+		addShortcut(VK_F15);
+		shortcut::commitShortcuts();
+		
+		Assert::AreSame(*shortcut_f14, getShortcut(0));
+		Assert::AreEqual(3, getShortcutCount());
+		
+		// Removed keystroke: unregistered. Kept and added keystrokes: registered.
+		Keystroke ks;
+		ks.m_vk = VK_F13;
+		Assert::IsFalse(ks.unregisterHotKey());
+		ks.m_vk = VK_F14;
+		Assert::IsTrue(ks.unregisterHotKey());
+		ks.m_vk = VK_F15;
+		Assert::IsTrue(ks.unregisterHotKey());
 	}
 	
 	TEST_METHOD(SaveShortcuts_allLanguages) {
@@ -490,20 +864,41 @@ public:
 	
 private:
 	
-	static Shortcut* createShortcut(BYTE vk) {
+	static Shortcut* addShortcut(BYTE vk) {
 		Keystroke ks;
 		ks.m_vk = vk;
-		return new Shortcut(ks);
+		return shortcut::addShortcut(Shortcut(ks));
 	}
 	
+	static Shortcut* addShortcut(const Keystroke& ks, LPCTSTR programs, bool programs_only) {
+		Shortcut shortcut(ks);
+		shortcut.m_programs = programs;
+		shortcut.m_programs_only = programs_only;
+		return shortcut::addShortcut(shortcut);
+	}
+	
+	// Counts the shortcuts by iterating on them.
 	static int getShortcutCount() {
 		int shortcut_count = 0;
-		for (Shortcut* sh = shortcut::getFirst(); sh; sh = sh->getNext()) {
+		for ([[maybe_unused]] const Shortcut& sh : shortcut::getShortcuts()) {
 			shortcut_count++;
 		}
+		Assert::AreEqual(shortcut::getShortcuts().getCount(), shortcut_count);
 		return shortcut_count;
 	}
 	
+	static Shortcut& getShortcut(int position) {
+		Shortcut* found = nullptr;
+		for (Shortcut& sh : shortcut::getShortcuts()) {
+			if (!position--) {
+				found = &sh;
+				break;
+			}
+		}
+		Assert::IsNotNull(found);
+		return *found;
+	}
+	
 	static void setNonDefaultGlobalValues() {
 		i18n::setLanguage(i18n::kLangFR);
 		e_main_dialog_size = { .cx = -1, .cy = -2 };